@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file cmd_devemu.c
+ * @author agent (agent@local)
+ * @brief Implementation of devemu command
+ */
+
+#include <vmm_error.h>
+#include <vmm_stdio.h>
+#include <vmm_manager.h>
+#include <vmm_devemu.h>
+#include <vmm_modules.h>
+#include <vmm_cmdmgr.h>
+#include <libs/stringlib.h>
+#include <libs/mathlib.h>
+
+#define MODULE_DESC			"Command devemu"
+#define MODULE_AUTHOR			"agent"
+#define MODULE_LICENSE			"GPL"
+#define MODULE_IPRIORITY		0
+#define	MODULE_INIT			cmd_devemu_init
+#define	MODULE_EXIT			cmd_devemu_exit
+
+/* Number of hot offsets shown for each emulated device */
+#define CMD_DEVEMU_TOP_N		8
+
+static void cmd_devemu_usage(struct vmm_chardev *cdev)
+{
+	vmm_cprintf(cdev, "Usage:\n");
+	vmm_cprintf(cdev, "   devemu help\n");
+	vmm_cprintf(cdev, "   devemu stats <guest_name>\n");
+	vmm_cprintf(cdev, "   devemu stats_reset <guest_name>\n");
+}
+
+static void cmd_devemu_stats_hist(struct vmm_chardev *cdev,
+				  const char *name, u64 *hist)
+{
+	u32 i;
+
+	vmm_cprintf(cdev, "  %s latency histogram (nsecs):\n", name);
+	for (i = 0; i < VMM_DEVEMU_STATS_HIST_SIZE; i++) {
+		if (!hist[i]) {
+			continue;
+		}
+		vmm_cprintf(cdev, "    [%"PRIu64", %"PRIu64") %"PRIu64"\n",
+			    (i) ? ((u64)1 << i) : (u64)0, (u64)1 << (i + 1),
+			    hist[i]);
+	}
+}
+
+static void cmd_devemu_stats_iter(struct vmm_emudev *edev, void *priv)
+{
+	u32 i, j;
+	u64 rcount, wcount;
+	struct vmm_devemu_stats_hot t;
+	struct vmm_devemu_stats stats;
+	struct vmm_chardev *cdev = priv;
+
+	if (vmm_devemu_stats_get(edev, &stats)) {
+		return;
+	}
+
+	rcount = wcount = 0;
+	for (i = 0; i < VMM_DEVEMU_MAX_ACCESS; i++) {
+		rcount += stats.read_count[i];
+		wcount += stats.write_count[i];
+	}
+	if (!rcount && !wcount) {
+		return;
+	}
+
+	vmm_cprintf(cdev, "%s (%s)\n", edev->node->name, edev->emu->name);
+	vmm_cprintf(cdev, "  Reads : 8-bit=%"PRIu64" 16-bit=%"PRIu64
+		    " 32-bit=%"PRIu64" 64-bit=%"PRIu64" avg=%"PRIu64
+		    " nsecs\n",
+		    stats.read_count[0], stats.read_count[1],
+		    stats.read_count[2], stats.read_count[3],
+		    (rcount) ? udiv64(stats.read_nsecs, rcount) : (u64)0);
+	vmm_cprintf(cdev, "  Writes: 8-bit=%"PRIu64" 16-bit=%"PRIu64
+		    " 32-bit=%"PRIu64" 64-bit=%"PRIu64" avg=%"PRIu64
+		    " nsecs\n",
+		    stats.write_count[0], stats.write_count[1],
+		    stats.write_count[2], stats.write_count[3],
+		    (wcount) ? udiv64(stats.write_nsecs, wcount) : (u64)0);
+	if (rcount) {
+		cmd_devemu_stats_hist(cdev, "Read", stats.read_hist);
+	}
+	if (wcount) {
+		cmd_devemu_stats_hist(cdev, "Write", stats.write_hist);
+	}
+
+	/* Partial selection sort of hot offsets */
+	vmm_cprintf(cdev, "  Hot offsets:");
+	for (i = 0; i < CMD_DEVEMU_TOP_N; i++) {
+		for (j = i + 1; j < VMM_DEVEMU_STATS_HOT_SIZE; j++) {
+			if (stats.hot[i].count < stats.hot[j].count) {
+				t = stats.hot[i];
+				stats.hot[i] = stats.hot[j];
+				stats.hot[j] = t;
+			}
+		}
+		if (!stats.hot[i].count) {
+			break;
+		}
+		vmm_cprintf(cdev, " 0x%"PRIPADDR"(%"PRIu64")",
+			    stats.hot[i].offset, stats.hot[i].count);
+	}
+	vmm_cprintf(cdev, "\n");
+}
+
+static int cmd_devemu_stats(struct vmm_chardev *cdev, const char *name)
+{
+	struct vmm_guest *guest = vmm_manager_guest_find(name);
+
+	if (!guest) {
+		vmm_cprintf(cdev, "Failed to find guest %s\n", name);
+		return VMM_ENOTAVAIL;
+	}
+
+	vmm_devemu_iterate_emudev(guest, cmd_devemu_stats_iter, cdev);
+
+	return VMM_OK;
+}
+
+static void cmd_devemu_stats_reset_iter(struct vmm_emudev *edev,
+					void *priv)
+{
+	vmm_devemu_stats_reset(edev);
+}
+
+static int cmd_devemu_stats_reset(struct vmm_chardev *cdev,
+				  const char *name)
+{
+	struct vmm_guest *guest = vmm_manager_guest_find(name);
+
+	if (!guest) {
+		vmm_cprintf(cdev, "Failed to find guest %s\n", name);
+		return VMM_ENOTAVAIL;
+	}
+
+	vmm_devemu_iterate_emudev(guest, cmd_devemu_stats_reset_iter, NULL);
+
+	return VMM_OK;
+}
+
+static int cmd_devemu_exec(struct vmm_chardev *cdev, int argc, char **argv)
+{
+	if (argc <= 1) {
+		goto fail;
+	}
+
+	if (strcmp(argv[1], "help") == 0) {
+		cmd_devemu_usage(cdev);
+		return VMM_OK;
+	} else if ((strcmp(argv[1], "stats") == 0) && (argc == 3)) {
+		return cmd_devemu_stats(cdev, argv[2]);
+	} else if ((strcmp(argv[1], "stats_reset") == 0) && (argc == 3)) {
+		return cmd_devemu_stats_reset(cdev, argv[2]);
+	}
+
+fail:
+	cmd_devemu_usage(cdev);
+	return VMM_EFAIL;
+}
+
+static struct vmm_cmd cmd_devemu = {
+	.name = "devemu",
+	.desc = "emulated device commands",
+	.usage = cmd_devemu_usage,
+	.exec = cmd_devemu_exec,
+};
+
+static int __init cmd_devemu_init(void)
+{
+	return vmm_cmdmgr_register_cmd(&cmd_devemu);
+}
+
+static void __exit cmd_devemu_exit(void)
+{
+	vmm_cmdmgr_unregister_cmd(&cmd_devemu);
+}
+
+VMM_DECLARE_MODULE(MODULE_DESC,
+			MODULE_AUTHOR,
+			MODULE_LICENSE,
+			MODULE_IPRIORITY,
+			MODULE_INIT,
+			MODULE_EXIT);
@@ -28,10 +28,14 @@
 #include <vmm_host_aspace.h>
 #include <vmm_modules.h>
 #include <vmm_cmdmgr.h>
+#include <arch_atomic64.h>
+#include <net/vmm_mbuf.h>
 #include <net/vmm_netport.h>
 #include <net/vmm_netswitch.h>
 #include <net/vmm_protocol.h>
+#include <net/vmm_pktgen.h>
 #include <libs/stringlib.h>
+#include <libs/mathlib.h>
 
 #define MODULE_DESC			"Command net"
 #define MODULE_AUTHOR			"Sukanto Ghosh"
@@ -48,7 +52,28 @@ static void cmd_net_usage(struct vmm_chardev *cdev)
 	vmm_cprintf(cdev, "   net switch list\n");
 	vmm_cprintf(cdev, "   net switch create <policy_name> <switch_name> ...\n");
 	vmm_cprintf(cdev, "   net switch destroy <switch_name>\n");
+	vmm_cprintf(cdev, "   net switch dump <switch_name>\n");
 	vmm_cprintf(cdev, "   net port list\n");
+	vmm_cprintf(cdev, "   net port stats <port_name>\n");
+	vmm_cprintf(cdev, "   net port rate <port_name> <ingress|egress> "
+			  "<bytes_per_sec> <pkts_per_sec>\n");
+	vmm_cprintf(cdev, "   net mbuf stats\n");
+#ifdef CONFIG_NET_PKTGEN
+	vmm_cprintf(cdev, "   net pktgen list\n");
+	vmm_cprintf(cdev, "   net pktgen create <pktgen_name> "
+			  "<switch_name>\n");
+	vmm_cprintf(cdev, "   net pktgen destroy <pktgen_name>\n");
+	vmm_cprintf(cdev, "   net pktgen start <pktgen_name> <dst_port_name> "
+			  "<size> <count> <rate_pps> [<dst_macs> <src_macs> "
+			  "[<vlan_id> <vlan_prio>]]\n");
+	vmm_cprintf(cdev, "   net pktgen stop <pktgen_name>\n");
+	vmm_cprintf(cdev, "   net pktgen stats <pktgen_name>\n");
+	vmm_cprintf(cdev, "   net pktgen reset <pktgen_name>\n");
+	vmm_cprintf(cdev, "Note:\n");
+	vmm_cprintf(cdev, "   <count> or <rate_pps> as 0 means unlimited\n");
+	vmm_cprintf(cdev, "   <dst_macs> and <src_macs> are number of MACs "
+			  "to cycle through\n");
+#endif
 }
 
 struct cmd_net_list_priv {
@@ -163,6 +188,33 @@ static int cmd_net_switch_destroy(struct vmm_chardev *cdev,
 	return VMM_OK;
 }
 
+static int cmd_net_switch_dump(struct vmm_chardev *cdev,
+			       const char *switch_name)
+{
+	struct vmm_netswitch *nsw;
+	struct vmm_netswitch_flow_stats fs;
+
+	nsw = vmm_netswitch_find(switch_name);
+	if (!nsw) {
+		vmm_cprintf(cdev, "Failed to find %s switch\n", switch_name);
+		return VMM_EINVALID;
+	}
+
+	vmm_cprintf(cdev, "Switch    : %s\n", nsw->name);
+	vmm_cprintf(cdev, "Policy    : %s\n", nsw->policy->name);
+	if (!vmm_netswitch_flow_stats_get(nsw, &fs)) {
+		vmm_cprintf(cdev, "Flows     : %d/%d hits=%"PRIu64
+			    " misses=%"PRIu64" flushes=%"PRIu64"\n",
+			    fs.entries, nsw->flow_count, fs.hits,
+			    fs.misses, fs.flushes);
+	}
+	if (nsw->dump) {
+		nsw->dump(nsw, cdev);
+	}
+
+	return VMM_OK;
+}
+
 static int cmd_net_port_list_iter(struct vmm_netport *port, void *data)
 {
 	char hwaddr[20];
@@ -203,6 +255,303 @@ static int cmd_net_port_list(struct vmm_chardev *cdev,
 	return VMM_OK;
 }
 
+static void cmd_net_port_rate_show(struct vmm_chardev *cdev,
+				   const char *name,
+				   struct vmm_netport_rate *r)
+{
+	vmm_cprintf(cdev, "%-9s : rate=%"PRIu64" bytes/s %"PRIu64" pkts/s\n",
+		    name, r->bytes_per_sec, r->pkts_per_sec);
+	vmm_cprintf(cdev, "%-9s   passed=%"PRIu64" marked=%"PRIu64
+		    " dropped=%"PRIu64"\n", "",
+		    arch_atomic64_read(&r->passed), r->marked, r->dropped);
+}
+
+static int cmd_net_port_stats(struct vmm_chardev *cdev,
+			      const char *port_name)
+{
+	u32 i;
+	struct vmm_netport *port;
+
+	port = vmm_netport_find(port_name);
+	if (!port) {
+		vmm_cprintf(cdev, "Failed to find %s port\n", port_name);
+		return VMM_EINVALID;
+	}
+
+	vmm_cprintf(cdev, "Port      : %s\n", port->name);
+	cmd_net_port_rate_show(cdev, "Ingress", &port->ingress);
+	cmd_net_port_rate_show(cdev, "Egress", &port->egress);
+	vmm_cprintf(cdev, "Priority  :");
+	for (i = 0; i < VMM_NETPORT_NR_PRIO; i++) {
+		vmm_cprintf(cdev, " q%d=%"PRIu64, i, port->prio_pkts[i]);
+	}
+	vmm_cprintf(cdev, "\n");
+
+	return VMM_OK;
+}
+
+static int cmd_net_port_rate(struct vmm_chardev *cdev,
+			     const char *port_name, const char *dir,
+			     const char *bps, const char *pps)
+{
+	u64 bytes_per_sec, pkts_per_sec;
+	struct vmm_netport *port;
+	struct vmm_netport_rate *r;
+
+	bytes_per_sec = strtoull(bps, NULL, 0);
+	pkts_per_sec = strtoull(pps, NULL, 0);
+	if ((bytes_per_sec > VMM_NETPORT_RATE_MAX) ||
+	    (pkts_per_sec > VMM_NETPORT_RATE_MAX)) {
+		vmm_cprintf(cdev, "Rate must not exceed %"PRIu64"\n",
+			    VMM_NETPORT_RATE_MAX);
+		return VMM_EINVALID;
+	}
+
+	port = vmm_netport_find(port_name);
+	if (!port) {
+		vmm_cprintf(cdev, "Failed to find %s port\n", port_name);
+		return VMM_EINVALID;
+	}
+
+	if (strcmp(dir, "ingress") == 0) {
+		r = &port->ingress;
+	} else if (strcmp(dir, "egress") == 0) {
+		r = &port->egress;
+	} else {
+		vmm_cprintf(cdev, "Invalid direction %s\n", dir);
+		return VMM_EINVALID;
+	}
+
+	vmm_netport_rate_set(r, bytes_per_sec, pkts_per_sec);
+
+	return VMM_OK;
+}
+
+static int cmd_net_mbuf_stats(struct vmm_chardev *cdev,
+			      int argc, char **argv)
+{
+	u32 i;
+	struct vmm_mbufpool_stats s;
+
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+	vmm_cprintf(cdev, " %-5s %-7s %-7s %-7s %-7s %-11s %-9s %-9s %-9s\n",
+		    "Num#", "BufSize", "Total", "Free", "Cached",
+		    "CacheHits", "Refills", "Drains", "Exhausted");
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+	for (i = 0; i < vmm_mbufpool_count(); i++) {
+		if (vmm_mbufpool_stats_get(i, &s)) {
+			continue;
+		}
+		vmm_cprintf(cdev, " %-5d %-7d %-7d %-7d %-7d %-11"PRIu64
+			    " %-9"PRIu64" %-9"PRIu64" %-9"PRIu64"\n",
+			    i, s.buf_size, s.total, s.free, s.cached,
+			    s.hits, s.refills, s.drains, s.exhausted);
+	}
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+
+	return VMM_OK;
+}
+
+#ifdef CONFIG_NET_PKTGEN
+static int cmd_net_pktgen_list_iter(struct vmm_pktgen *pg, void *data)
+{
+	struct vmm_pktgen_stats s;
+	struct vmm_netport *port = vmm_pktgen_port(pg);
+	struct cmd_net_list_priv *p = data;
+
+	if (vmm_pktgen_stats_get(pg, &s)) {
+		return VMM_OK;
+	}
+
+	vmm_cprintf(p->cdev, " %-5d %-19s %-19s %-8s %-11"PRIu64" %-11"PRIu64
+		    "\n", p->num++, port->name,
+		    (port->nsw) ? port->nsw->name : "--",
+		    (s.running) ? "RUNNING" : "STOPPED",
+		    s.tx_pkts, s.rx_pkts);
+
+	return VMM_OK;
+}
+
+static int cmd_net_pktgen_list(struct vmm_chardev *cdev)
+{
+	struct cmd_net_list_priv p = { .num = 0, .cdev = cdev };
+
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+	vmm_cprintf(cdev, " %-5s %-19s %-19s %-8s %-11s %-11s\n",
+		    "Num#", "Pktgen", "Switch", "State", "TX-Pkts", "RX-Pkts");
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+	vmm_pktgen_iterate(&p, cmd_net_pktgen_list_iter);
+	vmm_cprintf(cdev, "----------------------------------------"
+			  "----------------------------------------\n");
+
+	return VMM_OK;
+}
+
+static int cmd_net_pktgen_create(struct vmm_chardev *cdev,
+				 const char *name, const char *switch_name)
+{
+	struct vmm_netswitch *nsw;
+
+	nsw = vmm_netswitch_find(switch_name);
+	if (!nsw) {
+		vmm_cprintf(cdev, "Failed to find %s switch\n", switch_name);
+		return VMM_EINVALID;
+	}
+
+	if (!vmm_pktgen_create(name, nsw)) {
+		vmm_cprintf(cdev, "Failed to create %s pktgen\n", name);
+		return VMM_EFAIL;
+	}
+
+	vmm_cprintf(cdev, "Created %s pktgen\n", name);
+
+	return VMM_OK;
+}
+
+static struct vmm_pktgen *cmd_net_pktgen_find(struct vmm_chardev *cdev,
+					      const char *name)
+{
+	struct vmm_pktgen *pg = vmm_pktgen_find(name);
+
+	if (!pg) {
+		vmm_cprintf(cdev, "Failed to find %s pktgen\n", name);
+	}
+
+	return pg;
+}
+
+static int cmd_net_pktgen_start(struct vmm_chardev *cdev,
+				int argc, char **argv)
+{
+	int rc;
+	struct vmm_netport *dst;
+	struct vmm_pktgen_params params;
+	struct vmm_pktgen *pg = cmd_net_pktgen_find(cdev, argv[0]);
+
+	if (!pg) {
+		return VMM_EINVALID;
+	}
+
+	dst = vmm_netport_find(argv[1]);
+	if (!dst) {
+		vmm_cprintf(cdev, "Failed to find %s port\n", argv[1]);
+		return VMM_EINVALID;
+	}
+
+	memset(&params, 0, sizeof(params));
+	memcpy(params.dstmac, vmm_netport_mac(dst), sizeof(params.dstmac));
+	params.size = strtoul(argv[2], NULL, 0);
+	params.count = strtoull(argv[3], NULL, 0);
+	params.rate = strtoull(argv[4], NULL, 0);
+	if (argc >= 7) {
+		params.dstmac_count = strtoul(argv[5], NULL, 0);
+		params.srcmac_count = strtoul(argv[6], NULL, 0);
+	}
+	if (argc >= 9) {
+		params.vlan_id = strtoul(argv[7], NULL, 0);
+		params.vlan_prio = strtoul(argv[8], NULL, 0);
+	}
+
+	rc = vmm_pktgen_start(pg, &params);
+	if (rc) {
+		vmm_cprintf(cdev, "Failed to start %s pktgen (error %d)\n",
+			    argv[0], rc);
+	}
+
+	return rc;
+}
+
+static void cmd_net_pktgen_rate(struct vmm_chardev *cdev,
+				u64 pkts, u64 bytes, u64 nsecs)
+{
+	u64 kpps, mbps;
+
+	/* Packets and bits per nanosecond scaled to Kpps and Mbps */
+	kpps = (nsecs) ? udiv64(pkts * 1000000ULL, nsecs) : 0;
+	mbps = (nsecs) ? udiv64(bytes * 8000ULL, nsecs) : 0;
+	vmm_cprintf(cdev, "%"PRIu64".%03"PRIu64" Mpps "
+		    "%"PRIu64".%03"PRIu64" Gbps\n",
+		    udiv64(kpps, 1000), umod64(kpps, 1000),
+		    udiv64(mbps, 1000), umod64(mbps, 1000));
+}
+
+static int cmd_net_pktgen_stats(struct vmm_chardev *cdev, const char *name)
+{
+	struct vmm_pktgen_stats s;
+	struct vmm_pktgen *pg = cmd_net_pktgen_find(cdev, name);
+
+	if (!pg) {
+		return VMM_EINVALID;
+	}
+
+	vmm_pktgen_stats_get(pg, &s);
+
+	vmm_cprintf(cdev, "Pktgen    : %s (%s)\n",
+		    vmm_pktgen_port(pg)->name,
+		    (s.running) ? "running" : "stopped");
+	vmm_cprintf(cdev, "TX        : pkts=%"PRIu64" bytes=%"PRIu64
+		    " nobufs=%"PRIu64" time=%"PRIu64" usecs\n",
+		    s.tx_pkts, s.tx_bytes, s.tx_nobufs,
+		    udiv64(s.tx_nsecs, 1000));
+	vmm_cprintf(cdev, "TX rate   : ");
+	cmd_net_pktgen_rate(cdev, s.tx_pkts, s.tx_bytes, s.tx_nsecs);
+	vmm_cprintf(cdev, "RX        : pkts=%"PRIu64" bytes=%"PRIu64
+		    " other=%"PRIu64" time=%"PRIu64" usecs\n",
+		    s.rx_pkts, s.rx_bytes, s.rx_other,
+		    udiv64(s.rx_nsecs, 1000));
+	vmm_cprintf(cdev, "RX rate   : ");
+	cmd_net_pktgen_rate(cdev, s.rx_pkts, s.rx_bytes, s.rx_nsecs);
+	vmm_cprintf(cdev, "Latency   : min=%"PRIu64" avg=%"PRIu64
+		    " max=%"PRIu64" nsecs\n",
+		    s.lat_min, s.lat_avg, s.lat_max);
+	vmm_cprintf(cdev, "Percentile: p50=%"PRIu64" p90=%"PRIu64
+		    " p99=%"PRIu64" p99.9=%"PRIu64" nsecs\n",
+		    s.lat_p50, s.lat_p90, s.lat_p99, s.lat_p999);
+
+	return VMM_OK;
+}
+
+static int cmd_net_pktgen(struct vmm_chardev *cdev, int argc, char **argv)
+{
+	struct vmm_pktgen *pg;
+
+	if ((argc == 1) && (strcmp(argv[0], "list") == 0)) {
+		return cmd_net_pktgen_list(cdev);
+	} else if ((argc == 3) && (strcmp(argv[0], "create") == 0)) {
+		return cmd_net_pktgen_create(cdev, argv[1], argv[2]);
+	} else if ((argc == 6 || argc == 8 || argc == 10) &&
+		   (strcmp(argv[0], "start") == 0)) {
+		return cmd_net_pktgen_start(cdev, argc - 1, &argv[1]);
+	} else if ((argc == 2) && (strcmp(argv[0], "stats") == 0)) {
+		return cmd_net_pktgen_stats(cdev, argv[1]);
+	} else if (argc != 2) {
+		cmd_net_usage(cdev);
+		return VMM_EFAIL;
+	}
+
+	pg = cmd_net_pktgen_find(cdev, argv[1]);
+	if (!pg) {
+		return VMM_EINVALID;
+	}
+
+	if (strcmp(argv[0], "destroy") == 0) {
+		return vmm_pktgen_destroy(pg);
+	} else if (strcmp(argv[0], "stop") == 0) {
+		return vmm_pktgen_stop(pg);
+	} else if (strcmp(argv[0], "reset") == 0) {
+		return vmm_pktgen_reset(pg);
+	}
+
+	cmd_net_usage(cdev);
+	return VMM_EFAIL;
+}
+#endif
+
 static int cmd_net_exec(struct vmm_chardev *cdev, int argc, char **argv)
 {
 	if (argc <= 1) {
@@ -230,10 +579,32 @@ static int cmd_net_exec(struct vmm_chardev *cdev, int argc, char **argv)
 		   (strcmp(argv[2], "destroy") == 0)) {
 		return cmd_net_switch_destroy(cdev, argv[3],
 					      argc - 4, &argv[4]);
+	} else if ((argc == 4) &&
+		   (strcmp(argv[1], "switch") == 0) &&
+		   (strcmp(argv[2], "dump") == 0)) {
+		return cmd_net_switch_dump(cdev, argv[3]);
 	} else if ((argc >= 3) &&
 		   (strcmp(argv[1], "port") == 0) &&
 		   (strcmp(argv[2], "list") == 0)) {
 		return cmd_net_port_list(cdev, argc - 3, &argv[3]);
+	} else if ((argc == 4) &&
+		   (strcmp(argv[1], "port") == 0) &&
+		   (strcmp(argv[2], "stats") == 0)) {
+		return cmd_net_port_stats(cdev, argv[3]);
+	} else if ((argc == 7) &&
+		   (strcmp(argv[1], "port") == 0) &&
+		   (strcmp(argv[2], "rate") == 0)) {
+		return cmd_net_port_rate(cdev, argv[3], argv[4],
+					 argv[5], argv[6]);
+	} else if ((argc >= 3) &&
+		   (strcmp(argv[1], "mbuf") == 0) &&
+		   (strcmp(argv[2], "stats") == 0)) {
+		return cmd_net_mbuf_stats(cdev, argc - 3, &argv[3]);
+#ifdef CONFIG_NET_PKTGEN
+	} else if ((argc >= 3) &&
+		   (strcmp(argv[1], "pktgen") == 0)) {
+		return cmd_net_pktgen(cdev, argc - 2, &argv[2]);
+#endif
 	}
 
 fail:
@@ -0,0 +1,233 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file cmd_tcpbench.c
+ * @author agent (agent@local)
+ * @brief Implementation of tcpbench command
+ */
+
+#include <vmm_error.h>
+#include <vmm_stdio.h>
+#include <vmm_heap.h>
+#include <vmm_timer.h>
+#include <vmm_modules.h>
+#include <vmm_cmdmgr.h>
+#include <libs/netstack.h>
+#include <libs/stringlib.h>
+#include <libs/mathlib.h>
+
+#define MODULE_DESC			"Command tcpbench"
+#define MODULE_AUTHOR			"agent"
+#define MODULE_LICENSE			"GPL"
+#define MODULE_IPRIORITY		0
+#define	MODULE_INIT			cmd_tcpbench_init
+#define	MODULE_EXIT			cmd_tcpbench_exit
+
+#define TCPBENCH_WRITE_SIZE		8192
+#define TCPBENCH_MAX_WRITE_SIZE		65535
+
+/** server gives up when no data is received for this long */
+#define TCPBENCH_RECV_TIMEOUT_MS	10000
+
+static void cmd_tcpbench_usage(struct vmm_chardev *cdev)
+{
+	vmm_cprintf(cdev, "Usage:\n");
+	vmm_cprintf(cdev, "   tcpbench help\n");
+	vmm_cprintf(cdev, "   tcpbench server <port>\n");
+	vmm_cprintf(cdev, "   tcpbench client <ipaddr> <port> <kbytes> "
+			  "[<write_size>]\n");
+	vmm_cprintf(cdev, "Note:\n");
+	vmm_cprintf(cdev, "   server receives and discards data of one "
+			  "connection\n");
+	vmm_cprintf(cdev, "   client sends <kbytes> of data in writes of "
+			  "<write_size> bytes (default %d)\n", TCPBENCH_WRITE_SIZE);
+}
+
+static void cmd_tcpbench_report(struct vmm_chardev *cdev, const char *what,
+				u64 bytes, u64 nsecs)
+{
+	u64 kbps, usecs = udiv64(nsecs, 1000);
+
+	kbps = (nsecs) ? udiv64(bytes * 8000000ULL, nsecs) : 0;
+	vmm_cprintf(cdev, "%s %"PRIu64" bytes in %"PRIu64".%06"PRIu64
+		    " secs = %"PRIu64".%03"PRIu64" Mbps\n",
+		    what, bytes, udiv64(usecs, 1000000), umod64(usecs, 1000000),
+		    udiv64(kbps, 1000), umod64(kbps, 1000));
+}
+
+static int cmd_tcpbench_server(struct vmm_chardev *cdev, u16 port)
+{
+	int rc;
+	u64 bytes = 0, tstamp = 0, last = 0;
+	struct netstack_socket *sk, *new_sk;
+	struct netstack_socket_buf buf;
+
+	sk = netstack_socket_alloc(NETSTACK_SOCKET_TCP);
+	if (!sk) {
+		vmm_cprintf(cdev, "Failed to allocate socket\n");
+		return VMM_ENOMEM;
+	}
+
+	rc = netstack_socket_bind(sk, NULL, port);
+	if (rc) {
+		vmm_cprintf(cdev, "Failed to bind port %d\n", port);
+		goto done;
+	}
+
+	rc = netstack_socket_listen(sk);
+	if (rc) {
+		vmm_cprintf(cdev, "Failed to listen on port %d\n", port);
+		goto done;
+	}
+
+	vmm_cprintf(cdev, "Waiting for connection on port %d\n", port);
+	rc = netstack_socket_accept(sk, &new_sk);
+	if (rc) {
+		vmm_cprintf(cdev, "Failed to accept connection\n");
+		goto done;
+	}
+
+	/* Receive till peer closes connection or stops sending */
+	while (netstack_socket_recv(new_sk, &buf,
+				    TCPBENCH_RECV_TIMEOUT_MS) == VMM_OK) {
+		if (!tstamp) {
+			tstamp = vmm_timer_timestamp();
+		}
+		do {
+			bytes += buf.len;
+		} while (netstack_socket_nextbuf(&buf) == VMM_OK);
+		netstack_socket_freebuf(&buf);
+		last = vmm_timer_timestamp();
+	}
+
+	netstack_socket_close(new_sk);
+	netstack_socket_free(new_sk);
+
+	cmd_tcpbench_report(cdev, "Received", bytes, last - tstamp);
+
+done:
+	netstack_socket_close(sk);
+	netstack_socket_free(sk);
+	return rc;
+}
+
+static int cmd_tcpbench_client(struct vmm_chardev *cdev, u8 *ipaddr,
+			       u16 port, u64 total, u32 write_size)
+{
+	int rc;
+	u32 i, len;
+	u8 *data;
+	u64 bytes = 0, tstamp;
+	struct netstack_socket *sk;
+
+	data = vmm_malloc(write_size);
+	if (!data) {
+		return VMM_ENOMEM;
+	}
+	for (i = 0; i < write_size; i++) {
+		data[i] = (u8)i;
+	}
+
+	sk = netstack_socket_alloc(NETSTACK_SOCKET_TCP);
+	if (!sk) {
+		vmm_cprintf(cdev, "Failed to allocate socket\n");
+		rc = VMM_ENOMEM;
+		goto done;
+	}
+
+	rc = netstack_socket_connect(sk, ipaddr, port);
+	if (rc) {
+		vmm_cprintf(cdev, "Failed to connect\n");
+		goto done_free;
+	}
+
+	tstamp = vmm_timer_timestamp();
+	while (bytes < total) {
+		len = (u32)min((u64)write_size, total - bytes);
+		rc = netstack_socket_write(sk, data, len);
+		if (rc) {
+			vmm_cprintf(cdev, "Failed to write (error %d)\n", rc);
+			break;
+		}
+		bytes += len;
+	}
+	tstamp = vmm_timer_timestamp() - tstamp;
+
+	cmd_tcpbench_report(cdev, "Sent", bytes, tstamp);
+
+	netstack_socket_close(sk);
+done_free:
+	netstack_socket_free(sk);
+done:
+	vmm_free(data);
+	return rc;
+}
+
+static int cmd_tcpbench_exec(struct vmm_chardev *cdev, int argc, char **argv)
+{
+	u8 ipaddr[4];
+	u32 write_size = TCPBENCH_WRITE_SIZE;
+
+	if ((argc == 3) && (strcmp(argv[1], "server") == 0)) {
+		return cmd_tcpbench_server(cdev, atoi(argv[2]));
+	} else if ((argc == 5 || argc == 6) &&
+		   (strcmp(argv[1], "client") == 0)) {
+		if (argc == 6) {
+			write_size = atoi(argv[5]);
+		}
+		if (!write_size || (write_size > TCPBENCH_MAX_WRITE_SIZE)) {
+			vmm_cprintf(cdev, "Invalid write size %d\n",
+				    write_size);
+			return VMM_EINVALID;
+		}
+		str2ipaddr(ipaddr, argv[2]);
+		return cmd_tcpbench_client(cdev, ipaddr, atoi(argv[3]),
+				strtoull(argv[4], NULL, 0) * 1024, write_size);
+	}
+
+	cmd_tcpbench_usage(cdev);
+	if ((argc == 2) && (strcmp(argv[1], "help") == 0)) {
+		return VMM_OK;
+	}
+
+	return VMM_EFAIL;
+}
+
+static struct vmm_cmd cmd_tcpbench = {
+	.name = "tcpbench",
+	.desc = "TCP bulk-transfer benchmark",
+	.usage = cmd_tcpbench_usage,
+	.exec = cmd_tcpbench_exec,
+};
+
+static int __init cmd_tcpbench_init(void)
+{
+	return vmm_cmdmgr_register_cmd(&cmd_tcpbench);
+}
+
+static void __exit cmd_tcpbench_exit(void)
+{
+	vmm_cmdmgr_unregister_cmd(&cmd_tcpbench);
+}
+
+VMM_DECLARE_MODULE(MODULE_DESC,
+			MODULE_AUTHOR,
+			MODULE_LICENSE,
+			MODULE_IPRIORITY,
+			MODULE_INIT,
+			MODULE_EXIT);
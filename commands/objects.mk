@@ -39,6 +39,7 @@ commands-objs-$(CONFIG_CMD_STDIO)+= cmd_stdio.o
 commands-objs-$(CONFIG_CMD_HEAP)+= cmd_heap.o
 commands-objs-$(CONFIG_CMD_WALLCLOCK)+= cmd_wallclock.o
 commands-objs-$(CONFIG_CMD_MODULE)+= cmd_module.o
+commands-objs-$(CONFIG_CMD_DEVEMU)+= cmd_devemu.o
 commands-objs-$(CONFIG_CMD_PROFILE)+= cmd_profile.o
 
 commands-objs-$(CONFIG_CMD_VMSG)+= cmd_vmsg.o
@@ -63,6 +64,7 @@ commands-objs-$(CONFIG_CMD_SPIDEV)+= cmd_spidev.o
 commands-objs-$(CONFIG_CMD_NET)+= cmd_net.o
 commands-objs-$(CONFIG_CMD_IPCONFIG)+= cmd_ipconfig.o
 commands-objs-$(CONFIG_CMD_PING)+= cmd_ping.o
+commands-objs-$(CONFIG_CMD_TCPBENCH)+= cmd_tcpbench.o
 commands-objs-$(CONFIG_CMD_MII)+= cmd_mii.o
 
 commands-objs-$(CONFIG_CMD_VSDAEMON)+= cmd_vsdaemon.o
@@ -28,6 +28,7 @@
 #include <vmm_scheduler.h>
 #include <vmm_devdrv.h>
 #include <vmm_completion.h>
+#include <vmm_host_aspace.h>
 #include <block/vmm_blockdev.h>
 #include <libs/stringlib.h>
 #include <libs/mathlib.h>
@@ -39,8 +40,13 @@
 #define	MODULE_INIT			vmm_blockdev_init
 #define	MODULE_EXIT			vmm_blockdev_exit
 
+/* Size of shared zero buffer used to emulate WRITE_ZEROES */
+#define BLOCKDEV_ZERO_BUF_SIZE		(4 * VMM_PAGE_SIZE)
+
 static BLOCKING_NOTIFIER_CHAIN(bdev_notifier_chain);
 
+static u8 blockdev_zero_buf[BLOCKDEV_ZERO_BUF_SIZE];
+
 int vmm_blockdev_register_client(struct vmm_notifier_block *nb)
 {
 	return vmm_blocking_notifier_register(&bdev_notifier_chain, nb);
@@ -53,6 +59,98 @@ int vmm_blockdev_unregister_client(struct vmm_notifier_block *nb)
 }
 VMM_EXPORT_SYMBOL(vmm_blockdev_unregister_client);
 
+static int blockdev_bounce_alloc(struct vmm_blockdev *bdev,
+				 struct vmm_request *r)
+{
+	u32 i, pos, len = r->bcnt * bdev->block_size;
+
+	r->data = vmm_malloc(len);
+	if (!r->data) {
+		return VMM_ENOMEM;
+	}
+
+	if (r->type == VMM_REQUEST_WRITE) {
+		for (i = 0, pos = 0; (i < r->sg_cnt) && (pos < len); i++) {
+			memcpy(r->data + pos, r->sg[i].data,
+			       min(r->sg[i].len, len - pos));
+			pos += r->sg[i].len;
+		}
+	}
+
+	return VMM_OK;
+}
+
+static void blockdev_bounce_free(struct vmm_request *r, bool copy)
+{
+	u32 i, pos;
+
+	if (!r->sg_cnt || !r->data) {
+		return;
+	}
+
+	if (copy && (r->type == VMM_REQUEST_READ)) {
+		for (i = 0, pos = 0; i < r->sg_cnt; i++) {
+			memcpy(r->sg[i].data, r->data + pos, r->sg[i].len);
+			pos += r->sg[i].len;
+		}
+	}
+
+	vmm_free(r->data);
+	r->data = NULL;
+}
+
+static int blockdev_zeroes_alloc(struct vmm_blockdev *bdev,
+				 struct vmm_request *r)
+{
+	u32 i, len = r->bcnt * bdev->block_size;
+
+	if (bdev->rq->flags & VMM_REQUEST_QUEUE_SG) {
+		/* All segments point to the same zero buffer */
+		r->sg_cnt = udiv32(len + BLOCKDEV_ZERO_BUF_SIZE - 1,
+				   BLOCKDEV_ZERO_BUF_SIZE);
+		r->sg = vmm_malloc(r->sg_cnt * sizeof(*r->sg));
+		if (!r->sg) {
+			r->sg_cnt = 0;
+			return VMM_ENOMEM;
+		}
+		for (i = 0; i < r->sg_cnt; i++) {
+			r->sg[i].data = blockdev_zero_buf;
+			r->sg[i].len = min(len, (u32)BLOCKDEV_ZERO_BUF_SIZE);
+			len -= r->sg[i].len;
+		}
+	} else {
+		r->data = vmm_zalloc(len);
+		if (!r->data) {
+			return VMM_ENOMEM;
+		}
+	}
+
+	r->type = VMM_REQUEST_WRITE;
+	r->zeroes = TRUE;
+
+	return VMM_OK;
+}
+
+static void blockdev_zeroes_free(struct vmm_request *r)
+{
+	if (!r->zeroes) {
+		return;
+	}
+
+	if (r->sg) {
+		vmm_free(r->sg);
+		r->sg = NULL;
+		r->sg_cnt = 0;
+	}
+	if (r->data) {
+		vmm_free(r->data);
+		r->data = NULL;
+	}
+
+	r->type = VMM_REQUEST_WRITE_ZEROES;
+	r->zeroes = FALSE;
+}
+
 static int __blockdev_peek_cache(struct vmm_blockdev *bdev,
 				 struct vmm_request *r)
 {
@@ -132,6 +230,8 @@ int vmm_blockdev_complete_request(struct vmm_request *r)
 	}
 	rq = r->bdev->rq;
 	r->bdev = NULL;
+	blockdev_bounce_free(r, TRUE);
+	blockdev_zeroes_free(r);
 
 	if (r->completed) {
 		r->completed(r);
@@ -149,6 +249,10 @@ int vmm_blockdev_fail_request(struct vmm_request *r)
 	irq_flags_t flags;
 	struct vmm_request_queue *rq;
 
+	if (r) {
+		blockdev_bounce_free(r, FALSE);
+		blockdev_zeroes_free(r);
+	}
 	if (!r || !r->bdev || !r->bdev->rq) {
 		return VMM_EINVALID;
 	}
@@ -173,13 +277,18 @@ int vmm_blockdev_submit_request(struct vmm_blockdev *bdev,
 	irq_flags_t flags;
 	struct vmm_request_queue *rq;
 
+	if (r) {
+		r->zeroes = FALSE;
+	}
 	if (!bdev || !r || !bdev->rq) {
 		rc = VMM_EFAIL;
 		goto failed;
 	}
 	rq = bdev->rq;
 
-	if ((r->type == VMM_REQUEST_WRITE) &&
+	if (((r->type == VMM_REQUEST_WRITE) ||
+	     (r->type == VMM_REQUEST_DISCARD) ||
+	     (r->type == VMM_REQUEST_WRITE_ZEROES)) &&
 	   !(bdev->flags & VMM_BLOCKDEV_RW)) {
 		rc = VMM_EINVALID;
 		goto failed;
@@ -199,16 +308,42 @@ int vmm_blockdev_submit_request(struct vmm_blockdev *bdev,
 		goto failed;
 	}
 
+	if ((r->type == VMM_REQUEST_DISCARD) &&
+	    !(rq->flags & VMM_REQUEST_QUEUE_DISCARD)) {
+		/* Discard is only a hint so nothing to do */
+		if (r->completed) {
+			r->completed(r);
+		}
+		return VMM_OK;
+	}
+
+	if ((r->type == VMM_REQUEST_WRITE_ZEROES) &&
+	    !(rq->flags & VMM_REQUEST_QUEUE_WRITE_ZEROES)) {
+		rc = blockdev_zeroes_alloc(bdev, r);
+		if (rc) {
+			goto failed;
+		}
+	} else if (r->sg_cnt && !(rq->flags & VMM_REQUEST_QUEUE_SG)) {
+		rc = blockdev_bounce_alloc(bdev, r);
+		if (rc) {
+			goto failed;
+		}
+	}
+
 	if (rq->peek_cache) {
 		vmm_spin_lock_irqsave(&rq->lock, flags);
 		rc = __blockdev_peek_cache(bdev, r);
 		vmm_spin_unlock_irqrestore(&rq->lock, flags);
 		if (rc == VMM_OK) {
+			blockdev_bounce_free(r, TRUE);
+			blockdev_zeroes_free(r);
 			if (r->completed) {
 				r->completed(r);
 			}
 			return VMM_OK;
 		} else if (rc != VMM_ENOTAVAIL) {
+			blockdev_bounce_free(r, FALSE);
+			blockdev_zeroes_free(r);
 			if (r->failed) {
 				r->failed(r);
 			}
@@ -223,6 +358,8 @@ int vmm_blockdev_submit_request(struct vmm_blockdev *bdev,
 		rc = __blockdev_make_request(bdev, r, TRUE);
 		vmm_spin_unlock_irqrestore(&rq->lock, flags);
 		if (rc) {
+			blockdev_bounce_free(r, FALSE);
+			blockdev_zeroes_free(r);
 			return rc;
 		}
 	} else {
@@ -326,6 +463,8 @@ static int blockdev_rw_blocks(struct vmm_blockdev *bdev,
 	rw.req.lba = bdev->start_lba + lba;
 	rw.req.bcnt = bcnt;
 	rw.req.data = buf;
+	rw.req.sg = NULL;
+	rw.req.sg_cnt = 0;
 	rw.req.priv = &rw;
 	rw.req.completed = blockdev_rw_completed;
 	rw.req.failed = blockdev_rw_failed;
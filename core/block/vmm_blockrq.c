@@ -65,6 +65,16 @@ static int blockrq_cache_rw(struct vmm_blockrq *brq,
 			rc = brq->ops->write_cache(brq, r, brq->priv);
 		}
 		break;
+	case VMM_REQUEST_DISCARD:
+		if (brq->ops->discard_cache) {
+			rc = brq->ops->discard_cache(brq, r, brq->priv);
+		}
+		break;
+	case VMM_REQUEST_WRITE_ZEROES:
+		if (brq->ops->write_zeroes_cache) {
+			rc = brq->ops->write_zeroes_cache(brq, r, brq->priv);
+		}
+		break;
 	default:
 		break;
 	};
@@ -246,6 +256,21 @@ static void blockrq_work_func(struct vmm_work *work)
 			rc = VMM_EIO;
 		}
 		break;
+	case VMM_REQUEST_DISCARD:
+		if (brq->ops->discard) {
+			rc = brq->ops->discard(brq, bwork->d.rw.r, brq->priv);
+		} else {
+			rc = VMM_EIO;
+		}
+		break;
+	case VMM_REQUEST_WRITE_ZEROES:
+		if (brq->ops->write_zeroes) {
+			rc = brq->ops->write_zeroes(brq, bwork->d.rw.r,
+						    brq->priv);
+		} else {
+			rc = VMM_EIO;
+		}
+		break;
 	default:
 		rc = VMM_EINVALID;
 		break;
@@ -407,6 +432,12 @@ struct vmm_blockrq *vmm_blockrq_create(
 			   blockrq_abort_request,
 			   blockrq_flush_cache,
 			   brq);
+	if (ops->discard || ops->discard_cache) {
+		brq->rq.flags |= VMM_REQUEST_QUEUE_DISCARD;
+	}
+	if (ops->write_zeroes || ops->write_zeroes_cache) {
+		brq->rq.flags |= VMM_REQUEST_QUEUE_WRITE_ZEROES;
+	}
 
 	return brq;
 
@@ -38,7 +38,15 @@
 enum vmm_request_type {
 	VMM_REQUEST_UNKNOWN=0,
 	VMM_REQUEST_READ=1,
-	VMM_REQUEST_WRITE=2
+	VMM_REQUEST_WRITE=2,
+	VMM_REQUEST_DISCARD=3,
+	VMM_REQUEST_WRITE_ZEROES=4
+};
+
+/** Representation of a block IO scatter-gather segment */
+struct vmm_request_sg {
+	void *data;
+	u32 len;
 };
 
 /** Representation of a block IO request */
@@ -52,7 +60,16 @@ struct vmm_request {
 	enum vmm_request_type type;
 	u64 lba;
 	u32 bcnt;
-	void *data;
+	void *data; /* Must be NULL for DISCARD and WRITE_ZEROES */
+	struct vmm_request_sg *sg; /* If sg_cnt is non-zero then data is
+				    * described by sg segments and data
+				    * pointer must be NULL.
+				    */
+	u32 sg_cnt;
+	bool zeroes; /* No need to set this field.
+		      * submit_request() will set this field when
+		      * WRITE_ZEROES is emulated using zero writes.
+		      */
 
 	void (*completed)(struct vmm_request *);
 	void (*failed)(struct vmm_request *);
@@ -76,6 +93,21 @@ struct vmm_request_queue {
 	/* Backlog request list */
 	struct dlist backlog_list;
 
+	/* Request queue flags
+	 *
+	 * Note: if VMM_REQUEST_QUEUE_SG is not set then
+	 * scatter-gather requests are passed to peek_cache()
+	 * and make_request() with a bounce buffer as data.
+	 *
+	 * Note: if VMM_REQUEST_QUEUE_DISCARD is not set then
+	 * DISCARD requests are completed without any IO.
+	 *
+	 * Note: if VMM_REQUEST_QUEUE_WRITE_ZEROES is not set then
+	 * WRITE_ZEROES requests are passed to peek_cache() and
+	 * make_request() as WRITE requests of a shared zero buffer.
+	 */
+	u32 flags;
+
 	/* Note: if peek_cache succeeds then we assume
 	 * request completed successfully.
 	 *
@@ -122,6 +154,7 @@ struct vmm_request_queue {
 		(__rq)->pending_count = 0; \
 		(__rq)->backlog_count = 0; \
 		INIT_LIST_HEAD(&(__rq)->backlog_list); \
+		(__rq)->flags = 0; \
 		(__rq)->peek_cache = (__peek_cache); \
 		(__rq)->make_request = (__make_request); \
 		(__rq)->abort_request = (__abort_request); \
@@ -129,6 +162,11 @@ struct vmm_request_queue {
 		(__rq)->priv = (__priv); \
 	} while (0)
 
+/* Request queue flags */
+#define VMM_REQUEST_QUEUE_SG				0x00000001
+#define VMM_REQUEST_QUEUE_DISCARD			0x00000002
+#define VMM_REQUEST_QUEUE_WRITE_ZEROES			0x00000004
+
 /* Block device flags */
 #define VMM_BLOCKDEV_RDONLY				0x00000001
 #define VMM_BLOCKDEV_RW					0x00000002
@@ -43,6 +43,14 @@ struct vmm_blockrq_ops {
 		     struct vmm_request *r, void *priv);
 	int (*write_cache)(struct vmm_blockrq *brq,
 			   struct vmm_request *r, void *priv);
+	int (*discard)(struct vmm_blockrq *brq,
+		       struct vmm_request *r, void *priv);
+	int (*discard_cache)(struct vmm_blockrq *brq,
+			     struct vmm_request *r, void *priv);
+	int (*write_zeroes)(struct vmm_blockrq *brq,
+			    struct vmm_request *r, void *priv);
+	int (*write_zeroes_cache)(struct vmm_blockrq *brq,
+				  struct vmm_request *r, void *priv);
 	int (*abort)(struct vmm_blockrq *brq,
 		     struct vmm_request *r, void *priv);
 	void (*flush)(struct vmm_blockrq *brq, void *priv);
@@ -111,6 +111,12 @@ struct m_hdr {
  */
 struct m_pkthdr {
 	int	len;			/* total packet length */
+	u32	csum_flags;		/* checksum offload flags */
+	u16	csum_start;		/* offset to start checksumming from */
+	u16	csum_offset;		/* offset of checksum from csum_start */
+	u16	gso_type;		/* segmentation offload type */
+	u16	gso_size;		/* payload bytes per segment */
+	u16	hdr_len;		/* length of headers before payload */
 };
 
 struct m_ext {
@@ -136,6 +142,12 @@ struct vmm_mbuf {
 #define	m_len		m_hdr.mh_len
 #define	m_flags		m_hdr.mh_flags
 #define m_pktlen	m_pkthdr.len
+#define m_csum_flags	m_pkthdr.csum_flags
+#define m_csum_start	m_pkthdr.csum_start
+#define m_csum_offset	m_pkthdr.csum_offset
+#define m_gso_type	m_pkthdr.gso_type
+#define m_gso_size	m_pkthdr.gso_size
+#define m_hdr_len	m_pkthdr.hdr_len
 #define m_extbuf	m_ext.ext_buf
 #define m_extlen	m_ext.ext_size
 #define m_extref	m_ext.ext_refcnt
@@ -152,6 +164,7 @@ struct vmm_mbuf {
 
 /* mbuf flags */
 #define	M_PKTHDR	0x00001	/* start of record */
+#define	M_MARKED	0x00002	/* exceeded committed rate of source port */
 
 /* additional flags for M_EXT mbufs */
 #define	M_EXT_FLAGS	0xff000000
@@ -161,6 +174,16 @@ struct vmm_mbuf {
 #define	M_EXT_POOL	0x08000000	/* ext storage is pool alloced */
 #define	M_EXT_HEAP	0x10000000	/* ext storage is normal heap alloced */
 #define	M_EXT_DMA	0x20000000	/* ext storage is dma heap alloced */
+#define	M_EXT_GUEST	0x40000000	/* ext storage is pinned guest memory */
+
+/* checksum offload flags (m_csum_flags) */
+#define	M_CSUM_PARTIAL	0x1	/* L4 checksum to be filled from csum_start */
+#define	M_CSUM_VALID	0x2	/* L4 checksum already verified/complete */
+
+/* segmentation offload types (m_gso_type) */
+#define	M_GSO_NONE	0
+#define	M_GSO_TCPV4	1
+#define	M_GSO_TCPV6	2
 
 /* flags copied when copying m_pkthdr */
 #define	M_COPYFLAGS	(M_PKTHDR)
@@ -170,6 +193,28 @@ struct vmm_mbuf {
 
 #define MCLBYTES	2048
 
+/*
+ * Guest memory backing of M_EXT_GUEST mbufs.
+ *
+ * Such mbuf is never chained and only its first m_len bytes (packet
+ * headers) are copied to hypervisor memory at m_data. Remaining bytes
+ * up to m_pktlen stay in guest memory and are fetched on demand using
+ * read() so m_copydata() must be used to access the whole packet. The
+ * optional phys() callback returns host physical address of packet
+ * byte at given offset and number of contiguous bytes from there, so
+ * that a consumer can copy straight out of guest memory. The release()
+ * callback is called when last reference to ext storage is dropped
+ * after which guest can reuse its memory.
+ */
+#define M_GUEST_HDRLEN	128
+
+struct vmm_mbuf_guest {
+	u8 hdr[M_GUEST_HDRLEN];
+	u32 (*read)(struct vmm_mbuf_guest *g, u32 off, void *buf, u32 len);
+	u32 (*phys)(struct vmm_mbuf_guest *g, u32 off, physical_addr_t *hpa);
+	void (*release)(struct vmm_mbuf_guest *g);
+};
+
 /*
  * mbuf allocation/deallocation macros:
  *
@@ -287,10 +332,34 @@ struct vmm_mbuf *m_free(struct vmm_mbuf *m);
 struct vmm_mbuf *m_get(int nowait, int flags);
 void *m_ext_get(struct vmm_mbuf *m, u32 size, enum vmm_mbuf_alloc_types how);
 void m_ext_dma_ensure(struct vmm_mbuf *m);
-void m_copydata(struct vmm_mbuf *m, int off, int len, void *vp);
+int m_ext_guest_add(struct vmm_mbuf *m, u32 len, struct vmm_mbuf_guest *g);
+int m_copydata(struct vmm_mbuf *m, int off, int len, void *vp);
 void m_freem(struct vmm_mbuf *m);
 void m_ext_free(struct vmm_mbuf *m);
 void m_dump(struct vmm_mbuf *m);
+struct vmm_mbuf *m_dup(struct vmm_mbuf *m);
+int m_csum_finish(struct vmm_mbuf *m);
+int m_gso_segment(struct vmm_mbuf *m, struct dlist *segs);
+
+/*
+ * mbuf pool statistics.
+ */
+struct vmm_mbufpool_stats {
+	u32 buf_size;	/* size of each entity */
+	u32 total;	/* total entities */
+	u32 free;	/* free entities in global pool */
+	u32 cached;	/* free entities in per-CPU caches */
+	u64 hits;	/* allocations served by per-CPU caches */
+	u64 refills;	/* batch refills from global pool */
+	u64 drains;	/* batch drains to global pool */
+	u64 exhausted;	/* allocations which fell back to heap */
+};
+
+/** Number of mbuf pools (mbuf headers followed by ext slabs) */
+u32 vmm_mbufpool_count(void);
+
+/** Get statistics of mbuf pool at given index */
+int vmm_mbufpool_stats_get(u32 index, struct vmm_mbufpool_stats *stats);
 
 /*
  * mbuf pool initializaton and exit.
@@ -35,21 +35,64 @@
 /* Port Flags (should be defined as bits) */
 #define VMM_NETPORT_LINK_UP		1	/* If this bit is set link is up */
 
+/* Port offload features (should be defined as bits) */
+#define VMM_NETPORT_F_CSUM		0x1	/* Accepts partial checksums */
+#define VMM_NETPORT_F_TSO4		0x2	/* Accepts TCPv4 GSO packets */
+#define VMM_NETPORT_F_TSO6		0x4	/* Accepts TCPv6 GSO packets */
+#define VMM_NETPORT_F_GUEST_MBUF	0x8	/* Accepts M_EXT_GUEST mbufs */
+
 /* Default per-port queue size */
 #define VMM_NETPORT_MAX_QUEUE_SIZE	256
 
 /* Default per-port queue size */
 #define VMM_NETPORT_DEF_QUEUE_SIZE	(VMM_NETPORT_MAX_QUEUE_SIZE / 4)
 
+/* Number of egress priority queues (0 is highest priority) */
+#define VMM_NETPORT_NR_PRIO		4
+
+/* Burst allowed by port rate limiters (in nanoseconds of rate) */
+#define VMM_NETPORT_RATE_BURST_NS	100000000ULL
+
+/* Max rate of port rate limiters (token refill must not overflow) */
+#define VMM_NETPORT_RATE_MAX		\
+			((u64)(S64_MAX / (2 * VMM_NETPORT_RATE_BURST_NS)))
+
+/* Verdicts of port rate limiters */
+#define VMM_NETPORT_RATE_PASS		0	/* Within committed rate */
+#define VMM_NETPORT_RATE_MARK		1	/* Within excess burst */
+#define VMM_NETPORT_RATE_DROP		2	/* Exceeds excess burst */
+
 struct vmm_netswitch;
 struct vmm_netport;
 struct vmm_mbuf;
+struct vmm_devtree_node;
+
+/*
+ * Token bucket rate limiter of a port. Byte and packet tokens are
+ * scaled by nanoseconds so that refill needs no division. Packets
+ * beyond committed rate are marked (demoted to lowest priority) till
+ * tokens drop below minus burst and dropped thereafter. Zero rate
+ * means unlimited.
+ */
+struct vmm_netport_rate {
+	vmm_spinlock_t lock;
+	u64 bytes_per_sec;
+	u64 pkts_per_sec;
+	s64 byte_tokens;
+	s64 pkt_tokens;
+	u64 timestamp;
+	/* Also updated without lock when rate is unlimited */
+	atomic64_t passed;
+	u64 marked;
+	u64 dropped;
+};
 
 struct vmm_netport_lazy {
 	struct vmm_netport *port;
 	atomic_t sched_count;
 	struct dlist head;
 	int budget;
+	int cpu;	/* Host CPU for xfer (-1 means scheduling CPU) */
 	void *arg;
 	void (*xfer)(struct vmm_netport *, void *, int);
 };
@@ -60,6 +103,7 @@ do { \
 	ARCH_ATOMIC_INIT(&(__lazy)->sched_count, 0); \
 	INIT_LIST_HEAD(&(__lazy)->head); \
 	(__lazy)->budget = (__budget); \
+	(__lazy)->cpu = -1; \
 	(__lazy)->arg = (__arg); \
 	(__lazy)->xfer = (__xfer); \
 } while (0)
@@ -69,11 +113,19 @@ struct vmm_netport {
 	char name[VMM_FIELD_NAME_SIZE];
 	u32 queue_size;
 	int flags;
+	u32 features;
 	int mtu;
 	u8 macaddr[6];
 	struct vmm_netswitch *nsw;
 	struct vmm_device dev;
 
+	/* Admission control from port to switch */
+	struct vmm_netport_rate ingress;
+	/* Rate limiting from switch to port */
+	struct vmm_netport_rate egress;
+	/* Packets delivered from each egress priority queue */
+	u64 prio_pkts[VMM_NETPORT_NR_PRIO];
+
 	/* Link status changed */
 	void (*link_changed) (struct vmm_netport *);
 	/* Callback to determine if the port can RX */
@@ -81,6 +133,11 @@ struct vmm_netport {
 	/* Handle RX from switch to port */
 	vmm_spinlock_t switch2port_xfer_lock;
 	int (*switch2port_xfer) (struct vmm_netport *, struct vmm_mbuf *);
+	/* Handle bulk RX from switch to port (optional) */
+	int (*switch2port_xfer_bulk) (struct vmm_netport *,
+				      struct vmm_mbuf **, u32);
+	/* Owner reference plus one per netswitch batch still using port */
+	atomic_t ref_count;
 	/* Port private data */
 	void *priv;
 };
@@ -90,7 +147,7 @@ struct vmm_netport {
 /** Allocate new netport */
 struct vmm_netport *vmm_netport_alloc(char *name, u32 queue_size);
 
-/** Free netport */
+/** Free netport (deferred while netswitch batches still use it) */
 int vmm_netport_free(struct vmm_netport *port);
 
 /** Register netport to networking framework */
@@ -109,6 +166,19 @@ int vmm_netport_iterate(struct vmm_netport *start, void *data,
 /** Count number of netports */
 u32 vmm_netport_count(void);
 
+/** Set rate of a port rate limiter (zero means unlimited and rates
+ *  above VMM_NETPORT_RATE_MAX are clamped)
+ */
+void vmm_netport_rate_set(struct vmm_netport_rate *r,
+			  u64 bytes_per_sec, u64 pkts_per_sec);
+
+/** Account a packet of len bytes and get VMM_NETPORT_RATE_xxx verdict */
+int vmm_netport_rate_check(struct vmm_netport_rate *r, u32 len);
+
+/** Configure port rate limiters from device tree node attributes */
+void vmm_netport_rate_parse(struct vmm_netport *port,
+			    struct vmm_devtree_node *node);
+
 /** Get pointer to port mac address */
 #define vmm_netport_mac(port)	((port)->macaddr)
 
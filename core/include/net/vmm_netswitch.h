@@ -38,6 +38,15 @@ struct vmm_netswitch;
 struct vmm_netport;
 struct vmm_netport_lazy;
 struct vmm_mbuf;
+struct vmm_chardev;
+struct vmm_netswitch_flow;
+
+struct vmm_netswitch_flow_stats {
+	u64 hits;
+	u64 misses;
+	u64 flushes;
+	u32 entries;
+};
 
 struct vmm_netswitch {
 	/* === Private members === */
@@ -47,6 +56,15 @@ struct vmm_netswitch {
 	vmm_rwlock_t port_list_lock;
 	/* List of ports */
 	struct dlist port_list;
+	/* Lock to protect flow cache updates */
+	vmm_spinlock_t flow_lock;
+	/* Generation of flow cache (entries of older generation are stale) */
+	u32 flow_gen;
+	/* Exact-match flow cache */
+	u32 flow_count;
+	struct vmm_netswitch_flow *flows;
+	/* Per-CPU flow cache statistics */
+	struct vmm_netswitch_flow_stats *flow_stats;
 	/* === Public members === */
 	/* Policy */
 	struct vmm_netswitch_policy *policy;
@@ -64,6 +82,13 @@ struct vmm_netswitch {
 	/* Handle disabling of a port */
 	int (*port_remove) (struct vmm_netswitch *,
 			    struct vmm_netport *);
+	/* Dump switch specific state and statistics (optional) */
+	void (*dump) (struct vmm_netswitch *,
+		      struct vmm_chardev *);
+	/* Handle RX packet forwarded by flow cache (optional) */
+	void (*flow_hit) (struct vmm_netswitch *,
+			  struct vmm_netport *,
+			  struct vmm_mbuf *);
 	/* Switch private data */
 	void *priv;
 };
@@ -84,6 +109,10 @@ struct vmm_netswitch_policy {
 int vmm_port2switch_xfer_mbuf(struct vmm_netport *src,
 			      struct vmm_mbuf *mbuf);
 
+/** Transfer list of packets (linked by m_list) from port to switch */
+int vmm_port2switch_xfer_mbuf_list(struct vmm_netport *src,
+				   struct dlist *mbufs);
+
 /** Lazy transfer from port to switch */
 int vmm_port2switch_xfer_lazy(struct vmm_netport_lazy *lazy);
 
@@ -92,6 +121,20 @@ int vmm_switch2port_xfer_mbuf(struct vmm_netswitch *nsw,
 			      struct vmm_netport *dst,
 			      struct vmm_mbuf *mbuf);
 
+/** Invalidate flow cache of a network switch (used by network switch
+ *  policy whenever its forwarding decisions might change)
+ */
+void vmm_netswitch_flow_flush(struct vmm_netswitch *nsw);
+
+/** Do not cache output ports of the packet being forwarded (used by
+ *  network switch policy when flooding packet to unknown destination)
+ */
+void vmm_netswitch_flow_nocache(struct vmm_netswitch *nsw);
+
+/** Get flow cache statistics of a network switch */
+int vmm_netswitch_flow_stats_get(struct vmm_netswitch *nsw,
+				 struct vmm_netswitch_flow_stats *stats);
+
 /** Allocate new network switch (used by network switch policy)
  *  @name name of the network switch
  */
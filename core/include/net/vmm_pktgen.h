@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file vmm_pktgen.h
+ * @author agent (agent@local)
+ * @brief Packet generator and sink netport for benchmarking.
+ *
+ * Each pktgen instance is a netport attached to a netswitch. When
+ * started it injects frames carrying a sequence number and timestamp
+ * into the netswitch. Every pktgen instance also acts as sink which
+ * counts frames received from any pktgen and records their latency.
+ */
+
+#ifndef __VMM_PKTGEN_H_
+#define __VMM_PKTGEN_H_
+
+#include <vmm_types.h>
+
+/* Ethernet type of generated frames (IEEE local experimental) */
+#define VMM_PKTGEN_ETHER_TYPE		0x88b5
+
+/* Range of generated frame size (excluding FCS) */
+#define VMM_PKTGEN_MIN_SIZE		60
+#define VMM_PKTGEN_MAX_SIZE		1518
+
+struct vmm_pktgen;
+struct vmm_netport;
+struct vmm_netswitch;
+
+struct vmm_pktgen_params {
+	u32 size;		/* Frame size in bytes */
+	u64 count;		/* Frames to send (0 means till stopped) */
+	u64 rate;		/* Frames per second (0 means unlimited) */
+	u8 dstmac[6];		/* Base destination MAC */
+	u32 dstmac_count;	/* Destination MACs to cycle through */
+	u32 srcmac_count;	/* Source MACs to cycle through */
+	u16 vlan_id;		/* VLAN ID (0 means untagged) */
+	u8 vlan_prio;		/* VLAN priority code point */
+};
+
+struct vmm_pktgen_stats {
+	bool running;
+	/* Transmit side */
+	u64 tx_pkts;
+	u64 tx_bytes;
+	u64 tx_nsecs;
+	u64 tx_nobufs;
+	/* Receive (sink) side */
+	u64 rx_pkts;
+	u64 rx_bytes;
+	u64 rx_nsecs;
+	u64 rx_other;
+	/* Latency of received frames in nanoseconds */
+	u64 lat_min;
+	u64 lat_avg;
+	u64 lat_max;
+	u64 lat_p50;
+	u64 lat_p90;
+	u64 lat_p99;
+	u64 lat_p999;
+};
+
+/** Create a pktgen netport and attach it to given netswitch */
+struct vmm_pktgen *vmm_pktgen_create(const char *name,
+				     struct vmm_netswitch *nsw);
+
+/** Stop and destroy a pktgen */
+int vmm_pktgen_destroy(struct vmm_pktgen *pg);
+
+/** Find a pktgen by name */
+struct vmm_pktgen *vmm_pktgen_find(const char *name);
+
+/** Iterate over each pktgen */
+int vmm_pktgen_iterate(void *data,
+		       int (*fn)(struct vmm_pktgen *pg, void *data));
+
+/** Get netport of a pktgen */
+struct vmm_netport *vmm_pktgen_port(struct vmm_pktgen *pg);
+
+/** Start generating frames */
+int vmm_pktgen_start(struct vmm_pktgen *pg,
+		     const struct vmm_pktgen_params *params);
+
+/** Stop generating frames and wait till generator finishes */
+int vmm_pktgen_stop(struct vmm_pktgen *pg);
+
+/** Clear transmit and receive statistics */
+int vmm_pktgen_reset(struct vmm_pktgen *pg);
+
+/** Retrive transmit and receive statistics */
+int vmm_pktgen_stats_get(struct vmm_pktgen *pg,
+			 struct vmm_pktgen_stats *stats);
+
+#endif /* __VMM_PKTGEN_H_ */
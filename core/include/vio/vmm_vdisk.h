@@ -57,7 +57,9 @@ struct vmm_vdisk;
 enum vmm_vdisk_request_type {
 	VMM_VDISK_REQUEST_UNKNOWN=0,
 	VMM_VDISK_REQUEST_READ=1,
-	VMM_VDISK_REQUEST_WRITE=2
+	VMM_VDISK_REQUEST_WRITE=2,
+	VMM_VDISK_REQUEST_DISCARD=3,
+	VMM_VDISK_REQUEST_WRITE_ZEROES=4
 };
 
 /** Representation of a virtual disk request  */
@@ -77,7 +79,7 @@ struct vmm_vdisk {
 	void (*completed)(struct vmm_vdisk *, struct vmm_vdisk_request *);
 	void (*failed)(struct vmm_vdisk *, struct vmm_vdisk_request *);
 
-	vmm_spinlock_t blk_lock; /* Protect blk pointer */
+	vmm_rwlock_t blk_lock; /* Protect blk pointer */
 	struct vmm_blockdev *blk;
 	u32 blk_factor;
 
@@ -177,6 +179,23 @@ int vmm_vdisk_submit_request(struct vmm_vdisk *vdisk,
 			     enum vmm_vdisk_request_type type,
 			     u64 lba, void *data, u32 data_len);
 
+/** Submit scatter-gather IO request to virtual disk
+ *  NOTE: The sg segments must stay valid until request completes
+ */
+int vmm_vdisk_submit_request_sg(struct vmm_vdisk *vdisk,
+				struct vmm_vdisk_request *vreq,
+				enum vmm_vdisk_request_type type,
+				u64 lba, struct vmm_request_sg *sg,
+				u32 sg_cnt, u32 data_len);
+
+/** Submit DISCARD or WRITE_ZEROES request to virtual disk
+ *  NOTE: The data_len is the size of range in bytes
+ */
+int vmm_vdisk_submit_request_range(struct vmm_vdisk *vdisk,
+				   struct vmm_vdisk_request *vreq,
+				   enum vmm_vdisk_request_type type,
+				   u64 lba, u32 data_len);
+
 /* Abort IO request from virtual disk */
 int vmm_vdisk_abort_request(struct vmm_vdisk *vdisk,
 			    struct vmm_vdisk_request *vreq);
@@ -39,6 +39,7 @@
 
 struct vmm_guest;
 struct vmm_virtio_device;
+struct vmm_virtio_dataplane;
 
 struct vmm_virtio_iovec {
 	/* Address (guest-physical). */
@@ -49,12 +50,47 @@ struct vmm_virtio_iovec {
 	u16 flags;
 };
 
+/* Device writes to the segment (i.e. guest reads it) */
+#define VMM_VIRTIO_SG_WRITE			0x1
+/* Segment is backed by guest RAM so hpa (and hva if set) is usable */
+#define VMM_VIRTIO_SG_RAM			0x2
+
+struct vmm_region;
+
+struct vmm_virtio_sg {
+	/* Guest physical address. */
+	physical_addr_t gpa;
+	/* Host physical address (only for RAM segments). */
+	physical_addr_t hpa;
+	/* Host virtual address (zero if not mapped in hypervisor). */
+	virtual_addr_t hva;
+	/* Length. */
+	u32 len;
+	/* The flags as indicated above. */
+	u32 flags;
+	/* Guest region pinned for this segment. */
+	struct vmm_region *reg;
+};
+
 struct vmm_virtio_queue {
 	/* The last_avail_idx field is an index to ->ring of struct vring_avail.
 	   It's where we assume the next request index is at.  */
 	u16			last_avail_idx;
 	u16			last_used_signalled;
 
+	/* Packed virtqueue state. The used_idx field is the position in
+	   descriptor ring where next used descriptor will be written and
+	   chain_len holds number of descriptors of each outstanding buffer
+	   indexed by buffer ID. */
+	bool			packed;
+	bool			avail_wrap_counter;
+	bool			used_wrap_counter;
+	u16			used_idx;
+	u16			*chain_len;
+
+	/* Guest notifications (kicks) suppressed by polling backend */
+	bool			notify_disabled;
+
 	struct vmm_vring	vring;
 
 	struct vmm_guest	*guest;
@@ -83,6 +119,8 @@ struct vmm_virtio_device {
 	struct vmm_virtio_emulator *emu;
 	void *emu_data;
 
+	struct vmm_virtio_dataplane *dp;
+
 	struct dlist node;
 	struct vmm_guest *guest;
 };
@@ -103,10 +141,19 @@ struct vmm_virtio_emulator {
 				    u32 select, u32 features);
 	int (*init_vq) (struct vmm_virtio_device *dev, u32 vq, u32 page_size,
 			u32 align, u32 pfn);
+	int (*init_vq_addr) (struct vmm_virtio_device *dev, u32 vq, u32 size,
+			     physical_addr_t desc_addr,
+			     physical_addr_t driver_addr,
+			     physical_addr_t device_addr, bool packed);
 	int (*get_pfn_vq) (struct vmm_virtio_device *dev, u32 vq);
 	int (*get_size_vq) (struct vmm_virtio_device *dev, u32 vq);
 	int (*set_size_vq) (struct vmm_virtio_device *dev, u32 vq, int size);
 	int (*notify_vq) (struct vmm_virtio_device *dev, u32 vq);
+	/* Optional, required for polling dataplane
+	 * (returns NULL for first queue number not present)
+	 */
+	struct vmm_virtio_queue *(*get_vq) (struct vmm_virtio_device *dev,
+					    u32 vq);
 	void (*status_changed) (struct vmm_virtio_device *dev,
 				u32 new_status);
 
@@ -176,6 +223,10 @@ int vmm_virtio_queue_get_desc(struct vmm_virtio_queue *vq, u16 indx,
 
 /** Pop the index of next available descriptor
  *  Note: works only after queue setup is done
+ *  Note: for packed virtqueue this is the position of next available
+ *  descriptor in descriptor ring which is consumed only when passed to
+ *  vmm_virtio_queue_get_head_iovec() so callers must use the head
+ *  returned by vmm_virtio_queue_get_head_iovec() to identify buffers.
  */
 u16 vmm_virtio_queue_pop(struct vmm_virtio_queue *vq);
 
@@ -184,6 +235,17 @@ u16 vmm_virtio_queue_pop(struct vmm_virtio_queue *vq);
  */
 bool vmm_virtio_queue_available(struct vmm_virtio_queue *vq);
 
+/** Get current position in available ring (or descriptor ring)
+ *  Note: works only after queue setup is done
+ */
+u32 vmm_virtio_queue_avail_pos(struct vmm_virtio_queue *vq);
+
+/** Give back available buffers got after given position
+ *  Note: works only after queue setup is done
+ *  Note: buffers given back must not have been marked used
+ */
+void vmm_virtio_queue_rewind(struct vmm_virtio_queue *vq, u32 pos);
+
 /** Check whether queue notification is required
  *  Note: works only after queue setup is done
  */
@@ -194,12 +256,25 @@ bool vmm_virtio_queue_should_signal(struct vmm_virtio_queue *vq);
  */
 void vmm_virtio_queue_set_avail_event(struct vmm_virtio_queue *vq);
 
+/** Enable or suppress guest notifications for new available buffers
+ *  Note: works only after queue setup is done
+ */
+void vmm_virtio_queue_notify_enable(struct vmm_virtio_queue *vq,
+				    bool enable);
+
 /** Update used element in vring
  *  Note: works only after queue setup is done
  */
 void vmm_virtio_queue_set_used_elem(struct vmm_virtio_queue *vq,
 				    u32 head, u32 len);
 
+/** Update several used elements in vring and publish them together
+ *  Note: works only after queue setup is done
+ */
+void vmm_virtio_queue_set_used_elems(struct vmm_virtio_queue *vq,
+				struct vmm_vring_used_elem *elems,
+				u32 count);
+
 /** Check whether queue setup is done by guest or not */
 bool vmm_virtio_queue_setup_done(struct vmm_virtio_queue *vq);
 
@@ -217,6 +292,21 @@ int vmm_virtio_queue_setup(struct vmm_virtio_queue *vq,
 			   physical_size_t guest_page_size,
 			   u32 desc_count, u32 align);
 
+/** Setup or initialize the queue using separate guest physical address
+ *  of descriptor area, driver area and device area. The packed flag
+ *  selects packed virtqueue layout instead of split virtqueue layout.
+ *  Note: If queue was already setup then it will cleanup first.
+ */
+int vmm_virtio_queue_setup_addr(struct vmm_virtio_queue *vq,
+				struct vmm_guest *guest,
+				physical_addr_t desc_addr,
+				physical_addr_t driver_addr,
+				physical_addr_t device_addr,
+				u32 desc_count, bool packed);
+
+/** Check whether queue uses packed virtqueue layout */
+bool vmm_virtio_queue_is_packed(struct vmm_virtio_queue *vq);
+
 /** Get guest IO vectors based on given head
  *  Note: works only after queue setup is done
  */
@@ -250,6 +340,21 @@ void vmm_virtio_iovec_fill_zeros(struct vmm_virtio_device *dev,
 				 struct vmm_virtio_iovec *iov,
 				 u32 iov_cnt);
 
+/** Translate guest IO vectors to host segments split at guest region
+ *  boundaries. Underlying guest regions are pinned so segments remain
+ *  valid until vmm_virtio_sg_release() is called. Segments not backed
+ *  by guest RAM won't have VMM_VIRTIO_SG_RAM flag set and callers are
+ *  expected to fall back to copying for such segments.
+ */
+int vmm_virtio_iovec_to_sg(struct vmm_virtio_device *dev,
+			   struct vmm_virtio_iovec *iov, u32 iov_cnt,
+			   struct vmm_virtio_sg *sg, u32 sg_max,
+			   u32 *ret_sg_cnt);
+
+/** Release (or unpin) segments got from vmm_virtio_iovec_to_sg() */
+void vmm_virtio_sg_release(struct vmm_virtio_device *dev,
+			   struct vmm_virtio_sg *sg, u32 sg_cnt);
+
 /** Read VirtIO device configuration */
 int vmm_virtio_config_read(struct vmm_virtio_device *dev,
 			   u32 offset, void *dst, u32 dst_len);
@@ -258,6 +363,21 @@ int vmm_virtio_config_read(struct vmm_virtio_device *dev,
 int vmm_virtio_config_write(struct vmm_virtio_device *dev,
 			    u32 offset, void *src, u32 src_len);
 
+/** Process guest notification for VirtIO device queue
+ *  Note: transports must use this instead of emulator notify_vq()
+ *  so that devices with polling dataplane are handled.
+ */
+int vmm_virtio_notify_vq(struct vmm_virtio_device *dev, u32 vq);
+
+/** Stop polling dataplane from servicing queues of VirtIO device
+ *  Note: transports must wrap queue setup with pause and resume.
+ *  Note: this waits for queue processing in progress to finish.
+ */
+void vmm_virtio_dataplane_pause(struct vmm_virtio_device *dev);
+
+/** Allow polling dataplane to service queues of VirtIO device again */
+void vmm_virtio_dataplane_resume(struct vmm_virtio_device *dev);
+
 /** Reset VirtIO device */
 int vmm_virtio_reset(struct vmm_virtio_device *dev);
 
@@ -122,6 +122,7 @@
 #define VMM_VIRTIO_MMIO_INT_VRING		(1 << 0)
 #define VMM_VIRTIO_MMIO_INT_CONFIG		(1 << 1)
 
+#define VMM_VIRTIO_MMIO_QUEUE_MAX		64
 #define VMM_VIRTIO_MMIO_MAX_VQ			3
 #define VMM_VIRTIO_MMIO_MAX_CONFIG		1
 #define VMM_VIRTIO_MMIO_IO_SIZE			0x200
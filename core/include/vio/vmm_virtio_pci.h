@@ -54,9 +54,27 @@
 
 #define VMM_VIRTIO_PCI_REGION_SIZE		(VMM_VIRTIO_PCI_ISR)
 
+/* MSI-X registers: only enabled if MSI-X is enabled. */
+/* A 16-bit vector for configuration changes. */
+#define VMM_VIRTIO_MSI_CONFIG_VECTOR		20
+/* A 16-bit vector for selected queue notifications. */
+#define VMM_VIRTIO_MSI_QUEUE_VECTOR		22
+/* Vector value used to disable MSI for queue */
+#define VMM_VIRTIO_MSI_NO_VECTOR		0xffff
+
 /* The remaining space is defined by each driver as the per-driver
  * configuration space */
 #define VMM_VIRTIO_PCI_CONFIG			(20)
+#define VMM_VIRTIO_PCI_CONFIG_MSIX		(24)
+#define VMM_VIRTIO_PCI_CONFIG_OFF(msix_enabled)	\
+	((msix_enabled) ? VMM_VIRTIO_PCI_CONFIG_MSIX : VMM_VIRTIO_PCI_CONFIG)
+
+/* Placement of MSI-X capability in PCI config space and of MSI-X
+ * table and pending bit array in the (memory) BAR of virtio device */
+#define VMM_VIRTIO_PCI_MSIX_CAP			0x40
+#define VMM_VIRTIO_PCI_MSIX_TABLE		0x800
+#define VMM_VIRTIO_PCI_MSIX_PBA			0xC00
+#define VMM_VIRTIO_PCI_MSIX_BAR_SIZE		0x1000
 
 /* How many bits to shift physical queue address written to QUEUE_PFN.
  * 12 is historical, and due to x86 page size. */
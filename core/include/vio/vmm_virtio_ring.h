@@ -61,6 +61,25 @@
   */
 #define VMM_VIRTIO_RING_F_EVENT_IDX	29
 
+/* Mark a descriptor as available or used in packed ring.
+ * Notice: they are defined as shifts instead of shifted values.
+ */
+#define VMM_VRING_PACKED_DESC_F_AVAIL	7
+#define VMM_VRING_PACKED_DESC_F_USED	15
+
+/* Enable events in packed ring. */
+#define VMM_VRING_PACKED_EVENT_FLAG_ENABLE	0x0
+/* Disable events in packed ring. */
+#define VMM_VRING_PACKED_EVENT_FLAG_DISABLE	0x1
+/* Enable events for a specific descriptor in packed ring.
+ * (as specified by Descriptor Ring Change Event Offset/Wrap Counter).
+ * Only valid if VMM_VIRTIO_RING_F_EVENT_IDX has been negotiated.
+ */
+#define VMM_VRING_PACKED_EVENT_FLAG_DESC	0x2
+
+/* Wrap counter bit shift in event suppression structure of packed ring. */
+#define VMM_VRING_PACKED_EVENT_F_WRAP_CTR	15
+
 /* Virtio ring descriptors: 16 bytes.  These can chain together via "next". */
 struct vmm_vring_desc {
 	/* Address (guest-physical). */
@@ -93,6 +112,26 @@ struct vmm_vring_used {
 	struct vmm_vring_used_elem ring[];
 };
 
+/* Packed ring descriptors: 16 bytes. */
+struct vmm_vring_packed_desc {
+	/* Buffer Address. */
+	u64 addr;
+	/* Buffer Length. */
+	u32 len;
+	/* Buffer ID. */
+	u16 id;
+	/* The flags depending on descriptor type. */
+	u16 flags;
+};
+
+/* Packed ring event suppression structure: 4 bytes. */
+struct vmm_vring_packed_desc_event {
+	/* Descriptor Ring Change Event Offset/Wrap Counter. */
+	u16 off_wrap;
+	/* Descriptor Ring Change Event Flags. */
+	u16 flags;
+};
+
 struct vmm_vring {
 	unsigned int num;
 
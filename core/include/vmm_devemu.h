@@ -27,6 +27,7 @@
 #include <vmm_spinlocks.h>
 #include <vmm_devtree.h>
 #include <vmm_manager.h>
+#include <vmm_workqueue.h>
 
 struct vmm_emudev;
 struct vmm_emulator;
@@ -39,6 +40,41 @@ enum vmm_devemu_endianness {
 	VMM_DEVEMU_MAX_ENDIAN=4,
 };
 
+/** Number of access sizes (i.e. 8, 16, 32, and 64 bits) */
+#define VMM_DEVEMU_MAX_ACCESS		4
+
+/** Number of log2 buckets in access latency histogram */
+#define VMM_DEVEMU_STATS_HIST_SIZE	32
+
+/** Number of slots used for tracking hot offsets */
+#define VMM_DEVEMU_STATS_HOT_SIZE	16
+
+struct vmm_devemu_stats_hot {
+	physical_addr_t offset;
+	u64 count;
+};
+
+/** Access statistics of an emulated device
+ *  Note: Histogram bucket N counts accesses which took
+ *  [2^N, 2^(N+1)) nanoseconds in emulator (bucket 0 also
+ *  counts zero). Hot offsets are tracked approximately using
+ *  slots indexed by register number.
+ */
+struct vmm_devemu_stats {
+	u64 read_count[VMM_DEVEMU_MAX_ACCESS];
+	u64 write_count[VMM_DEVEMU_MAX_ACCESS];
+	u64 read_nsecs;
+	u64 write_nsecs;
+	u64 read_hist[VMM_DEVEMU_STATS_HIST_SIZE];
+	u64 write_hist[VMM_DEVEMU_STATS_HIST_SIZE];
+	struct vmm_devemu_stats_hot hot[VMM_DEVEMU_STATS_HOT_SIZE];
+};
+
+typedef int (*vmm_devemu_read_t)(struct vmm_emudev *edev,
+				 physical_addr_t offset, void *dst);
+typedef int (*vmm_devemu_write_t)(struct vmm_emudev *edev,
+				  physical_addr_t offset, void *src);
+
 struct vmm_emulator {
 	struct dlist head;
 	char name[VMM_FIELD_NAME_SIZE];
@@ -84,6 +120,9 @@ struct vmm_emulator {
 			     u32 regmask,
 			     u32 regval,
 			     u32 size);
+	int (*msi) (struct vmm_emudev *edev,
+		    physical_addr_t offset,
+		    u32 data);
 };
 
 int vmm_devemu_simple_read8(struct vmm_emudev *edev,
@@ -136,12 +175,66 @@ struct vmm_emudev {
 	struct dlist head;
 	vmm_rwlock_t child_list_lock;
 	struct dlist child_list;
+	/* Access handlers resolved at probe time for each
+	 * access size and guest endianness.
+	 */
+	vmm_devemu_read_t read_op[VMM_DEVEMU_MAX_ACCESS][VMM_DEVEMU_MAX_ENDIAN];
+	vmm_devemu_write_t write_op[VMM_DEVEMU_MAX_ACCESS][VMM_DEVEMU_MAX_ENDIAN];
+	vmm_rwlock_t doorbell_list_lock;
+	struct dlist doorbell_list;
+	vmm_rwlock_t coalesced_list_lock;
+	struct dlist coalesced_list;
 	void *priv;
 #ifdef CONFIG_DEVEMU_DEBUG
 	u32 debug_info;
 #endif
+#ifdef CONFIG_DEVEMU_STATS
+	/* Per-CPU access statistics indexed by host CPU number */
+	struct vmm_devemu_stats *stats;
+#endif
 };
 
+/** Doorbell flag to match written value against doorbell data */
+#define VMM_DEVEMU_DOORBELL_DATAMATCH	0x00000001
+
+/** Number of distinct values a doorbell without data match can latch */
+#define VMM_DEVEMU_DOORBELL_MAX_VALUE	64
+
+/** Doorbell (write-only notify register) of an emulated device
+ *
+ * A write to offset with given size (and value if DATAMATCH flag is
+ * set) is acknowledged immediately and the ring() callback is invoked
+ * later from a shared per-CPU work queue instead of VCPU context.
+ * Writes of the same value which arrive before ring() is invoked are
+ * coalesced. The ring() callback must not sleep.
+ */
+struct vmm_devemu_doorbell {
+	struct dlist head;
+	struct vmm_emudev *edev;
+	physical_addr_t offset;
+	u32 size;
+	u32 flags;
+	u64 data;
+	struct vmm_workqueue *wq;
+	struct vmm_work work;
+	vmm_spinlock_t ring_lock;
+	vmm_spinlock_t pending_lock;
+	u64 pending;
+	void (*ring) (struct vmm_devemu_doorbell *db, u64 val);
+	void *priv;
+};
+
+/** Coalesced range flag to append writes to per-guest ring */
+#define VMM_DEVEMU_COALESCED_WRITE		0x00000001
+/** Coalesced range flag to not apply pending writes before reads */
+#define VMM_DEVEMU_COALESCED_READ_NOFLUSH	0x00000002
+
+/** Max number of pending coalesced writes of a guest */
+#define VMM_DEVEMU_COALESCED_RING_SIZE		256
+
+/** Max time for which coalesced writes stay pending */
+#define VMM_DEVEMU_COALESCED_DRAIN_NSECS	1000000ULL
+
 struct vmm_devemu_irqchip {
 	const char *name;
 	void (*handle) (u32 irq, int cpu, int level, void *opaque);
@@ -209,6 +302,19 @@ extern int __vmm_devemu_emulate_irq2(struct vmm_guest *guest, u32 irq,
 #define vmm_devemu_emulate_percpu_irq2(guest, irq, cpu, level0, level1)	\
 		__vmm_devemu_emulate_irq2(guest, irq, cpu, level0, level1)
 
+/** Emulate message signaled interrupt for guest by passing MSI data
+ *  to the msi() callback of emulated interrupt controller owning the
+ *  MSI doorbell address
+ *  Note: This will only work after guest is created.
+ */
+int vmm_devemu_emulate_msi(struct vmm_guest *guest,
+			   physical_addr_t addr, u32 data);
+
+/** Check whether guest has an emulated interrupt controller which
+ *  can receive MSIs (only covers emulators probed so far)
+ */
+bool vmm_devemu_msi_capable(struct vmm_guest *guest);
+
 /** Map host irq to guest irq for guest
  *  Note: This will only work after guest is created.
  */
@@ -258,6 +364,68 @@ struct vmm_emulator *vmm_devemu_emulator(int index);
 /** Count available emulators */
 u32 vmm_devemu_emulator_count(void);
 
+/** Register doorbell for given emulated device
+ *  Note: ring() callbacks of a doorbell are serialized and run on
+ *  doorbell work queue of one host CPU.
+ */
+int vmm_devemu_register_doorbell(struct vmm_emudev *edev,
+				 struct vmm_devemu_doorbell *db,
+				 physical_addr_t offset, u32 size,
+				 u32 flags, u64 data,
+				 void (*ring) (struct vmm_devemu_doorbell *,
+					       u64),
+				 void *priv);
+
+/** Wait for in-progress ring() callback of given doorbell to finish
+ *  and drop pending doorbell writes
+ *  Note: this does not sleep so it can be called from VCPU context.
+ */
+void vmm_devemu_flush_doorbell(struct vmm_devemu_doorbell *db);
+
+/** Unregister doorbell of given emulated device
+ *  Note: this flushes the doorbell after unregistering it.
+ */
+int vmm_devemu_unregister_doorbell(struct vmm_emudev *edev,
+				   struct vmm_devemu_doorbell *db);
+
+/** Register coalesced range for given emulated device
+ *  Note: Writes to range with VMM_DEVEMU_COALESCED_WRITE flag are
+ *  acknowledged immediately and applied later in batches. Pending
+ *  writes of a guest are applied when ring is full, after
+ *  VMM_DEVEMU_COALESCED_DRAIN_NSECS, before any other access to an
+ *  emulated device having coalesced ranges (except reads of range
+ *  with VMM_DEVEMU_COALESCED_READ_NOFLUSH flag), or upon explicit
+ *  flush. Only registers whose writes need not take effect
+ *  immediately should be coalesced.
+ */
+int vmm_devemu_register_coalesced(struct vmm_emudev *edev,
+				  physical_addr_t offset,
+				  physical_size_t size, u32 flags);
+
+/** Unregister coalesced range of given emulated device */
+int vmm_devemu_unregister_coalesced(struct vmm_emudev *edev,
+				    physical_addr_t offset,
+				    physical_size_t size);
+
+/** Apply pending coalesced writes of given guest */
+int vmm_devemu_flush_coalesced(struct vmm_guest *guest);
+
+/** Iterate over each emulated device of a guest including children */
+void vmm_devemu_iterate_emudev(struct vmm_guest *guest,
+			void (*func)(struct vmm_emudev *edev, void *priv),
+			void *priv);
+
+#ifdef CONFIG_DEVEMU_STATS
+
+/** Get access statistics of emulated device summed over all CPUs */
+int vmm_devemu_stats_get(struct vmm_emudev *edev,
+			 struct vmm_devemu_stats *stats);
+
+/** Reset access statistics of emulated device */
+int vmm_devemu_stats_reset(struct vmm_emudev *edev);
+
+#endif
+
 /** Sync children of given emulated device */
 int vmm_devemu_sync_children(struct vmm_guest *guest,
 			     struct vmm_emudev *edev,
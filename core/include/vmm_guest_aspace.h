@@ -106,6 +106,24 @@ int vmm_guest_physical_unmap(struct vmm_guest *guest,
 			     physical_addr_t gphys_addr,
 			     physical_size_t phys_size);
 
+/** Map guest physical address to some host physical address and
+ *  pin the underlying guest region so that it cannot be deleted
+ *  until vmm_guest_physical_unpin() is called for returned region.
+ *  If guest address space is destroyed meanwhile then the region
+ *  and its host memory are only freed after last unpin.
+ */
+int vmm_guest_physical_pin(struct vmm_guest *guest,
+			   physical_addr_t gphys_addr,
+			   physical_size_t gphys_size,
+			   physical_addr_t *hphys_addr,
+			   physical_size_t *phys_size,
+			   u32 *reg_flags,
+			   struct vmm_region **pinned_reg);
+
+/** Unpin guest region pinned by vmm_guest_physical_pin() */
+void vmm_guest_physical_unpin(struct vmm_guest *guest,
+			      struct vmm_region *reg);
+
 /** Add a new region from a given node in DTS */
 int vmm_guest_add_region_from_node(struct vmm_guest *guest,
 				   struct vmm_devtree_node *node,
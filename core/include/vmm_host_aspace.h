@@ -180,6 +180,16 @@ u32 vmm_host_memory_read(physical_addr_t hpa,
 u32 vmm_host_memory_write(physical_addr_t hpa,
 			  void *src, u32 len, bool cacheable);
 
+/** Map host memory one page at a time and pass each mapped chunk
+ *  to fn(), which returns the number of bytes it consumed. Returns
+ *  the total bytes consumed. fn() is called with irqs disabled and
+ *  may use vmm_host_memory_read/write but must not sleep.
+ *  Note: We assume non-IO (or non-device) physical address
+ */
+u32 vmm_host_memory_map_read(physical_addr_t hpa, u32 len, bool cacheable,
+			     u32 (*fn)(void *src, u32 len, void *priv),
+			     void *priv);
+
 /** Write a byte pattern to host memory
  *  Note: We assume non-IO (or non-device) physical address
  */
@@ -90,6 +90,7 @@ struct vmm_region {
 	u32 map_order;
 	u32 maps_count;
 	struct vmm_region_mapping *maps;
+	atomic_t pin_count;
 	void *devemu_priv;
 	void *priv;
 };
@@ -29,6 +29,7 @@ vmm_netcore-y += vmm_netswitch.o
 vmm_netcore-y += vmm_netport.o
 vmm_netcore-y += vmm_hub.o
 vmm_netcore-y += vmm_bridge.o
+vmm_netcore-$(CONFIG_NET_PKTGEN) += vmm_pktgen.o
 
 %/vmm_netcore.o: $(foreach obj,$(vmm_netcore-y),%/$(obj))
 	$(call merge_objs,$@,$^)
@@ -23,12 +23,17 @@
 
 #include <vmm_error.h>
 #include <vmm_heap.h>
+#include <vmm_smp.h>
 #include <vmm_stdio.h>
 #include <vmm_timer.h>
+#include <vmm_spinlocks.h>
+#include <vmm_chardev.h>
+#include <arch_barrier.h>
 #include <net/vmm_protocol.h>
 #include <net/vmm_mbuf.h>
 #include <net/vmm_netswitch.h>
 #include <net/vmm_netport.h>
+#include <libs/list.h>
 #include <libs/stringlib.h>
 
 #undef DEBUG_BRIDGE
@@ -40,144 +45,382 @@
 #define DPRINTF(fmt, ...) do {} while(0)
 #endif
 
-#define BRIDGE_MAC_TABLE_SZ	32
+#define BRIDGE_MAC_BUCKET_WAYS	4
+#define BRIDGE_MAC_MIN_BUCKETS	16
+#define BRIDGE_MAC_MAX_BUCKETS	1024
 #define BRIDGE_MAC_EXPIRY	30000000000LLU
+#define BRIDGE_MAC_AGEING	(BRIDGE_MAC_EXPIRY / 10)
 
-/* We maintain a table of learned mac addresses
+/* We maintain a hash table of learned (mac, vlan) addresses
  * (please note that the mac of the immediate netports are not
- * kept in this table) */
+ * kept in this table). Each bucket has BRIDGE_MAC_BUCKET_WAYS
+ * entries and the table doubles whenever a bucket overflows
+ * until BRIDGE_MAC_MAX_BUCKETS after which oldest entry of the
+ * bucket is replaced.
+ *
+ * Lookups on forwarding path are lock-free and only validated
+ * using mac_seq sequence counter which is odd while an update
+ * is in progress. Updates are serialized using mac_lock.
+ */
 struct bridge_mac_entry {
 	struct vmm_netport *port;
-	u8 macaddr[6];
 	u64 timestamp;
+	u8 macaddr[6];
+	u16 vlan;
+	u8 active;
+};
+
+struct bridge_mac_table {
+	struct dlist head;
+	u32 nr_buckets;
+	u32 count;
+	struct bridge_mac_entry ent[];
+};
+
+struct bridge_mac_stats {
+	u64 lookups;
+	u64 hits;
+	u64 floods;
+	u64 learned;
+	u64 moved;
+	u64 aged;
+	u64 evicted;
+	u64 resizes;
 };
 
 struct bridge_ctrl {
 	struct vmm_netswitch *nsw;
 	struct vmm_timer_event ev;
-	vmm_rwlock_t mac_table_lock;
-	u32 mac_table_sz;
-	struct bridge_mac_entry *mac_table;
+	vmm_spinlock_t mac_lock;
+	u32 mac_seq;
+	struct bridge_mac_table *mac_table;
+	/* Replaced tables are only freed upon bridge destroy because
+	 * lock-free readers might still be walking them. As the table
+	 * only grows, this is less than the size of current table.
+	 */
+	struct dlist mac_retired;
+	struct bridge_mac_stats *stats;
 };
 
-static void bridge_mactable_cleanup_port(struct bridge_ctrl *br,
-					 struct vmm_netport *port)
+#define bridge_stats(br)	(&(br)->stats[vmm_smp_processor_id()])
+
+static inline u32 bridge_mac_hash(const u8 *mac, u16 vlan, u32 nr_buckets)
 {
-	u32 m;
-	irq_flags_t f;
+	u32 h;
+
+	h = ((u32)mac[2] << 24) | ((u32)mac[3] << 16) |
+	    ((u32)mac[4] << 8) | (u32)mac[5];
+	h ^= (((u32)mac[0] << 8) | (u32)mac[1] | ((u32)vlan << 16)) *
+								0x9E3779B1;
+	h *= 0x9E3779B1;
+
+	return (h >> 16) & (nr_buckets - 1);
+}
+
+static struct bridge_mac_table *bridge_mactable_alloc(u32 nr_buckets)
+{
+	struct bridge_mac_table *t;
+
+	t = vmm_zalloc(sizeof(*t) + sizeof(struct bridge_mac_entry) *
+					nr_buckets * BRIDGE_MAC_BUCKET_WAYS);
+	if (!t) {
+		return NULL;
+	}
+
+	INIT_LIST_HEAD(&t->head);
+	t->nr_buckets = nr_buckets;
+
+	return t;
+}
+
+static inline struct bridge_mac_entry *bridge_mactable_bucket(
+					struct bridge_mac_table *t,
+					const u8 *mac, u16 vlan)
+{
+	return &t->ent[bridge_mac_hash(mac, vlan, t->nr_buckets) *
+		       BRIDGE_MAC_BUCKET_WAYS];
+}
+
+static struct bridge_mac_entry *bridge_mactable_find(
+					struct bridge_mac_table *t,
+					const u8 *mac, u16 vlan)
+{
+	u32 i;
+	struct bridge_mac_entry *m = bridge_mactable_bucket(t, mac, vlan);
 
-	vmm_write_lock_irqsave_lite(&br->mac_table_lock, f);
-	for (m = 0; m < br->mac_table_sz; m++) {
-		if (br->mac_table[m].port == port) {
-			br->mac_table[m].port = NULL;
+	for (i = 0; i < BRIDGE_MAC_BUCKET_WAYS; i++, m++) {
+		if (m->port && (m->vlan == vlan) &&
+		    !compare_ether_addr(m->macaddr, mac)) {
+			return m;
 		}
 	}
-	vmm_write_unlock_irqrestore_lite(&br->mac_table_lock, f);
+
+	return NULL;
 }
 
-static struct vmm_netport *bridge_mactable_learn_find(struct bridge_ctrl *br,
-						      const u8 *dstmac,
-						      const u8 *srcmac,
-						      struct vmm_netport *src)
+static inline u32 bridge_mac_read_begin(struct bridge_ctrl *br)
+{
+	u32 seq;
+
+	while ((seq = *(volatile u32 *)&br->mac_seq) & 0x1) ;
+	arch_smp_rmb();
+
+	return seq;
+}
+
+static inline bool bridge_mac_read_retry(struct bridge_ctrl *br, u32 seq)
+{
+	arch_smp_rmb();
+
+	return (*(volatile u32 *)&br->mac_seq != seq) ? TRUE : FALSE;
+}
+
+/* Note: Must be called with mac_lock held */
+static inline void bridge_mac_write_begin(struct bridge_ctrl *br)
+{
+	br->mac_seq++;
+	arch_smp_wmb();
+}
+
+/* Note: Must be called with mac_lock held */
+static inline void bridge_mac_write_end(struct bridge_ctrl *br)
+{
+	arch_smp_wmb();
+	br->mac_seq++;
+}
+
+/* Note: Must be called with mac_lock held and write in progress */
+static void bridge_mactable_fill(struct bridge_mac_entry *m,
+				 const u8 *mac, u16 vlan,
+				 struct vmm_netport *port, u64 tstamp)
+{
+	memcpy(m->macaddr, mac, 6);
+	m->vlan = vlan;
+	m->timestamp = tstamp;
+	m->active = 0;
+	m->port = port;
+}
+
+/* Note: Must be called with mac_lock held */
+static struct bridge_mac_entry *bridge_mactable_free_entry(
+					struct bridge_mac_table *t,
+					const u8 *mac, u16 vlan)
+{
+	u32 i;
+	struct bridge_mac_entry *m = bridge_mactable_bucket(t, mac, vlan);
+
+	for (i = 0; i < BRIDGE_MAC_BUCKET_WAYS; i++, m++) {
+		if (!m->port) {
+			return m;
+		}
+	}
+
+	return NULL;
+}
+
+/* Note: Must be called with mac_lock held and write in progress */
+static void bridge_mactable_rehash(struct bridge_ctrl *br,
+				   struct bridge_mac_table *t,
+				   struct bridge_mac_table *nt)
+{
+	u32 i;
+	struct bridge_mac_entry *m, *nm;
+
+	for (i = 0; i < (t->nr_buckets * BRIDGE_MAC_BUCKET_WAYS); i++) {
+		m = &t->ent[i];
+		if (!m->port) {
+			continue;
+		}
+		nm = bridge_mactable_free_entry(nt, m->macaddr, m->vlan);
+		if (!nm) {
+			bridge_stats(br)->evicted++;
+			continue;
+		}
+		*nm = *m;
+		nt->count++;
+	}
+
+	br->mac_table = nt;
+	list_add_tail(&t->head, &br->mac_retired);
+	bridge_stats(br)->resizes++;
+}
+
+static void bridge_mactable_learn(struct bridge_ctrl *br,
+				  const u8 *mac, u16 vlan,
+				  struct vmm_netport *port)
 {
 	u32 i;
 	u64 tstamp;
 	irq_flags_t f;
-	bool learn, update, found;
-	struct vmm_netport *dst;
+	bool changed = FALSE;
+	struct bridge_mac_table *t, *nt = NULL;
 	struct bridge_mac_entry *m;
 
-	/* Acquire read lock */
-	vmm_read_lock_irqsave_lite(&br->mac_table_lock, f);
+	/* Retrive current timestamp */
+	tstamp = vmm_timer_timestamp();
+
+again:
+	vmm_spin_lock_irqsave_lite(&br->mac_lock, f);
+
+	t = br->mac_table;
 
-	/* Check for for dstmac and whether we need
-	 * to Learn (srcmac, src) mapping ??
+	/* If mac entry already exist then
+	 * update only port and timestamp
 	 */
-	learn = TRUE;
-	dst = NULL;
-	for (i = 0; i < br->mac_table_sz; i++) {
-		m = &br->mac_table[i];
-		/* If mac table entry is unused then continue */
-		if (!m->port) {
-			continue;
+	m = bridge_mactable_find(t, mac, vlan);
+	if (m) {
+		if (m->port != port) {
+			bridge_mac_write_begin(br);
+			m->port = port;
+			bridge_mac_write_end(br);
+			bridge_stats(br)->moved++;
+			changed = TRUE;
 		}
-		/* Match (srcmac, srcport) */
-		if (learn &&
-		    !compare_ether_addr(m->macaddr, srcmac) &&
-		    (m->port == src)) {
-			learn = FALSE;
+		m->timestamp = tstamp;
+		goto done;
+	}
+
+	/* If bucket is full then try to grow the table */
+	m = bridge_mactable_free_entry(t, mac, vlan);
+	if (!m && (t->nr_buckets < BRIDGE_MAC_MAX_BUCKETS)) {
+		if (!nt || (nt->nr_buckets != (t->nr_buckets * 2))) {
+			vmm_spin_unlock_irqrestore_lite(&br->mac_lock, f);
+			if (nt) {
+				vmm_free(nt);
+			}
+			nt = bridge_mactable_alloc(t->nr_buckets * 2);
+			if (nt) {
+				goto again;
+			}
+			vmm_spin_lock_irqsave_lite(&br->mac_lock, f);
+			t = br->mac_table;
+		} else {
+			bridge_mac_write_begin(br);
+			bridge_mactable_rehash(br, t, nt);
+			bridge_mac_write_end(br);
+			t = nt;
+			nt = NULL;
 		}
-		/* Match (dstmac) */
-		if (!dst &&
-		    !compare_ether_addr(m->macaddr, dstmac)) {
-			dst = m->port;
+		m = bridge_mactable_free_entry(t, mac, vlan);
+	}
+
+	/* If bucket is still full then replace oldest entry */
+	if (!m) {
+		m = bridge_mactable_bucket(t, mac, vlan);
+		for (i = 1; i < BRIDGE_MAC_BUCKET_WAYS; i++) {
+			if (m[i].port && (m[i].timestamp < m->timestamp)) {
+				m = &m[i];
+			}
 		}
-		/* If no need to learn and found
-		 * destination port then break
-		 */
-		if (!learn && dst) {
-			break;
+		if (m->port) {
+			t->count--;
+			bridge_stats(br)->evicted++;
 		}
 	}
 
-	/* Release read lock */
-	vmm_read_unlock_irqrestore_lite(&br->mac_table_lock, f);
-
-	/* If leaning required then update mac table */
-	if (learn) {
-		/* Retrive current timestamp */
-		tstamp = vmm_timer_timestamp();
-
-		/* Acquire write lock */
-		vmm_write_lock_irqsave_lite(&br->mac_table_lock, f);
-
-		/* If mac entry already exist then
-		 * update only port and timestamp
-		 */
-		update = TRUE;
-		for (i = 0; i < br->mac_table_sz; i++) {
-			m = &br->mac_table[i];
-			if (!compare_ether_addr(m->macaddr, srcmac)) {
-				m->port = src;
-				m->timestamp = tstamp;
-				update = FALSE;
-				break;
-			}
+	bridge_mac_write_begin(br);
+	bridge_mactable_fill(m, mac, vlan, port, tstamp);
+	bridge_mac_write_end(br);
+	t->count++;
+	bridge_stats(br)->learned++;
+	changed = TRUE;
+
+done:
+	vmm_spin_unlock_irqrestore_lite(&br->mac_lock, f);
+
+	if (nt) {
+		vmm_free(nt);
+	}
+
+	/* Flows cached by netswitch might now go elsewhere */
+	if (changed) {
+		vmm_netswitch_flow_flush(br->nsw);
+	}
+}
+
+static void bridge_mactable_cleanup_port(struct bridge_ctrl *br,
+					 struct vmm_netport *port)
+{
+	u32 i;
+	irq_flags_t f;
+	struct bridge_mac_table *t;
+
+	vmm_spin_lock_irqsave_lite(&br->mac_lock, f);
+
+	t = br->mac_table;
+	bridge_mac_write_begin(br);
+	for (i = 0; i < (t->nr_buckets * BRIDGE_MAC_BUCKET_WAYS); i++) {
+		if (t->ent[i].port == port) {
+			t->ent[i].port = NULL;
+			t->count--;
 		}
+	}
+	bridge_mac_write_end(br);
 
-		/* If mac entry does not exist then
-		 * save (mac, port, timestamp) in a
-		 * free mac table entry.
-		 */
-		if (update) {
-			found = FALSE;
-			for (i = 0; i < br->mac_table_sz; i++) {
-				m = &br->mac_table[i];
-				if (m->port == NULL) {
-					found = TRUE;
-					break;
-				}
-			}
-			if (found) {
-				m->port = src;
-				memcpy(m->macaddr, srcmac, 6);
-				m->timestamp = tstamp;
-			}
+	vmm_spin_unlock_irqrestore_lite(&br->mac_lock, f);
+}
+
+/* Learn (srcmac, src) mapping or mark existing one as active */
+static void bridge_mactable_refresh(struct bridge_ctrl *br,
+				    const u8 *srcmac, u16 vlan,
+				    struct vmm_netport *src)
+{
+	u32 seq;
+	bool learn;
+	struct bridge_mac_entry *m;
+
+	do {
+		seq = bridge_mac_read_begin(br);
+		m = bridge_mactable_find(br->mac_table, srcmac, vlan);
+		learn = (!m || (m->port != src)) ? TRUE : FALSE;
+	} while (bridge_mac_read_retry(br, seq));
+
+	/* Mark entry active so that ageing refreshes it */
+	if (!learn) {
+		if (!m->active) {
+			m->active = 1;
 		}
+	} else {
+		bridge_mactable_learn(br, srcmac, vlan, src);
+	}
+}
 
-		/* Release write lock */
-		vmm_write_unlock_irqrestore_lite(&br->mac_table_lock, f);
+static struct vmm_netport *bridge_mactable_learn_find(struct bridge_ctrl *br,
+						      const u8 *dstmac,
+						      const u8 *srcmac,
+						      u16 vlan,
+						      struct vmm_netport *src)
+{
+	u32 seq;
+	struct vmm_netport *dst;
+	struct bridge_mac_entry *m;
+	struct bridge_mac_stats *st = bridge_stats(br);
+
+	/* Lock-free lookup of dstmac */
+	do {
+		seq = bridge_mac_read_begin(br);
+		m = bridge_mactable_find(br->mac_table, dstmac, vlan);
+		dst = (m) ? m->port : NULL;
+	} while (bridge_mac_read_retry(br, seq));
+
+	st->lookups++;
+	if (dst) {
+		st->hits++;
 	}
 
+	/* Learn (srcmac, src) mapping if we need to */
+	bridge_mactable_refresh(br, srcmac, vlan, src);
+
 	return dst;
 }
 
 static void bridge_timer_event(struct vmm_timer_event *ev)
 {
-	u32 i;
+	u32 i, aged = 0;
 	u64 tstamp;
 	irq_flags_t f;
 	struct bridge_ctrl *br = ev->priv;
+	struct bridge_mac_table *t;
 	struct bridge_mac_entry *m;
 
 	DPRINTF("%s: bridge expiry event nsw=%s\n",
@@ -186,27 +429,87 @@ static void bridge_timer_event(struct vmm_timer_event *ev)
 	/* Retrive current timestamp */
 	tstamp = vmm_timer_timestamp();
 
-	/* Acquire write lock */
-	vmm_write_lock_irqsave_lite(&br->mac_table_lock, f);
+	vmm_spin_lock_irqsave_lite(&br->mac_lock, f);
 
-	/* Purge old enteries */
-	for (i = 0; i < br->mac_table_sz; i++) {
-		m = &br->mac_table[i];
-		if (m->port &&
-		    ((m->timestamp - tstamp) > BRIDGE_MAC_EXPIRY)) {
+	/* Refresh active enteries and purge old enteries */
+	t = br->mac_table;
+	for (i = 0; i < (t->nr_buckets * BRIDGE_MAC_BUCKET_WAYS); i++) {
+		m = &t->ent[i];
+		if (!m->port) {
+			continue;
+		}
+		if (m->active) {
+			m->active = 0;
+			m->timestamp = tstamp;
+		} else if ((tstamp - m->timestamp) > BRIDGE_MAC_EXPIRY) {
 			DPRINTF("%s: purge port=%s\n",
 				__func__, m->port->name);
+			bridge_mac_write_begin(br);
 			m->port = NULL;
-			memset(m->macaddr, 0, 6);
-			m->timestamp = 0;
+			bridge_mac_write_end(br);
+			t->count--;
+			bridge_stats(br)->aged++;
+			aged++;
 		}
 	}
 
-	/* Release write lock */
-	vmm_write_unlock_irqrestore_lite(&br->mac_table_lock, f);
+	vmm_spin_unlock_irqrestore_lite(&br->mac_lock, f);
+
+	if (aged) {
+		vmm_netswitch_flow_flush(br->nsw);
+	}
 
 	/* Again start the bridge timer event */
-	vmm_timer_event_start(&br->ev, BRIDGE_MAC_EXPIRY);
+	vmm_timer_event_start(&br->ev, BRIDGE_MAC_AGEING);
+}
+
+static void bridge_dump(struct vmm_netswitch *nsw, struct vmm_chardev *cdev)
+{
+	u32 c, nr_buckets, count;
+	irq_flags_t f;
+	struct bridge_mac_stats st, *cst;
+	struct bridge_ctrl *br = nsw->priv;
+
+	memset(&st, 0, sizeof(st));
+	for (c = 0; c < CONFIG_CPU_COUNT; c++) {
+		cst = &br->stats[c];
+		st.lookups += cst->lookups;
+		st.hits += cst->hits;
+		st.learned += cst->learned;
+		st.moved += cst->moved;
+		st.aged += cst->aged;
+		st.evicted += cst->evicted;
+		st.resizes += cst->resizes;
+	}
+	st.floods = st.lookups - st.hits;
+
+	vmm_spin_lock_irqsave_lite(&br->mac_lock, f);
+	nr_buckets = br->mac_table->nr_buckets;
+	count = br->mac_table->count;
+	vmm_spin_unlock_irqrestore_lite(&br->mac_lock, f);
+
+	vmm_cprintf(cdev, "MAC table : %d entries in %d buckets x %d ways\n",
+		    count, nr_buckets, BRIDGE_MAC_BUCKET_WAYS);
+	vmm_cprintf(cdev, "Lookups   : %"PRIu64"\n", st.lookups);
+	vmm_cprintf(cdev, "Hits      : %"PRIu64"\n", st.hits);
+	vmm_cprintf(cdev, "Floods    : %"PRIu64"\n", st.floods);
+	vmm_cprintf(cdev, "Learned   : %"PRIu64"\n", st.learned);
+	vmm_cprintf(cdev, "Moved     : %"PRIu64"\n", st.moved);
+	vmm_cprintf(cdev, "Aged      : %"PRIu64"\n", st.aged);
+	vmm_cprintf(cdev, "Evicted   : %"PRIu64"\n", st.evicted);
+	vmm_cprintf(cdev, "Resizes   : %"PRIu64"\n", st.resizes);
+}
+
+/* VLAN id of 802.1Q tagged frame (or zero for untagged frame) */
+static inline u16 bridge_frame_vlan(struct vmm_mbuf *mbuf)
+{
+	const u8 *buf = mtod(mbuf, const u8 *);
+
+	if ((mbuf->m_len >= 16) && (buf[12] == 0x81) && (buf[13] == 0x00)) {
+		return (((u16)buf[14] << 8) | buf[15]) & 0xFFF;
+	}
+
+	return 0;
 }
 
 /**
@@ -231,7 +534,8 @@ static int bridge_rx_handler(struct vmm_netswitch *nsw,
 	/* Learn source mac address and find port
 	 * matching destination mac address
 	 */
-	dst = bridge_mactable_learn_find(br, dstmac, srcmac, src);
+	dst = bridge_mactable_learn_find(br, dstmac, srcmac,
+					 bridge_frame_vlan(mbuf), src);
 
 	/* If the frame below cases then it should be unicast.
 	 *
@@ -246,6 +550,8 @@ static int bridge_rx_handler(struct vmm_netswitch *nsw,
 	/* Transfer mbuf to appropriate ports */
 	if (broadcast) {
 		DPRINTF("%s: broadcasting\n", __func__);
+		/* Flooding must stop once destination is learned */
+		vmm_netswitch_flow_nocache(nsw);
 		vmm_read_lock_irqsave_lite(&nsw->port_list_lock, f);
 		list_for_each_safe(l, l1, &nsw->port_list) {
 			port = list_port(l);
@@ -265,6 +571,15 @@ static int bridge_rx_handler(struct vmm_netswitch *nsw,
 	return VMM_OK;
 }
 
+/* Packet forwarded by netswitch flow cache bypassed bridge_rx_handler */
+static void bridge_flow_hit(struct vmm_netswitch *nsw,
+			    struct vmm_netport *src,
+			    struct vmm_mbuf *mbuf)
+{
+	bridge_mactable_refresh(nsw->priv, ether_srcmac(mtod(mbuf, u8 *)),
+				bridge_frame_vlan(mbuf), src);
+}
+
 static int bridge_port_add(struct vmm_netswitch *nsw,
 			   struct vmm_netport *port)
 {
@@ -298,6 +613,8 @@ static struct vmm_netswitch *bridge_create(
 	nsw->port2switch_xfer = bridge_rx_handler;
 	nsw->port_add = bridge_port_add;
 	nsw->port_remove = bridge_port_remove;
+	nsw->dump = bridge_dump;
+	nsw->flow_hit = bridge_flow_hit;
 
 	br = vmm_zalloc(sizeof(struct bridge_ctrl));
 	if (!br) {
@@ -306,24 +623,32 @@ static struct vmm_netswitch *bridge_create(
 
 	br->nsw = nsw;
 	INIT_TIMER_EVENT(&br->ev, bridge_timer_event, br);
-	INIT_RW_LOCK(&br->mac_table_lock);
-	br->mac_table_sz = BRIDGE_MAC_TABLE_SZ;
-	br->mac_table = vmm_zalloc(sizeof(struct bridge_mac_entry) *
-				   br->mac_table_sz);
+	INIT_SPIN_LOCK(&br->mac_lock);
+	br->mac_seq = 0;
+	INIT_LIST_HEAD(&br->mac_retired);
+	br->mac_table = bridge_mactable_alloc(BRIDGE_MAC_MIN_BUCKETS);
 	if (!br->mac_table) {
 		goto bridge_alloc_mac_table_fail;
 	}
 
+	br->stats = vmm_zalloc(sizeof(struct bridge_mac_stats) *
+			       CONFIG_CPU_COUNT);
+	if (!br->stats) {
+		goto bridge_alloc_stats_fail;
+	}
+
 	rc = vmm_netswitch_register(nsw, NULL, br);
 	if (rc) {
 		goto bridge_netswitch_register_fail;
 	}
 
-	vmm_timer_event_start(&br->ev, BRIDGE_MAC_EXPIRY);
+	vmm_timer_event_start(&br->ev, BRIDGE_MAC_AGEING);
 
 	return nsw;
 
 bridge_netswitch_register_fail:
+	vmm_free(br->stats);
+bridge_alloc_stats_fail:
 	vmm_free(br->mac_table);
 bridge_alloc_mac_table_fail:
 	vmm_free(br);
@@ -337,6 +662,7 @@ static void bridge_destroy(struct vmm_netswitch_policy *policy,
 			   struct vmm_netswitch *nsw)
 {
 	struct bridge_ctrl *br;
+	struct bridge_mac_table *t, *nt;
 
 	if (!nsw || !nsw->priv) {
 		return;
@@ -347,7 +673,12 @@ static void bridge_destroy(struct vmm_netswitch_policy *policy,
 
 	vmm_netswitch_unregister(nsw);
 
+	list_for_each_entry_safe(t, nt, &br->mac_retired, head) {
+		list_del(&t->head);
+		vmm_free(t);
+	}
 	vmm_free(br->mac_table);
+	vmm_free(br->stats);
 	vmm_free(br);
 
 	vmm_netswitch_free(nsw);
@@ -89,27 +89,63 @@
 #include <vmm_types.h>
 #include <vmm_stdio.h>
 #include <vmm_heap.h>
+#include <vmm_smp.h>
+#include <vmm_percpu.h>
 #include <vmm_host_aspace.h>
 #include <vmm_modules.h>
+#include <arch_cpu_irq.h>
 #include <net/vmm_mbuf.h>
 #include <libs/list.h>
 #include <libs/stringlib.h>
+#include <libs/checksum.h>
 #include <libs/mathlib.h>
 #include <libs/mempool.h>
 
 
 /*
  * Mbuffer pool.
+ *
+ * Mbuf headers and external buffers come from global mempools
+ * (index 0 is mbuf headers and remaining are ext slabs). Each host
+ * CPU keeps a small cache of free entities for every mempool which
+ * is refilled from and drained to the global mempool in batches so
+ * that allocation and free on forwarding path remain CPU-local.
  */
 
-#define EPOOL_SLAB_COUNT		4
+#define EPOOL_SLAB_COUNT		5
+#define EPOOL_JUMBO_SLAB		(EPOOL_SLAB_COUNT - 1)
+#define MBUFPOOL_COUNT			(1 + EPOOL_SLAB_COUNT)
+#define MBUFPOOL_CACHE_SIZE		64
+
+struct vmm_mbufpool {
+	struct mempool *mp;
+	u32 buf_size;
+	u32 cache_max;
+	u32 cache_batch;
+};
+
+struct vmm_mbufpool_cache {
+	u32 count;
+	void *objs[MBUFPOOL_CACHE_SIZE];
+	u64 hits;
+	u64 refills;
+	u64 drains;
+	u64 exhausted;
+};
+
+struct vmm_mbufpool_percpu {
+	struct vmm_mbufpool_cache cache[MBUFPOOL_COUNT];
+};
 
 struct vmm_mbufpool_ctrl {
-	struct mempool *mpool;
-	struct mempool *epool_slabs[EPOOL_SLAB_COUNT];
+	struct vmm_mbufpool pools[MBUFPOOL_COUNT];
 };
 
 static struct vmm_mbufpool_ctrl mbpctrl;
+static DEFINE_PER_CPU(struct vmm_mbufpool_percpu, mbpcache);
+
+#define mbpctrl_mpool		(&mbpctrl.pools[0])
+#define mbpctrl_epool(slab)	(&mbpctrl.pools[1 + (slab)])
 
 static u32 epool_slab_buf_size(u32 slab)
 {
@@ -122,6 +158,8 @@ static u32 epool_slab_buf_size(u32 slab)
 		return 1536;
 	case 3:
 		return 2048;
+	case 4:
+		return 65536;
 	default:
 		break;
 	};
@@ -133,6 +171,12 @@ static u32 epool_slab_buf_count(u32 pool_sz, u32 slab)
 {
 	u32 slab_size, buf_size, weight, total_weight;
 
+	/* Jumbo slab for GSO packets is sized separately */
+	if (slab == EPOOL_JUMBO_SLAB) {
+		return udiv32(CONFIG_NET_MBUF_EXT_JUMBO_POOL_SIZE_KB * 1024,
+			      epool_slab_buf_size(slab));
+	}
+
 	switch (slab) {
 	case 0:
 		weight = 1;
@@ -164,6 +208,115 @@ static u32 epool_slab_buf_count(u32 pool_sz, u32 slab)
 	return udiv32(slab_size, buf_size);
 }
 
+static void mbufpool_setup(struct vmm_mbufpool *p, u32 b_size, u32 b_count)
+{
+	p->buf_size = b_size;
+	p->mp = mempool_ram_create(b_size,
+				   VMM_SIZE_TO_PAGE(b_size * b_count),
+				   VMM_PAGEPOOL_NORMAL);
+	if (!p->mp) {
+		return;
+	}
+
+	/* Let per-CPU caches hold at most quarter of the mempool */
+	p->cache_max = udiv32(b_count, 4 * vmm_num_possible_cpus());
+	if (p->cache_max >= MBUFPOOL_CACHE_SIZE) {
+		p->cache_max = MBUFPOOL_CACHE_SIZE - 1;
+	}
+	p->cache_batch = (p->cache_max / 2) ? (p->cache_max / 2) : 1;
+}
+
+static void *mbufpool_alloc(struct vmm_mbufpool *p)
+{
+	void *obj = NULL;
+	irq_flags_t flags;
+	struct vmm_mbufpool_cache *c;
+
+	if (!p->mp) {
+		return NULL;
+	}
+
+	arch_cpu_irq_save(flags);
+
+	c = &this_cpu(mbpcache).cache[p - mbpctrl.pools];
+	if (!c->count) {
+		c->count = mempool_malloc_bulk(p->mp, c->objs,
+					       p->cache_batch);
+		if (c->count) {
+			c->refills++;
+		}
+	}
+	if (c->count) {
+		obj = c->objs[--c->count];
+		c->hits++;
+	} else {
+		c->exhausted++;
+	}
+
+	arch_cpu_irq_restore(flags);
+
+	return obj;
+}
+
+static void mbufpool_free(struct vmm_mbufpool *p, void *obj)
+{
+	u32 n;
+	irq_flags_t flags;
+	struct vmm_mbufpool_cache *c;
+
+	arch_cpu_irq_save(flags);
+
+	c = &this_cpu(mbpcache).cache[p - mbpctrl.pools];
+	c->objs[c->count++] = obj;
+	if (c->count > p->cache_max) {
+		n = min(c->count, p->cache_batch);
+		c->count -= n;
+		if (mempool_free_bulk(p->mp, &c->objs[c->count], n) != n) {
+			vmm_printf("%s: failed to drain %d entities\n",
+				   __func__, n);
+		}
+		c->drains++;
+	}
+
+	arch_cpu_irq_restore(flags);
+}
+
+u32 vmm_mbufpool_count(void)
+{
+	return MBUFPOOL_COUNT;
+}
+VMM_EXPORT_SYMBOL(vmm_mbufpool_count);
+
+int vmm_mbufpool_stats_get(u32 index, struct vmm_mbufpool_stats *stats)
+{
+	u32 cpu;
+	struct vmm_mbufpool *p;
+	struct vmm_mbufpool_cache *c;
+
+	if ((MBUFPOOL_COUNT <= index) || !stats) {
+		return VMM_EINVALID;
+	}
+	p = &mbpctrl.pools[index];
+
+	memset(stats, 0, sizeof(*stats));
+	stats->buf_size = p->buf_size;
+	if (p->mp) {
+		stats->total = mempool_total_entities(p->mp);
+		stats->free = mempool_free_entities(p->mp);
+	}
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(mbpcache, cpu).cache[index];
+		stats->cached += c->count;
+		stats->hits += c->hits;
+		stats->refills += c->refills;
+		stats->drains += c->drains;
+		stats->exhausted += c->exhausted;
+	}
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(vmm_mbufpool_stats_get);
+
 int __init vmm_mbufpool_init(void)
 {
 	u32 slab, b_size, b_count, epool_sz;
@@ -173,10 +326,8 @@ int __init vmm_mbufpool_init(void)
 	/* Create mbuf pool */
 	b_size = sizeof(struct vmm_mbuf);
 	b_count = CONFIG_NET_MBUF_POOL_SIZE;
-	mbpctrl.mpool = mempool_ram_create(b_size,
-					VMM_SIZE_TO_PAGE(b_size * b_count),
-					VMM_PAGEPOOL_NORMAL);
-	if (!mbpctrl.mpool) {
+	mbufpool_setup(mbpctrl_mpool, b_size, b_count);
+	if (!mbpctrl_mpool->mp) {
 		return VMM_ENOMEM;
 	}
 
@@ -186,12 +337,7 @@ int __init vmm_mbufpool_init(void)
 		b_size = epool_slab_buf_size(slab);
 		b_count = epool_slab_buf_count(epool_sz, slab);
 		if (b_count && b_size) {
-			mbpctrl.epool_slabs[slab] = 
-				mempool_ram_create(b_size,
-					VMM_SIZE_TO_PAGE(b_size * b_count),
-					VMM_PAGEPOOL_NORMAL);
-		} else {
-			mbpctrl.epool_slabs[slab] = NULL;
+			mbufpool_setup(mbpctrl_epool(slab), b_size, b_count);
 		}
 	}
 
@@ -200,17 +346,20 @@ int __init vmm_mbufpool_init(void)
 
 void __exit vmm_mbufpool_exit(void)
 {
-	u32 slab;
+	u32 i, cpu;
 
-	/* Destroy mbuf pool */
-	if (mbpctrl.mpool) {
-		mempool_destroy(mbpctrl.mpool);
+	/* Forget cached entities */
+	for_each_possible_cpu(cpu) {
+		for (i = 0; i < MBUFPOOL_COUNT; i++) {
+			per_cpu(mbpcache, cpu).cache[i].count = 0;
+		}
 	}
 
-	/* Destroy ext slab pools */
-	for (slab = 0; slab < EPOOL_SLAB_COUNT; slab++) {
-		if (mbpctrl.epool_slabs[slab]) {
-			mempool_destroy(mbpctrl.epool_slabs[slab]);
+	/* Destroy mbuf pool and ext slab pools */
+	for (i = 0; i < MBUFPOOL_COUNT; i++) {
+		if (mbpctrl.pools[i].mp) {
+			mempool_destroy(mbpctrl.pools[i].mp);
+			mbpctrl.pools[i].mp = NULL;
 		}
 	}
 }
@@ -221,9 +370,10 @@ void __exit vmm_mbufpool_exit(void)
 
 /*
  * Copy data from an mbuf chain starting "off" bytes from the beginning,
- * continuing for "len" bytes, into the indicated buffer.
+ * continuing for "len" bytes, into the indicated buffer. Fails only
+ * if guest memory backing an M_EXT_GUEST mbuf can't be read.
  */
-void m_copydata(struct vmm_mbuf *m, int off, int len, void *vp)
+int m_copydata(struct vmm_mbuf *m, int off, int len, void *vp)
 {
 	unsigned count;
 	void *cp = vp;
@@ -232,6 +382,24 @@ void m_copydata(struct vmm_mbuf *m, int off, int len, void *vp)
 		vmm_panic("%s: either m or vp is NULL\n", __func__);
 	if (off < 0 || len < 0)
 		vmm_panic("%s: off %d, len %d", __func__, off, len);
+	if (m->m_flags & M_EXT_GUEST) {
+		/* Headers are local, rest is read from guest memory */
+		if ((off + len) > m->m_pktlen)
+			vmm_panic("%s: off %d, len %d", __func__, off, len);
+		if (off < m->m_len) {
+			count = min(m->m_len - off, len);
+			memcpy(cp, mtod(m, char *) + off, count);
+			len -= count;
+			off += count;
+			cp = (char *)cp + count;
+		}
+		if (len > 0) {
+			struct vmm_mbuf_guest *g = m->m_extarg;
+			if (g->read(g, off, cp, len) != len)
+				return VMM_EIO;
+		}
+		return VMM_OK;
+	}
 	while (off > 0) {
 		if (m == NULL)
 			vmm_panic("%s: m == NULL, off %d", __func__, off);
@@ -248,12 +416,14 @@ void m_copydata(struct vmm_mbuf *m, int off, int len, void *vp)
 		off = 0;
 		m = m->m_next;
 	}
+
+	return VMM_OK;
 }
 VMM_EXPORT_SYMBOL(m_copydata);
 
 static void mbuf_pool_free(struct vmm_mbuf *m)
 {
-	mempool_free(mbpctrl.mpool, m);
+	mbufpool_free(mbpctrl_mpool, m);
 }
 
 static void mbuf_heap_free(struct vmm_mbuf *m)
@@ -272,8 +442,9 @@ struct vmm_mbuf *m_get(int nowait, int flags)
 
 	/* TODO: implement non-blocking variant */
 
-	m = mempool_zalloc(mbpctrl.mpool);
+	m = mbufpool_alloc(mbpctrl_mpool);
 	if (m) {
+		memset(m, 0, sizeof(*m));
 		m->m_freefn = mbuf_pool_free;
 	} else if (NULL != (m = vmm_zalloc(sizeof(struct vmm_mbuf)))) {
 		m->m_freefn = mbuf_heap_free;
@@ -289,6 +460,9 @@ struct vmm_mbuf *m_get(int nowait, int flags)
 	m->m_flags = flags;
 	if (flags & M_PKTHDR) {
 		m->m_pktlen = 0;
+		m->m_csum_flags = 0;
+		m->m_gso_type = M_GSO_NONE;
+		m->m_gso_size = 0;
 	}
 	m->m_ref = 1;
 
@@ -298,9 +472,7 @@ VMM_EXPORT_SYMBOL(m_get);
 
 static void ext_pool_free(struct vmm_mbuf *m, void *ptr, u32 size, void *arg)
 {
-	struct mempool *mp = arg;
-
-	mempool_free(mp, ptr);
+	mbufpool_free(arg, ptr);
 }
 
 static void ext_heap_free(struct vmm_mbuf *m, void *ptr, u32 size, void *arg)
@@ -317,7 +489,7 @@ void *m_ext_get(struct vmm_mbuf *m, u32 size, enum vmm_mbuf_alloc_types how)
 {
 	void *buf;
 	u32 slab;
-	struct mempool *mp = NULL;
+	struct vmm_mbufpool *p = NULL;
 
 	if (VMM_MBUF_ALLOC_DMA == how) {
 		buf = vmm_dma_malloc(size);
@@ -329,14 +501,14 @@ void *m_ext_get(struct vmm_mbuf *m, u32 size, enum vmm_mbuf_alloc_types how)
 	} else {
 		for (slab = 0; slab < EPOOL_SLAB_COUNT; slab++) {
 			if (size <= epool_slab_buf_size(slab)) {
-				mp = mbpctrl.epool_slabs[slab];
+				p = mbpctrl_epool(slab);
 				break;
 			}
 		}
 
-		if (mp && (buf = mempool_malloc(mp))) {
+		if (p && (buf = mbufpool_alloc(p))) {
 			m->m_flags |= M_EXT_POOL;
-			MEXTADD(m, buf, size, ext_pool_free, mp);
+			MEXTADD(m, buf, size, ext_pool_free, p);
 		} else if ((buf = vmm_malloc(size))) {
 			m->m_flags |= M_EXT_HEAP;
 			MEXTADD(m, buf, size, ext_heap_free, NULL);
@@ -349,6 +521,42 @@ void *m_ext_get(struct vmm_mbuf *m, u32 size, enum vmm_mbuf_alloc_types how)
 }
 VMM_EXPORT_SYMBOL(m_ext_get);
 
+static void ext_guest_free(struct vmm_mbuf *m, void *ptr, u32 size, void *arg)
+{
+	struct vmm_mbuf_guest *g = arg;
+
+	g->release(g);
+}
+
+/*
+ * m_ext_guest_add: attach guest memory of len bytes as external storage
+ * of a packet header mbuf. Packet headers are copied to g->hdr and the
+ * rest of packet is read from guest memory only when needed.
+ */
+int m_ext_guest_add(struct vmm_mbuf *m, u32 len, struct vmm_mbuf_guest *g)
+{
+	u32 hlen;
+
+	if (!m || !(m->m_flags & M_PKTHDR) || !len ||
+	    !g || !g->read || !g->release) {
+		return VMM_EINVALID;
+	}
+
+	hlen = min(len, (u32)M_GUEST_HDRLEN);
+	if (g->read(g, 0, g->hdr, hlen) != hlen) {
+		return VMM_EIO;
+	}
+
+	MEXTADD(m, g->hdr, hlen, ext_guest_free, g);
+	m->m_flags &= ~M_EXT_RW;
+	m->m_flags |= M_EXT_GUEST;
+	m->m_len = hlen;
+	m->m_pktlen = len;
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(m_ext_guest_add);
+
 /*
  * m_ext_dma_ensure: Ensure that the data buffer is DMA proof, reallocating
  * and copying data to do so.
@@ -418,6 +626,220 @@ void m_freem(struct vmm_mbuf *m)
 }
 VMM_EXPORT_SYMBOL(m_freem);
 
+/*
+ * m_dup: make a deep copy of a packet header mbuf chain into
+ * a single writable mbuf. The packet header is copied as well.
+ */
+struct vmm_mbuf *m_dup(struct vmm_mbuf *m)
+{
+	struct vmm_mbuf *n;
+
+	if (!m || !(m->m_flags & M_PKTHDR)) {
+		return NULL;
+	}
+
+	MGETHDR(n, 0, 0);
+	if (!n) {
+		return NULL;
+	}
+	if (!MEXTMALLOC(n, m->m_pktlen, 0)) {
+		m_freem(n);
+		return NULL;
+	}
+
+	n->m_pkthdr = m->m_pkthdr;
+	if (m_copydata(m, 0, m->m_pktlen, n->m_data)) {
+		m_freem(n);
+		return NULL;
+	}
+	n->m_len = m->m_pktlen;
+
+	return n;
+}
+VMM_EXPORT_SYMBOL(m_dup);
+
+/*
+ * m_csum_finish: complete a partial checksum (M_CSUM_PARTIAL) in
+ * software. The checksum field at csum_start + csum_offset is expected
+ * to hold the pseudo-header sum, as with virtio VIRTIO_NET_HDR_F_NEEDS_CSUM.
+ * The mbuf must be writable and must not be chained.
+ */
+int m_csum_finish(struct vmm_mbuf *m)
+{
+	u8 *p;
+	u16 csum;
+	u32 start, off;
+
+	if (!m || !(m->m_flags & M_PKTHDR)) {
+		return VMM_EINVALID;
+	}
+	if (!(m->m_csum_flags & M_CSUM_PARTIAL)) {
+		return VMM_OK;
+	}
+	if (m->m_next || M_READONLY(m)) {
+		return VMM_EINVALID;
+	}
+
+	start = m->m_csum_start;
+	off = start + m->m_csum_offset;
+	if ((off + 2) > m->m_len) {
+		return VMM_EINVALID;
+	}
+
+	p = mtod(m, u8 *);
+	csum = csum_fold(csum_partial(p + start, m->m_len - start, 0));
+	if (!csum) {
+		csum = 0xffff;
+	}
+	p[off] = csum >> 8;
+	p[off + 1] = csum & 0xff;
+
+	m->m_csum_flags &= ~M_CSUM_PARTIAL;
+	m->m_csum_flags |= M_CSUM_VALID;
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(m_csum_finish);
+
+/* Largest Ethernet + VLAN + IP + TCP header handled by m_gso_segment() */
+#define MBUF_GSO_MAX_HDR	(18 + 60 + 60)
+
+/*
+ * m_gso_segment: split a TCP segmentation offload packet into
+ * gso_size sized segments appended to the (empty) list segs.
+ * Each segment carries a complete IP and TCP header with valid
+ * checksums. The original mbuf is left untouched.
+ */
+int m_gso_segment(struct vmm_mbuf *m, struct dlist *segs)
+{
+	int rc = VMM_ENOMEM;
+	u8 h[MBUF_GSO_MAX_HDR], *b, *ip, *th;
+	u32 i, len, off, l3, l4, hlen, plen, tlen, chunk, seq, sum;
+	u16 etype, id;
+	struct vmm_mbuf *s;
+
+	if (!m || !segs || !(m->m_flags & M_PKTHDR)) {
+		return VMM_EINVALID;
+	}
+	if ((m->m_gso_type != M_GSO_TCPV4) &&
+	    (m->m_gso_type != M_GSO_TCPV6)) {
+		return VMM_ENOTSUPP;
+	}
+	if (!m->m_gso_size) {
+		return VMM_EINVALID;
+	}
+
+	/* Parse headers from the packet itself */
+	len = min((u32)m->m_pktlen, (u32)sizeof(h));
+	if (len < 14) {
+		return VMM_EINVALID;
+	}
+	if (m_copydata(m, 0, len, h)) {
+		return VMM_EIO;
+	}
+	l3 = 14;
+	etype = ((u16)h[12] << 8) | h[13];
+	if (etype == 0x8100) {
+		l3 = 18;
+		etype = ((u16)h[16] << 8) | h[17];
+	}
+	if (m->m_gso_type == M_GSO_TCPV4) {
+		if ((etype != 0x0800) || (len < (l3 + 20)) ||
+		    ((h[l3] >> 4) != 4) || ((h[l3] & 0xf) < 5) ||
+		    (h[l3 + 9] != 6)) {
+			return VMM_EINVALID;
+		}
+		l4 = l3 + (h[l3] & 0xf) * 4;
+	} else {
+		if ((etype != 0x86dd) || (len < (l3 + 40)) ||
+		    (h[l3 + 6] != 6)) {
+			return VMM_EINVALID;
+		}
+		l4 = l3 + 40;
+	}
+	if (len < (l4 + 20)) {
+		return VMM_EINVALID;
+	}
+	hlen = l4 + (h[l4 + 12] >> 4) * 4;
+	if ((hlen < (l4 + 20)) || (hlen > len) || (m->m_pktlen <= hlen)) {
+		return VMM_EINVALID;
+	}
+	plen = m->m_pktlen - hlen;
+	seq = ((u32)h[l4 + 4] << 24) | ((u32)h[l4 + 5] << 16) |
+	      ((u32)h[l4 + 6] << 8) | h[l4 + 7];
+	id = ((u16)h[l3 + 4] << 8) | h[l3 + 5];
+
+	for (i = 0, off = 0; off < plen; i++, off += chunk) {
+		chunk = min(plen - off, (u32)m->m_gso_size);
+
+		MGETHDR(s, 0, 0);
+		if (!s) {
+			goto fail;
+		}
+		if (!MEXTMALLOC(s, hlen + chunk, 0)) {
+			m_freem(s);
+			goto fail;
+		}
+		b = mtod(s, u8 *);
+		memcpy(b, h, hlen);
+		if (m_copydata(m, hlen + off, chunk, b + hlen)) {
+			m_freem(s);
+			rc = VMM_EIO;
+			goto fail;
+		}
+		s->m_len = s->m_pktlen = hlen + chunk;
+		ip = b + l3;
+		th = b + l4;
+		tlen = hlen - l4 + chunk;
+
+		/* Fix IP header and build TCP pseudo-header sum */
+		if (m->m_gso_type == M_GSO_TCPV4) {
+			ip[2] = (hlen - l3 + chunk) >> 8;
+			ip[3] = (hlen - l3 + chunk) & 0xff;
+			ip[4] = (u16)(id + i) >> 8;
+			ip[5] = (u16)(id + i) & 0xff;
+			ip[10] = ip[11] = 0;
+			sum = csum_fold(csum_partial(ip, l4 - l3, 0));
+			ip[10] = sum >> 8;
+			ip[11] = sum & 0xff;
+			sum = csum_partial(ip + 12, 8, 0);
+		} else {
+			ip[4] = tlen >> 8;
+			ip[5] = tlen & 0xff;
+			sum = csum_partial(ip + 8, 32, 0);
+		}
+		sum = csum_add(sum, 6 + tlen);
+
+		/* Fix TCP sequence number, flags and checksum */
+		th[4] = (seq + off) >> 24;
+		th[5] = ((seq + off) >> 16) & 0xff;
+		th[6] = ((seq + off) >> 8) & 0xff;
+		th[7] = (seq + off) & 0xff;
+		if ((off + chunk) < plen) {
+			th[13] &= ~(0x08 | 0x01); /* PSH | FIN */
+		}
+		if (i) {
+			th[13] &= ~0x80; /* CWR */
+		}
+		th[16] = th[17] = 0;
+		sum = csum_fold(csum_partial(th, tlen, sum));
+		th[16] = sum >> 8;
+		th[17] = sum & 0xff;
+
+		s->m_csum_flags = M_CSUM_VALID;
+		list_add_tail(&s->m_list, segs);
+	}
+
+	return VMM_OK;
+
+fail:
+	while (!list_empty(segs)) {
+		m_freem(m_list_entry(list_pop(segs)));
+	}
+	return rc;
+}
+VMM_EXPORT_SYMBOL(m_gso_segment);
+
 static void mbuf_data_dump(char *buf, unsigned int buflen)
 {
 	int index;
@@ -26,6 +26,10 @@
 #include <vmm_stdio.h>
 #include <vmm_modules.h>
 #include <vmm_devdrv.h>
+#include <vmm_devtree.h>
+#include <vmm_timer.h>
+#include <arch_atomic.h>
+#include <arch_atomic64.h>
 #include <net/vmm_protocol.h>
 #include <net/vmm_netswitch.h>
 #include <net/vmm_netport.h>
@@ -46,23 +50,157 @@ struct vmm_netport *vmm_netport_alloc(char *name, u32 queue_size)
 	    sizeof(port->name)) {
 		vmm_free(port);
 		return NULL;
-	};
+	}
 
 	port->queue_size = (queue_size < VMM_NETPORT_MAX_QUEUE_SIZE) ?
 				queue_size : VMM_NETPORT_MAX_QUEUE_SIZE;
 
 	INIT_SPIN_LOCK(&port->switch2port_xfer_lock);
+	INIT_SPIN_LOCK(&port->ingress.lock);
+	INIT_SPIN_LOCK(&port->egress.lock);
+	ARCH_ATOMIC_INIT(&port->ref_count, 1);
 
 	return port;
 }
 VMM_EXPORT_SYMBOL(vmm_netport_alloc);
 
+/* Largest packet which must always fit in a burst */
+#define NETPORT_RATE_MIN_BURST_BYTES	65536ULL
+
+static s64 netport_rate_burst(u64 rate, u64 min_burst)
+{
+	u64 burst = rate * VMM_NETPORT_RATE_BURST_NS;
+
+	return (s64)max(burst, (u64)(min_burst * 1000000000ULL));
+}
+
+void vmm_netport_rate_set(struct vmm_netport_rate *r,
+			  u64 bytes_per_sec, u64 pkts_per_sec)
+{
+	irq_flags_t f;
+
+	if (!r) {
+		return;
+	}
+
+	bytes_per_sec = min(bytes_per_sec, VMM_NETPORT_RATE_MAX);
+	pkts_per_sec = min(pkts_per_sec, VMM_NETPORT_RATE_MAX);
+
+	vmm_spin_lock_irqsave_lite(&r->lock, f);
+	r->bytes_per_sec = bytes_per_sec;
+	r->pkts_per_sec = pkts_per_sec;
+	r->byte_tokens = netport_rate_burst(bytes_per_sec,
+					    NETPORT_RATE_MIN_BURST_BYTES);
+	r->pkt_tokens = netport_rate_burst(pkts_per_sec, 1);
+	r->timestamp = vmm_timer_timestamp();
+	vmm_spin_unlock_irqrestore_lite(&r->lock, f);
+}
+VMM_EXPORT_SYMBOL(vmm_netport_rate_set);
+
+static int netport_rate_bucket(s64 *tokens, u64 rate, u64 elapsed,
+			       u64 min_burst, u64 cost)
+{
+	s64 burst;
+
+	if (!rate) {
+		return VMM_NETPORT_RATE_PASS;
+	}
+
+	burst = netport_rate_burst(rate, min_burst);
+	*tokens += (s64)(min(elapsed, (u64)VMM_NETPORT_RATE_BURST_NS) * rate);
+	if (*tokens > burst) {
+		*tokens = burst;
+	}
+
+	cost *= 1000000000ULL;
+	if (*tokens >= (s64)cost) {
+		return VMM_NETPORT_RATE_PASS;
+	} else if ((*tokens - (s64)cost) >= -burst) {
+		return VMM_NETPORT_RATE_MARK;
+	}
+
+	return VMM_NETPORT_RATE_DROP;
+}
+
+int vmm_netport_rate_check(struct vmm_netport_rate *r, u32 len)
+{
+	int v, pv;
+	u64 now;
+	irq_flags_t f;
+
+	if (!r->bytes_per_sec && !r->pkts_per_sec) {
+		arch_atomic64_inc(&r->passed);
+		return VMM_NETPORT_RATE_PASS;
+	}
+
+	vmm_spin_lock_irqsave_lite(&r->lock, f);
+
+	now = vmm_timer_timestamp();
+	v = netport_rate_bucket(&r->byte_tokens, r->bytes_per_sec,
+				now - r->timestamp,
+				NETPORT_RATE_MIN_BURST_BYTES, len);
+	pv = netport_rate_bucket(&r->pkt_tokens, r->pkts_per_sec,
+				 now - r->timestamp, 1, 1);
+	r->timestamp = now;
+
+	v = max(v, pv);
+	switch (v) {
+	case VMM_NETPORT_RATE_PASS:
+		arch_atomic64_inc(&r->passed);
+		break;
+	case VMM_NETPORT_RATE_MARK:
+		r->marked++;
+		break;
+	default:
+		r->dropped++;
+		break;
+	}
+	if (v != VMM_NETPORT_RATE_DROP) {
+		if (r->bytes_per_sec) {
+			r->byte_tokens -= (s64)len * 1000000000LL;
+		}
+		if (r->pkts_per_sec) {
+			r->pkt_tokens -= 1000000000LL;
+		}
+	}
+
+	vmm_spin_unlock_irqrestore_lite(&r->lock, f);
+
+	return v;
+}
+VMM_EXPORT_SYMBOL(vmm_netport_rate_check);
+
+void vmm_netport_rate_parse(struct vmm_netport *port,
+			    struct vmm_devtree_node *node)
+{
+	u32 bps, pps;
+
+	if (!port || !node) {
+		return;
+	}
+
+	bps = pps = 0;
+	vmm_devtree_read_u32(node, "ingress_bytes_per_sec", &bps);
+	vmm_devtree_read_u32(node, "ingress_pkts_per_sec", &pps);
+	vmm_netport_rate_set(&port->ingress, bps, pps);
+
+	bps = pps = 0;
+	vmm_devtree_read_u32(node, "egress_bytes_per_sec", &bps);
+	vmm_devtree_read_u32(node, "egress_pkts_per_sec", &pps);
+	vmm_netport_rate_set(&port->egress, bps, pps);
+}
+VMM_EXPORT_SYMBOL(vmm_netport_rate_parse);
+
 int vmm_netport_free(struct vmm_netport *port)
 {
 	if (!port) {
 		return VMM_EFAIL;
 	}
 
+	if (arch_atomic_sub_return(&port->ref_count, 1)) {
+		return VMM_OK;
+	}
+
 	vmm_free(port);
 
 	return VMM_OK;
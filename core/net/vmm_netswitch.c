@@ -32,7 +32,11 @@
 #include <vmm_stdio.h>
 #include <vmm_modules.h>
 #include <vmm_threads.h>
+#include <vmm_mutex.h>
+#include <vmm_scheduler.h>
 #include <vmm_completion.h>
+#include <arch_atomic.h>
+#include <arch_barrier.h>
 #include <net/vmm_mbuf.h>
 #include <net/vmm_protocol.h>
 #include <net/vmm_netswitch.h>
@@ -127,12 +131,68 @@ if (ether_type(mtod(mbuf, u8 *)) == 0x0806	/* ARP */) {		\
 #define DUMP_NETSWITCH_PKT(mbuf)
 #endif
 
+/* Max switch to port transfers deferred by bottom-half */
+#define NETSWITCH_BH_XFER_BATCH		64
+
+/* Max output ports of a cached flow (larger fan-out is not cached) */
+#define NETSWITCH_FLOW_MAX_PORTS	8
+
+struct netswitch_flow_key {
+	struct vmm_netport *src;
+	u8 dstmac[6];
+	u8 srcmac[6];
+	u16 vlan;
+	u16 etype;
+};
+
+/*
+ * Flow cache entry mapping exact-match key to output ports chosen
+ * by netswitch policy for first packet of the flow. Entries are read
+ * lock-free using seq counter which is odd while an update is in
+ * progress. Flushing the cache only increments switch generation.
+ */
+struct vmm_netswitch_flow {
+	u32 seq;
+	u32 gen;
+	struct netswitch_flow_key key;
+	u32 nports;
+	struct vmm_netport *ports[NETSWITCH_FLOW_MAX_PORTS];
+};
+
+struct vmm_netswitch_bh_xfer {
+	struct vmm_netport *port;
+	struct vmm_mbuf *mbuf;
+	u32 prio;
+};
+
+struct vmm_netswitch_bh_release {
+	struct dlist head;
+	struct vmm_netport *port;
+};
+
 struct vmm_netswitch_bh_ctrl {
 	struct vmm_thread *thread;
 	struct vmm_completion bh_cmpl;
 	vmm_spinlock_t bh_list_lock;
 	struct dlist mbuf_list;
 	struct dlist lazy_list;
+	/* Held by bottom-half thread while processing a batch */
+	struct vmm_mutex batch_lock;
+	/* Batches grabbed and completed (protected by bh_list_lock) */
+	u32 batch_start;
+	u32 batch_end;
+	/* Ports to release when in-flight batch completes */
+	struct dlist release_list;
+	/* Switch to port transfers deferred till end of batch */
+	bool xfer_defer;
+	u32 xfer_count;
+	struct vmm_netswitch_bh_xfer xfer[NETSWITCH_BH_XFER_BATCH];
+	struct vmm_mbuf *xfer_bulk[NETSWITCH_BH_XFER_BATCH];
+	/* Output ports chosen by policy for flow being resolved */
+	struct vmm_netswitch *flow_nsw;
+	u32 flow_nports;
+	struct vmm_netport *flow_ports[NETSWITCH_FLOW_MAX_PORTS];
+	bool flow_nocache;
 };
 
 static DEFINE_PER_CPU(struct vmm_netswitch_bh_ctrl, nbctrl);
@@ -146,6 +206,15 @@ static void __init netswitch_bh_init(struct vmm_netswitch_bh_ctrl *nbp)
 	INIT_SPIN_LOCK(&nbp->bh_list_lock);
 	INIT_LIST_HEAD(&nbp->mbuf_list);
 	INIT_LIST_HEAD(&nbp->lazy_list);
+	INIT_MUTEX(&nbp->batch_lock);
+	nbp->batch_start = 0;
+	nbp->batch_end = 0;
+	INIT_LIST_HEAD(&nbp->release_list);
+	nbp->xfer_defer = FALSE;
+	nbp->xfer_count = 0;
+	nbp->flow_nsw = NULL;
+	nbp->flow_nports = 0;
+	nbp->flow_nocache = FALSE;
 }
 
 static int netswitch_bh_enqueue(struct vmm_netswitch_bh_ctrl *nbp,
@@ -172,13 +241,14 @@ static int netswitch_bh_enqueue(struct vmm_netswitch_bh_ctrl *nbp,
 	return VMM_OK;
 }
 
-static int netswitch_bh_dequeue(struct vmm_netswitch_bh_ctrl *nbp,
-				struct vmm_mbuf **mbufp,
-				struct vmm_netport_lazy **lazyp)
+/* Move all pending requests to given lists or block if none */
+static int netswitch_bh_dequeue_bulk(struct vmm_netswitch_bh_ctrl *nbp,
+				     struct dlist *mbufs,
+				     struct dlist *lazys)
 {
 	irq_flags_t flags;
 
-	if (!nbp || !mbufp || !lazyp) {
+	if (!nbp || !mbufs || !lazys) {
 		return VMM_EINVALID;
 	}
 
@@ -190,19 +260,105 @@ static int netswitch_bh_dequeue(struct vmm_netswitch_bh_ctrl *nbp,
 		vmm_spin_lock_irqsave_lite(&nbp->bh_list_lock, flags);
 	}
 
-	if (!list_empty(&nbp->mbuf_list)) {
-		*mbufp = list_entry(list_pop(&nbp->mbuf_list),
-				    struct vmm_mbuf, m_list);
+	list_splice_tail_init(&nbp->mbuf_list, mbufs);
+	list_splice_tail_init(&nbp->lazy_list, lazys);
+	nbp->batch_start++;
+
+	vmm_spin_unlock_irqrestore_lite(&nbp->bh_list_lock, flags);
+
+	return VMM_OK;
+}
+
+/* Mark in-flight batch as completed and drop ports released during it */
+static void netswitch_bh_batch_end(struct vmm_netswitch_bh_ctrl *nbp)
+{
+	irq_flags_t flags;
+	struct dlist releases;
+	struct vmm_netswitch_bh_release *rel;
+
+	INIT_LIST_HEAD(&releases);
+
+	vmm_spin_lock_irqsave_lite(&nbp->bh_list_lock, flags);
+	nbp->batch_end = nbp->batch_start;
+	list_splice_tail_init(&nbp->release_list, &releases);
+	vmm_spin_unlock_irqrestore_lite(&nbp->bh_list_lock, flags);
+
+	while (!list_empty(&releases)) {
+		rel = list_entry(list_pop(&releases),
+				 struct vmm_netswitch_bh_release, head);
+		vmm_netport_free(rel->port);
+		vmm_free(rel);
 	}
+}
 
-	if (!list_empty(&nbp->lazy_list)) {
-		*lazyp = list_entry(list_pop(&nbp->lazy_list),
-				    struct vmm_netport_lazy, head);
+static int netswitch_xfer_bulk(struct vmm_netport *dst,
+			       struct vmm_mbuf **mbufs, u32 count)
+{
+	u32 i;
+	int rc = VMM_OK;
+	irq_flags_t f;
+
+	vmm_spin_lock_irqsave_lite(&dst->switch2port_xfer_lock, f);
+	if (dst->switch2port_xfer_bulk) {
+		rc = dst->switch2port_xfer_bulk(dst, mbufs, count);
+	} else {
+		for (i = 0; i < count; i++) {
+			rc = dst->switch2port_xfer(dst, mbufs[i]);
+		}
 	}
+	vmm_spin_unlock_irqrestore_lite(&dst->switch2port_xfer_lock, f);
 
-	vmm_spin_unlock_irqrestore_lite(&nbp->bh_list_lock, flags);
+	return rc;
+}
 
-	return VMM_OK;
+/* Hand over deferred transfers grouped by destination port */
+static void netswitch_bh_xfer_flush(struct vmm_netswitch_bh_ctrl *nbp)
+{
+	u32 i, j, p, count, prio_base;
+	struct vmm_netport *port;
+
+	for (i = 0; i < nbp->xfer_count; i++) {
+		port = nbp->xfer[i].port;
+		if (!port) {
+			continue;
+		}
+
+		/* Gather packets of port in strict priority order */
+		count = prio_base = 0;
+		for (p = 0; p < VMM_NETPORT_NR_PRIO; p++) {
+			for (j = i; j < nbp->xfer_count; j++) {
+				if ((nbp->xfer[j].port != port) ||
+				    (nbp->xfer[j].prio != p)) {
+					continue;
+				}
+				nbp->xfer_bulk[count++] = nbp->xfer[j].mbuf;
+				nbp->xfer[j].port = NULL;
+				nbp->xfer[j].mbuf = NULL;
+			}
+			port->prio_pkts[p] += count - prio_base;
+			prio_base = count;
+		}
+
+		/* Port might have been removed from netswitch */
+		if (!port->nsw) {
+			for (j = 0; j < count; j++) {
+				m_freem(nbp->xfer_bulk[j]);
+			}
+			continue;
+		}
+
+		netswitch_xfer_bulk(port, nbp->xfer_bulk, count);
+	}
+
+	nbp->xfer_count = 0;
+}
+
+/* Check whether current context is bottom-half thread of this CPU */
+static inline bool netswitch_bh_context(struct vmm_netswitch_bh_ctrl *nbp)
+{
+	return (nbp->thread &&
+		(vmm_scheduler_current_vcpu() == nbp->thread->tvcpu)) ?
+								TRUE : FALSE;
 }
 
 static void netswitch_bh_port_flush(struct vmm_netswitch_bh_ctrl *nbp,
@@ -231,6 +387,266 @@ static void netswitch_bh_port_flush(struct vmm_netswitch_bh_ctrl *nbp,
 	vmm_spin_unlock_irqrestore_lite(&nbp->bh_list_lock, flags);
 }
 
+static bool netswitch_bh_batch_done(struct vmm_netswitch_bh_ctrl *nbp,
+				    u32 batch)
+{
+	bool ret;
+	irq_flags_t flags;
+
+	vmm_spin_lock_irqsave_lite(&nbp->bh_list_lock, flags);
+	ret = ((s32)(nbp->batch_end - batch) >= 0) ? TRUE : FALSE;
+	vmm_spin_unlock_irqrestore_lite(&nbp->bh_list_lock, flags);
+
+	return ret;
+}
+
+/* Sleep till batch in-flight at the time of call is completed */
+static void netswitch_bh_batch_wait(struct vmm_netswitch_bh_ctrl *nbp)
+{
+	u32 batch;
+	irq_flags_t flags;
+
+	vmm_spin_lock_irqsave_lite(&nbp->bh_list_lock, flags);
+	batch = nbp->batch_start;
+	vmm_spin_unlock_irqrestore_lite(&nbp->bh_list_lock, flags);
+
+	while (!netswitch_bh_batch_done(nbp, batch)) {
+		vmm_mutex_lock(&nbp->batch_lock);
+		vmm_mutex_unlock(&nbp->batch_lock);
+	}
+}
+
+/* Hold a port reference till batch in-flight at the time of call
+ * is completed, for contexts which cannot sleep on batch_lock
+ */
+static void netswitch_bh_port_release(struct vmm_netswitch_bh_ctrl *nbp,
+				      struct vmm_netport *port)
+{
+	irq_flags_t flags;
+	struct vmm_netswitch_bh_release *rel;
+
+	rel = vmm_malloc(sizeof(*rel));
+
+	vmm_spin_lock_irqsave_lite(&nbp->bh_list_lock, flags);
+	if (nbp->batch_end != nbp->batch_start) {
+		arch_atomic_add(&port->ref_count, 1);
+		if (rel) {
+			INIT_LIST_HEAD(&rel->head);
+			rel->port = port;
+			list_add_tail(&rel->head, &nbp->release_list);
+			rel = NULL;
+		} else {
+			vmm_printf("%s: port=%s leaked as batch is "
+				   "in-flight\n", __func__, port->name);
+		}
+	}
+	vmm_spin_unlock_irqrestore_lite(&nbp->bh_list_lock, flags);
+
+	if (rel) {
+		vmm_free(rel);
+	}
+}
+
+#define netswitch_flow_stats(nsw)	\
+	(&(nsw)->flow_stats[vmm_smp_processor_id()])
+
+static int netswitch_flow_key(struct vmm_netport *src,
+			      struct vmm_mbuf *mbuf,
+			      struct netswitch_flow_key *key)
+{
+	const u8 *buf = mtod(mbuf, const u8 *);
+
+	if (mbuf->m_len < ETHER_HLEN) {
+		return VMM_EINVALID;
+	}
+
+	memset(key, 0, sizeof(*key));
+	key->src = src;
+	memcpy(key->dstmac, ether_dstmac(buf), sizeof(key->dstmac));
+	memcpy(key->srcmac, ether_srcmac(buf), sizeof(key->srcmac));
+	key->etype = ether_type(buf);
+	if (key->etype == 0x8100) {
+		if (mbuf->m_len < (ETHER_HLEN + 4)) {
+			return VMM_EINVALID;
+		}
+		key->vlan = (((u16)buf[14] << 8) | buf[15]) & 0xFFF;
+		key->etype = ((u16)buf[16] << 8) | buf[17];
+	}
+
+	return VMM_OK;
+}
+
+static struct vmm_netswitch_flow *netswitch_flow_entry(
+					struct vmm_netswitch *nsw,
+					struct netswitch_flow_key *key)
+{
+	u32 i, hash = (u32)(unsigned long)key->src;
+
+	for (i = 0; i < 6; i++) {
+		hash = (hash << 5) - hash + key->dstmac[i];
+		hash = (hash << 5) - hash + key->srcmac[i];
+	}
+	hash = (hash << 5) - hash + key->vlan;
+	hash = (hash << 5) - hash + key->etype;
+	hash ^= hash >> 16;
+
+	return &nsw->flows[umod32(hash, nsw->flow_count)];
+}
+
+static bool netswitch_flow_lookup(struct vmm_netswitch *nsw,
+				  struct netswitch_flow_key *key,
+				  struct vmm_netswitch_flow *flow)
+{
+	u32 seq;
+	struct vmm_netswitch_flow *f = netswitch_flow_entry(nsw, key);
+
+	do {
+		seq = *(volatile u32 *)&f->seq;
+		if (seq & 0x1) {
+			return FALSE;
+		}
+		arch_smp_rmb();
+		*flow = *f;
+		arch_smp_rmb();
+	} while (*(volatile u32 *)&f->seq != seq);
+
+	if ((flow->gen != *(volatile u32 *)&nsw->flow_gen) ||
+	    memcmp(&flow->key, key, sizeof(*key))) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void netswitch_flow_insert(struct vmm_netswitch *nsw,
+				  struct netswitch_flow_key *key, u32 gen,
+				  struct vmm_netport **ports, u32 nports)
+{
+	irq_flags_t flags;
+	struct vmm_netswitch_flow *f = netswitch_flow_entry(nsw, key);
+
+	vmm_spin_lock_irqsave_lite(&nsw->flow_lock, flags);
+
+	/* Policy decision is stale if cache was flushed meanwhile */
+	if (gen == nsw->flow_gen) {
+		f->seq++;
+		arch_smp_wmb();
+		f->gen = gen;
+		f->key = *key;
+		f->nports = nports;
+		memcpy(f->ports, ports, nports * sizeof(*ports));
+		arch_smp_wmb();
+		f->seq++;
+	}
+
+	vmm_spin_unlock_irqrestore_lite(&nsw->flow_lock, flags);
+}
+
+/* Forward packet using flow cache or netswitch policy */
+static void netswitch_flow_xfer(struct vmm_netswitch_bh_ctrl *nbp,
+				struct vmm_netswitch *nsw,
+				struct vmm_netport *src,
+				struct vmm_mbuf *mbuf)
+{
+	u32 i, gen;
+	struct netswitch_flow_key key;
+	struct vmm_netswitch_flow flow;
+
+	if (!nsw->flows || netswitch_flow_key(src, mbuf, &key)) {
+		nsw->port2switch_xfer(nsw, src, mbuf);
+		return;
+	}
+
+	if (netswitch_flow_lookup(nsw, &key, &flow)) {
+		netswitch_flow_stats(nsw)->hits++;
+		/* Policy state (e.g. MAC ageing) must see this packet */
+		if (nsw->flow_hit) {
+			nsw->flow_hit(nsw, src, mbuf);
+		}
+		for (i = 0; i < flow.nports; i++) {
+			vmm_switch2port_xfer_mbuf(nsw, flow.ports[i], mbuf);
+		}
+		return;
+	}
+	netswitch_flow_stats(nsw)->misses++;
+
+	/* Let policy decide and record ports it transfers to */
+	gen = *(volatile u32 *)&nsw->flow_gen;
+	arch_smp_rmb();
+	nbp->flow_nsw = nsw;
+	nbp->flow_nports = 0;
+	nbp->flow_nocache = FALSE;
+	nsw->port2switch_xfer(nsw, src, mbuf);
+	nbp->flow_nsw = NULL;
+
+	if (!nbp->flow_nocache &&
+	    (nbp->flow_nports <= NETSWITCH_FLOW_MAX_PORTS)) {
+		netswitch_flow_insert(nsw, &key, gen,
+				      nbp->flow_ports, nbp->flow_nports);
+	}
+}
+
+void vmm_netswitch_flow_nocache(struct vmm_netswitch *nsw)
+{
+	struct vmm_netswitch_bh_ctrl *nbp = &this_cpu(nbctrl);
+
+	if ((nbp->flow_nsw == nsw) && netswitch_bh_context(nbp)) {
+		nbp->flow_nocache = TRUE;
+	}
+}
+VMM_EXPORT_SYMBOL(vmm_netswitch_flow_nocache);
+
+void vmm_netswitch_flow_flush(struct vmm_netswitch *nsw)
+{
+	irq_flags_t flags;
+
+	if (!nsw || !nsw->flows) {
+		return;
+	}
+
+	vmm_spin_lock_irqsave_lite(&nsw->flow_lock, flags);
+	nsw->flow_gen++;
+	if (!nsw->flow_gen) {
+		/* Generation zero is never used by valid entries */
+		nsw->flow_gen++;
+	}
+	vmm_spin_unlock_irqrestore_lite(&nsw->flow_lock, flags);
+
+	netswitch_flow_stats(nsw)->flushes++;
+}
+VMM_EXPORT_SYMBOL(vmm_netswitch_flow_flush);
+
+int vmm_netswitch_flow_stats_get(struct vmm_netswitch *nsw,
+				 struct vmm_netswitch_flow_stats *stats)
+{
+	u32 i, gen;
+
+	if (!nsw || !stats) {
+		return VMM_EINVALID;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	if (!nsw->flows) {
+		return VMM_OK;
+	}
+
+	for (i = 0; i < CONFIG_CPU_COUNT; i++) {
+		stats->hits += nsw->flow_stats[i].hits;
+		stats->misses += nsw->flow_stats[i].misses;
+		stats->flushes += nsw->flow_stats[i].flushes;
+	}
+
+	gen = *(volatile u32 *)&nsw->flow_gen;
+	for (i = 0; i < nsw->flow_count; i++) {
+		if (nsw->flows[i].gen == gen) {
+			stats->entries++;
+		}
+	}
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(vmm_netswitch_flow_stats_get);
+
 static int netswitch_bh_main(void *param)
 {
 	int rc;
@@ -238,29 +654,35 @@ static int netswitch_bh_main(void *param)
 	struct vmm_netswitch *nsw;
 	struct vmm_mbuf *mbuf;
 	struct vmm_netport_lazy *lazy;
+	struct dlist mbufs, lazys;
 	struct vmm_netswitch_bh_ctrl *nbp = param;
 
+	INIT_LIST_HEAD(&mbufs);
+	INIT_LIST_HEAD(&lazys);
+
 	while (1) {
-		/* Try to get next request from list or block if empty */
-		lazy = NULL;
-		mbuf = NULL;
-		rc = netswitch_bh_dequeue(nbp, &mbuf, &lazy);
+		/* Grab all pending requests or block if none */
+		rc = netswitch_bh_dequeue_bulk(nbp, &mbufs, &lazys);
 		if (rc) {
 			continue;
 		}
 
-		/* Process mbuf request */
-		if (mbuf) {
+		vmm_mutex_lock(&nbp->batch_lock);
+
+		/* Process mbuf requests and defer transfers to ports */
+		nbp->xfer_defer = TRUE;
+		while (!list_empty(&mbufs)) {
+			mbuf = m_list_entry(list_pop(&mbufs));
+			INIT_LIST_HEAD(&mbuf->m_list);
+
 			/* Extract port from mbuf */
 			port = mbuf->m_list_priv;
-			nsw = port->nsw;
+			nsw = (port) ? port->nsw : NULL;
 			mbuf->m_list_priv = NULL;
 
 			/* Port might have been removed from netswitch */
 			if (!port || !nsw) {
-				if (mbuf) {
-					m_freem(mbuf);
-				}
+				m_freem(mbuf);
 				continue;
 			}
 
@@ -271,19 +693,29 @@ static int netswitch_bh_main(void *param)
 			/* Dump packet */
 			DUMP_NETSWITCH_PKT(mbuf);
 
-			/* Call the rx function of net switch */
-			nsw->port2switch_xfer(nsw, port, mbuf);
+			/* Forward using flow cache or rx function of switch */
+			netswitch_flow_xfer(nbp, nsw, port, mbuf);
 
 			/* Free mbuf */
 			m_freem(mbuf);
 		}
+		netswitch_bh_xfer_flush(nbp);
+		nbp->xfer_defer = FALSE;
+
+		/* Process lazy requests */
+		while (!list_empty(&lazys)) {
+			lazy = list_entry(list_pop(&lazys),
+					  struct vmm_netport_lazy, head);
 
-		/* Process lazy request */
-		if (lazy) {
 			/* Extract info from lazy request */
 			port = lazy->port;
 			nsw = port->nsw;
 
+			/* Port might have been removed from netswitch */
+			if (!nsw) {
+				continue;
+			}
+
 			/* Print debug info */
 			DPRINTF("%s: nsw=%s port=%s lazy\n", __func__,
 				nsw->name, port->name);
@@ -302,11 +734,40 @@ static int netswitch_bh_main(void *param)
 				}
 			}
 		}
+
+		netswitch_bh_batch_end(nbp);
+		vmm_mutex_unlock(&nbp->batch_lock);
 	}
 
 	return VMM_OK;
 }
 
+static inline u32 netswitch_mbuf_len(struct vmm_mbuf *mbuf)
+{
+	return (mbuf->m_flags & M_PKTHDR) ? mbuf->m_pktlen : mbuf->m_len;
+}
+
+/* Admission control of source port (returns FALSE if mbuf is dropped) */
+static bool netswitch_ingress_admit(struct vmm_netport *src,
+				    struct vmm_mbuf *mbuf)
+{
+	int rc = vmm_netport_rate_check(&src->ingress,
+					netswitch_mbuf_len(mbuf));
+
+	switch (rc) {
+	case VMM_NETPORT_RATE_DROP:
+		m_freem(mbuf);
+		return FALSE;
+	case VMM_NETPORT_RATE_MARK:
+		mbuf->m_flags |= M_MARKED;
+		break;
+	default:
+		break;
+	}
+
+	return TRUE;
+}
+
 int vmm_port2switch_xfer_mbuf(struct vmm_netport *src, struct vmm_mbuf *mbuf)
 {
 	int rc;
@@ -327,6 +788,11 @@ int vmm_port2switch_xfer_mbuf(struct vmm_netport *src, struct vmm_mbuf *mbuf)
 	/* Print debug info */
 	DPRINTF("%s: nsw=%s src=%s\n", __func__, nsw->name, src->name);
 
+	/* Admission control of source port */
+	if (!netswitch_ingress_admit(src, mbuf)) {
+		return VMM_OK;
+	}
+
 	/* Save port in mbuf */
 	mbuf->m_list_priv = src;
 
@@ -342,9 +808,57 @@ int vmm_port2switch_xfer_mbuf(struct vmm_netport *src, struct vmm_mbuf *mbuf)
 }
 VMM_EXPORT_SYMBOL(vmm_port2switch_xfer_mbuf);
 
+int vmm_port2switch_xfer_mbuf_list(struct vmm_netport *src,
+				   struct dlist *mbufs)
+{
+	irq_flags_t flags;
+	struct vmm_mbuf *mbuf;
+	struct vmm_netswitch_bh_ctrl *nbp;
+	LIST_HEAD(xfer);
+
+	if (!mbufs) {
+		return VMM_EFAIL;
+	}
+
+	if (!src || !src->nsw) {
+		vmm_printf("%s: invalid source port.\n", __func__);
+		while (!list_empty(mbufs)) {
+			m_freem(list_entry(list_pop(mbufs),
+					   struct vmm_mbuf, m_list));
+		}
+		return VMM_EFAIL;
+	}
+
+	while (!list_empty(mbufs)) {
+		mbuf = list_entry(list_pop(mbufs), struct vmm_mbuf, m_list);
+		if (!netswitch_ingress_admit(src, mbuf)) {
+			continue;
+		}
+		mbuf->m_list_priv = src;
+		list_add_tail(&mbuf->m_list, &xfer);
+	}
+	if (list_empty(&xfer)) {
+		return VMM_OK;
+	}
+
+	/* Print debug info */
+	DPRINTF("%s: nsw=%s src=%s\n", __func__, src->nsw->name, src->name);
+
+	/* Add all mbufs to bh queue in one go */
+	nbp = &this_cpu(nbctrl);
+	vmm_spin_lock_irqsave_lite(&nbp->bh_list_lock, flags);
+	list_splice_tail(&xfer, &nbp->mbuf_list);
+	vmm_spin_unlock_irqrestore_lite(&nbp->bh_list_lock, flags);
+
+	vmm_completion_complete_once(&nbp->bh_cmpl);
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(vmm_port2switch_xfer_mbuf_list);
+
 int vmm_port2switch_xfer_lazy(struct vmm_netport_lazy *lazy)
 {
-	int rc = VMM_EBUSY;
+	int cpu, rc = VMM_EBUSY;
 	long sched_count;
 
 	if (!lazy || !lazy->xfer || !lazy->port || !lazy->port->nsw) {
@@ -362,8 +876,12 @@ int vmm_port2switch_xfer_lazy(struct vmm_netport_lazy *lazy)
 		DPRINTF("%s: nsw=%s port=%s bh enqueue\n",
 			__func__, lazy->port->nsw->name, lazy->port->name);
 
-		/* Add xfer request to xfer ring */
-		rc = netswitch_bh_enqueue(&this_cpu(nbctrl), NULL, lazy);
+		/* Add xfer request to xfer ring of preferred host CPU */
+		cpu = lazy->cpu;
+		if ((cpu < 0) || !vmm_cpu_online(cpu)) {
+			cpu = vmm_smp_processor_id();
+		}
+		rc = netswitch_bh_enqueue(&per_cpu(nbctrl, cpu), NULL, lazy);
 		if (rc) {
 			vmm_printf("%s: nsw=%s port=%s lazy bh "
 				   "enqueue failed.\n", __func__,
@@ -377,12 +895,106 @@ int vmm_port2switch_xfer_lazy(struct vmm_netport_lazy *lazy)
 }
 VMM_EXPORT_SYMBOL(vmm_port2switch_xfer_lazy);
 
+static bool netswitch_need_sw_offload(struct vmm_netport *dst,
+				      struct vmm_mbuf *mbuf)
+{
+	u32 need = 0;
+
+	if (mbuf->m_csum_flags & M_CSUM_PARTIAL) {
+		need |= VMM_NETPORT_F_CSUM;
+	}
+	if (mbuf->m_gso_type == M_GSO_TCPV4) {
+		need |= VMM_NETPORT_F_TSO4;
+	} else if (mbuf->m_gso_type == M_GSO_TCPV6) {
+		need |= VMM_NETPORT_F_TSO6;
+	}
+
+	return (dst->features & need) != need;
+}
+
+/*
+ * Segment and/or checksum a private copy of the packet for a
+ * destination port which cannot handle the offload itself. Packets
+ * backed by guest memory are linearized into a private copy for ports
+ * which cannot read them. The shared mbuf is never modified because
+ * other ports may hold it.
+ */
+static int netswitch_xfer_sw_offload(struct vmm_netport *dst,
+				     struct vmm_mbuf *mbuf)
+{
+	int rc;
+	irq_flags_t f;
+	struct vmm_mbuf *m;
+	struct dlist segs;
+
+	INIT_LIST_HEAD(&segs);
+	if ((mbuf->m_gso_type != M_GSO_NONE) &&
+	    netswitch_need_sw_offload(dst, mbuf)) {
+		rc = m_gso_segment(mbuf, &segs);
+	} else if ((m = m_dup(mbuf))) {
+		rc = (netswitch_need_sw_offload(dst, m)) ?
+		     m_csum_finish(m) : VMM_OK;
+		if (rc) {
+			m_freem(m);
+		} else {
+			list_add_tail(&m->m_list, &segs);
+		}
+	} else {
+		rc = VMM_ENOMEM;
+	}
+	if (rc) {
+		return rc;
+	}
+
+	vmm_spin_lock_irqsave_lite(&dst->switch2port_xfer_lock, f);
+	while (!list_empty(&segs)) {
+		m = m_list_entry(list_pop(&segs));
+		INIT_LIST_HEAD(&m->m_list);
+		rc = dst->switch2port_xfer(dst, m);
+	}
+	vmm_spin_unlock_irqrestore_lite(&dst->switch2port_xfer_lock, f);
+
+	return rc;
+}
+
+/*
+ * Egress priority of a packet from VLAN PCP or IP DSCP class selector
+ * (priority 0 is highest). Packets marked by ingress rate limiter of
+ * their source port get lowest priority.
+ */
+static u32 netswitch_mbuf_prio(struct vmm_mbuf *mbuf)
+{
+	u32 l3 = ETHER_HLEN, pcp = 0;
+	u16 etype;
+	const u8 *buf = mtod(mbuf, const u8 *);
+
+	if ((mbuf->m_flags & M_MARKED) || (mbuf->m_len < ETHER_HLEN)) {
+		return VMM_NETPORT_NR_PRIO - 1;
+	}
+
+	etype = ether_type(buf);
+	if ((etype == 0x8100) && (mbuf->m_len >= (ETHER_HLEN + 4))) {
+		pcp = buf[14] >> 5;
+		etype = ((u16)buf[16] << 8) | buf[17];
+		l3 += 4;
+	}
+	if (!pcp && (etype == 0x0800) && (mbuf->m_len > (l3 + 1))) {
+		pcp = buf[l3 + 1] >> 5;
+	} else if (!pcp && (etype == 0x86dd) && (mbuf->m_len > (l3 + 1))) {
+		pcp = (buf[l3] & 0xf) >> 1;
+	}
+
+	return (VMM_NETPORT_NR_PRIO - 1) - (pcp >> 1);
+}
+
 int vmm_switch2port_xfer_mbuf(struct vmm_netswitch *nsw,
 			      struct vmm_netport *dst,
 			      struct vmm_mbuf *mbuf)
 {
 	int rc;
+	u32 prio;
 	irq_flags_t f;
+	struct vmm_netswitch_bh_ctrl *nbp;
 
 	if (!nsw || !dst || !mbuf) {
 		return VMM_EFAIL;
@@ -391,13 +1003,54 @@ int vmm_switch2port_xfer_mbuf(struct vmm_netswitch *nsw,
 	/* Print debug info */
 	DPRINTF("%s: nsw=%s dst=%s\n", __func__, nsw->name, dst->name);
 
+	/* Record output port of flow being resolved by policy */
+	nbp = &this_cpu(nbctrl);
+	if ((nbp->flow_nsw == nsw) && netswitch_bh_context(nbp)) {
+		if (nbp->flow_nports < NETSWITCH_FLOW_MAX_PORTS) {
+			nbp->flow_ports[nbp->flow_nports] = dst;
+		}
+		nbp->flow_nports++;
+	}
+
 	if (dst->can_receive && !dst->can_receive(dst)) {
 		return VMM_OK;
 	}
 
+	/* Rate limiting of destination port */
+	prio = netswitch_mbuf_prio(mbuf);
+	rc = vmm_netport_rate_check(&dst->egress, netswitch_mbuf_len(mbuf));
+	switch (rc) {
+	case VMM_NETPORT_RATE_DROP:
+		return VMM_OK;
+	case VMM_NETPORT_RATE_MARK:
+		prio = VMM_NETPORT_NR_PRIO - 1;
+		break;
+	default:
+		break;
+	}
+
+	if (((mbuf->m_flags & M_EXT_GUEST) &&
+	     !(dst->features & VMM_NETPORT_F_GUEST_MBUF)) ||
+	    netswitch_need_sw_offload(dst, mbuf)) {
+		return netswitch_xfer_sw_offload(dst, mbuf);
+	}
+
 	MADDREFERENCE(mbuf);
 	MCLADDREFERENCE(mbuf);
 
+	/* Defer transfer till end of batch in bottom-half context */
+	if (nbp->xfer_defer && netswitch_bh_context(nbp)) {
+		if (nbp->xfer_count == NETSWITCH_BH_XFER_BATCH) {
+			netswitch_bh_xfer_flush(nbp);
+		}
+		nbp->xfer[nbp->xfer_count].port = dst;
+		nbp->xfer[nbp->xfer_count].mbuf = mbuf;
+		nbp->xfer[nbp->xfer_count].prio = prio;
+		nbp->xfer_count++;
+		return VMM_OK;
+	}
+
+	dst->prio_pkts[prio]++;
 	vmm_spin_lock_irqsave_lite(&dst->switch2port_xfer_lock, f);
 	rc = dst->switch2port_xfer(dst, mbuf);
 	vmm_spin_unlock_irqrestore_lite(&dst->switch2port_xfer_lock, f);
@@ -427,10 +1080,32 @@ struct vmm_netswitch *vmm_netswitch_alloc(struct vmm_netswitch_policy *nsp,
 	INIT_RW_LOCK(&nsw->port_list_lock);
 	INIT_LIST_HEAD(&nsw->port_list);
 
+	INIT_SPIN_LOCK(&nsw->flow_lock);
+	nsw->flow_gen = 1;
+	nsw->flow_count = CONFIG_NET_FLOW_CACHE_SIZE;
+	if (nsw->flow_count) {
+		nsw->flows = vmm_zalloc(sizeof(struct vmm_netswitch_flow) *
+					nsw->flow_count);
+		nsw->flow_stats = vmm_zalloc(
+				sizeof(struct vmm_netswitch_flow_stats) *
+				CONFIG_CPU_COUNT);
+		if (!nsw->flows || !nsw->flow_stats) {
+			vmm_printf("%s Failed to allocate flow cache\n",
+				   __func__);
+			goto vmm_netswitch_alloc_failed;
+		}
+	}
+
 	goto vmm_netswitch_alloc_done;
 
 vmm_netswitch_alloc_failed:
 	if (nsw) {
+		if (nsw->flow_stats) {
+			vmm_free(nsw->flow_stats);
+		}
+		if (nsw->flows) {
+			vmm_free(nsw->flows);
+		}
 		vmm_free(nsw);
 		nsw = NULL;
 	}
@@ -442,6 +1117,12 @@ VMM_EXPORT_SYMBOL(vmm_netswitch_alloc);
 void vmm_netswitch_free(struct vmm_netswitch *nsw)
 {
 	if (nsw) {
+		if (nsw->flow_stats) {
+			vmm_free(nsw->flow_stats);
+		}
+		if (nsw->flows) {
+			vmm_free(nsw->flows);
+		}
 		vmm_free(nsw);
 	}
 }
@@ -471,6 +1152,9 @@ int vmm_netswitch_port_add(struct vmm_netswitch *nsw,
 		/* Mark this port to belong to the netswitch */
 		port->nsw = nsw;
 
+		/* Cached flows don't know about new port */
+		vmm_netswitch_flow_flush(nsw);
+
 		/* Notify the port about the link-status change */
 		port->flags |= VMM_NETPORT_LINK_UP;
 		port->link_changed(port);
@@ -493,6 +1177,7 @@ static void netswitch_port_remove(struct vmm_netswitch *nsw,
 				  struct vmm_netport *port)
 {
 	u32 c;
+	bool can_wait;
 	irq_flags_t f;
 	struct vmm_netswitch_bh_ctrl *nbp;
 
@@ -503,10 +1188,27 @@ static void netswitch_port_remove(struct vmm_netswitch *nsw,
 	/* Mark the port to belong to NULL netswitch */
 	port->nsw = NULL;
 
-	/* Flush all xfer request related to this port */
+	/* Drop cached flows before waiting for in-flight batches */
+	vmm_netswitch_flow_flush(nsw);
+
+	/* Flush all xfer request related to this port and wait for
+	 * batches already grabbed by bottom-half threads. Contexts which
+	 * cannot sleep on batch_lock (including bottom-half threads) keep
+	 * the port allocated till those batches are completed.
+	 */
+	can_wait = (vmm_scheduler_orphan_context() &&
+		    !netswitch_bh_context(&this_cpu(nbctrl))) ? TRUE : FALSE;
 	for_each_online_cpu(c) {
 		nbp = &per_cpu(nbctrl, c);
 		netswitch_bh_port_flush(nbp, port);
+		if (!nbp->thread) {
+			continue;
+		}
+		if (can_wait) {
+			netswitch_bh_batch_wait(nbp);
+		} else {
+			netswitch_bh_port_release(nbp, port);
+		}
 	}
 
 	/* Remove the port from port_list */
@@ -878,6 +1580,8 @@ static void vmm_netswitch_percpu_init(void *a1, void *a2, void *a3)
 	u32 cpu = vmm_smp_processor_id();
 	struct vmm_netswitch_bh_ctrl *nbp = &per_cpu(nbctrl, cpu);
 
+	netswitch_bh_init(nbp);
+
 	vmm_snprintf(name, sizeof(name), "%s/%d",
 		     VMM_NETSWITCH_CLASS_NAME, cpu);
 
@@ -894,11 +1598,10 @@ static void vmm_netswitch_percpu_init(void *a1, void *a2, void *a3)
 		vmm_printf("%s: CPU%d: Failed to set thread affinity\n",
 			   __func__, cpu);
 		vmm_threads_destroy(nbp->thread);
+		nbp->thread = NULL;
 		return;
 	}
 
-	netswitch_bh_init(nbp);
-
 	vmm_threads_start(nbp->thread);
 }
 
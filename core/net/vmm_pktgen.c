@@ -0,0 +1,626 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file vmm_pktgen.c
+ * @author agent (agent@local)
+ * @brief Packet generator and sink netport for benchmarking.
+ */
+
+#include <vmm_error.h>
+#include <vmm_heap.h>
+#include <vmm_stdio.h>
+#include <vmm_timer.h>
+#include <vmm_mutex.h>
+#include <vmm_threads.h>
+#include <vmm_scheduler.h>
+#include <vmm_completion.h>
+#include <vmm_delay.h>
+#include <vmm_modules.h>
+#include <arch_atomic.h>
+#include <net/vmm_mbuf.h>
+#include <net/vmm_protocol.h>
+#include <net/vmm_netport.h>
+#include <net/vmm_netswitch.h>
+#include <net/vmm_pktgen.h>
+#include <libs/bitops.h>
+#include <libs/mempool.h>
+#include <libs/mathlib.h>
+#include <libs/stringlib.h>
+
+/* Frame buffers per pktgen (limits frames in flight) */
+#define PKTGEN_POOL_SIZE		256
+#define PKTGEN_BUF_SIZE			1536
+
+/* Pacing gaps larger than this are slept instead of spun */
+#define PKTGEN_SLEEP_NSECS		1000000ULL
+
+#define PKTGEN_MAGIC			0x706b7467
+
+/*
+ * Latency histogram with 8 linear sub-buckets for each power of two
+ * so that percentiles are accurate to 12.5%. Latencies of 2^41 nsecs
+ * or more land in the last bucket.
+ */
+#define PKTGEN_LAT_SUB_SHIFT		3
+#define PKTGEN_LAT_SUB			(1 << PKTGEN_LAT_SUB_SHIFT)
+#define PKTGEN_LAT_MAX_SHIFT		40
+#define PKTGEN_LAT_BUCKETS		\
+	((PKTGEN_LAT_MAX_SHIFT - PKTGEN_LAT_SUB_SHIFT + 2) << \
+	 PKTGEN_LAT_SUB_SHIFT)
+
+/* Payload carried by generated frames after ethernet header */
+struct pktgen_payload {
+	u32 magic;
+	u32 reserved;
+	u64 seq;
+	u64 tstamp;
+};
+
+struct vmm_pktgen {
+	struct dlist head;
+	atomic_t ref;
+	struct vmm_netport *port;
+	struct mempool *pool;
+
+	/* Generator state (protected by lock) */
+	struct vmm_mutex lock;
+	struct vmm_thread *thread;
+	struct vmm_completion done;
+	volatile bool running;
+	struct vmm_pktgen_params params;
+	u64 tx_pkts;
+	u64 tx_bytes;
+	u64 tx_nobufs;
+	u64 tx_start;
+	u64 tx_end;
+
+	/* Sink state (protected by switch2port_xfer_lock of port) */
+	u64 rx_pkts;
+	u64 rx_bytes;
+	u64 rx_other;
+	u64 rx_first;
+	u64 rx_last;
+	u64 lat_min;
+	u64 lat_max;
+	u64 lat_sum;
+	u64 lat_hist[PKTGEN_LAT_BUCKETS];
+};
+
+static DEFINE_MUTEX(pktgen_list_lock);
+static LIST_HEAD(pktgen_list);
+
+static void pktgen_put(struct vmm_pktgen *pg)
+{
+	if (arch_atomic_sub_return(&pg->ref, 1)) {
+		return;
+	}
+
+	mempool_destroy(pg->pool);
+	vmm_free(pg);
+}
+
+static void pktgen_ext_free(struct vmm_mbuf *m, void *buf,
+			    u32 len, void *arg)
+{
+	struct vmm_pktgen *pg = arg;
+
+	mempool_free(pg->pool, buf);
+	pktgen_put(pg);
+}
+
+static u32 pktgen_lat_bucket(u64 lat)
+{
+	u32 msb;
+
+	if (lat < PKTGEN_LAT_SUB) {
+		return lat;
+	}
+
+	msb = fls64(lat) - 1;
+	if (msb > PKTGEN_LAT_MAX_SHIFT) {
+		return PKTGEN_LAT_BUCKETS - 1;
+	}
+
+	return ((msb - PKTGEN_LAT_SUB_SHIFT + 1) << PKTGEN_LAT_SUB_SHIFT) +
+	       ((lat >> (msb - PKTGEN_LAT_SUB_SHIFT)) & (PKTGEN_LAT_SUB - 1));
+}
+
+static u64 pktgen_lat_bucket_base(u32 idx)
+{
+	u32 msb;
+
+	if (idx < PKTGEN_LAT_SUB) {
+		return idx;
+	}
+
+	msb = (idx >> PKTGEN_LAT_SUB_SHIFT) + PKTGEN_LAT_SUB_SHIFT - 1;
+
+	return (u64)(PKTGEN_LAT_SUB + (idx & (PKTGEN_LAT_SUB - 1))) <<
+					(msb - PKTGEN_LAT_SUB_SHIFT);
+}
+
+static int pktgen_switch2port_xfer(struct vmm_netport *port,
+				   struct vmm_mbuf *mbuf)
+{
+	u16 etype;
+	u32 off, len;
+	u64 lat, now = vmm_timer_timestamp();
+	u8 hdr[ETHER_HLEN + 4];
+	struct pktgen_payload pl;
+	struct vmm_pktgen *pg = port->priv;
+
+	len = (mbuf->m_flags & M_PKTHDR) ? mbuf->m_pktlen : mbuf->m_len;
+	if (len < (sizeof(hdr) + sizeof(pl))) {
+		goto other;
+	}
+
+	m_copydata(mbuf, 0, sizeof(hdr), hdr);
+	off = ETHER_HLEN;
+	etype = ether_type(hdr);
+	if (etype == 0x8100) {
+		etype = ((u16)hdr[16] << 8) | hdr[17];
+		off += 4;
+	}
+	if (etype != VMM_PKTGEN_ETHER_TYPE) {
+		goto other;
+	}
+
+	m_copydata(mbuf, off, sizeof(pl), &pl);
+	if (pl.magic != PKTGEN_MAGIC) {
+		goto other;
+	}
+
+	lat = (now > pl.tstamp) ? now - pl.tstamp : 0;
+	if (!pg->rx_pkts) {
+		pg->rx_first = now;
+		pg->lat_min = lat;
+	}
+	pg->rx_last = now;
+	pg->rx_pkts++;
+	pg->rx_bytes += len;
+	pg->lat_min = min(pg->lat_min, lat);
+	pg->lat_max = max(pg->lat_max, lat);
+	pg->lat_sum += lat;
+	pg->lat_hist[pktgen_lat_bucket(lat)]++;
+
+	m_freem(mbuf);
+	return VMM_OK;
+
+other:
+	pg->rx_other++;
+	m_freem(mbuf);
+	return VMM_OK;
+}
+
+/* Add val to lower 24 bits of a MAC address */
+static void pktgen_mac_add(u8 *mac, u32 val)
+{
+	val += ((u32)mac[3] << 16) | ((u32)mac[4] << 8) | mac[5];
+	mac[3] = (val >> 16) & 0xff;
+	mac[4] = (val >> 8) & 0xff;
+	mac[5] = val & 0xff;
+}
+
+static struct vmm_mbuf *pktgen_build(struct vmm_pktgen *pg, u64 seq)
+{
+	u8 *buf;
+	u32 off;
+	struct vmm_mbuf *m;
+	struct pktgen_payload pl;
+	struct vmm_pktgen_params *p = &pg->params;
+
+	buf = mempool_malloc(pg->pool);
+	if (!buf) {
+		return NULL;
+	}
+
+	MGETHDR(m, 0, 0);
+	if (!m) {
+		mempool_free(pg->pool, buf);
+		return NULL;
+	}
+	arch_atomic_add(&pg->ref, 1);
+	MEXTADD(m, buf, PKTGEN_BUF_SIZE, pktgen_ext_free, pg);
+
+	memcpy(buf, p->dstmac, 6);
+	if (p->dstmac_count > 1) {
+		pktgen_mac_add(buf, umod64(seq, p->dstmac_count));
+	}
+	memcpy(buf + 6, vmm_netport_mac(pg->port), 6);
+	if (p->srcmac_count > 1) {
+		pktgen_mac_add(buf + 6, umod64(seq, p->srcmac_count));
+	}
+
+	off = 12;
+	if (p->vlan_id) {
+		buf[off++] = 0x81;
+		buf[off++] = 0x00;
+		buf[off++] = (p->vlan_prio << 5) | ((p->vlan_id >> 8) & 0xf);
+		buf[off++] = p->vlan_id & 0xff;
+	}
+	buf[off++] = (VMM_PKTGEN_ETHER_TYPE >> 8) & 0xff;
+	buf[off++] = VMM_PKTGEN_ETHER_TYPE & 0xff;
+
+	pl.magic = PKTGEN_MAGIC;
+	pl.reserved = 0;
+	pl.seq = seq;
+	pl.tstamp = vmm_timer_timestamp();
+	memcpy(buf + off, &pl, sizeof(pl));
+
+	m->m_len = m->m_pktlen = p->size;
+
+	return m;
+}
+
+static int pktgen_tx_main(void *data)
+{
+	u32 len;
+	u64 now, due, seq = 0;
+	struct vmm_mbuf *m;
+	struct vmm_pktgen *pg = data;
+	struct vmm_pktgen_params *p = &pg->params;
+
+	pg->tx_start = vmm_timer_timestamp();
+
+	while (pg->running && (!p->count || (seq < p->count))) {
+		/* Pace frames when rate is specified */
+		if (p->rate) {
+			due = pg->tx_start +
+			      udiv64(seq * 1000000000ULL, p->rate);
+			now = vmm_timer_timestamp();
+			if (now < due) {
+				if ((due - now) > PKTGEN_SLEEP_NSECS) {
+					vmm_usleep(udiv64(due - now, 1000));
+				} else {
+					vmm_scheduler_yield();
+				}
+				continue;
+			}
+		}
+
+		/* Back off when all frame buffers are in flight */
+		m = pktgen_build(pg, seq);
+		if (!m) {
+			pg->tx_nobufs++;
+			vmm_scheduler_yield();
+			continue;
+		}
+
+		len = m->m_pktlen;
+		if (vmm_port2switch_xfer_mbuf(pg->port, m)) {
+			break;
+		}
+
+		pg->tx_pkts++;
+		pg->tx_bytes += len;
+		seq++;
+	}
+
+	pg->tx_end = vmm_timer_timestamp();
+	pg->running = FALSE;
+	vmm_completion_complete(&pg->done);
+
+	return VMM_OK;
+}
+
+/* Reap generator thread (must be called with pg->lock held) */
+static void pktgen_tx_reap(struct vmm_pktgen *pg)
+{
+	if (!pg->thread) {
+		return;
+	}
+
+	pg->running = FALSE;
+	vmm_completion_wait(&pg->done);
+	vmm_threads_stop(pg->thread);
+	vmm_threads_destroy(pg->thread);
+	pg->thread = NULL;
+}
+
+struct vmm_pktgen *vmm_pktgen_create(const char *name,
+				     struct vmm_netswitch *nsw)
+{
+	int rc;
+	struct vmm_pktgen *pg;
+
+	if (!name || !nsw) {
+		return NULL;
+	}
+
+	if (vmm_pktgen_find(name)) {
+		return NULL;
+	}
+
+	pg = vmm_zalloc(sizeof(*pg));
+	if (!pg) {
+		return NULL;
+	}
+	INIT_LIST_HEAD(&pg->head);
+	ARCH_ATOMIC_INIT(&pg->ref, 1);
+	INIT_MUTEX(&pg->lock);
+	INIT_COMPLETION(&pg->done);
+
+	pg->pool = mempool_heap_create(PKTGEN_BUF_SIZE, PKTGEN_POOL_SIZE);
+	if (!pg->pool) {
+		goto fail_free_pg;
+	}
+
+	pg->port = vmm_netport_alloc((char *)name,
+				     VMM_NETPORT_DEF_QUEUE_SIZE);
+	if (!pg->port) {
+		goto fail_free_pool;
+	}
+	pg->port->mtu = VMM_PKTGEN_MAX_SIZE;
+	pg->port->features = VMM_NETPORT_F_CSUM |
+			     VMM_NETPORT_F_TSO4 |
+			     VMM_NETPORT_F_TSO6 |
+			     VMM_NETPORT_F_GUEST_MBUF;
+	pg->port->switch2port_xfer = pktgen_switch2port_xfer;
+	pg->port->priv = pg;
+
+	rc = vmm_netport_register(pg->port);
+	if (rc) {
+		goto fail_free_port;
+	}
+
+	rc = vmm_netswitch_port_add(nsw, pg->port);
+	if (rc) {
+		goto fail_unreg_port;
+	}
+
+	vmm_mutex_lock(&pktgen_list_lock);
+	list_add_tail(&pg->head, &pktgen_list);
+	vmm_mutex_unlock(&pktgen_list_lock);
+
+	return pg;
+
+fail_unreg_port:
+	vmm_netport_unregister(pg->port);
+fail_free_port:
+	vmm_netport_free(pg->port);
+fail_free_pool:
+	mempool_destroy(pg->pool);
+fail_free_pg:
+	vmm_free(pg);
+	return NULL;
+}
+VMM_EXPORT_SYMBOL(vmm_pktgen_create);
+
+int vmm_pktgen_destroy(struct vmm_pktgen *pg)
+{
+	if (!pg) {
+		return VMM_EINVALID;
+	}
+
+	vmm_mutex_lock(&pktgen_list_lock);
+	list_del(&pg->head);
+	vmm_mutex_unlock(&pktgen_list_lock);
+
+	vmm_mutex_lock(&pg->lock);
+	pktgen_tx_reap(pg);
+	vmm_mutex_unlock(&pg->lock);
+
+	if (pg->port->nsw) {
+		vmm_netswitch_port_remove(pg->port);
+	}
+	vmm_netport_unregister(pg->port);
+	vmm_netport_free(pg->port);
+	pg->port = NULL;
+
+	/* Frames still in flight hold reference to frame buffers */
+	pktgen_put(pg);
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(vmm_pktgen_destroy);
+
+struct vmm_pktgen *vmm_pktgen_find(const char *name)
+{
+	bool found = FALSE;
+	struct vmm_pktgen *pg;
+
+	if (!name) {
+		return NULL;
+	}
+
+	vmm_mutex_lock(&pktgen_list_lock);
+	list_for_each_entry(pg, &pktgen_list, head) {
+		if (strcmp(pg->port->name, name) == 0) {
+			found = TRUE;
+			break;
+		}
+	}
+	vmm_mutex_unlock(&pktgen_list_lock);
+
+	return (found) ? pg : NULL;
+}
+VMM_EXPORT_SYMBOL(vmm_pktgen_find);
+
+int vmm_pktgen_iterate(void *data,
+		       int (*fn)(struct vmm_pktgen *pg, void *data))
+{
+	int rc = VMM_OK;
+	struct vmm_pktgen *pg;
+
+	if (!fn) {
+		return VMM_EINVALID;
+	}
+
+	vmm_mutex_lock(&pktgen_list_lock);
+	list_for_each_entry(pg, &pktgen_list, head) {
+		rc = fn(pg, data);
+		if (rc) {
+			break;
+		}
+	}
+	vmm_mutex_unlock(&pktgen_list_lock);
+
+	return rc;
+}
+VMM_EXPORT_SYMBOL(vmm_pktgen_iterate);
+
+struct vmm_netport *vmm_pktgen_port(struct vmm_pktgen *pg)
+{
+	return (pg) ? pg->port : NULL;
+}
+VMM_EXPORT_SYMBOL(vmm_pktgen_port);
+
+int vmm_pktgen_start(struct vmm_pktgen *pg,
+		     const struct vmm_pktgen_params *params)
+{
+	int rc = VMM_OK;
+
+	if (!pg || !params ||
+	    (params->size < VMM_PKTGEN_MIN_SIZE) ||
+	    (params->size > VMM_PKTGEN_MAX_SIZE) ||
+	    (params->vlan_id > 4095) || (params->vlan_prio > 7)) {
+		return VMM_EINVALID;
+	}
+
+	vmm_mutex_lock(&pg->lock);
+
+	if (pg->running) {
+		rc = VMM_EBUSY;
+		goto done;
+	}
+	pktgen_tx_reap(pg);
+
+	memcpy(&pg->params, params, sizeof(pg->params));
+	pg->tx_pkts = pg->tx_bytes = pg->tx_nobufs = 0;
+	pg->tx_start = pg->tx_end = 0;
+	REINIT_COMPLETION(&pg->done);
+
+	pg->thread = vmm_threads_create(pg->port->name, pktgen_tx_main, pg,
+					VMM_THREAD_DEF_PRIORITY,
+					VMM_THREAD_DEF_TIME_SLICE);
+	if (!pg->thread) {
+		rc = VMM_ENOMEM;
+		goto done;
+	}
+
+	pg->running = TRUE;
+	rc = vmm_threads_start(pg->thread);
+	if (rc) {
+		pg->running = FALSE;
+		vmm_threads_destroy(pg->thread);
+		pg->thread = NULL;
+	}
+
+done:
+	vmm_mutex_unlock(&pg->lock);
+	return rc;
+}
+VMM_EXPORT_SYMBOL(vmm_pktgen_start);
+
+int vmm_pktgen_stop(struct vmm_pktgen *pg)
+{
+	if (!pg) {
+		return VMM_EINVALID;
+	}
+
+	vmm_mutex_lock(&pg->lock);
+	pktgen_tx_reap(pg);
+	vmm_mutex_unlock(&pg->lock);
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(vmm_pktgen_stop);
+
+int vmm_pktgen_reset(struct vmm_pktgen *pg)
+{
+	irq_flags_t f;
+
+	if (!pg) {
+		return VMM_EINVALID;
+	}
+
+	vmm_mutex_lock(&pg->lock);
+	if (!pg->running) {
+		pg->tx_pkts = pg->tx_bytes = pg->tx_nobufs = 0;
+		pg->tx_start = pg->tx_end = 0;
+	}
+	vmm_mutex_unlock(&pg->lock);
+
+	vmm_spin_lock_irqsave_lite(&pg->port->switch2port_xfer_lock, f);
+	pg->rx_pkts = pg->rx_bytes = pg->rx_other = 0;
+	pg->rx_first = pg->rx_last = 0;
+	pg->lat_min = pg->lat_max = pg->lat_sum = 0;
+	memset(pg->lat_hist, 0, sizeof(pg->lat_hist));
+	vmm_spin_unlock_irqrestore_lite(&pg->port->switch2port_xfer_lock, f);
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(vmm_pktgen_reset);
+
+int vmm_pktgen_stats_get(struct vmm_pktgen *pg,
+			 struct vmm_pktgen_stats *stats)
+{
+	u32 i, p;
+	u64 cnt, target;
+	irq_flags_t f;
+	u64 *lat[] = { &stats->lat_p50, &stats->lat_p90,
+		       &stats->lat_p99, &stats->lat_p999 };
+	const u32 permille[] = { 500, 900, 990, 999 };
+
+	if (!pg || !stats) {
+		return VMM_EINVALID;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	stats->running = pg->running;
+	stats->tx_pkts = pg->tx_pkts;
+	stats->tx_bytes = pg->tx_bytes;
+	stats->tx_nobufs = pg->tx_nobufs;
+	if (pg->tx_start) {
+		stats->tx_nsecs = ((stats->running) ?
+			vmm_timer_timestamp() : pg->tx_end) - pg->tx_start;
+	}
+
+	vmm_spin_lock_irqsave_lite(&pg->port->switch2port_xfer_lock, f);
+
+	stats->rx_pkts = pg->rx_pkts;
+	stats->rx_bytes = pg->rx_bytes;
+	stats->rx_nsecs = pg->rx_last - pg->rx_first;
+	stats->rx_other = pg->rx_other;
+	if (pg->rx_pkts) {
+		stats->lat_min = pg->lat_min;
+		stats->lat_avg = udiv64(pg->lat_sum, pg->rx_pkts);
+		stats->lat_max = pg->lat_max;
+
+		cnt = 0;
+		p = 0;
+		for (i = 0; (i < PKTGEN_LAT_BUCKETS) &&
+			    (p < array_size(permille)); i++) {
+			cnt += pg->lat_hist[i];
+			while (p < array_size(permille)) {
+				target = udiv64(pg->rx_pkts * permille[p] + 999,
+						1000);
+				if (cnt < target) {
+					break;
+				}
+				*lat[p++] = pktgen_lat_bucket_base(i);
+			}
+		}
+	}
+
+	vmm_spin_unlock_irqrestore_lite(&pg->port->switch2port_xfer_lock, f);
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(vmm_pktgen_stats_get);
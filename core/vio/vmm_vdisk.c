@@ -109,6 +109,12 @@ void vmm_vdisk_set_request_type(struct vmm_vdisk_request *vreq,
 	case VMM_VDISK_REQUEST_WRITE:
 		vreq->r.type = VMM_REQUEST_WRITE;
 		break;
+	case VMM_VDISK_REQUEST_DISCARD:
+		vreq->r.type = VMM_REQUEST_DISCARD;
+		break;
+	case VMM_VDISK_REQUEST_WRITE_ZEROES:
+		vreq->r.type = VMM_REQUEST_WRITE_ZEROES;
+		break;
 	default:
 		vreq->r.type = VMM_REQUEST_UNKNOWN;
 		break;
@@ -131,6 +137,12 @@ enum vmm_vdisk_request_type vmm_vdisk_get_request_type(
 	case VMM_REQUEST_WRITE:
 		type = VMM_VDISK_REQUEST_WRITE;
 		break;
+	case VMM_REQUEST_DISCARD:
+		type = VMM_VDISK_REQUEST_DISCARD;
+		break;
+	case VMM_REQUEST_WRITE_ZEROES:
+		type = VMM_VDISK_REQUEST_WRITE_ZEROES;
+		break;
 	default:
 		type = VMM_VDISK_REQUEST_UNKNOWN;
 		break;
@@ -150,10 +162,10 @@ void vmm_vdisk_set_request_len(struct vmm_vdisk_request *vreq, u32 data_len)
 	}
 
 	vdisk = vreq->vdisk;
-	vmm_spin_lock_irqsave_lite(&vdisk->blk_lock, flags);
+	vmm_read_lock_irqsave_lite(&vdisk->blk_lock, flags);
 	vreq->r.bcnt =
 		udiv32(data_len, vdisk->block_size) * vdisk->blk_factor;
-	vmm_spin_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
+	vmm_read_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
 }
 VMM_EXPORT_SYMBOL(vmm_vdisk_set_request_len);
 
@@ -168,34 +180,39 @@ u32 vmm_vdisk_get_request_len(struct vmm_vdisk_request *vreq)
 	}
 
 	vdisk = vreq->vdisk;
-	vmm_spin_lock_irqsave_lite(&vdisk->blk_lock, flags);
+	vmm_read_lock_irqsave_lite(&vdisk->blk_lock, flags);
 	ret = udiv32(vreq->r.bcnt, vdisk->blk_factor) * vdisk->block_size;
-	vmm_spin_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
+	vmm_read_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
 
 	return ret;
 }
 VMM_EXPORT_SYMBOL(vmm_vdisk_get_request_len);
 
-int vmm_vdisk_submit_request(struct vmm_vdisk *vdisk,
-			     struct vmm_vdisk_request *vreq,
-			     enum vmm_vdisk_request_type type,
-			     u64 lba, void *data, u32 data_len)
+static int vdisk_submit_request(struct vmm_vdisk *vdisk,
+				struct vmm_vdisk_request *vreq,
+				enum vmm_vdisk_request_type type,
+				u64 lba, void *data,
+				struct vmm_request_sg *sg, u32 sg_cnt,
+				u32 data_len)
 {
 	int rc;
 	irq_flags_t flags;
 
-	if (!vdisk || !vreq || !data) {
+	if (!vdisk || !vreq) {
 		return VMM_EINVALID;
 	}
 	if (data_len < vdisk->block_size) {
 		return VMM_EINVALID;
 	}
 	if ((type < VMM_VDISK_REQUEST_READ) ||
-	    (VMM_VDISK_REQUEST_WRITE < type)) {
+	    (VMM_VDISK_REQUEST_WRITE_ZEROES < type)) {
+		return VMM_EINVALID;
+	}
+	if ((type <= VMM_VDISK_REQUEST_WRITE) && !data && !sg_cnt) {
 		return VMM_EINVALID;
 	}
 
-	vmm_spin_lock_irqsave_lite(&vdisk->blk_lock, flags);
+	vmm_read_lock_irqsave_lite(&vdisk->blk_lock, flags);
 	if (vdisk->blk) {
 		vreq->vdisk = vdisk;
 		vmm_vdisk_set_request_type(vreq, type);
@@ -203,6 +220,8 @@ int vmm_vdisk_submit_request(struct vmm_vdisk *vdisk,
 		vreq->r.bcnt =
 			udiv32(data_len, vdisk->block_size) * vdisk->blk_factor;
 		vreq->r.data = data;
+		vreq->r.sg = sg;
+		vreq->r.sg_cnt = sg_cnt;
 		vreq->r.completed = vdisk_req_completed;
 		vreq->r.failed = vdisk_req_failed;
 		vreq->r.priv = NULL;
@@ -211,15 +230,58 @@ int vmm_vdisk_submit_request(struct vmm_vdisk *vdisk,
 		vdisk->failed(vdisk, vreq);
 		rc = VMM_ENODEV;
 	}
-	vmm_spin_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
+	vmm_read_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
 
 	DPRINTF("%s: vdisk=%s lba=0x%llx bcnt=%d rc=%d\n",
 		__func__, vdisk->name, (u64)vreq->r.lba, vreq->r.bcnt, rc);
 
 	return rc;
 }
+
+int vmm_vdisk_submit_request(struct vmm_vdisk *vdisk,
+			     struct vmm_vdisk_request *vreq,
+			     enum vmm_vdisk_request_type type,
+			     u64 lba, void *data, u32 data_len)
+{
+	if (!data) {
+		return VMM_EINVALID;
+	}
+
+	return vdisk_submit_request(vdisk, vreq, type, lba,
+				    data, NULL, 0, data_len);
+}
 VMM_EXPORT_SYMBOL(vmm_vdisk_submit_request);
 
+int vmm_vdisk_submit_request_sg(struct vmm_vdisk *vdisk,
+				struct vmm_vdisk_request *vreq,
+				enum vmm_vdisk_request_type type,
+				u64 lba, struct vmm_request_sg *sg,
+				u32 sg_cnt, u32 data_len)
+{
+	if (!sg || !sg_cnt) {
+		return VMM_EINVALID;
+	}
+
+	return vdisk_submit_request(vdisk, vreq, type, lba,
+				    NULL, sg, sg_cnt, data_len);
+}
+VMM_EXPORT_SYMBOL(vmm_vdisk_submit_request_sg);
+
+int vmm_vdisk_submit_request_range(struct vmm_vdisk *vdisk,
+				   struct vmm_vdisk_request *vreq,
+				   enum vmm_vdisk_request_type type,
+				   u64 lba, u32 data_len)
+{
+	if ((type != VMM_VDISK_REQUEST_DISCARD) &&
+	    (type != VMM_VDISK_REQUEST_WRITE_ZEROES)) {
+		return VMM_EINVALID;
+	}
+
+	return vdisk_submit_request(vdisk, vreq, type, lba,
+				    NULL, NULL, 0, data_len);
+}
+VMM_EXPORT_SYMBOL(vmm_vdisk_submit_request_range);
+
 int vmm_vdisk_abort_request(struct vmm_vdisk *vdisk,
 			    struct vmm_vdisk_request *vreq)
 {
@@ -233,13 +295,13 @@ int vmm_vdisk_abort_request(struct vmm_vdisk *vdisk,
 		return VMM_EINVALID;
 	}
 
-	vmm_spin_lock_irqsave_lite(&vdisk->blk_lock, flags);
+	vmm_read_lock_irqsave_lite(&vdisk->blk_lock, flags);
 	if (vdisk->blk) {
 		rc = vmm_blockdev_abort_request(&vreq->r);
 	} else {
 		rc = VMM_ENODEV;
 	}
-	vmm_spin_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
+	vmm_read_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
 
 	DPRINTF("%s: vdisk=%s lba=0x%llx bcnt=%d rc=%d\n",
 		__func__, vdisk->name, (u64)vreq->r.lba, vreq->r.bcnt, rc);
@@ -257,13 +319,13 @@ int vmm_vdisk_flush_cache(struct vmm_vdisk *vdisk)
 		return VMM_EINVALID;
 	}
 
-	vmm_spin_lock_irqsave_lite(&vdisk->blk_lock, flags);
+	vmm_read_lock_irqsave_lite(&vdisk->blk_lock, flags);
 	if (vdisk->blk) {
 		rc = vmm_blockdev_flush_cache(vdisk->blk);
 	} else {
 		rc = VMM_ENODEV;
 	}
-	vmm_spin_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
+	vmm_read_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
 
 	DPRINTF("%s: vdisk=%s rc=%d\n",
 		__func__, vdisk->name, rc);
@@ -281,14 +343,14 @@ u64 vmm_vdisk_capacity(struct vmm_vdisk *vdisk)
 		return 0;
 	}
 
-	vmm_spin_lock_irqsave_lite(&vdisk->blk_lock, flags);
+	vmm_read_lock_irqsave_lite(&vdisk->blk_lock, flags);
 	if (vdisk->blk) {
 		ret = udiv64(vdisk->blk->num_blocks, vdisk->blk_factor);
 	} else {
 		ret = 0;
 	}
 	ret = (vdisk->blk) ? vdisk->blk->num_blocks : 0;
-	vmm_spin_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
+	vmm_read_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
 
 	return ret;
 }
@@ -304,14 +366,14 @@ int vmm_vdisk_current_block_device(struct vmm_vdisk *vdisk,
 		return VMM_EINVALID;
 	}
 
-	vmm_spin_lock_irqsave_lite(&vdisk->blk_lock, flags);
+	vmm_read_lock_irqsave_lite(&vdisk->blk_lock, flags);
 	if (vdisk->blk) {
 		strncpy(name, vdisk->blk->name, name_len);
 		rc = VMM_OK;
 	} else {
 		rc = VMM_ENODEV;
 	}
-	vmm_spin_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
+	vmm_read_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
 
 	return rc;
 }
@@ -332,7 +394,7 @@ static int vdisk_attach_iter(struct vmm_blockdev *dev, void *data)
 
 	if (strncmp(dev->name, bdev_name, sizeof(dev->name))==0) {
 		attached = FALSE;
-		vmm_spin_lock_irqsave_lite(&vdisk->blk_lock, flags);
+		vmm_write_lock_irqsave_lite(&vdisk->blk_lock, flags);
 		if (!vdisk->blk &&
 		    (dev->block_size <= vdisk->block_size) &&
 		    !umod32(vdisk->block_size, dev->block_size)) {
@@ -341,7 +403,7 @@ static int vdisk_attach_iter(struct vmm_blockdev *dev, void *data)
 					           vdisk->blk->block_size);
 			attached = TRUE;
 		}
-		vmm_spin_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
+		vmm_write_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
 		if (attached && vdisk->attached) {
 			vdisk->attached(vdisk);
 		}
@@ -375,14 +437,14 @@ void vmm_vdisk_detach_block_device(struct vmm_vdisk *vdisk)
 	}
 
 	detached = FALSE;
-	vmm_spin_lock_irqsave_lite(&vdisk->blk_lock, flags);
+	vmm_write_lock_irqsave_lite(&vdisk->blk_lock, flags);
 	if (vdisk->blk) {
 		vmm_blockdev_flush_cache(vdisk->blk);
 		detached = TRUE;
 	}
 	vdisk->blk = NULL;
 	vdisk->blk_factor = 1;
-	vmm_spin_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
+	vmm_write_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
 
 	if (detached && vdisk->detached) {
 		vdisk->detached(vdisk);
@@ -440,7 +502,7 @@ struct vmm_vdisk *vmm_vdisk_create(const char *name, u32 block_size,
 	vdisk->detached = detached;
 	vdisk->completed = completed;
 	vdisk->failed = failed;
-	INIT_SPIN_LOCK(&vdisk->blk_lock);
+	INIT_RW_LOCK(&vdisk->blk_lock);
 	vdisk->blk = NULL;
 	vdisk->blk_factor = 1;
 	vdisk->priv = priv;
@@ -613,12 +675,12 @@ static int vdisk_blk_notification(struct vmm_notifier_block *nb,
 
 	/* Find virtual disk using block device */
 	list_for_each_entry(vdisk, &vdctrl.vdisk_list, head) {
-		vmm_spin_lock_irqsave_lite(&vdisk->blk_lock, flags);
+		vmm_write_lock_irqsave_lite(&vdisk->blk_lock, flags);
 		if (vdisk->blk == e->bdev) {
 			vdisk->blk = NULL;
 			vdisk->blk_factor = 1;
 		}
-		vmm_spin_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
+		vmm_write_unlock_irqrestore_lite(&vdisk->blk_lock, flags);
 	}
 
 	/* Unlock virtual disk list */
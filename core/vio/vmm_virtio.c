@@ -26,9 +26,19 @@
 #include <vmm_heap.h>
 #include <vmm_mutex.h>
 #include <vmm_stdio.h>
+#include <vmm_delay.h>
+#include <vmm_timer.h>
+#include <vmm_threads.h>
+#include <vmm_completion.h>
+#include <vmm_devtree.h>
+#include <vmm_devemu.h>
+#include <vmm_scheduler.h>
+#include <vmm_manager.h>
 #include <vmm_host_io.h>
+#include <vmm_host_aspace.h>
 #include <vmm_guest_aspace.h>
 #include <vmm_modules.h>
+#include <arch_barrier.h>
 #include <vio/vmm_virtio.h>
 #include <libs/mathlib.h>
 #include <libs/stringlib.h>
@@ -51,6 +61,386 @@ static LIST_HEAD(virtio_dev_list);
 
 static LIST_HEAD(virtio_emu_list);
 
+/* ========== Indirect descriptor helpers ========== */
+
+/*
+ * Translate an indirect descriptor table to guest IO vectors. Entries
+ * of split virtqueue table are chained using next field whereas entries
+ * of packed virtqueue table are used sequentially. The table itself can
+ * have at most desc_count entries and can span guest pages or regions
+ * because it is read entry-by-entry from guest memory.
+ */
+static int virtio_queue_indirect_iovec(struct vmm_virtio_queue *vq,
+				       u64 table_addr, u32 table_len,
+				       struct vmm_virtio_iovec *iov,
+				       u32 *ret_iov_cnt, u32 *ret_total_len)
+{
+	bool next;
+	u32 ret, i = 0, idx = 0, count, total_len = 0;
+	physical_addr_t desc_pa;
+	union {
+		struct vmm_vring_desc split;
+		struct vmm_vring_packed_desc packed;
+	} d;
+
+	if (!table_len ||
+	    (table_len & (sizeof(struct vmm_vring_desc) - 1))) {
+		vmm_printf("%s: invalid indirect table length=%d\n",
+			   __func__, table_len);
+		return VMM_EINVALID;
+	}
+
+	count = table_len / sizeof(struct vmm_vring_desc);
+	if (vq->desc_count < count) {
+		vmm_printf("%s: indirect table too large count=%d\n",
+			   __func__, count);
+		return VMM_EINVALID;
+	}
+
+	do {
+		if ((count <= idx) || (count <= i)) {
+			vmm_printf("%s: invalid indirect descriptor idx=%d\n",
+				   __func__, idx);
+			return VMM_EINVALID;
+		}
+
+		desc_pa = table_addr + idx * sizeof(struct vmm_vring_desc);
+		ret = vmm_guest_memory_read(vq->guest, desc_pa,
+					    &d, sizeof(d), TRUE);
+		if (ret != sizeof(d)) {
+			vmm_printf("%s: read failed at desc_pa=0x%"PRIPADDR"\n",
+				   __func__, desc_pa);
+			return VMM_EIO;
+		}
+
+		if (vq->packed) {
+			iov[i].addr = d.packed.addr;
+			iov[i].len = d.packed.len;
+			iov[i].flags =
+			(d.packed.flags & VMM_VRING_DESC_F_WRITE) ? 1 : 0;
+			next = (++idx < count) ? TRUE : FALSE;
+		} else {
+			if (d.split.flags & VMM_VRING_DESC_F_INDIRECT) {
+				vmm_printf("%s: nested indirect descriptor\n",
+					   __func__);
+				return VMM_EINVALID;
+			}
+			iov[i].addr = d.split.addr;
+			iov[i].len = d.split.len;
+			iov[i].flags =
+			(d.split.flags & VMM_VRING_DESC_F_WRITE) ? 1 : 0;
+			next = (d.split.flags & VMM_VRING_DESC_F_NEXT) ?
+				TRUE : FALSE;
+			idx = d.split.next;
+		}
+
+		total_len += iov[i].len;
+		i++;
+	} while (next);
+
+	*ret_iov_cnt = i;
+	*ret_total_len = total_len;
+
+	return VMM_OK;
+}
+
+/* ========== Packed virtqueue helpers ========== */
+
+#define VIRTIO_PACKED_DESC_F_AVAIL	(1 << VMM_VRING_PACKED_DESC_F_AVAIL)
+#define VIRTIO_PACKED_DESC_F_USED	(1 << VMM_VRING_PACKED_DESC_F_USED)
+
+static bool virtio_packed_desc_avail(u16 flags, bool wrap_counter)
+{
+	bool avail = (flags & VIRTIO_PACKED_DESC_F_AVAIL) ? TRUE : FALSE;
+	bool used = (flags & VIRTIO_PACKED_DESC_F_USED) ? TRUE : FALSE;
+
+	return (avail == wrap_counter) && (used != wrap_counter);
+}
+
+static int virtio_packed_read_flags(struct vmm_virtio_queue *vq,
+				    u16 indx, u16 *flags)
+{
+	u32 ret;
+	physical_addr_t desc_pa;
+
+	desc_pa = vq->vring.desc_pa +
+		  indx * sizeof(struct vmm_vring_packed_desc) +
+		  offsetof(struct vmm_vring_packed_desc, flags);
+	ret = vmm_guest_memory_read(vq->guest, desc_pa,
+				    flags, sizeof(*flags), TRUE);
+	if (ret != sizeof(*flags)) {
+		vmm_printf("%s: read failed at desc_pa=0x%"PRIPADDR"\n",
+			   __func__, desc_pa);
+		return VMM_EIO;
+	}
+
+	return VMM_OK;
+}
+
+static int virtio_packed_get_desc(struct vmm_virtio_queue *vq, u16 indx,
+				  struct vmm_vring_packed_desc *desc)
+{
+	u32 ret;
+	physical_addr_t desc_pa;
+
+	desc_pa = vq->vring.desc_pa + indx * sizeof(*desc);
+	ret = vmm_guest_memory_read(vq->guest, desc_pa,
+				    desc, sizeof(*desc), TRUE);
+	if (ret != sizeof(*desc)) {
+		return VMM_EIO;
+	}
+
+	return VMM_OK;
+}
+
+static bool virtio_packed_available(struct vmm_virtio_queue *vq)
+{
+	u16 flags;
+
+	if (virtio_packed_read_flags(vq, vq->last_avail_idx, &flags)) {
+		return FALSE;
+	}
+
+	return virtio_packed_desc_avail(flags, vq->avail_wrap_counter);
+}
+
+static bool virtio_packed_should_signal(struct vmm_virtio_queue *vq)
+{
+	u32 ret;
+	int off;
+	u16 old_idx, new_idx;
+	struct vmm_vring_packed_desc_event evt;
+
+	old_idx = vq->last_used_signalled;
+	new_idx = vq->last_used_signalled = vq->used_idx;
+
+	/* Driver event suppression structure lives in driver area */
+	ret = vmm_guest_memory_read(vq->guest, vq->vring.avail_pa,
+				    &evt, sizeof(evt), TRUE);
+	if (ret != sizeof(evt)) {
+		vmm_printf("%s: read failed at driver_pa=0x%"PRIPADDR"\n",
+			   __func__, vq->vring.avail_pa);
+		return FALSE;
+	}
+
+	if (evt.flags == VMM_VRING_PACKED_EVENT_FLAG_DISABLE) {
+		return FALSE;
+	} else if (evt.flags == VMM_VRING_PACKED_EVENT_FLAG_ENABLE) {
+		return TRUE;
+	}
+
+	off = evt.off_wrap & ~(1 << VMM_VRING_PACKED_EVENT_F_WRAP_CTR);
+	if (vq->used_wrap_counter !=
+	    (evt.off_wrap >> VMM_VRING_PACKED_EVENT_F_WRAP_CTR)) {
+		off -= vq->desc_count;
+	}
+
+	return vmm_vring_need_event(off, new_idx, old_idx) ? TRUE : FALSE;
+}
+
+static void virtio_packed_set_avail_event(struct vmm_virtio_queue *vq)
+{
+	u16 val;
+	u32 ret;
+	physical_addr_t device_pa;
+
+	val = vq->last_avail_idx;
+	if (vq->avail_wrap_counter) {
+		val |= (1 << VMM_VRING_PACKED_EVENT_F_WRAP_CTR);
+	}
+	device_pa = vq->vring.used_pa +
+		    offsetof(struct vmm_vring_packed_desc_event, off_wrap);
+	ret = vmm_guest_memory_write(vq->guest, device_pa,
+				     &val, sizeof(val), TRUE);
+	if (ret != sizeof(val)) {
+		vmm_printf("%s: write failed at device_pa=0x%"PRIPADDR"\n",
+			   __func__, device_pa);
+	}
+}
+
+static void virtio_packed_write_used(struct vmm_virtio_queue *vq,
+				     u16 idx, u16 id, u32 len)
+{
+	u32 ret;
+	physical_addr_t desc_pa;
+
+	desc_pa = vq->vring.desc_pa +
+		  idx * sizeof(struct vmm_vring_packed_desc);
+	ret = vmm_guest_memory_write(vq->guest, desc_pa +
+			offsetof(struct vmm_vring_packed_desc, id),
+			&id, sizeof(id), TRUE);
+	ret += vmm_guest_memory_write(vq->guest, desc_pa +
+			offsetof(struct vmm_vring_packed_desc, len),
+			&len, sizeof(len), TRUE);
+	if (ret != (sizeof(id) + sizeof(len))) {
+		vmm_printf("%s: write failed at desc_pa=0x%"PRIPADDR"\n",
+			   __func__, desc_pa);
+	}
+}
+
+static void virtio_packed_write_used_flags(struct vmm_virtio_queue *vq,
+					   u16 idx, bool wrap_counter)
+{
+	u32 ret;
+	u16 flags;
+	physical_addr_t desc_pa;
+
+	desc_pa = vq->vring.desc_pa +
+		  idx * sizeof(struct vmm_vring_packed_desc);
+	flags = (wrap_counter) ?
+		(VIRTIO_PACKED_DESC_F_AVAIL | VIRTIO_PACKED_DESC_F_USED) : 0;
+	ret = vmm_guest_memory_write(vq->guest, desc_pa +
+			offsetof(struct vmm_vring_packed_desc, flags),
+			&flags, sizeof(flags), TRUE);
+	if (ret != sizeof(flags)) {
+		vmm_printf("%s: write failed at desc_pa=0x%"PRIPADDR"\n",
+			   __func__, desc_pa);
+	}
+}
+
+/*
+ * The flags of the first used descriptor are written last so that
+ * the driver sees the whole batch at once.
+ */
+static void virtio_packed_set_used_elems(struct vmm_virtio_queue *vq,
+				struct vmm_vring_used_elem *elems,
+				u32 count)
+{
+	u32 i, head;
+	u16 first_idx = vq->used_idx;
+	bool first_wrap = vq->used_wrap_counter;
+
+	for (i = 0; i < count; i++) {
+		head = elems[i].id;
+		if ((vq->desc_count <= head) || !vq->chain_len[head]) {
+			vmm_printf("%s: invalid buffer id=%d\n",
+				   __func__, head);
+			break;
+		}
+
+		virtio_packed_write_used(vq, vq->used_idx,
+					 head, elems[i].len);
+		if (i) {
+			/* Descriptor id and len must be visible before flags */
+			arch_smp_wmb();
+			virtio_packed_write_used_flags(vq, vq->used_idx,
+						       vq->used_wrap_counter);
+		}
+
+		vq->used_idx += vq->chain_len[head];
+		vq->chain_len[head] = 0;
+		if (vq->desc_count <= vq->used_idx) {
+			vq->used_idx -= vq->desc_count;
+			vq->used_wrap_counter = !vq->used_wrap_counter;
+		}
+	}
+
+	if (i) {
+		arch_smp_wmb();
+		virtio_packed_write_used_flags(vq, first_idx, first_wrap);
+	}
+}
+
+static int virtio_packed_get_head_iovec(struct vmm_virtio_queue *vq,
+					u16 head, struct vmm_virtio_iovec *iov,
+					u32 *ret_iov_cnt, u32 *ret_total_len,
+					u16 *ret_head)
+{
+	int rc;
+	u16 id = 0, flags;
+	u32 i = 0, n = 0, idx = head, total_len = 0;
+	bool wrap_counter = vq->avail_wrap_counter;
+	struct vmm_vring_packed_desc desc;
+
+	if (head != vq->last_avail_idx) {
+		vmm_printf("%s: head=%d is not next available descriptor\n",
+			   __func__, head);
+		return VMM_EINVALID;
+	}
+
+	rc = virtio_packed_read_flags(vq, head, &flags);
+	if (rc) {
+		return rc;
+	}
+	if (!virtio_packed_desc_avail(flags, wrap_counter)) {
+		return VMM_ENOENT;
+	}
+
+	/* Read rest of the descriptors only after head flags */
+	arch_smp_rmb();
+
+	do {
+		if (vq->desc_count <= n) {
+			vmm_printf("%s: descriptor chain too long head=%d\n",
+				   __func__, head);
+			rc = VMM_EINVALID;
+			break;
+		}
+
+		rc = virtio_packed_get_desc(vq, idx, &desc);
+		if (rc) {
+			vmm_printf("%s: failed to get descriptor idx=%d "
+				   "error=%d\n", __func__, idx, rc);
+			break;
+		}
+
+		if (++idx >= vq->desc_count) {
+			idx = 0;
+			wrap_counter = !wrap_counter;
+		}
+		n++;
+
+		/* Indirect descriptor must be the only one in chain */
+		if (desc.flags & VMM_VRING_DESC_F_INDIRECT) {
+			if (i || (desc.flags & VMM_VRING_DESC_F_NEXT)) {
+				vmm_printf("%s: invalid indirect descriptor "
+					   "idx=%d\n", __func__, idx);
+				rc = VMM_EINVALID;
+				break;
+			}
+			rc = virtio_queue_indirect_iovec(vq, desc.addr,
+					desc.len, iov, &i, &total_len);
+			id = desc.id;
+			break;
+		}
+
+		iov[i].addr = desc.addr;
+		iov[i].len = desc.len;
+		iov[i].flags = (desc.flags & VMM_VRING_DESC_F_WRITE) ? 1 : 0;
+		total_len += desc.len;
+		id = desc.id;
+		i++;
+	} while (desc.flags & VMM_VRING_DESC_F_NEXT);
+
+	/* Descriptors walked so far are consumed even on failure
+	 * otherwise a broken chain would stall the queue forever.
+	 */
+	vq->last_avail_idx = idx;
+	vq->avail_wrap_counter = wrap_counter;
+
+	if (!rc && (vq->desc_count <= id)) {
+		vmm_printf("%s: invalid buffer id=%d\n", __func__, id);
+		rc = VMM_EINVALID;
+	}
+	if (rc) {
+		return rc;
+	}
+
+	vq->chain_len[id] = n;
+
+	if (ret_iov_cnt) {
+		*ret_iov_cnt = i;
+	}
+	if (ret_total_len) {
+		*ret_total_len = total_len;
+	}
+	if (ret_head) {
+		*ret_head = id;
+	}
+
+	return VMM_OK;
+}
+
 /* ========== VirtIO queue implementations ========== */
 
 struct vmm_guest *vmm_virtio_queue_guest(struct vmm_virtio_queue *vq)
@@ -142,6 +532,10 @@ u16 vmm_virtio_queue_pop(struct vmm_virtio_queue *vq)
 		return 0;
 	}
 
+	if (vq->packed) {
+		return vq->last_avail_idx;
+	}
+
 	ret = umod32(vq->last_avail_idx++, vq->desc_count);
 
 	avail_pa = vq->vring.avail_pa +
@@ -168,6 +562,10 @@ bool vmm_virtio_queue_available(struct vmm_virtio_queue *vq)
 		return FALSE;
 	}
 
+	if (vq->packed) {
+		return virtio_packed_available(vq);
+	}
+
 	avail_pa = vq->vring.avail_pa +
 		   offsetof(struct vmm_vring_avail, idx);
 	ret = vmm_guest_memory_read(vq->guest, avail_pa,
@@ -182,6 +580,31 @@ bool vmm_virtio_queue_available(struct vmm_virtio_queue *vq)
 }
 VMM_EXPORT_SYMBOL(vmm_virtio_queue_available);
 
+u32 vmm_virtio_queue_avail_pos(struct vmm_virtio_queue *vq)
+{
+	if (!vq) {
+		return 0;
+	}
+
+	return ((u32)vq->avail_wrap_counter << 16) | vq->last_avail_idx;
+}
+VMM_EXPORT_SYMBOL(vmm_virtio_queue_avail_pos);
+
+void vmm_virtio_queue_rewind(struct vmm_virtio_queue *vq, u32 pos)
+{
+	if (!vq || !vq->guest) {
+		return;
+	}
+
+	vq->last_avail_idx = pos & 0xffff;
+	if (vq->packed) {
+		vq->avail_wrap_counter = (pos >> 16) ? TRUE : FALSE;
+	} else {
+		vmm_virtio_queue_set_avail_event(vq);
+	}
+}
+VMM_EXPORT_SYMBOL(vmm_virtio_queue_rewind);
+
 bool vmm_virtio_queue_should_signal(struct vmm_virtio_queue *vq)
 {
 	u32 ret;
@@ -192,6 +615,10 @@ bool vmm_virtio_queue_should_signal(struct vmm_virtio_queue *vq)
 		return FALSE;
 	}
 
+	if (vq->packed) {
+		return virtio_packed_should_signal(vq);
+	}
+
 	old_idx = vq->last_used_signalled;
 
 	used_pa = vq->vring.used_pa +
@@ -233,7 +660,20 @@ void vmm_virtio_queue_set_avail_event(struct vmm_virtio_queue *vq)
 		return;
 	}
 
+	/* Device event offset of packed virtqueue is only updated by
+	 * vmm_virtio_queue_notify_enable() when suppression changes.
+	 */
+	if (vq->packed) {
+		return;
+	}
+
+	/* Keeping avail_event behind last_avail_idx means
+	 * guest never crosses it hence never notifies us.
+	 */
 	val = vq->last_avail_idx;
+	if (vq->notify_disabled) {
+		val--;
+	}
 	avail_evt_pa = vq->vring.used_pa +
 		  offsetof(struct vmm_vring_used, ring[vq->vring.num]);
 	ret = vmm_guest_memory_write(vq->guest, avail_evt_pa,
@@ -246,15 +686,61 @@ void vmm_virtio_queue_set_avail_event(struct vmm_virtio_queue *vq)
 }
 VMM_EXPORT_SYMBOL(vmm_virtio_queue_set_avail_event);
 
-void vmm_virtio_queue_set_used_elem(struct vmm_virtio_queue *vq,
-				    u32 head, u32 len)
+void vmm_virtio_queue_notify_enable(struct vmm_virtio_queue *vq,
+				    bool enable)
 {
+	u16 val;
 	u32 ret;
+	physical_addr_t flags_pa;
+
+	if (!vq || !vq->guest) {
+		return;
+	}
+
+	vq->notify_disabled = (enable) ? FALSE : TRUE;
+
+	if (vq->packed) {
+		val = (enable) ? VMM_VRING_PACKED_EVENT_FLAG_ENABLE :
+				 VMM_VRING_PACKED_EVENT_FLAG_DISABLE;
+		flags_pa = vq->vring.used_pa +
+			offsetof(struct vmm_vring_packed_desc_event, flags);
+	} else {
+		val = (enable) ? 0 : VMM_VRING_USED_F_NO_NOTIFY;
+		flags_pa = vq->vring.used_pa +
+			offsetof(struct vmm_vring_used, flags);
+	}
+	ret = vmm_guest_memory_write(vq->guest, flags_pa,
+				     &val, sizeof(val), TRUE);
+	if (ret != sizeof(val)) {
+		vmm_printf("%s: write failed at flags_pa=0x%"PRIPADDR"\n",
+			   __func__, flags_pa);
+	}
+
+	if (vq->packed) {
+		virtio_packed_set_avail_event(vq);
+	} else {
+		vmm_virtio_queue_set_avail_event(vq);
+	}
+
+	/* Make it visible before caller checks available buffers */
+	arch_smp_mb();
+}
+VMM_EXPORT_SYMBOL(vmm_virtio_queue_notify_enable);
+
+void vmm_virtio_queue_set_used_elems(struct vmm_virtio_queue *vq,
+				struct vmm_vring_used_elem *elems,
+				u32 count)
+{
+	u32 i, ret;
 	u16 used_idx;
-	struct vmm_vring_used_elem used_elem;
 	physical_addr_t used_idx_pa, used_elem_pa;
 
-	if (!vq || !vq->guest) {
+	if (!vq || !vq->guest || !elems || !count) {
+		return;
+	}
+
+	if (vq->packed) {
+		virtio_packed_set_used_elems(vq, elems, count);
 		return;
 	}
 
@@ -267,19 +753,23 @@ void vmm_virtio_queue_set_used_elem(struct vmm_virtio_queue *vq,
 			   __func__, used_idx_pa);
 	}
 
-	used_elem.id = head;
-	used_elem.len = len;
-	ret = umod32(used_idx, vq->vring.num);
-	used_elem_pa = vq->vring.used_pa +
-		       offsetof(struct vmm_vring_used, ring[ret]);
-	ret = vmm_guest_memory_write(vq->guest, used_elem_pa,
-				     &used_elem, sizeof(used_elem), TRUE);
-	if (ret != sizeof(used_elem)) {
-		vmm_printf("%s: write failed at used_elem_pa=0x%"PRIPADDR"\n",
-			   __func__, used_elem_pa);
+	for (i = 0; i < count; i++) {
+		ret = umod32((u16)(used_idx + i), vq->vring.num);
+		used_elem_pa = vq->vring.used_pa +
+			       offsetof(struct vmm_vring_used, ring[ret]);
+		ret = vmm_guest_memory_write(vq->guest, used_elem_pa,
+					     &elems[i], sizeof(elems[i]), TRUE);
+		if (ret != sizeof(elems[i])) {
+			vmm_printf("%s: write failed at "
+				   "used_elem_pa=0x%"PRIPADDR"\n",
+				   __func__, used_elem_pa);
+		}
 	}
 
-	used_idx++;
+	/* Used elements must be visible before used index */
+	arch_smp_wmb();
+
+	used_idx += count;
 	ret = vmm_guest_memory_write(vq->guest, used_idx_pa,
 				     &used_idx, sizeof(used_idx), TRUE);
 	if (ret != sizeof(used_idx)) {
@@ -287,6 +777,17 @@ void vmm_virtio_queue_set_used_elem(struct vmm_virtio_queue *vq,
 			   __func__, used_idx_pa);
 	}
 }
+VMM_EXPORT_SYMBOL(vmm_virtio_queue_set_used_elems);
+
+void vmm_virtio_queue_set_used_elem(struct vmm_virtio_queue *vq,
+				    u32 head, u32 len)
+{
+	struct vmm_vring_used_elem used_elem;
+
+	used_elem.id = head;
+	used_elem.len = len;
+	vmm_virtio_queue_set_used_elems(vq, &used_elem, 1);
+}
 VMM_EXPORT_SYMBOL(vmm_virtio_queue_set_used_elem);
 
 bool vmm_virtio_queue_setup_done(struct vmm_virtio_queue *vq)
@@ -303,6 +804,16 @@ int vmm_virtio_queue_cleanup(struct vmm_virtio_queue *vq)
 
 	vq->last_avail_idx = 0;
 	vq->last_used_signalled = 0;
+	vq->notify_disabled = FALSE;
+
+	vq->packed = FALSE;
+	vq->avail_wrap_counter = FALSE;
+	vq->used_wrap_counter = FALSE;
+	vq->used_idx = 0;
+	if (vq->chain_len) {
+		vmm_free(vq->chain_len);
+		vq->chain_len = NULL;
+	}
 
 	vq->guest = NULL;
 
@@ -320,6 +831,34 @@ done:
 }
 VMM_EXPORT_SYMBOL(vmm_virtio_queue_cleanup);
 
+static int virtio_queue_map_area(struct vmm_guest *guest,
+				 physical_addr_t gphys_addr,
+				 physical_size_t gphys_size,
+				 physical_addr_t *hphys_addr)
+{
+	u32 reg_flags;
+	physical_size_t avail_size;
+
+	if (vmm_guest_physical_map(guest, gphys_addr, gphys_size,
+				   hphys_addr, &avail_size, &reg_flags)) {
+		vmm_printf("%s: vmm_guest_physical_map() failed\n", __func__);
+		return VMM_EFAIL;
+	}
+
+	if (!(reg_flags & VMM_REGION_ISRAM)) {
+		vmm_printf("%s: region is not backed by RAM\n", __func__);
+		return VMM_EINVALID;
+	}
+
+	if (avail_size < gphys_size) {
+		vmm_printf("%s: available size less than required size\n",
+			   __func__);
+		return VMM_EINVALID;
+	}
+
+	return VMM_OK;
+}
+
 int vmm_virtio_queue_setup(struct vmm_virtio_queue *vq,
 			   struct vmm_guest *guest,
 			   physical_addr_t guest_pfn,
@@ -327,9 +866,8 @@ int vmm_virtio_queue_setup(struct vmm_virtio_queue *vq,
 			   u32 desc_count, u32 align)
 {
 	int rc = VMM_OK;
-	u32 reg_flags;
 	physical_addr_t gphys_addr, hphys_addr;
-	physical_size_t gphys_size, avail_size;
+	physical_size_t gphys_size;
 
 	if (!vq || !guest) {
 		return VMM_EFAIL;
@@ -343,22 +881,9 @@ int vmm_virtio_queue_setup(struct vmm_virtio_queue *vq,
 	gphys_addr = guest_pfn * guest_page_size;
 	gphys_size = vmm_vring_size(desc_count, align);
 
-	if ((rc = vmm_guest_physical_map(guest, gphys_addr, gphys_size,
-					 &hphys_addr, &avail_size,
-					 &reg_flags))) {
-		vmm_printf("%s: vmm_guest_physical_map() failed\n", __func__);
-		return VMM_EFAIL;
-	}
-
-	if (!(reg_flags & VMM_REGION_ISRAM)) {
-		vmm_printf("%s: region is not backed by RAM\n", __func__);
-		return VMM_EINVALID;
-	}
-
-	if (avail_size < gphys_size) {
-		vmm_printf("%s: available size less than required size\n",
-			   __func__);
-		return VMM_EINVALID;
+	rc = virtio_queue_map_area(guest, gphys_addr, gphys_size, &hphys_addr);
+	if (rc) {
+		return rc;
 	}
 
 	vmm_vring_init(&vq->vring, desc_count, NULL, gphys_addr, align);
@@ -377,6 +902,100 @@ int vmm_virtio_queue_setup(struct vmm_virtio_queue *vq,
 }
 VMM_EXPORT_SYMBOL(vmm_virtio_queue_setup);
 
+int vmm_virtio_queue_setup_addr(struct vmm_virtio_queue *vq,
+				struct vmm_guest *guest,
+				physical_addr_t desc_addr,
+				physical_addr_t driver_addr,
+				physical_addr_t device_addr,
+				u32 desc_count, bool packed)
+{
+	int rc = VMM_OK;
+	physical_addr_t hphys_addr, tmp_addr;
+	physical_size_t desc_size, driver_size, device_size;
+
+	if (!vq || !guest || !desc_count) {
+		return VMM_EFAIL;
+	}
+
+	/* Packed ring positions must leave room for wrap counter bit */
+	if (packed &&
+	    ((1 << VMM_VRING_PACKED_EVENT_F_WRAP_CTR) < desc_count)) {
+		return VMM_EINVALID;
+	}
+
+	if ((rc = vmm_virtio_queue_cleanup(vq))) {
+		vmm_printf("%s: cleanup failed\n", __func__);
+		return rc;
+	}
+
+	if (packed) {
+		desc_size = desc_count * sizeof(struct vmm_vring_packed_desc);
+		driver_size = sizeof(struct vmm_vring_packed_desc_event);
+		device_size = sizeof(struct vmm_vring_packed_desc_event);
+	} else {
+		desc_size = desc_count * sizeof(struct vmm_vring_desc);
+		driver_size = offsetof(struct vmm_vring_avail,
+				       ring[desc_count]) + sizeof(u16);
+		device_size = offsetof(struct vmm_vring_used,
+				       ring[desc_count]) + sizeof(u16);
+	}
+
+	rc = virtio_queue_map_area(guest, desc_addr, desc_size, &hphys_addr);
+	if (rc) {
+		return rc;
+	}
+	rc = virtio_queue_map_area(guest, driver_addr, driver_size, &tmp_addr);
+	if (rc) {
+		return rc;
+	}
+	rc = virtio_queue_map_area(guest, device_addr, device_size, &tmp_addr);
+	if (rc) {
+		return rc;
+	}
+
+	if (packed) {
+		vq->chain_len = vmm_zalloc(desc_count * sizeof(u16));
+		if (!vq->chain_len) {
+			return VMM_ENOMEM;
+		}
+	}
+
+	/* For packed virtqueue, the avail and used addresses point to
+	 * driver and device event suppression structures respectively.
+	 */
+	vq->vring.num = desc_count;
+	vq->vring.desc = NULL;
+	vq->vring.desc_pa = desc_addr;
+	vq->vring.avail = NULL;
+	vq->vring.avail_pa = driver_addr;
+	vq->vring.used = NULL;
+	vq->vring.used_pa = device_addr;
+
+	vq->packed = packed;
+	vq->avail_wrap_counter = TRUE;
+	vq->used_wrap_counter = TRUE;
+	vq->used_idx = 0;
+
+	vq->guest = guest;
+	vq->desc_count = desc_count;
+	vq->align = 0;
+	vq->guest_pfn = 0;
+	vq->guest_page_size = 0;
+
+	vq->guest_addr = desc_addr;
+	vq->host_addr = hphys_addr;
+	vq->total_size = desc_size + driver_size + device_size;
+
+	return VMM_OK;
+}
+VMM_EXPORT_SYMBOL(vmm_virtio_queue_setup_addr);
+
+bool vmm_virtio_queue_is_packed(struct vmm_virtio_queue *vq)
+{
+	return (vq && vq->guest) ? vq->packed : FALSE;
+}
+VMM_EXPORT_SYMBOL(vmm_virtio_queue_is_packed);
+
 /*
  * Each buffer in the virtqueues is actually a chain of descriptors.  This
  * function returns the next descriptor in the chain, max descriptor count
@@ -410,7 +1029,8 @@ int vmm_virtio_queue_get_head_iovec(struct vmm_virtio_queue *vq,
 				    u32 *ret_iov_cnt, u32 *ret_total_len,
 				    u16 *ret_head)
 {
-	int i, rc = VMM_OK;
+	int rc = VMM_OK;
+	u32 i, len;
 	u16 idx, max;
 	struct vmm_vring_desc desc;
 
@@ -418,6 +1038,15 @@ int vmm_virtio_queue_get_head_iovec(struct vmm_virtio_queue *vq,
 		goto fail;
 	}
 
+	if (vq->packed) {
+		rc = virtio_packed_get_head_iovec(vq, head, iov, ret_iov_cnt,
+						  ret_total_len, ret_head);
+		if (rc) {
+			goto fail;
+		}
+		return VMM_OK;
+	}
+
 	idx = head;
 
 	if (ret_iov_cnt) {
@@ -432,6 +1061,12 @@ int vmm_virtio_queue_get_head_iovec(struct vmm_virtio_queue *vq,
 
 	max = vmm_virtio_queue_max_desc(vq);
 
+	if (max <= head) {
+		vmm_printf("%s: invalid head=%d\n", __func__, head);
+		rc = VMM_EINVALID;
+		goto fail;
+	}
+
 	rc = vmm_virtio_queue_get_desc(vq, idx, &desc);
 	if (rc) {
 		vmm_printf("%s: failed to get descriptor idx=%d error=%d\n",
@@ -440,19 +1075,33 @@ int vmm_virtio_queue_get_head_iovec(struct vmm_virtio_queue *vq,
 	}
 
 	if (desc.flags & VMM_VRING_DESC_F_INDIRECT) {
-#if 0
-		max = desc[idx].len / sizeof(struct vring_desc);
-		desc = guest_flat_to_host(kvm, desc[idx].addr);
-		idx = 0;
-#endif
-		vmm_printf("%s: indirect descriptor not supported idx=%d\n",
-			   __func__, idx);
-		rc = VMM_ENOTSUPP;
-		goto fail;
+		/* Indirect descriptor must not be chained */
+		if (desc.flags & VMM_VRING_DESC_F_NEXT) {
+			vmm_printf("%s: invalid indirect descriptor head=%d\n",
+				   __func__, head);
+			rc = VMM_EINVALID;
+			goto fail;
+		}
+		rc = virtio_queue_indirect_iovec(vq, desc.addr, desc.len,
+						 iov, &i, &len);
+		if (rc) {
+			goto fail;
+		}
+		if (ret_total_len) {
+			*ret_total_len = len;
+		}
+		goto done;
 	}
 
 	i = 0;
 	do {
+		if (max <= i) {
+			vmm_printf("%s: descriptor chain too long head=%d\n",
+				   __func__, head);
+			rc = VMM_EINVALID;
+			goto fail;
+		}
+
 		iov[i].addr = desc.addr;
 		iov[i].len = desc.len;
 
@@ -469,6 +1118,7 @@ int vmm_virtio_queue_get_head_iovec(struct vmm_virtio_queue *vq,
 		i++;
 	} while ((idx = next_desc(vq, &desc, idx, max)) != max);
 
+done:
 	if (ret_iov_cnt) {
 		*ret_iov_cnt = i;
 	}
@@ -579,29 +1229,416 @@ void vmm_virtio_iovec_fill_zeros(struct vmm_virtio_device *dev,
 }
 VMM_EXPORT_SYMBOL(vmm_virtio_iovec_fill_zeros);
 
+/* Get host virtual address only when whole segment is already
+ * contiguously mapped. Each page is checked because host mappings
+ * of physically contiguous memory need not be virtually contiguous.
+ */
+static bool virtio_sg_hva(physical_addr_t hpa, physical_size_t len,
+			  virtual_addr_t *hva)
+{
+	physical_addr_t pa;
+	virtual_addr_t va, start;
+
+	if (vmm_host_pa2va(hpa, &start)) {
+		return FALSE;
+	}
+
+	pa = (hpa & ~((physical_addr_t)VMM_PAGE_MASK)) + VMM_PAGE_SIZE;
+	while (pa < (hpa + len)) {
+		if (vmm_host_pa2va(pa, &va) ||
+		    (va != (start + (virtual_addr_t)(pa - hpa)))) {
+			return FALSE;
+		}
+		pa += VMM_PAGE_SIZE;
+	}
+
+	*hva = start;
+	return TRUE;
+}
+
+int vmm_virtio_iovec_to_sg(struct vmm_virtio_device *dev,
+			   struct vmm_virtio_iovec *iov, u32 iov_cnt,
+			   struct vmm_virtio_sg *sg, u32 sg_max,
+			   u32 *ret_sg_cnt)
+{
+	int rc;
+	u32 i, pos, cnt = 0, reg_flags;
+	physical_addr_t hpa;
+	physical_size_t len;
+	virtual_addr_t hva;
+	struct vmm_region *reg;
+
+	if (!dev || !dev->guest || !iov || !sg) {
+		return VMM_EINVALID;
+	}
+
+	for (i = 0; i < iov_cnt; i++) {
+		pos = 0;
+		while (pos < iov[i].len) {
+			if (cnt == sg_max) {
+				rc = VMM_ENOSPC;
+				goto fail;
+			}
+
+			rc = vmm_guest_physical_pin(dev->guest,
+						    iov[i].addr + pos,
+						    iov[i].len - pos,
+						    &hpa, &len, &reg_flags,
+						    &reg);
+			if (rc) {
+				goto fail;
+			}
+			if (!len) {
+				vmm_guest_physical_unpin(dev->guest, reg);
+				rc = VMM_EFAULT;
+				goto fail;
+			}
+
+			sg[cnt].gpa = iov[i].addr + pos;
+			sg[cnt].hpa = 0;
+			sg[cnt].hva = 0;
+			sg[cnt].len = len;
+			sg[cnt].flags = (iov[i].flags) ? VMM_VIRTIO_SG_WRITE : 0;
+			sg[cnt].reg = reg;
+
+			if ((reg_flags & VMM_REGION_REAL) &&
+			    (reg_flags & VMM_REGION_ISRAM)) {
+				sg[cnt].flags |= VMM_VIRTIO_SG_RAM;
+				sg[cnt].hpa = hpa;
+				if (virtio_sg_hva(hpa, len, &hva)) {
+					sg[cnt].hva = hva;
+				}
+			}
+
+			pos += len;
+			cnt++;
+		}
+	}
+
+	if (ret_sg_cnt) {
+		*ret_sg_cnt = cnt;
+	}
+
+	return VMM_OK;
+
+fail:
+	vmm_virtio_sg_release(dev, sg, cnt);
+	if (ret_sg_cnt) {
+		*ret_sg_cnt = 0;
+	}
+	return rc;
+}
+VMM_EXPORT_SYMBOL(vmm_virtio_iovec_to_sg);
+
+void vmm_virtio_sg_release(struct vmm_virtio_device *dev,
+			   struct vmm_virtio_sg *sg, u32 sg_cnt)
+{
+	u32 i;
+
+	if (!dev || !sg) {
+		return;
+	}
+
+	for (i = 0; i < sg_cnt; i++) {
+		vmm_guest_physical_unpin(dev->guest, sg[i].reg);
+		sg[i].reg = NULL;
+	}
+}
+VMM_EXPORT_SYMBOL(vmm_virtio_sg_release);
+
+/* ========== VirtIO dataplane implementations ========== */
+
+#define VIRTIO_DATAPLANE_MAX_VQ			64
+#define VIRTIO_DATAPLANE_POLL_MIN_NSECS		((u64)10000)
+#define VIRTIO_DATAPLANE_POLL_MAX_NSECS		((u64)500000)
+
+/* Polling thread which services all queues of a VirtIO device */
+struct vmm_virtio_dataplane {
+	struct vmm_virtio_device *dev;
+	struct vmm_thread *thread;
+	/* Protects pause and busy */
+	vmm_spinlock_t lock;
+	/* Number of reset or queue setup operations in progress */
+	u32 pause;
+	/* Set while dataplane is servicing a queue */
+	bool busy;
+	struct vmm_completion kick;
+	struct vmm_completion exited;
+	bool stop;
+	/* Adaptive poll budget before waiting for guest kick */
+	u64 poll_nsecs;
+	u64 poll_max_nsecs;
+};
+
+static u32 virtio_dataplane_poll(struct vmm_virtio_dataplane *dp,
+				 bool notify)
+{
+	bool avail;
+	u32 i, work = 0;
+	irq_flags_t flags;
+	struct vmm_virtio_queue *vq;
+	struct vmm_virtio_device *dev = dp->dev;
+
+	for (i = 0; i < VIRTIO_DATAPLANE_MAX_VQ; i++) {
+		/* Back off while reset or queue setup is in progress */
+		vmm_spin_lock_irqsave_lite(&dp->lock, flags);
+		if (dp->pause) {
+			vmm_spin_unlock_irqrestore_lite(&dp->lock, flags);
+			break;
+		}
+		dp->busy = TRUE;
+		vmm_spin_unlock_irqrestore_lite(&dp->lock, flags);
+
+		/* Only the ring check is done with preemption disabled
+		 * and queue processing stays preemptible. VCPUs waiting
+		 * for us never run on our host CPU (see dataplane start).
+		 */
+		avail = FALSE;
+		vmm_scheduler_preempt_disable();
+		vq = dev->emu->get_vq(dev, i);
+		if (vq && vmm_virtio_queue_setup_done(vq)) {
+			if (vq->notify_disabled == notify) {
+				vmm_virtio_queue_notify_enable(vq, notify);
+			}
+			avail = vmm_virtio_queue_available(vq);
+		}
+		vmm_scheduler_preempt_enable();
+
+		if (avail) {
+			dev->emu->notify_vq(dev, i);
+			work++;
+		}
+
+		vmm_spin_lock_irqsave_lite(&dp->lock, flags);
+		dp->busy = FALSE;
+		vmm_spin_unlock_irqrestore_lite(&dp->lock, flags);
+
+		if (!vq) {
+			break;
+		}
+	}
+
+	return work;
+}
+
+static int virtio_dataplane_main(void *udata)
+{
+	u64 tstamp, idle_start = 0;
+	struct vmm_virtio_dataplane *dp = udata;
+
+	while (!dp->stop) {
+		/* Busy polling with guest notifications suppressed */
+		if (virtio_dataplane_poll(dp, FALSE)) {
+			idle_start = 0;
+			continue;
+		}
+
+		tstamp = vmm_timer_timestamp();
+		if (!idle_start) {
+			idle_start = tstamp;
+		}
+		if ((tstamp - idle_start) < dp->poll_nsecs) {
+			/* Let other threads on this host CPU run */
+			vmm_scheduler_yield();
+			continue;
+		}
+		idle_start = 0;
+
+		/* Poll budget exhausted so enable guest notifications,
+		 * check once more and wait for guest kick.
+		 */
+		if (virtio_dataplane_poll(dp, TRUE) || dp->stop) {
+			continue;
+		}
+		tstamp = vmm_timer_timestamp();
+		vmm_completion_wait(&dp->kick);
+		tstamp = vmm_timer_timestamp() - tstamp;
+
+		/* Grow the budget if kick came soon after we stopped
+		 * polling otherwise shrink it.
+		 */
+		if (tstamp < dp->poll_max_nsecs) {
+			dp->poll_nsecs = min(dp->poll_nsecs << 1,
+					     dp->poll_max_nsecs);
+		} else {
+			dp->poll_nsecs = max(dp->poll_nsecs >> 1,
+					     VIRTIO_DATAPLANE_POLL_MIN_NSECS);
+		}
+	}
+
+	vmm_completion_complete(&dp->exited);
+
+	return VMM_OK;
+}
+
+static void __virtio_dataplane_start(struct vmm_virtio_device *dev)
+{
+	u32 cpu, usecs;
+	char name[VMM_FIELD_NAME_SIZE];
+	struct vmm_vcpu *vcpu;
+	struct vmm_virtio_dataplane *dp;
+
+	if (!dev->edev ||
+	    vmm_devtree_read_u32(dev->edev->node, "dataplane_cpu", &cpu)) {
+		return;
+	}
+	if (!dev->emu->get_vq || !dev->emu->notify_vq) {
+		vmm_printf("%s: %s: emulator %s does not support dataplane\n",
+			   __func__, dev->name, dev->emu->name);
+		return;
+	}
+	if ((CONFIG_CPU_COUNT <= cpu) || !vmm_cpu_online(cpu)) {
+		vmm_printf("%s: %s: invalid dataplane_cpu %d\n",
+			   __func__, dev->name, cpu);
+		return;
+	}
+
+	/* VCPUs spin while waiting for dataplane to pause so they
+	 * must never share the host CPU dedicated to dataplane.
+	 */
+	vmm_manager_for_each_guest_vcpu(vcpu, dev->guest) {
+		if (vmm_cpumask_test_cpu(cpu,
+				vmm_manager_vcpu_get_affinity(vcpu))) {
+			vmm_printf("%s: %s: dataplane_cpu %d is in affinity "
+				   "of VCPU %s\n", __func__, dev->name,
+				   cpu, vcpu->name);
+			return;
+		}
+	}
+
+	dp = vmm_zalloc(sizeof(*dp));
+	if (!dp) {
+		return;
+	}
+	dp->dev = dev;
+	INIT_SPIN_LOCK(&dp->lock);
+	dp->pause = 0;
+	dp->busy = FALSE;
+	INIT_COMPLETION(&dp->kick);
+	INIT_COMPLETION(&dp->exited);
+	dp->stop = FALSE;
+	dp->poll_max_nsecs = VIRTIO_DATAPLANE_POLL_MAX_NSECS;
+	if (!vmm_devtree_read_u32(dev->edev->node,
+				  "dataplane_poll_usecs", &usecs) && usecs) {
+		dp->poll_max_nsecs = (u64)usecs * 1000;
+	}
+	dp->poll_nsecs = min(VIRTIO_DATAPLANE_POLL_MIN_NSECS,
+			     dp->poll_max_nsecs);
+
+	vmm_snprintf(name, sizeof(name), "vdp/%s", dev->name);
+	dp->thread = vmm_threads_create(name, virtio_dataplane_main, dp,
+					VMM_THREAD_DEF_PRIORITY,
+					VMM_THREAD_DEF_TIME_SLICE);
+	if (!dp->thread) {
+		vmm_free(dp);
+		return;
+	}
+	vmm_threads_set_affinity(dp->thread, vmm_cpumask_of(cpu));
+
+	dev->dp = dp;
+	vmm_threads_start(dp->thread);
+}
+
+static void __virtio_dataplane_stop(struct vmm_virtio_device *dev)
+{
+	struct vmm_virtio_dataplane *dp = dev->dp;
+
+	if (!dp) {
+		return;
+	}
+
+	dp->stop = TRUE;
+	vmm_completion_complete(&dp->kick);
+	vmm_completion_wait(&dp->exited);
+	while (vmm_threads_get_state(dp->thread) !=
+					VMM_THREAD_STATE_STOPPED) {
+		vmm_scheduler_yield();
+	}
+	vmm_threads_destroy(dp->thread);
+
+	dev->dp = NULL;
+	vmm_free(dp);
+}
+
+void vmm_virtio_dataplane_pause(struct vmm_virtio_device *dev)
+{
+	irq_flags_t flags;
+	struct vmm_virtio_dataplane *dp = (dev) ? dev->dp : NULL;
+
+	if (!dp) {
+		return;
+	}
+
+	vmm_spin_lock_irqsave_lite(&dp->lock, flags);
+	dp->pause++;
+	while (dp->busy) {
+		vmm_spin_unlock_irqrestore_lite(&dp->lock, flags);
+		if (vmm_scheduler_orphan_context()) {
+			vmm_scheduler_yield();
+		} else {
+			vmm_udelay(1);
+		}
+		vmm_spin_lock_irqsave_lite(&dp->lock, flags);
+	}
+	vmm_spin_unlock_irqrestore_lite(&dp->lock, flags);
+}
+VMM_EXPORT_SYMBOL(vmm_virtio_dataplane_pause);
+
+void vmm_virtio_dataplane_resume(struct vmm_virtio_device *dev)
+{
+	irq_flags_t flags;
+	struct vmm_virtio_dataplane *dp = (dev) ? dev->dp : NULL;
+
+	if (!dp) {
+		return;
+	}
+
+	vmm_spin_lock_irqsave_lite(&dp->lock, flags);
+	if (dp->pause) {
+		dp->pause--;
+	}
+	vmm_spin_unlock_irqrestore_lite(&dp->lock, flags);
+
+	/* Pick up any guest kick which came while paused */
+	vmm_completion_complete_once(&dp->kick);
+}
+VMM_EXPORT_SYMBOL(vmm_virtio_dataplane_resume);
+
 /* ========== VirtIO device and emulator implementations ========== */
 
 static int __virtio_reset_emulator(struct vmm_virtio_device *dev)
 {
+	int rc = VMM_OK;
+
 	if (dev && dev->emu && dev->emu->reset) {
-		return dev->emu->reset(dev);
+		vmm_virtio_dataplane_pause(dev);
+		rc = dev->emu->reset(dev);
+		vmm_virtio_dataplane_resume(dev);
 	}
 
-	return VMM_OK;
+	return rc;
 }
 
 static int __virtio_connect_emulator(struct vmm_virtio_device *dev,
 				     struct vmm_virtio_emulator *emu)
 {
+	int rc = VMM_OK;
+
 	if (dev && emu && emu->connect) {
-		return emu->connect(dev, emu);
+		rc = emu->connect(dev, emu);
+	}
+	if (!rc && dev) {
+		__virtio_dataplane_start(dev);
 	}
 
-	return VMM_OK;
+	return rc;
 }
 
 static void __virtio_disconnect_emulator(struct vmm_virtio_device *dev)
 {
+	if (dev) {
+		__virtio_dataplane_stop(dev);
+	}
 	if (dev && dev->emu && dev->emu->disconnect) {
 		dev->emu->disconnect(dev);
 	}
@@ -697,6 +1734,22 @@ int vmm_virtio_config_write(struct vmm_virtio_device *dev,
 }
 VMM_EXPORT_SYMBOL(vmm_virtio_config_write);
 
+int vmm_virtio_notify_vq(struct vmm_virtio_device *dev, u32 vq)
+{
+	if (!dev || !dev->emu || !dev->emu->notify_vq) {
+		return VMM_EINVALID;
+	}
+
+	/* Dataplane thread will find the new buffers by itself */
+	if (dev->dp) {
+		vmm_completion_complete_once(&dev->dp->kick);
+		return VMM_OK;
+	}
+
+	return dev->emu->notify_vq(dev, vq);
+}
+VMM_EXPORT_SYMBOL(vmm_virtio_notify_vq);
+
 int vmm_virtio_reset(struct vmm_virtio_device *dev)
 {
 	return __virtio_reset_emulator(dev);
@@ -714,6 +1767,7 @@ int vmm_virtio_register_device(struct vmm_virtio_device *dev)
 	INIT_LIST_HEAD(&dev->node);
 	dev->emu = NULL;
 	dev->emu_data = NULL;
+	dev->dp = NULL;
 
 	vmm_mutex_lock(&virtio_mutex);
 
@@ -21,16 +21,22 @@
  * @brief source code for device emulation framework
  */
 
+#include <arch_cpu_irq.h>
 #include <vmm_error.h>
+#include <vmm_macros.h>
 #include <vmm_stdio.h>
 #include <vmm_heap.h>
 #include <vmm_host_io.h>
 #include <vmm_host_irq.h>
 #include <vmm_mutex.h>
+#include <vmm_smp.h>
+#include <vmm_timer.h>
+#include <vmm_threads.h>
 #include <vmm_guest_aspace.h>
 #include <vmm_devemu.h>
 #include <vmm_devemu_debug.h>
 #include <libs/stringlib.h>
+#include <libs/log2.h>
 
 struct vmm_devemu_guest_irq {
 	struct dlist head;
@@ -38,15 +44,45 @@ struct vmm_devemu_guest_irq {
 	void *opaque;
 };
 
+struct vmm_devemu_coalesced_range {
+	struct dlist head;
+	physical_addr_t offset;
+	physical_size_t size;
+	u32 flags;
+};
+
+struct vmm_devemu_coalesced_entry {
+	struct vmm_emudev *edev;
+	physical_addr_t offset;
+	u32 size;
+	u64 data;
+};
+
+struct vmm_devemu_coalesced_ring {
+	vmm_spinlock_t drain_lock;
+	vmm_spinlock_t lock;
+	u32 count;
+	u32 inflight;
+	struct vmm_devemu_coalesced_entry *ent;
+	struct vmm_devemu_coalesced_entry
+			buf[2][VMM_DEVEMU_COALESCED_RING_SIZE];
+	struct vmm_timer_event drain_ev;
+	struct vmm_work drain_work;
+};
+
 struct vmm_devemu_guest_context {
 	u32 g_irq_count;
 	struct dlist *g_irq;
+	struct vmm_devemu_coalesced_ring cring;
 };
 
 struct vmm_devemu_ctrl {
 	enum vmm_devemu_endianness host_endian;
 	struct vmm_mutex emu_lock;
         struct dlist emu_list;
+	struct vmm_mutex db_wq_lock;
+	u32 db_wq_next;
+	struct vmm_workqueue *db_wq[CONFIG_CPU_COUNT];
 };
 
 static struct vmm_devemu_ctrl dectrl;
@@ -118,296 +154,614 @@ static inline void debug_write(const struct vmm_emudev *edev,
 	}
 }
 
-static int devemu_doread(struct vmm_emudev *edev,
-			 physical_addr_t offset,
-			 void *dst, u32 dst_len,
-			 enum vmm_devemu_endianness dst_endian)
+/*
+ * Access handlers
+ *
+ * Endianness conversion required for each combination of emulator
+ * endianness and guest endianness is either nothing or a byte swap
+ * so we resolve one handler per access size and guest endianness
+ * at probe time instead of checking endianness on every access.
+ */
+
+#ifdef CONFIG_CPU_BE
+#define devemu_swab16(v)	vmm_cpu_to_le16(v)
+#define devemu_swab32(v)	vmm_cpu_to_le32(v)
+#define devemu_swab64(v)	vmm_cpu_to_le64(v)
+#else
+#define devemu_swab16(v)	vmm_cpu_to_be16(v)
+#define devemu_swab32(v)	vmm_cpu_to_be32(v)
+#define devemu_swab64(v)	vmm_cpu_to_be64(v)
+#endif
+
+#define DEVEMU_ACCESS_INVALID	VMM_DEVEMU_MAX_ACCESS
+
+static const u8 devemu_len2access[] = {
+	DEVEMU_ACCESS_INVALID,	/* 0 bytes */
+	0,			/* 1 byte */
+	1,			/* 2 bytes */
+	DEVEMU_ACCESS_INVALID,	/* 3 bytes */
+	2,			/* 4 bytes */
+	DEVEMU_ACCESS_INVALID,	/* 5 bytes */
+	DEVEMU_ACCESS_INVALID,	/* 6 bytes */
+	DEVEMU_ACCESS_INVALID,	/* 7 bytes */
+	3,			/* 8 bytes */
+};
+
+static int devemu_read_notavail(struct vmm_emudev *edev,
+				physical_addr_t offset, void *dst)
 {
-	int rc;
-	u16 data16;
-	u32 data32;
-	u64 data64;
-	enum vmm_devemu_endianness data_endian;
+	return VMM_ENOTAVAIL;
+}
 
-	if (!edev ||
-	    (dst_endian <= VMM_DEVEMU_UNKNOWN_ENDIAN) ||
-	    (VMM_DEVEMU_MAX_ENDIAN <= dst_endian)) {
-		return VMM_EFAIL;
-	}
+static int devemu_write_notavail(struct vmm_emudev *edev,
+				 physical_addr_t offset, void *src)
+{
+	return VMM_ENOTAVAIL;
+}
 
-	switch (dst_len) {
-	case 1:
-		if (edev->emu->read8) {
-			rc = edev->emu->read8(edev, offset, dst);
-			debug_read(edev, offset, sizeof(u8), *((u8 *)dst));
-		} else {
-			vmm_printf("%s: edev=%s does not have read8()\n",
-				   __func__, edev->node->name);
-			rc = VMM_ENOTAVAIL;
-		}
-		break;
-	case 2:
-		if (edev->emu->read16) {
-			rc = edev->emu->read16(edev, offset, &data16);
-			debug_read(edev, offset, sizeof(u16), data16);
-		} else {
-			vmm_printf("%s: edev=%s does not have read16()\n",
-				   __func__, edev->node->name);
-			rc = VMM_ENOTAVAIL;
+static int devemu_read_invalid(struct vmm_emudev *edev,
+			       physical_addr_t offset, void *dst)
+{
+	return VMM_EFAIL;
+}
+
+static int devemu_write_invalid(struct vmm_emudev *edev,
+				physical_addr_t offset, void *src)
+{
+	return VMM_EFAIL;
+}
+
+static bool devemu_doorbell_ring(struct vmm_emudev *edev,
+				 physical_addr_t offset, u32 size, u64 val)
+{
+	bool found = FALSE;
+	irq_flags_t flags, flags1;
+	struct vmm_devemu_doorbell *db;
+
+	vmm_read_lock_irqsave_lite(&edev->doorbell_list_lock, flags);
+
+	list_for_each_entry(db, &edev->doorbell_list, head) {
+		if ((db->offset != offset) || (db->size != size)) {
+			continue;
 		}
-		if (!rc) {
-			switch (edev->emu->endian) {
-			case VMM_DEVEMU_LITTLE_ENDIAN:
-				data16 = vmm_cpu_to_le16(data16);
-				data_endian = VMM_DEVEMU_LITTLE_ENDIAN;
-				break;
-			case VMM_DEVEMU_BIG_ENDIAN:
-				data16 = vmm_cpu_to_be16(data16);
-				data_endian = VMM_DEVEMU_BIG_ENDIAN;
-				break;
-			default:
-				data_endian = VMM_DEVEMU_NATIVE_ENDIAN;
-				break;
-			};
-			if (data_endian != dst_endian) {
-				switch (dst_endian) {
-				case VMM_DEVEMU_LITTLE_ENDIAN:
-					data16 = vmm_cpu_to_le16(data16);
-					break;
-				case VMM_DEVEMU_BIG_ENDIAN:
-					data16 = vmm_cpu_to_be16(data16);
-					break;
-				default:
-					break;
-				};
+		if (db->flags & VMM_DEVEMU_DOORBELL_DATAMATCH) {
+			if (db->data != val) {
+				continue;
 			}
-			*(u16 *)dst = data16;
+			val = 0;
+		} else if (VMM_DEVEMU_DOORBELL_MAX_VALUE <= val) {
+			/* Emulator handles it synchronously */
+			continue;
 		}
+
+		vmm_spin_lock_irqsave_lite(&db->pending_lock, flags1);
+		db->pending |= ((u64)1 << val);
+		vmm_spin_unlock_irqrestore_lite(&db->pending_lock, flags1);
+
+		vmm_workqueue_schedule_work(db->wq, &db->work);
+
+		found = TRUE;
 		break;
-	case 4:
-		if (edev->emu->read32) {
-			rc = edev->emu->read32(edev, offset, &data32);
-			debug_read(edev, offset, sizeof(u32), data32);
-		} else {
-			vmm_printf("%s: edev=%s does not have read32()\n",
-				   __func__, edev->node->name);
-			rc = VMM_ENOTAVAIL;
-		}
-		if (!rc) {
-			switch (edev->emu->endian) {
-			case VMM_DEVEMU_LITTLE_ENDIAN:
-				data32 = vmm_cpu_to_le32(data32);
-				data_endian = VMM_DEVEMU_LITTLE_ENDIAN;
-				break;
-			case VMM_DEVEMU_BIG_ENDIAN:
-				data32 = vmm_cpu_to_be32(data32);
-				data_endian = VMM_DEVEMU_BIG_ENDIAN;
-				break;
-			default:
-				data_endian = VMM_DEVEMU_NATIVE_ENDIAN;
-				break;
-			};
-			if (data_endian != dst_endian) {
-				switch (dst_endian) {
-				case VMM_DEVEMU_LITTLE_ENDIAN:
-					data32 = vmm_cpu_to_le32(data32);
-					break;
-				case VMM_DEVEMU_BIG_ENDIAN:
-					data32 = vmm_cpu_to_be32(data32);
-					break;
-				default:
-					break;
-				};
-			}
-			*(u32 *)dst = data32;
+	}
+
+	vmm_read_unlock_irqrestore_lite(&edev->doorbell_list_lock, flags);
+
+	return found;
+}
+
+static void devemu_doorbell_work(struct vmm_work *work)
+{
+	u64 i, pending;
+	irq_flags_t flags;
+	struct vmm_devemu_doorbell *db =
+			container_of(work, struct vmm_devemu_doorbell, work);
+
+	/* Ring with preemption disabled, like synchronous emulation */
+	vmm_spin_lock(&db->ring_lock);
+
+	vmm_spin_lock_irqsave_lite(&db->pending_lock, flags);
+	pending = db->pending;
+	db->pending = 0;
+	vmm_spin_unlock_irqrestore_lite(&db->pending_lock, flags);
+
+	for (i = 0; pending; i++, pending >>= 1) {
+		if (!(pending & 0x1)) {
+			continue;
 		}
-		break;
-	case 8:
-		if (edev->emu->read64) {
-			rc = edev->emu->read64(edev, offset, &data64);
-			debug_read(edev, offset, sizeof(u64), data64);
+		if (db->flags & VMM_DEVEMU_DOORBELL_DATAMATCH) {
+			db->ring(db, db->data);
 		} else {
-			vmm_printf("%s: edev=%s does not have read64()\n",
-				   __func__, edev->node->name);
-			rc = VMM_ENOTAVAIL;
+			db->ring(db, i);
 		}
-		if (!rc) {
-			switch (edev->emu->endian) {
-			case VMM_DEVEMU_LITTLE_ENDIAN:
-				data64 = vmm_cpu_to_le64(data64);
-				data_endian = VMM_DEVEMU_LITTLE_ENDIAN;
-				break;
-			case VMM_DEVEMU_BIG_ENDIAN:
-				data64 = vmm_cpu_to_be64(data64);
-				data_endian = VMM_DEVEMU_BIG_ENDIAN;
-				break;
-			default:
-				data_endian = VMM_DEVEMU_NATIVE_ENDIAN;
-				break;
-			};
-			if (data_endian != dst_endian) {
-				switch (dst_endian) {
-				case VMM_DEVEMU_LITTLE_ENDIAN:
-					data64 = vmm_cpu_to_le64(data64);
-					break;
-				case VMM_DEVEMU_BIG_ENDIAN:
-					data64 = vmm_cpu_to_be32(data64);
-					break;
-				default:
-					break;
-				};
-			}
-			*(u64 *)dst = data64;
-		}
-		break;
-	default:
-		vmm_printf("%s: edev=%s invalid len=%d\n",
-			   __func__, edev->node->name, dst_len);
-		rc = VMM_EINVALID;
-		break;
-	};
-
-	if (rc) {
-		vmm_printf("%s: edev=%s offset=0x%"PRIPADDR" dst_len=%d "
-			   "failed (error %d)\n", __func__,
-			   edev->node->name, offset, dst_len, rc);
 	}
 
-	return rc;
+	vmm_spin_unlock(&db->ring_lock);
 }
 
-static int devemu_dowrite(struct vmm_emudev *edev,
-			  physical_addr_t offset,
-			  void *src, u32 src_len,
-			  enum vmm_devemu_endianness src_endian)
+/*
+ * Doorbells are spread over per-CPU work queues created on demand
+ * so that we don't have one work queue thread per emulated device.
+ */
+static struct vmm_workqueue *devemu_doorbell_wq(void)
 {
-	int rc;
-	u16 data16;
-	u32 data32;
-	u64 data64;
+	u32 cpu;
+	struct vmm_workqueue *wq = NULL;
+	char name[VMM_FIELD_NAME_SIZE];
 
-	if (!edev ||
-	    (src_endian <= VMM_DEVEMU_UNKNOWN_ENDIAN) ||
-	    (VMM_DEVEMU_MAX_ENDIAN <= src_endian)) {
-		return VMM_EFAIL;
+	vmm_mutex_lock(&dectrl.db_wq_lock);
+
+	for (cpu = 0; cpu < CONFIG_CPU_COUNT; cpu++) {
+		dectrl.db_wq_next = (dectrl.db_wq_next + 1) % CONFIG_CPU_COUNT;
+		if (vmm_cpu_online(dectrl.db_wq_next)) {
+			break;
+		}
 	}
+	cpu = dectrl.db_wq_next;
 
-	switch (src_len) {
-	case 1:		
-		if (edev->emu->write8) {
-			rc = edev->emu->write8(edev, offset, *((u8 *)src));
-			debug_write(edev, offset, sizeof(u8), *((u8 *)src));
-		} else {
-			vmm_printf("%s: edev=%s does not have write8()\n",
-				   __func__, edev->node->name);
-			rc = VMM_ENOTAVAIL;
+	if (!dectrl.db_wq[cpu]) {
+		vmm_snprintf(name, sizeof(name), "doorbell/%d", cpu);
+		wq = vmm_workqueue_create(name, VMM_THREAD_DEF_PRIORITY);
+		if (wq && vmm_threads_set_affinity(
+					vmm_workqueue_get_thread(wq),
+					vmm_cpumask_of(cpu))) {
+			vmm_workqueue_destroy(wq);
+			wq = NULL;
 		}
-		break;
+		dectrl.db_wq[cpu] = wq;
+	}
+	wq = dectrl.db_wq[cpu];
+
+	vmm_mutex_unlock(&dectrl.db_wq_lock);
+
+	return wq;
+}
+
+static int devemu_write_apply(struct vmm_emudev *edev,
+			      physical_addr_t offset, u32 size, u64 data)
+{
+	switch (size) {
+	case 1:
+		return edev->emu->write8(edev, offset, (u8)data);
 	case 2:
-		data16 = *(u16 *)src;
-		switch (src_endian) {
-		case VMM_DEVEMU_LITTLE_ENDIAN:
-			data16 = vmm_le16_to_cpu(data16);
-			break;
-		case VMM_DEVEMU_BIG_ENDIAN:
-			data16 = vmm_be16_to_cpu(data16);
-			break;
-		default:
-			break;
-		};
-		switch (edev->emu->endian) {
-		case VMM_DEVEMU_LITTLE_ENDIAN:
-			data16 = vmm_cpu_to_le16(data16);
-			break;
-		case VMM_DEVEMU_BIG_ENDIAN:
-			data16 = vmm_cpu_to_be16(data16);
-			break;
-		default:
-			break;
-		};
-		if (edev->emu->write16) {
-			rc = edev->emu->write16(edev, offset, data16);
-			debug_write(edev, offset, sizeof(u16), data16);
-		} else {
-			vmm_printf("%s: edev=%s does not have write16()\n",
-				   __func__, edev->node->name);
-			rc = VMM_ENOTAVAIL;
-		}
-		break;
+		return edev->emu->write16(edev, offset, (u16)data);
 	case 4:
-		data32 = *(u32 *)src;
-		switch (src_endian) {
-		case VMM_DEVEMU_LITTLE_ENDIAN:
-			data32 = vmm_le32_to_cpu(data32);
-			break;
-		case VMM_DEVEMU_BIG_ENDIAN:
-			data32 = vmm_be32_to_cpu(data32);
-			break;
-		default:
-			break;
-		};
-		switch (edev->emu->endian) {
-		case VMM_DEVEMU_LITTLE_ENDIAN:
-			data32 = vmm_cpu_to_le32(data32);
-			break;
-		case VMM_DEVEMU_BIG_ENDIAN:
-			data32 = vmm_cpu_to_be32(data32);
-			break;
-		default:
-			break;
-		};
-		if (edev->emu->write32) {
-			rc = edev->emu->write32(edev, offset, data32);
-			debug_write(edev, offset, sizeof(u32), data32);
-		} else {
-			vmm_printf("%s: edev=%s does not have write32()\n",
-				   __func__, edev->node->name);
-			rc = VMM_ENOTAVAIL;
-		}
-		break;
+		return edev->emu->write32(edev, offset, (u32)data);
 	case 8:
-		data64 = *(u64 *)src;
-		switch (src_endian) {
-		case VMM_DEVEMU_LITTLE_ENDIAN:
-			data64 = vmm_le64_to_cpu(data64);
-			break;
-		case VMM_DEVEMU_BIG_ENDIAN:
-			data64 = vmm_be64_to_cpu(data64);
-			break;
-		default:
-			break;
-		};
-		switch (edev->emu->endian) {
-		case VMM_DEVEMU_LITTLE_ENDIAN:
-			data64 = vmm_cpu_to_le64(data64);
-			break;
-		case VMM_DEVEMU_BIG_ENDIAN:
-			data64 = vmm_cpu_to_be64(data64);
-			break;
-		default:
+		return edev->emu->write64(edev, offset, data);
+	default:
+		break;
+	};
+
+	return VMM_EFAIL;
+}
+
+static u32 devemu_coalesced_flags(struct vmm_emudev *edev,
+				  physical_addr_t offset, u32 size)
+{
+	u32 ret = 0;
+	irq_flags_t f;
+	struct vmm_devemu_coalesced_range *cr;
+
+	vmm_read_lock_irqsave_lite(&edev->coalesced_list_lock, f);
+
+	list_for_each_entry(cr, &edev->coalesced_list, head) {
+		if ((cr->offset <= offset) &&
+		    ((offset + size) <= (cr->offset + cr->size))) {
+			ret = cr->flags;
 			break;
-		};
-		if (edev->emu->write64) {
-			rc = edev->emu->write64(edev, offset, data64);
-			debug_write(edev, offset, sizeof(u64), data64);
-		} else {
-			vmm_printf("%s: edev=%s does not have write64()\n",
-				   __func__, edev->node->name);
-			rc = VMM_ENOTAVAIL;
 		}
-		break;
+	}
+
+	vmm_read_unlock_irqrestore_lite(&edev->coalesced_list_lock, f);
+
+	return ret;
+}
+
+/*
+ * Pending writes are taken out of the ring by swapping buffers and
+ * applied with ring lock dropped so that VCPUs can keep appending.
+ * Drains are serialized using drain_lock to keep writes in order.
+ * This is called from VCPU context so drain_lock is a spinlock and
+ * inflight makes a concurrent drain wait for the one in progress.
+ */
+static void devemu_coalesced_drain(struct vmm_devemu_coalesced_ring *r)
+{
+	u32 i, count;
+	irq_flags_t f;
+	struct vmm_devemu_coalesced_entry *e;
+
+	if (!r->count && !r->inflight) {
+		return;
+	}
+
+	vmm_spin_lock(&r->drain_lock);
+
+	vmm_spin_lock_irqsave(&r->lock, f);
+	e = r->ent;
+	count = r->count;
+	r->ent = (e == r->buf[0]) ? r->buf[1] : r->buf[0];
+	r->count = 0;
+	r->inflight = count;
+	vmm_spin_unlock_irqrestore(&r->lock, f);
+
+	for (i = 0; i < count; i++) {
+		devemu_write_apply(e[i].edev, e[i].offset,
+				   e[i].size, e[i].data);
+	}
+	r->inflight = 0;
+
+	vmm_spin_unlock(&r->drain_lock);
+}
+
+static void devemu_coalesced_drain_work(struct vmm_work *work)
+{
+	struct vmm_devemu_coalesced_ring *r =
+		container_of(work, struct vmm_devemu_coalesced_ring,
+			     drain_work);
+
+	devemu_coalesced_drain(r);
+}
+
+static void devemu_coalesced_drain_event(struct vmm_timer_event *ev)
+{
+	struct vmm_devemu_coalesced_ring *r = ev->priv;
+
+	/* Emulators don't expect to be called from interrupt context */
+	vmm_workqueue_schedule_work(NULL, &r->drain_work);
+}
+
+static inline struct vmm_devemu_coalesced_ring *devemu_coalesced_ring(
+						struct vmm_emudev *edev)
+{
+	struct vmm_devemu_guest_context *eg = edev->reg->aspace->devemu_priv;
+
+	return &eg->cring;
+}
+
+/* Apply pending coalesced writes before emulator state is read */
+static void devemu_coalesced_sync(struct vmm_emudev *edev,
+				  physical_addr_t offset, u32 size)
+{
+	if (list_empty(&edev->coalesced_list) ||
+	    (devemu_coalesced_flags(edev, offset, size) &
+	     VMM_DEVEMU_COALESCED_READ_NOFLUSH)) {
+		return;
+	}
+
+	devemu_coalesced_drain(devemu_coalesced_ring(edev));
+}
+
+static bool devemu_coalesced_write(struct vmm_emudev *edev,
+				   physical_addr_t offset, u32 size, u64 data)
+{
+	irq_flags_t f;
+	struct vmm_devemu_coalesced_ring *r;
+	struct vmm_devemu_coalesced_entry *e;
+
+	if (list_empty(&edev->coalesced_list)) {
+		return FALSE;
+	}
+
+	r = devemu_coalesced_ring(edev);
+
+	if (!(devemu_coalesced_flags(edev, offset, size) &
+	      VMM_DEVEMU_COALESCED_WRITE)) {
+		/* Keep ordering with pending coalesced writes */
+		devemu_coalesced_drain(r);
+		return FALSE;
+	}
+
+	vmm_spin_lock_irqsave(&r->lock, f);
+
+	while (r->count == VMM_DEVEMU_COALESCED_RING_SIZE) {
+		vmm_spin_unlock_irqrestore(&r->lock, f);
+		devemu_coalesced_drain(r);
+		vmm_spin_lock_irqsave(&r->lock, f);
+	}
+
+	e = &r->ent[r->count];
+	e->edev = edev;
+	e->offset = offset;
+	e->size = size;
+	e->data = data;
+	r->count++;
+
+	if (r->count == 1) {
+		vmm_timer_event_start(&r->drain_ev,
+				      VMM_DEVEMU_COALESCED_DRAIN_NSECS);
+	}
+
+	vmm_spin_unlock_irqrestore(&r->lock, f);
+
+	return TRUE;
+}
+
+static int devemu_write_ext(struct vmm_emudev *edev,
+			    physical_addr_t offset, u32 size, u64 data)
+{
+	if (devemu_doorbell_ring(edev, offset, size, data)) {
+		return VMM_OK;
+	}
+
+	if (devemu_coalesced_write(edev, offset, size, data)) {
+		return VMM_OK;
+	}
+
+	return devemu_write_apply(edev, offset, size, data);
+}
+
+#define DEVEMU_DEFINE_ACCESS(bits)					\
+static int devemu_read##bits(struct vmm_emudev *edev,			\
+			     physical_addr_t offset, void *dst)		\
+{									\
+	int rc = edev->emu->read##bits(edev, offset, dst);		\
+	debug_read(edev, offset, sizeof(u##bits), *((u##bits *)dst));	\
+	return rc;							\
+}									\
+static int devemu_write##bits(struct vmm_emudev *edev,			\
+			      physical_addr_t offset, void *src)	\
+{									\
+	debug_write(edev, offset, sizeof(u##bits), *((u##bits *)src));	\
+	return edev->emu->write##bits(edev, offset, *((u##bits *)src));	\
+}									\
+static int devemu_read##bits##_ext(struct vmm_emudev *edev,		\
+				   physical_addr_t offset, void *dst)	\
+{									\
+	devemu_coalesced_sync(edev, offset, sizeof(u##bits));		\
+	return devemu_read##bits(edev, offset, dst);			\
+}									\
+static int devemu_write##bits##_ext(struct vmm_emudev *edev,		\
+				    physical_addr_t offset, void *src)	\
+{									\
+	u##bits data = *((u##bits *)src);				\
+	debug_write(edev, offset, sizeof(u##bits), data);		\
+	return devemu_write_ext(edev, offset, sizeof(u##bits), data);	\
+}
+
+#define DEVEMU_DEFINE_ACCESS_SWAP(bits)					\
+static int devemu_read##bits##_swap(struct vmm_emudev *edev,		\
+				    physical_addr_t offset, void *dst)	\
+{									\
+	int rc;								\
+	u##bits data = 0;						\
+	rc = edev->emu->read##bits(edev, offset, &data);		\
+	debug_read(edev, offset, sizeof(u##bits), data);		\
+	if (!rc) {							\
+		*((u##bits *)dst) = devemu_swab##bits(data);		\
+	}								\
+	return rc;							\
+}									\
+static int devemu_write##bits##_swap(struct vmm_emudev *edev,		\
+				     physical_addr_t offset, void *src)	\
+{									\
+	u##bits data = devemu_swab##bits(*((u##bits *)src));		\
+	debug_write(edev, offset, sizeof(u##bits), data);		\
+	return edev->emu->write##bits(edev, offset, data);		\
+}									\
+static int devemu_read##bits##_swap_ext(struct vmm_emudev *edev,	\
+					physical_addr_t offset,		\
+					void *dst)			\
+{									\
+	devemu_coalesced_sync(edev, offset, sizeof(u##bits));		\
+	return devemu_read##bits##_swap(edev, offset, dst);		\
+}									\
+static int devemu_write##bits##_swap_ext(struct vmm_emudev *edev,	\
+					 physical_addr_t offset,	\
+					 void *src)			\
+{									\
+	u##bits data = devemu_swab##bits(*((u##bits *)src));		\
+	debug_write(edev, offset, sizeof(u##bits), data);		\
+	return devemu_write_ext(edev, offset, sizeof(u##bits), data);	\
+}
+
+DEVEMU_DEFINE_ACCESS(8)
+DEVEMU_DEFINE_ACCESS(16)
+DEVEMU_DEFINE_ACCESS(32)
+DEVEMU_DEFINE_ACCESS(64)
+DEVEMU_DEFINE_ACCESS_SWAP(16)
+DEVEMU_DEFINE_ACCESS_SWAP(32)
+DEVEMU_DEFINE_ACCESS_SWAP(64)
+
+/* Indexed by [access][swap][ext] where ext means emulated device
+ * has doorbells or coalesced ranges.
+ */
+static const vmm_devemu_read_t devemu_read_ops[][2][2] = {
+	{ { devemu_read8, devemu_read8_ext },
+	  { devemu_read8, devemu_read8_ext } },
+	{ { devemu_read16, devemu_read16_ext },
+	  { devemu_read16_swap, devemu_read16_swap_ext } },
+	{ { devemu_read32, devemu_read32_ext },
+	  { devemu_read32_swap, devemu_read32_swap_ext } },
+	{ { devemu_read64, devemu_read64_ext },
+	  { devemu_read64_swap, devemu_read64_swap_ext } },
+};
+
+static const vmm_devemu_write_t devemu_write_ops[][2][2] = {
+	{ { devemu_write8, devemu_write8_ext },
+	  { devemu_write8, devemu_write8_ext } },
+	{ { devemu_write16, devemu_write16_ext },
+	  { devemu_write16_swap, devemu_write16_swap_ext } },
+	{ { devemu_write32, devemu_write32_ext },
+	  { devemu_write32_swap, devemu_write32_swap_ext } },
+	{ { devemu_write64, devemu_write64_ext },
+	  { devemu_write64_swap, devemu_write64_swap_ext } },
+};
+
+static bool devemu_endian_swaps(enum vmm_devemu_endianness endian)
+{
+	switch (endian) {
+	case VMM_DEVEMU_LITTLE_ENDIAN:
+	case VMM_DEVEMU_BIG_ENDIAN:
+		return (endian != dectrl.host_endian) ? TRUE : FALSE;
 	default:
-		vmm_printf("%s: edev=%s invalid len=%d\n",
-			   __func__, edev->node->name, src_len);
-		rc = VMM_EINVALID;
 		break;
 	};
 
-	if (rc) {
-		vmm_printf("%s: edev=%s offset=0x%"PRIPADDR" src_len=%d "
-			   "failed (error %d)\n", __func__,
-			   edev->node->name, offset, src_len, rc);
+	return FALSE;
+}
+
+static void devemu_resolve_ops(struct vmm_emudev *edev)
+{
+	u32 a, e;
+	bool swap, ext, rd[VMM_DEVEMU_MAX_ACCESS], wr[VMM_DEVEMU_MAX_ACCESS];
+	struct vmm_emulator *emu = edev->emu;
+
+	rd[0] = (emu->read8) ? TRUE : FALSE;
+	rd[1] = (emu->read16) ? TRUE : FALSE;
+	rd[2] = (emu->read32) ? TRUE : FALSE;
+	rd[3] = (emu->read64) ? TRUE : FALSE;
+	wr[0] = (emu->write8) ? TRUE : FALSE;
+	wr[1] = (emu->write16) ? TRUE : FALSE;
+	wr[2] = (emu->write32) ? TRUE : FALSE;
+	wr[3] = (emu->write64) ? TRUE : FALSE;
+
+	ext = (list_empty(&edev->doorbell_list) &&
+	       list_empty(&edev->coalesced_list)) ? FALSE : TRUE;
+
+	for (e = 0; e < VMM_DEVEMU_MAX_ENDIAN; e++) {
+		/* Conversion between guest and emulator endianness
+		 * is a byte swap only if exactly one of them differs
+		 * from host endianness.
+		 */
+		swap = devemu_endian_swaps(emu->endian) ^
+		       devemu_endian_swaps(e);
+
+		for (a = 0; a < VMM_DEVEMU_MAX_ACCESS; a++) {
+			if (e == VMM_DEVEMU_UNKNOWN_ENDIAN) {
+				edev->read_op[a][e] = devemu_read_invalid;
+				edev->write_op[a][e] = devemu_write_invalid;
+				continue;
+			}
+
+			edev->read_op[a][e] = (rd[a]) ?
+				devemu_read_ops[a][swap][ext] :
+				devemu_read_notavail;
+			edev->write_op[a][e] = (wr[a]) ?
+				devemu_write_ops[a][swap][ext] :
+				devemu_write_notavail;
+		}
 	}
+}
+
+#ifdef CONFIG_DEVEMU_STATS
+
+static inline u64 devemu_stats_start(void)
+{
+	return vmm_timer_timestamp();
+}
+
+static void devemu_stats_update(struct vmm_emudev *edev,
+				physical_addr_t offset, u32 access,
+				bool write, u64 tstamp)
+{
+	u32 b;
+	irq_flags_t f;
+	struct vmm_devemu_stats *st;
+	struct vmm_devemu_stats_hot *h;
+	u64 nsecs = vmm_timer_timestamp() - tstamp;
+
+	b = (nsecs) ? __ilog2_u64(nsecs) : 0;
+	if (VMM_DEVEMU_STATS_HIST_SIZE <= b) {
+		b = VMM_DEVEMU_STATS_HIST_SIZE - 1;
+	}
+
+	/* Statistics are per-CPU so we only need to protect
+	 * against interrupts on current CPU.
+	 */
+	arch_cpu_irq_save(f);
+
+	st = &edev->stats[vmm_smp_processor_id()];
+	if (write) {
+		st->write_count[access]++;
+		st->write_nsecs += nsecs;
+		st->write_hist[b]++;
+	} else {
+		st->read_count[access]++;
+		st->read_nsecs += nsecs;
+		st->read_hist[b]++;
+	}
+
+	/* Each slot keeps the offset seen most often, an offset
+	 * replaces the current one after outnumbering it.
+	 */
+	h = &st->hot[(offset >> 2) & (VMM_DEVEMU_STATS_HOT_SIZE - 1)];
+	if (h->offset == offset) {
+		h->count++;
+	} else if (h->count) {
+		h->count--;
+	} else {
+		h->offset = offset;
+		h->count = 1;
+	}
+
+	arch_cpu_irq_restore(f);
+}
+
+#else
+
+static inline u64 devemu_stats_start(void)
+{
+	return 0;
+}
+
+static inline void devemu_stats_update(struct vmm_emudev *edev,
+				       physical_addr_t offset, u32 access,
+				       bool write, u64 tstamp)
+{
+}
+
+#endif
+
+static inline int devemu_doread(struct vmm_emudev *edev,
+				physical_addr_t offset,
+				void *dst, u32 dst_len,
+				enum vmm_devemu_endianness dst_endian)
+{
+	int rc;
+	u32 access;
+	u64 tstamp;
+
+	if (!edev ||
+	    (VMM_DEVEMU_MAX_ENDIAN <= (u32)dst_endian) ||
+	    (array_size(devemu_len2access) <= dst_len)) {
+		return VMM_EINVALID;
+	}
+
+	access = devemu_len2access[dst_len];
+	if (access == DEVEMU_ACCESS_INVALID) {
+		return VMM_EINVALID;
+	}
+
+	tstamp = devemu_stats_start();
+	rc = edev->read_op[access][dst_endian](edev, offset, dst);
+	devemu_stats_update(edev, offset, access, FALSE, tstamp);
+
+	return rc;
+}
+
+static inline int devemu_dowrite(struct vmm_emudev *edev,
+				 physical_addr_t offset,
+				 void *src, u32 src_len,
+				 enum vmm_devemu_endianness src_endian)
+{
+	int rc;
+	u32 access;
+	u64 tstamp;
+
+	if (!edev ||
+	    (VMM_DEVEMU_MAX_ENDIAN <= (u32)src_endian) ||
+	    (array_size(devemu_len2access) <= src_len)) {
+		return VMM_EINVALID;
+	}
+
+	access = devemu_len2access[src_len];
+	if (access == DEVEMU_ACCESS_INVALID) {
+		return VMM_EINVALID;
+	}
+
+	tstamp = devemu_stats_start();
+	rc = edev->write_op[access][src_endian](edev, offset, src);
+	devemu_stats_update(edev, offset, access, TRUE, tstamp);
 
 	return rc;
 }
@@ -597,6 +951,43 @@ int __vmm_devemu_emulate_irq2(struct vmm_guest *guest,
 	return VMM_OK;
 }
 
+int vmm_devemu_emulate_msi(struct vmm_guest *guest,
+			   physical_addr_t addr, u32 data)
+{
+	struct vmm_region *reg;
+	struct vmm_emudev *edev;
+
+	if (!guest) {
+		return VMM_EFAIL;
+	}
+
+	/* MSI is a posted write to the doorbell of emulated irqchip */
+	reg = vmm_guest_find_region(guest, addr,
+			VMM_REGION_VIRTUAL | VMM_REGION_MEMORY, FALSE);
+	edev = (reg) ? reg->devemu_priv : NULL;
+	if (!edev || !edev->emu->msi) {
+		return VMM_ENOTAVAIL;
+	}
+
+	return edev->emu->msi(edev, addr - reg->gphys_addr, data);
+}
+
+static void devemu_msi_capable(struct vmm_emudev *edev, void *priv)
+{
+	if (edev->emu->msi) {
+		*(bool *)priv = TRUE;
+	}
+}
+
+bool vmm_devemu_msi_capable(struct vmm_guest *guest)
+{
+	bool ret = FALSE;
+
+	vmm_devemu_iterate_emudev(guest, devemu_msi_capable, &ret);
+
+	return ret;
+}
+
 int vmm_devemu_map_host2guest_irq(struct vmm_guest *guest, u32 irq,
 				  u32 host_irq)
 {
@@ -1003,6 +1394,334 @@ u32 vmm_devemu_emulator_count(void)
 	return retval;
 }
 
+int vmm_devemu_register_doorbell(struct vmm_emudev *edev,
+				 struct vmm_devemu_doorbell *db,
+				 physical_addr_t offset, u32 size,
+				 u32 flags, u64 data,
+				 void (*ring) (struct vmm_devemu_doorbell *,
+					       u64),
+				 void *priv)
+{
+	irq_flags_t f;
+	struct vmm_workqueue *wq;
+	struct vmm_devemu_doorbell *d;
+
+	if (!edev || !db || !ring) {
+		return VMM_EFAIL;
+	}
+	if ((size != 1) && (size != 2) && (size != 4) && (size != 8)) {
+		return VMM_EINVALID;
+	}
+	if (edev->reg && (edev->reg->phys_size < (offset + size))) {
+		return VMM_EINVALID;
+	}
+
+	wq = devemu_doorbell_wq();
+	if (!wq) {
+		return VMM_ENOMEM;
+	}
+
+	INIT_LIST_HEAD(&db->head);
+	db->edev = edev;
+	db->offset = offset;
+	db->size = size;
+	db->flags = flags;
+	db->data = data;
+	db->wq = wq;
+	INIT_WORK(&db->work, devemu_doorbell_work);
+	INIT_SPIN_LOCK(&db->ring_lock);
+	INIT_SPIN_LOCK(&db->pending_lock);
+	db->pending = 0;
+	db->ring = ring;
+	db->priv = priv;
+
+	vmm_write_lock_irqsave_lite(&edev->doorbell_list_lock, f);
+
+	list_for_each_entry(d, &edev->doorbell_list, head) {
+		if ((d->offset == offset) && (d->size == size) &&
+		    (!(d->flags & VMM_DEVEMU_DOORBELL_DATAMATCH) ||
+		     !(flags & VMM_DEVEMU_DOORBELL_DATAMATCH) ||
+		     (d->data == data))) {
+			vmm_write_unlock_irqrestore_lite(
+					&edev->doorbell_list_lock, f);
+			return VMM_EEXIST;
+		}
+	}
+
+	list_add_tail(&db->head, &edev->doorbell_list);
+	devemu_resolve_ops(edev);
+
+	vmm_write_unlock_irqrestore_lite(&edev->doorbell_list_lock, f);
+
+	return VMM_OK;
+}
+
+void vmm_devemu_flush_doorbell(struct vmm_devemu_doorbell *db)
+{
+	irq_flags_t f;
+
+	if (!db) {
+		return;
+	}
+
+	/*
+	 * Wait for in-progress ring() callbacks without sleeping because
+	 * this is called from VCPU context upon device reset. Already
+	 * scheduled work finds nothing pending after this.
+	 */
+	vmm_spin_lock(&db->ring_lock);
+	vmm_spin_lock_irqsave_lite(&db->pending_lock, f);
+	db->pending = 0;
+	vmm_spin_unlock_irqrestore_lite(&db->pending_lock, f);
+	vmm_spin_unlock(&db->ring_lock);
+}
+
+int vmm_devemu_unregister_doorbell(struct vmm_emudev *edev,
+				   struct vmm_devemu_doorbell *db)
+{
+	bool found;
+	irq_flags_t f;
+	struct vmm_devemu_doorbell *d;
+
+	if (!edev || !db) {
+		return VMM_EFAIL;
+	}
+
+	vmm_write_lock_irqsave_lite(&edev->doorbell_list_lock, f);
+
+	found = FALSE;
+	list_for_each_entry(d, &edev->doorbell_list, head) {
+		if (d == db) {
+			found = TRUE;
+			break;
+		}
+	}
+	if (!found) {
+		vmm_write_unlock_irqrestore_lite(&edev->doorbell_list_lock, f);
+		return VMM_ENOTAVAIL;
+	}
+
+	list_del(&db->head);
+	devemu_resolve_ops(edev);
+
+	vmm_write_unlock_irqrestore_lite(&edev->doorbell_list_lock, f);
+
+	/* Work can't be running ring() anymore so this won't spin long */
+	vmm_devemu_flush_doorbell(db);
+	vmm_workqueue_stop_work(&db->work);
+
+	return VMM_OK;
+}
+
+int vmm_devemu_register_coalesced(struct vmm_emudev *edev,
+				  physical_addr_t offset,
+				  physical_size_t size, u32 flags)
+{
+	irq_flags_t f;
+	struct vmm_devemu_coalesced_range *cr;
+
+	if (!edev || !size) {
+		return VMM_EFAIL;
+	}
+	if (!edev->reg || (edev->reg->phys_size < (offset + size))) {
+		return VMM_EINVALID;
+	}
+
+	cr = vmm_zalloc(sizeof(*cr));
+	if (!cr) {
+		return VMM_ENOMEM;
+	}
+
+	INIT_LIST_HEAD(&cr->head);
+	cr->offset = offset;
+	cr->size = size;
+	cr->flags = flags;
+
+	vmm_write_lock_irqsave_lite(&edev->coalesced_list_lock, f);
+	list_add_tail(&cr->head, &edev->coalesced_list);
+	devemu_resolve_ops(edev);
+	vmm_write_unlock_irqrestore_lite(&edev->coalesced_list_lock, f);
+
+	return VMM_OK;
+}
+
+int vmm_devemu_unregister_coalesced(struct vmm_emudev *edev,
+				    physical_addr_t offset,
+				    physical_size_t size)
+{
+	irq_flags_t f;
+	struct vmm_devemu_coalesced_range *cr, *found = NULL;
+
+	if (!edev) {
+		return VMM_EFAIL;
+	}
+
+	vmm_write_lock_irqsave_lite(&edev->coalesced_list_lock, f);
+
+	list_for_each_entry(cr, &edev->coalesced_list, head) {
+		if ((cr->offset == offset) && (cr->size == size)) {
+			found = cr;
+			break;
+		}
+	}
+	if (found) {
+		list_del(&found->head);
+		devemu_resolve_ops(edev);
+	}
+
+	vmm_write_unlock_irqrestore_lite(&edev->coalesced_list_lock, f);
+
+	if (!found) {
+		return VMM_ENOTAVAIL;
+	}
+
+	/* Pending writes may still refer to this range */
+	devemu_coalesced_drain(devemu_coalesced_ring(edev));
+
+	vmm_free(found);
+
+	return VMM_OK;
+}
+
+static void devemu_coalesced_free_ranges(struct vmm_emudev *edev)
+{
+	irq_flags_t f;
+	struct vmm_devemu_coalesced_range *cr;
+
+	vmm_write_lock_irqsave_lite(&edev->coalesced_list_lock, f);
+
+	while (!list_empty(&edev->coalesced_list)) {
+		cr = list_first_entry(&edev->coalesced_list,
+				      struct vmm_devemu_coalesced_range, head);
+		list_del(&cr->head);
+		vmm_free(cr);
+	}
+
+	vmm_write_unlock_irqrestore_lite(&edev->coalesced_list_lock, f);
+}
+
+int vmm_devemu_flush_coalesced(struct vmm_guest *guest)
+{
+	struct vmm_devemu_guest_context *eg;
+
+	if (!guest || !guest->aspace.devemu_priv) {
+		return VMM_EFAIL;
+	}
+
+	eg = guest->aspace.devemu_priv;
+	devemu_coalesced_drain(&eg->cring);
+
+	return VMM_OK;
+}
+
+static void devemu_iterate_edev(struct vmm_emudev *edev,
+			void (*func)(struct vmm_emudev *edev, void *priv),
+			void *priv)
+{
+	irq_flags_t f;
+	struct vmm_emudev *e, *en;
+
+	func(edev, priv);
+
+	vmm_read_lock_irqsave_lite(&edev->child_list_lock, f);
+	list_for_each_entry_safe(e, en, &edev->child_list, head) {
+		vmm_read_unlock_irqrestore_lite(&edev->child_list_lock, f);
+		devemu_iterate_edev(e, func, priv);
+		vmm_read_lock_irqsave_lite(&edev->child_list_lock, f);
+	}
+	vmm_read_unlock_irqrestore_lite(&edev->child_list_lock, f);
+}
+
+struct devemu_iterate_priv {
+	void (*func)(struct vmm_emudev *edev, void *priv);
+	void *priv;
+};
+
+static void devemu_iterate_region(struct vmm_guest *guest,
+				  struct vmm_region *reg, void *priv)
+{
+	struct devemu_iterate_priv *p = priv;
+
+	if (!reg->devemu_priv || (reg->flags & VMM_REGION_ALIAS)) {
+		return;
+	}
+
+	devemu_iterate_edev(reg->devemu_priv, p->func, p->priv);
+}
+
+void vmm_devemu_iterate_emudev(struct vmm_guest *guest,
+			void (*func)(struct vmm_emudev *edev, void *priv),
+			void *priv)
+{
+	struct devemu_iterate_priv p;
+
+	if (!guest || !func) {
+		return;
+	}
+
+	p.func = func;
+	p.priv = priv;
+	vmm_guest_iterate_region(guest, VMM_REGION_ISDEVICE,
+				 devemu_iterate_region, &p);
+	vmm_guest_iterate_region(guest, VMM_REGION_ISDEVICE | VMM_REGION_IO,
+				 devemu_iterate_region, &p);
+}
+
+#ifdef CONFIG_DEVEMU_STATS
+
+int vmm_devemu_stats_get(struct vmm_emudev *edev,
+			 struct vmm_devemu_stats *stats)
+{
+	u32 c, i;
+	struct vmm_devemu_stats *st;
+	struct vmm_devemu_stats_hot *h, *sh;
+
+	if (!edev || !stats) {
+		return VMM_EFAIL;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (c = 0; c < CONFIG_CPU_COUNT; c++) {
+		st = &edev->stats[c];
+		for (i = 0; i < VMM_DEVEMU_MAX_ACCESS; i++) {
+			stats->read_count[i] += st->read_count[i];
+			stats->write_count[i] += st->write_count[i];
+		}
+		stats->read_nsecs += st->read_nsecs;
+		stats->write_nsecs += st->write_nsecs;
+		for (i = 0; i < VMM_DEVEMU_STATS_HIST_SIZE; i++) {
+			stats->read_hist[i] += st->read_hist[i];
+			stats->write_hist[i] += st->write_hist[i];
+		}
+		for (i = 0; i < VMM_DEVEMU_STATS_HOT_SIZE; i++) {
+			h = &st->hot[i];
+			sh = &stats->hot[i];
+			if (sh->offset == h->offset) {
+				sh->count += h->count;
+			} else if (sh->count < h->count) {
+				*sh = *h;
+			}
+		}
+	}
+
+	return VMM_OK;
+}
+
+int vmm_devemu_stats_reset(struct vmm_emudev *edev)
+{
+	if (!edev) {
+		return VMM_EFAIL;
+	}
+
+	memset(edev->stats, 0,
+	       sizeof(struct vmm_devemu_stats) * CONFIG_CPU_COUNT);
+
+	return VMM_OK;
+}
+
+#endif
+
 static int devemu_sync(struct vmm_guest *guest,
 		       struct vmm_emudev *edev,
 		       unsigned long val, void *v)
@@ -1059,11 +1778,19 @@ int vmm_devemu_sync_parent(struct vmm_guest *guest,
 
 int vmm_devemu_reset_context(struct vmm_guest *guest)
 {
-	if (!guest) {
+	irq_flags_t f;
+	struct vmm_devemu_guest_context *eg;
+
+	if (!guest || !guest->aspace.devemu_priv) {
 		return VMM_EFAIL;
 	}
 
-	/* For now nothing to do here. */
+	eg = guest->aspace.devemu_priv;
+
+	/* Writes done before guest reset are of no use */
+	vmm_spin_lock_irqsave(&eg->cring.lock, f);
+	eg->cring.count = 0;
+	vmm_spin_unlock_irqrestore(&eg->cring.lock, f);
 
 	return VMM_OK;
 }
@@ -1157,6 +1884,11 @@ static int devemu_remove_edev(struct vmm_guest *guest,
 
 	vmm_write_unlock_irqrestore_lite(&edev->child_list_lock, f);
 
+	/* Pending coalesced writes may refer to this emulated device */
+	if (edev->reg) {
+		devemu_coalesced_drain(devemu_coalesced_ring(edev));
+	}
+
 	debug_remove(edev);
 	if ((rc = edev->emu->remove(edev))) {
 		if (edev->parent) {
@@ -1172,6 +1904,8 @@ static int devemu_remove_edev(struct vmm_guest *guest,
 		return rc;
 	}
 
+	devemu_coalesced_free_ranges(edev);
+
 	vmm_devtree_dref_node(edev->node);
 	edev->node = NULL;
 
@@ -1180,6 +1914,9 @@ static int devemu_remove_edev(struct vmm_guest *guest,
 		edev->reg = NULL;
 	}
 
+#ifdef CONFIG_DEVEMU_STATS
+	vmm_free(edev->stats);
+#endif
 	vmm_free(edev);
 
 	return VMM_OK;
@@ -1262,6 +1999,15 @@ static struct vmm_emudev *devemu_probe_edev(struct vmm_guest *guest,
 			vmm_mutex_unlock(&dectrl.emu_lock);
 			return VMM_ERR_PTR(VMM_ENOMEM);
 		}
+#ifdef CONFIG_DEVEMU_STATS
+		edev->stats = vmm_zalloc(sizeof(struct vmm_devemu_stats) *
+					 CONFIG_CPU_COUNT);
+		if (!edev->stats) {
+			vmm_free(edev);
+			vmm_mutex_unlock(&dectrl.emu_lock);
+			return VMM_ERR_PTR(VMM_ENOMEM);
+		}
+#endif
 
 		INIT_SPIN_LOCK(&edev->lock);
 		vmm_devtree_ref_node(node);
@@ -1272,7 +2018,12 @@ static struct vmm_emudev *devemu_probe_edev(struct vmm_guest *guest,
 		INIT_LIST_HEAD(&edev->head);
 		INIT_RW_LOCK(&edev->child_list_lock);
 		INIT_LIST_HEAD(&edev->child_list);
+		INIT_RW_LOCK(&edev->doorbell_list_lock);
+		INIT_LIST_HEAD(&edev->doorbell_list);
+		INIT_RW_LOCK(&edev->coalesced_list_lock);
+		INIT_LIST_HEAD(&edev->coalesced_list);
 		edev->priv = NULL;
+		devemu_resolve_ops(edev);
 		set_debug_info(edev);
 
 		debug_probe(edev);
@@ -1288,8 +2039,12 @@ static struct vmm_emudev *devemu_probe_edev(struct vmm_guest *guest,
 					   edev->node->name, rc);
 			}
 			vmm_mutex_unlock(&dectrl.emu_lock);
+			devemu_coalesced_free_ranges(edev);
 			vmm_devtree_dref_node(edev->node);
 			edev->node = NULL;
+#ifdef CONFIG_DEVEMU_STATS
+			vmm_free(edev->stats);
+#endif
 			vmm_free(edev);
 			return VMM_ERR_PTR(rc);
 		}
@@ -1307,8 +2062,12 @@ static struct vmm_emudev *devemu_probe_edev(struct vmm_guest *guest,
 					   edev->node->name, rc);
 			}
 			vmm_mutex_unlock(&dectrl.emu_lock);
+			devemu_coalesced_free_ranges(edev);
 			vmm_devtree_dref_node(edev->node);
 			edev->node = NULL;
+#ifdef CONFIG_DEVEMU_STATS
+			vmm_free(edev->stats);
+#endif
 			vmm_free(edev);
 			return VMM_ERR_PTR(rc);
 		}
@@ -1413,6 +2172,15 @@ int vmm_devemu_init_context(struct vmm_guest *guest)
 		INIT_LIST_HEAD(&eg->g_irq[ite]);
 	}
 
+	INIT_SPIN_LOCK(&eg->cring.drain_lock);
+	INIT_SPIN_LOCK(&eg->cring.lock);
+	eg->cring.count = 0;
+	eg->cring.inflight = 0;
+	eg->cring.ent = eg->cring.buf[0];
+	INIT_TIMER_EVENT(&eg->cring.drain_ev,
+			 devemu_coalesced_drain_event, &eg->cring);
+	INIT_WORK(&eg->cring.drain_work, devemu_coalesced_drain_work);
+
 	guest->aspace.devemu_priv = eg;
 
 	goto devemu_init_context_done;
@@ -1436,6 +2204,9 @@ int vmm_devemu_deinit_context(struct vmm_guest *guest)
 	guest->aspace.devemu_priv = NULL;
 
 	if (eg) {
+		vmm_timer_event_stop(&eg->cring.drain_ev);
+		vmm_workqueue_stop_work(&eg->cring.drain_work);
+
 		if (eg->g_irq) {
 			vmm_free(eg->g_irq);
 			eg->g_irq = NULL;
@@ -1460,6 +2231,7 @@ int __init vmm_devemu_init(void)
 
 	INIT_MUTEX(&dectrl.emu_lock);
 	INIT_LIST_HEAD(&dectrl.emu_list);
+	INIT_MUTEX(&dectrl.db_wq_lock);
 
 	return VMM_OK;
 }
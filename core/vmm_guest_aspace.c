@@ -34,6 +34,7 @@
 #include <vmm_guest_aspace.h>
 #include <vmm_stdio.h>
 #include <vmm_notifier.h>
+#include <vmm_workqueue.h>
 #include <arch_guest.h>
 #include <libs/stringlib.h>
 #include <libs/mathlib.h>
@@ -455,6 +456,192 @@ int vmm_guest_physical_unmap(struct vmm_guest *guest,
 	return VMM_OK;
 }
 
+/* Free a region which is no more part of guest address space */
+static int region_free(struct vmm_region *reg)
+{
+	u32 i;
+	int rc = VMM_OK;
+	struct vmm_devtree_node *rnode = reg->node;
+	struct vmm_guest *guest = reg->aspace->guest;
+
+	/* Free host RAM if region has alloced/reserved host RAM */
+	if (!(reg->flags & (VMM_REGION_ALIAS | VMM_REGION_VIRTUAL)) &&
+	    (reg->flags & (VMM_REGION_ISRAM | VMM_REGION_ISROM))) {
+		for (i = 0; i < reg->maps_count; i++) {
+			if (!(reg->maps[i].flags &
+			      VMM_REGION_MAPPING_ISHOSTRAM))
+				continue;
+			rc = vmm_host_ram_free(reg->maps[i].hphys_addr,
+					       mapping_phys_size(reg, i));
+			if (rc) {
+				vmm_printf("%s: Failed to free host RAM "
+					   "for %s/%s (error %d)\n",
+					   __func__, guest->name,
+					   reg->node->name, rc);
+			}
+			reg->maps[i].flags &= ~VMM_REGION_MAPPING_ISHOSTRAM;
+		}
+	}
+
+	/* Free region mappings */
+	vmm_free(reg->maps);
+
+	/* De-reference shared memory */
+	if (reg->shm) {
+		vmm_shmem_dref(reg->shm);
+		reg->shm = NULL;
+	}
+
+	/* Free the region */
+	vmm_free(reg);
+
+	/* De-reference the region node */
+	vmm_devtree_dref_node(rnode);
+
+	return rc;
+}
+
+/*
+ * Regions unpinned for the last time after being deleted are freed
+ * from workqueue context because unpin can happen in atomic context.
+ */
+static LIST_HEAD(region_free_list);
+static DEFINE_SPINLOCK(region_free_lock);
+
+static void region_free_worker(struct vmm_work *work)
+{
+	irq_flags_t flags;
+	struct vmm_region *reg;
+
+	vmm_spin_lock_irqsave(&region_free_lock, flags);
+	while (!list_empty(&region_free_list)) {
+		reg = list_entry(list_pop(&region_free_list),
+				 struct vmm_region, phead);
+		vmm_spin_unlock_irqrestore(&region_free_lock, flags);
+		region_free(reg);
+		vmm_spin_lock_irqsave(&region_free_lock, flags);
+	}
+	vmm_spin_unlock_irqrestore(&region_free_lock, flags);
+}
+
+static struct vmm_work region_free_work =
+		__WORK_INITIALIZER(region_free_work, region_free_worker);
+
+static void region_put(struct vmm_region *reg)
+{
+	int count;
+	irq_flags_t flags;
+
+	count = arch_atomic_sub_return(&reg->pin_count, 1);
+	if (count > 0) {
+		return;
+	} else if (count < 0) {
+		vmm_printf("%s: %s/%s pin count underflow\n",
+			   __func__, reg->aspace->guest->name,
+			   reg->node->name);
+		return;
+	}
+
+	/* Last unpin of deleted region */
+	vmm_spin_lock_irqsave(&region_free_lock, flags);
+	list_add_tail(&reg->phead, &region_free_list);
+	vmm_spin_unlock_irqrestore(&region_free_lock, flags);
+
+	vmm_workqueue_schedule_work(NULL, &region_free_work);
+}
+
+int vmm_guest_physical_pin(struct vmm_guest *guest,
+			   physical_addr_t gphys_addr,
+			   physical_size_t gphys_size,
+			   physical_addr_t *hphys_addr,
+			   physical_size_t *phys_size,
+			   u32 *reg_flags,
+			   struct vmm_region **pinned_reg)
+{
+	bool found;
+	irq_flags_t flags;
+	physical_addr_t hphys;
+	physical_size_t size;
+	struct rb_node *pos;
+	struct vmm_region *reg = NULL;
+	struct vmm_guest_aspace *aspace;
+
+	if (!guest || !hphys_addr || !pinned_reg) {
+		return VMM_EFAIL;
+	}
+	aspace = &guest->aspace;
+
+	/*
+	 * Lookup and pin the region under region tree lock so
+	 * that we don't race with vmm_guest_del_region().
+	 */
+	vmm_read_lock_irqsave_lite(&aspace->reg_memtree_lock, flags);
+	do {
+		found = FALSE;
+		pos = aspace->reg_memtree.rb_node;
+		while (pos) {
+			reg = rb_entry(pos, struct vmm_region, head);
+			if (gphys_addr < VMM_REGION_GPHYS_START(reg)) {
+				pos = pos->rb_left;
+			} else if (VMM_REGION_GPHYS_END(reg) <= gphys_addr) {
+				pos = pos->rb_right;
+			} else {
+				found = TRUE;
+				break;
+			}
+		}
+		if (!found) {
+			break;
+		}
+		if (reg->flags & VMM_REGION_ALIAS) {
+			gphys_addr = VMM_REGION_GPHYS_TO_APHYS(reg,
+							       gphys_addr);
+		}
+	} while (reg->flags & VMM_REGION_ALIAS);
+	if (found) {
+		arch_atomic_inc(&reg->pin_count);
+	}
+	vmm_read_unlock_irqrestore_lite(&aspace->reg_memtree_lock, flags);
+	if (!found) {
+		return VMM_EFAIL;
+	}
+
+	if (reg->flags & VMM_REGION_REAL) {
+		vmm_guest_find_mapping(guest, reg, gphys_addr, &hphys, &size);
+	} else {
+		hphys = 0;
+		size = VMM_REGION_GPHYS_END(reg) - gphys_addr;
+	}
+
+	if (gphys_size < size) {
+		size = gphys_size;
+	}
+
+	*hphys_addr = hphys;
+
+	if (phys_size) {
+		*phys_size = size;
+	}
+
+	if (reg_flags) {
+		*reg_flags = reg->flags;
+	}
+
+	*pinned_reg = reg;
+
+	return VMM_OK;
+}
+
+void vmm_guest_physical_unpin(struct vmm_guest *guest,
+			      struct vmm_region *reg)
+{
+	if (!guest || !reg) {
+		return;
+	}
+
+	region_put(reg);
+}
+
 bool is_region_node_valid(struct vmm_devtree_node *rnode)
 {
 	const char *aval;
@@ -711,6 +898,7 @@ static int region_add(struct vmm_guest *guest,
 	/* Fillup region details */
 	reg->node = rnode;
 	reg->aspace = aspace;
+	arch_atomic_write(&reg->pin_count, 1);
 	reg->flags = 0x0;
 
 	/* Determine manifest_type */
@@ -1145,12 +1333,10 @@ static int region_del(struct vmm_guest *guest,
 		      bool del_reg_tree,
 		      bool del_probe_list)
 {
-	u32 i;
 	int rc = VMM_OK;
 	irq_flags_t flags;
 	vmm_rwlock_t *root_lock;
 	struct rb_root *root = NULL;
-	struct vmm_devtree_node *rnode = reg->node;
 	struct vmm_guest_aspace *aspace = &guest->aspace;
 
 	/* Remove it from region tree if not removed already */
@@ -1163,6 +1349,10 @@ static int region_del(struct vmm_guest *guest,
 			root_lock = &aspace->reg_memtree_lock;
 		}
 		vmm_write_lock_irqsave_lite(root_lock, flags);
+		if (arch_atomic_read(&reg->pin_count) > 1) {
+			vmm_write_unlock_irqrestore_lite(root_lock, flags);
+			return VMM_EBUSY;
+		}
 		rb_erase(&reg->head, root);
 		vmm_write_unlock_irqrestore_lite(root_lock, flags);
 	}
@@ -1193,41 +1383,15 @@ static int region_del(struct vmm_guest *guest,
 		vmm_devemu_remove_region(guest, reg);
 	}
 
-	/* Free host RAM if region has alloced/reserved host RAM */
-	if (!(reg->flags & (VMM_REGION_ALIAS | VMM_REGION_VIRTUAL)) &&
-	    (reg->flags & (VMM_REGION_ISRAM | VMM_REGION_ISROM))) {
-		for (i = 0; i < reg->maps_count; i++) {
-			if (!(reg->maps[i].flags &
-			      VMM_REGION_MAPPING_ISHOSTRAM))
-				continue;
-			rc = vmm_host_ram_free(reg->maps[i].hphys_addr,
-					       mapping_phys_size(reg, i));
-			if (rc) {
-				vmm_printf("%s: Failed to free host RAM "
-					   "for %s/%s (error %d)\n",
-					   __func__, guest->name,
-					   reg->node->name, rc);
-			}
-			reg->maps[i].flags &= ~VMM_REGION_MAPPING_ISHOSTRAM;
-		}
-	}
-
-	/* Free region mappings */
-	vmm_free(reg->maps);
-
-	/* De-reference shared memory */
-	if (reg->shm) {
-		vmm_shmem_dref(reg->shm);
-		reg->shm = NULL;
+	/*
+	 * Drop reference held by guest address space. The region
+	 * is freed by last vmm_guest_physical_unpin() if pinned.
+	 */
+	if (arch_atomic_sub_return(&reg->pin_count, 1) > 0) {
+		return rc;
 	}
 
-	/* Free the region */
-	vmm_free(reg);
-
-	/* De-reference the region node */
-	vmm_devtree_dref_node(rnode);
-
-	return rc;
+	return region_free(reg);
 }
 
 int vmm_guest_aspace_reset(struct vmm_guest *guest)
@@ -37,6 +37,7 @@
 #include <libs/rbtree_augmented.h>
 
 static virtual_addr_t host_mem_rw_va[CONFIG_CPU_COUNT];
+static virtual_addr_t host_mem_map_va[CONFIG_CPU_COUNT];
 
 struct host_mhash_entry {
 	struct rb_node rb;
@@ -732,6 +733,60 @@ u32 vmm_host_memory_write(physical_addr_t hpa,
 	return bytes_written;
 }
 
+u32 vmm_host_memory_map_read(physical_addr_t hpa, u32 len, bool cacheable,
+			     u32 (*fn)(void *src, u32 len, void *priv),
+			     void *priv)
+{
+	int rc;
+	irq_flags_t flags;
+	u32 bytes_read = 0, page_offset, page_read, done;
+	virtual_addr_t tmp_va = host_mem_map_va[vmm_smp_processor_id()];
+
+	if (!fn) {
+		return 0;
+	}
+
+	/* Map one page at time with irqs disabled since, we use
+	 * one virtual address per-host CPU. The mapping address is
+	 * separate from the one used by vmm_host_memory_read/write
+	 * so that fn() can itself write to host memory.
+	 */
+	while (bytes_read < len) {
+		page_offset = hpa & VMM_PAGE_MASK;
+
+		page_read = VMM_PAGE_SIZE - page_offset;
+		page_read = (page_read < (len - bytes_read)) ?
+			     page_read : (len - bytes_read);
+
+		arch_cpu_irq_save(flags);
+
+		rc = arch_cpu_aspace_map(tmp_va, VMM_PAGE_SIZE,
+					 hpa & ~VMM_PAGE_MASK,
+					 (cacheable) ?
+					 VMM_MEMORY_FLAGS_NORMAL :
+					 VMM_MEMORY_FLAGS_NORMAL_NOCACHE);
+		if (rc) {
+			arch_cpu_irq_restore(flags);
+			break;
+		}
+
+		done = fn((void *)(tmp_va + page_offset), page_read, priv);
+
+		rc = arch_cpu_aspace_unmap(tmp_va);
+
+		arch_cpu_irq_restore(flags);
+
+		bytes_read += (done < page_read) ? done : page_read;
+		if (rc || (done < page_read)) {
+			break;
+		}
+
+		hpa += page_read;
+	}
+
+	return bytes_read;
+}
+
 u32 vmm_host_memory_set(physical_addr_t hpa,
 			  u8 byte, u32 len, bool cacheable)
 {
@@ -1044,6 +1099,11 @@ static int __init host_aspace_init_primary(void)
 		if (rc) {
 			return rc;
 		}
+		rc = vmm_host_vapool_alloc(&host_mem_map_va[cpu],
+					   VMM_PAGE_SIZE);
+		if (rc) {
+			return rc;
+		}
 	}
 
 #if defined(ARCH_HAS_MEMORY_READWRITE)
@@ -46,14 +46,25 @@ static DEFINE_SPINLOCK(rbd_list_lock);
 static int rbd_read_cache(struct vmm_blockrq *brq,
 			  struct vmm_request *r, void *priv)
 {
+	u32 i;
 	struct rbd *d = priv;
 	physical_addr_t pa;
-	physical_size_t sz;
+	physical_size_t sz, len;
 
 	pa = d->addr + r->lba * RBD_BLOCK_SIZE;
 	sz = r->bcnt * RBD_BLOCK_SIZE;
 
-	vmm_host_memory_read(pa, r->data, sz, TRUE);
+	if (!r->sg_cnt) {
+		vmm_host_memory_read(pa, r->data, sz, TRUE);
+		return VMM_OK;
+	}
+
+	for (i = 0; (i < r->sg_cnt) && sz; i++) {
+		len = min((physical_size_t)r->sg[i].len, sz);
+		vmm_host_memory_read(pa, r->sg[i].data, len, TRUE);
+		pa += len;
+		sz -= len;
+	}
 
 	return VMM_OK;
 }
@@ -61,21 +72,48 @@ static int rbd_read_cache(struct vmm_blockrq *brq,
 static int rbd_write_cache(struct vmm_blockrq *brq,
 			   struct vmm_request *r, void *priv)
 {
+	u32 i;
 	struct rbd *d = priv;
 	physical_addr_t pa;
-	physical_size_t sz;
+	physical_size_t sz, len;
 
 	pa = d->addr + r->lba * RBD_BLOCK_SIZE;
 	sz = r->bcnt * RBD_BLOCK_SIZE;
 
-	vmm_host_memory_write(pa, r->data, sz, TRUE);
+	if (!r->sg_cnt) {
+		vmm_host_memory_write(pa, r->data, sz, TRUE);
+		return VMM_OK;
+	}
+
+	for (i = 0; (i < r->sg_cnt) && sz; i++) {
+		len = min((physical_size_t)r->sg[i].len, sz);
+		vmm_host_memory_write(pa, r->sg[i].data, len, TRUE);
+		pa += len;
+		sz -= len;
+	}
+
+	return VMM_OK;
+}
+
+/* RAM backing is reserved for the whole device lifetime so
+ * discarded blocks are simply zeroed in place.
+ */
+static int rbd_zero_cache(struct vmm_blockrq *brq,
+			  struct vmm_request *r, void *priv)
+{
+	struct rbd *d = priv;
+
+	vmm_host_memory_set(d->addr + r->lba * RBD_BLOCK_SIZE, 0,
+			    r->bcnt * RBD_BLOCK_SIZE, TRUE);
 
 	return VMM_OK;
 }
 
 static struct vmm_blockrq_ops rbd_rq_ops = {
 	.read_cache = rbd_read_cache,
-	.write_cache = rbd_write_cache
+	.write_cache = rbd_write_cache,
+	.discard_cache = rbd_zero_cache,
+	.write_zeroes_cache = rbd_zero_cache
 };
 
 static struct rbd *__rbd_create(struct vmm_device *dev,
@@ -121,6 +159,7 @@ static struct rbd *__rbd_create(struct vmm_device *dev,
 		goto free_bdev;
 	}
 	d->bdev->rq = vmm_blockrq_to_rq(brq);
+	d->bdev->rq->flags |= VMM_REQUEST_QUEUE_SG;
 
 	/* Register block device instance */
 	if (vmm_blockdev_register(d->bdev)) {
@@ -160,9 +160,11 @@ struct napi_struct {
 	 * can remove from the list right before clearing the bit.
 	 */
 	struct list_head	poll_list;
+#endif /* 0 */
 
 	unsigned long		state;
 	int			weight;
+#if 0
 	unsigned int		gro_count;
 #endif /* 0 */
 	int			(*poll)(struct napi_struct *, int);
@@ -180,10 +182,18 @@ struct napi_struct {
 	struct hlist_node	napi_hash_node;
 	unsigned int		napi_id;
 #else /* 0 */
+	/* Poll runs as lazy xfer from netswitch bottom-half */
 	struct vmm_netport_lazy lazy;
+	/* Frames received in current poll round */
+	struct dlist		rx_list;
 #endif /* 0 */
 };
 
+enum {
+	NAPI_STATE_SCHED,	/* Poll is scheduled */
+	NAPI_STATE_DISABLE,	/* Disable pending */
+};
+
 enum gro_result {
 	GRO_MERGED,
 	GRO_MERGED_FREE,
@@ -485,6 +495,24 @@ void napi_disable(struct napi_struct *n);
  */
 void napi_enable(struct napi_struct *n);
 
+/**
+ *	napi_schedule_prep - check if NAPI can be scheduled
+ *	@n: napi context
+ *
+ * Test if NAPI routine is already running, and if not mark
+ * it as running.  This is used as a condition variable to
+ * insure only one NAPI poll instance runs.
+ */
+bool napi_schedule_prep(struct napi_struct *n);
+
+/**
+ *	__napi_schedule - schedule NAPI poll
+ *	@n: napi context
+ *
+ * Schedule NAPI poll routine which was marked by napi_schedule_prep().
+ */
+void __napi_schedule(struct napi_struct *n);
+
 /**
  *	napi_schedule - schedule NAPI poll
  *	@n: napi context
@@ -494,10 +522,15 @@ void napi_enable(struct napi_struct *n);
  */
 void napi_schedule(struct napi_struct *n);
 
+/*
+ * Frames received from NAPI poll are queued and handed-off to
+ * the netswitch in one go at the end of each poll round.
+ */
 static inline gro_result_t napi_gro_receive(struct napi_struct *napi,
 					    struct sk_buff *skb)
 {
-	return netif_rx(skb, napi->dev);
+	list_add_tail(&skb->m_list, &napi->rx_list);
+	return GRO_NORMAL;
 }
 
 #endif /* __LINUX_NETDEVICE_H_ */
@@ -25,14 +25,38 @@
 
 #include <linux/netdevice.h>
 #include <linux/phy.h>
+#include <linux/delay.h>
 
 int netdev_budget __read_mostly = 300;
 
+static void napi_rx_flush(struct napi_struct *napi)
+{
+	if (list_empty(&napi->rx_list))
+		return;
+
+	vmm_port2switch_xfer_mbuf_list(napi->lazy.port, &napi->rx_list);
+}
+
 static void lazy_xfer2napi_poll(struct vmm_netport *port, void *arg, int budget)
 {
+	int work;
 	struct napi_struct *napi = arg;
 
-	napi->poll(napi, budget);
+	work = napi->poll(napi, budget);
+
+	/* Hand-off frames received in this round to netswitch at once */
+	napi_rx_flush(napi);
+
+	/*
+	 * Driver keeps device interrupts masked and does not complete
+	 * when whole budget is consumed so poll again in next round.
+	 */
+	if (work >= budget) {
+		if (unlikely(test_bit(NAPI_STATE_DISABLE, &napi->state)))
+			__napi_complete(napi);
+		else
+			vmm_port2switch_xfer_lazy(&napi->lazy);
+	}
 }
 
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
@@ -45,43 +69,43 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 			    "device %s\n", weight, dev->name);
 	napi->dev = dev;
 	napi->poll = poll;
-	INIT_NETPORT_LAZY(&napi->lazy, port, netdev_budget,
-			  NULL, lazy_xfer2napi_poll);
+	napi->weight = weight;
+	INIT_LIST_HEAD(&napi->rx_list);
+	INIT_NETPORT_LAZY(&napi->lazy, port, weight,
+			  napi, lazy_xfer2napi_poll);
+	set_bit(NAPI_STATE_SCHED, &napi->state);
 }
 EXPORT_SYMBOL(netif_napi_add);
 
 void napi_disable(struct napi_struct *n)
 {
-#if 0
-	might_sleep();
 	set_bit(NAPI_STATE_DISABLE, &n->state);
 	while (test_and_set_bit(NAPI_STATE_SCHED, &n->state))
 		msleep(1);
 	clear_bit(NAPI_STATE_DISABLE, &n->state);
-#endif
 }
+EXPORT_SYMBOL(napi_disable);
 
 void napi_enable(struct napi_struct *n)
 {
-#if 0
-	BUG_ON(!test_bit(NAPI_STATE_SCHED, &n->state));
-	smp_mb__before_clear_bit();
+	smp_mb();
 	clear_bit(NAPI_STATE_SCHED, &n->state);
-#endif
 }
+EXPORT_SYMBOL(napi_enable);
 
-void napi_schedule(struct napi_struct *n)
+bool napi_schedule_prep(struct napi_struct *n)
 {
-	struct vmm_netport *port = n->dev->nsw_priv;
-
-	if (!port || !port->nsw) {
-		vmm_printf("%s: Invalid netport for %s Netdev\n",
-			   __func__, n->dev->name);
-		return;
-	}
+	return !test_bit(NAPI_STATE_DISABLE, &n->state) &&
+		!test_and_set_bit(NAPI_STATE_SCHED, &n->state);
+}
+EXPORT_SYMBOL(napi_schedule_prep);
 
-	vmm_port2switch_xfer_lazy(&n->lazy);
+void napi_schedule(struct napi_struct *n)
+{
+	if (napi_schedule_prep(n))
+		__napi_schedule(n);
 }
+EXPORT_SYMBOL(napi_schedule);
 
 void netif_napi_del(struct napi_struct *napi)
 {
@@ -91,34 +115,16 @@ EXPORT_SYMBOL(netif_napi_del);
 
 void __napi_complete(struct napi_struct *n)
 {
-#if 0
 	BUG_ON(!test_bit(NAPI_STATE_SCHED, &n->state));
-	BUG_ON(n->gro_list);
 
-	list_del(&n->poll_list);
-	smp_mb__before_clear_bit();
+	smp_mb();
 	clear_bit(NAPI_STATE_SCHED, &n->state);
-#endif
 }
 EXPORT_SYMBOL(__napi_complete);
 
 void napi_complete(struct napi_struct *n)
 {
-#if 0
-	unsigned long flags;
-
-	/*
-	 * don't let napi dequeue from the cpu poll list
-	 * just in case its running on a different cpu
-	 */
-	if (unlikely(test_bit(NAPI_STATE_NPSVC, &n->state)))
-		return;
-
-	napi_gro_flush(n, false);
-	local_irq_save(flags);
 	__napi_complete(n);
-	local_irq_restore(flags);
-#endif
 }
 EXPORT_SYMBOL(napi_complete);
 
@@ -127,15 +133,21 @@ EXPORT_SYMBOL(napi_complete);
  * @n: entry to schedule
  *
  * The entry's receive function will be scheduled to run
+ * from netswitch bottom-half.
  */
 void __napi_schedule(struct napi_struct *n)
 {
-#if 0
-	unsigned long flags;
+	/* Netport is usually registered after netif_napi_add() */
+	if (!n->lazy.port)
+		n->lazy.port = n->dev->nsw_priv;
+
+	if (!n->lazy.port || !n->lazy.port->nsw) {
+		vmm_printf("%s: Invalid netport for %s Netdev\n",
+			   __func__, n->dev->name);
+		clear_bit(NAPI_STATE_SCHED, &n->state);
+		return;
+	}
 
-	local_irq_save(flags);
-	____napi_schedule(&__get_cpu_var(softnet_data), n);
-	local_irq_restore(flags);
-#endif
+	vmm_port2switch_xfer_lazy(&n->lazy);
 }
 EXPORT_SYMBOL(__napi_schedule);
@@ -426,13 +426,50 @@ static inline void	 smc911x_rcv(struct net_device *dev)
 		DBG(SMC_DEBUG_PKTS, "%s: Received packet\n", dev->name);
 		PRINT_PKT(data, ((pkt_len - 4) <= 64) ? pkt_len - 4 : 64);
 		//Fixme: skb->protocol = eth_type_trans(skb, dev);
-		netif_rx(skb, dev);
+		napi_gro_receive(&lp->napi, skb);
 		dev->stats.rx_packets++;
 		dev->stats.rx_bytes += pkt_len-4;
 #endif
 	}
 }
 
+/*
+ * NAPI poll: receive up to budget packets with RX interrupt masked
+ * and unmask it once RX status FIFO is drained.
+ */
+static int smc911x_poll(struct napi_struct *napi, int budget)
+{
+	struct net_device *dev = napi->dev;
+	struct smc911x_local *lp = netdev_priv(dev);
+	unsigned int pkts;
+	unsigned long flags;
+	int work = 0;
+
+	DBG(SMC_DEBUG_FUNC | SMC_DEBUG_RX, "%s: --> %s\n",
+		dev->name, __func__);
+
+	spin_lock_irqsave(&lp->lock, flags);
+	while (work < budget) {
+		pkts = (SMC_GET_RX_FIFO_INF(lp) & RX_FIFO_INF_RXSUSED_) >> 16;
+		if (!pkts) {
+			/* Ack before re-checking so no packet is missed */
+			SMC_ACK_INT(lp, INT_STS_RSFL_);
+			pkts = (SMC_GET_RX_FIFO_INF(lp) &
+				RX_FIFO_INF_RXSUSED_) >> 16;
+			if (!pkts) {
+				napi_complete(napi);
+				SMC_ENABLE_INT(lp, INT_EN_RSFL_EN_);
+				break;
+			}
+		}
+		smc911x_rcv(dev);
+		work++;
+	}
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	return work;
+}
+
 /*
  * This is called to actually send a packet to the chip.
  */
@@ -1100,7 +1137,11 @@ static vmm_irq_return_t smc911x_interrupt(int irq_no, void *dev_id)
 					SMC_SET_FIFO_INT(lp, fifo);
 				} else
 #endif
-				smc911x_rcv(dev);
+				{
+					/* Mask RX till NAPI poll drains it */
+					mask &= ~INT_EN_RSFL_EN_;
+					napi_schedule(&lp->napi);
+				}
 			}
 			SMC_ACK_INT(lp, INT_STS_RSFL_);
 		}
@@ -1423,6 +1464,7 @@ smc911x_open(struct net_device *dev)
 	smc911x_phy_configure(&lp->phy_configure);
 
 	/* Turn on Tx + Rx */
+	napi_enable(&lp->napi);
 	smc911x_enable(dev);
 
 	netif_start_queue(dev);
@@ -1447,6 +1489,7 @@ static int smc911x_close(struct net_device *dev)
 	netif_carrier_off(dev);
 
 	/* clear everything */
+	napi_disable(&lp->napi);
 	smc911x_shutdown(dev);
 
 	if (lp->phy_type != 0) {
@@ -1937,6 +1980,7 @@ static int smc911x_probe(struct net_device *dev)
 	ether_setup(dev);
 
 	dev->netdev_ops = &smc911x_netdev_ops;
+	netif_napi_add(dev, &lp->napi, smc911x_poll, NAPI_POLL_WEIGHT);
 #if 0
 	dev->watchdog_timeo = msecs_to_jiffies(watchdog);
 #endif
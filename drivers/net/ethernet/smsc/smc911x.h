@@ -135,6 +135,7 @@ struct smc911x_local {
 	spinlock_t lock;
 
 	struct net_device *netdev;
+	struct napi_struct napi;
 
 #ifdef SMC_USE_DMA
 	/* DMA needs the physical address of the chip */
@@ -484,12 +484,45 @@ static inline void  smc_rcv(struct net_device *dev)
 		skb->protocol = eth_type_trans(skb, dev);
 		netif_rx(skb);
 #endif
-		netif_rx(skb, dev);
+		napi_gro_receive(&lp->napi, skb);
 		dev->stats.rx_packets++;
 		dev->stats.rx_bytes += data_len;
 	}
 }
 
+/*
+ * NAPI poll: receive up to budget packets with RX interrupt masked
+ * and unmask it once RX FIFO is drained.
+ */
+static int smc_poll(struct napi_struct *napi, int budget)
+{
+	struct net_device *dev = napi->dev;
+	struct smc_local *lp = netdev_priv(dev);
+	void __iomem *ioaddr = lp->base;
+	int saved_pointer, work = 0;
+	unsigned long flags;
+
+	DBG(3, "%s: %s\n", dev->name, __func__);
+
+	spin_lock_irqsave(&lp->lock, flags);
+	saved_pointer = SMC_GET_PTR(lp);
+	while (work < budget) {
+		if (SMC_GET_RXFIFO(lp) & RXFIFO_REMPTY)
+			break;
+		smc_rcv(dev);
+		work++;
+	}
+	SMC_SET_PTR(lp, saved_pointer);
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	if (work < budget) {
+		napi_complete(napi);
+		SMC_ENABLE_INT(lp, IM_RCV_INT);
+	}
+
+	return work;
+}
+
 #ifdef CONFIG_SMP
 /*
  * On SMP we have the following problem:
@@ -1245,7 +1278,9 @@ static vmm_irq_return_t smc_interrupt(int irq_no, void *dev_id)
 				netif_wake_queue(dev);
 		} else if (status & IM_RCV_INT) {
 			DBG(3, "%s: RX irq\n", dev->name);
-			smc_rcv(dev);
+			/* Mask RX till NAPI poll drains it */
+			mask &= ~IM_RCV_INT;
+			napi_schedule(&lp->napi);
 		} else if (status & IM_ALLOC_INT) {
 			DBG(3, "%s: Allocation irq\n", dev->name);
 			tasklet_hi_schedule(&lp->tx_task);
@@ -1504,6 +1539,7 @@ smc_open(struct net_device *dev)
 
 	/* reset the hardware */
 	smc_reset(dev);
+	napi_enable(&lp->napi);
 	smc_enable(dev);
 
 	/* Configure the PHY, initialize the link state */
@@ -1537,6 +1573,7 @@ static int smc_close(struct net_device *dev)
 	netif_carrier_off(dev);
 
 	/* clear everything */
+	napi_disable(&lp->napi);
 	smc_shutdown(dev);
 	tasklet_kill(&lp->tx_task);
 	smc_phy_powerdown(dev);
@@ -2002,6 +2039,7 @@ static int __devinit smc_probe(struct net_device *dev, void __iomem *ioaddr,
 	dev->watchdog_timeo = msecs_to_jiffies(watchdog);
 #endif
 	dev->netdev_ops = &smc_netdev_ops;
+	netif_napi_add(dev, &lp->napi, smc_poll, NAPI_POLL_WEIGHT);
 #if 0
 	dev->ethtool_ops = &smc_ethtool_ops;
 
@@ -412,6 +412,8 @@ struct smc_local {
 
 	/* work queue */
 	struct work_struct phy_configure;
+
+	struct napi_struct napi;
 	struct net_device *dev;
 	int	work_pending;
 
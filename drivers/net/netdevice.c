@@ -147,7 +147,8 @@ void netdev_set_link(struct vmm_netport *port)
 			dev->state |= NETDEV_OPEN;
 		else
 			dev->state &= ~NETDEV_OPEN;
-	} else {
+	} else if (dev->state & NETDEV_OPEN) {
+		/* Drivers expect ndo_stop() only after successful ndo_open() */
 		dev->netdev_ops->ndo_stop(dev);
 		dev->state &= ~NETDEV_OPEN;
 	}
@@ -27,6 +27,7 @@
 #include <vmm_spinlocks.h>
 #include <vmm_modules.h>
 #include <vmm_devemu.h>
+#include <vmm_manager.h>
 #include <vio/vmm_vdisk.h>
 #include <vio/vmm_virtio.h>
 #include <vio/vmm_virtio_blk.h>
@@ -49,30 +50,54 @@
 #define MODULE_EXIT			virtio_blk_exit
 
 #define VIRTIO_BLK_QUEUE_SIZE		128
-#define VIRTIO_BLK_IO_QUEUE		0
-#define VIRTIO_BLK_NUM_QUEUES		1
+#define VIRTIO_BLK_MAX_QUEUES		16
 #define VIRTIO_BLK_SECTOR_SIZE		512
 #define VIRTIO_BLK_DISK_SEG_MAX		(VIRTIO_BLK_QUEUE_SIZE - 2)
+#define VIRTIO_BLK_SG_MAX		VIRTIO_BLK_DISK_SEG_MAX
+#define VIRTIO_BLK_RANGE_SECTORS_MAX	8192
+
+struct virtio_blk_queue;
 
 struct virtio_blk_dev_req {
-	struct vmm_virtio_queue		*vq;
+	struct virtio_blk_queue		*q;
 	u16				head;
 	struct vmm_virtio_iovec		*read_iov;
 	u32				read_iov_cnt;
 	u32				len;
 	struct vmm_virtio_iovec		status_iov;
 	void				*data;
+	struct vmm_virtio_sg		*vsg;
+	struct vmm_request_sg		*bsg;
+	u32				sg_cnt;
 	struct vmm_vdisk_request	r;
 };
 
+/* Each request queue has its own ring, request slots and used lock */
+struct virtio_blk_queue {
+	u32				num;
+	struct vmm_virtio_queue 	vq;
+	vmm_spinlock_t			used_lock;
+	struct vmm_virtio_iovec		iov[VIRTIO_BLK_QUEUE_SIZE];
+	struct virtio_blk_dev_req	reqs[VIRTIO_BLK_QUEUE_SIZE];
+	/* Segment arrays of all request slots (only for zero-copy) */
+	struct vmm_virtio_sg		*vsgs;
+	struct vmm_request_sg		*bsgs;
+};
+
 struct virtio_blk_dev {
 	struct vmm_virtio_device 	*vdev;
 
-	struct vmm_virtio_queue 	vqs[VIRTIO_BLK_NUM_QUEUES];
-	struct vmm_virtio_iovec		iov[VIRTIO_BLK_QUEUE_SIZE];
-	struct virtio_blk_dev_req	reqs[VIRTIO_BLK_QUEUE_SIZE];
+	u32				num_queues;
+	struct virtio_blk_queue		*queues;
 	u64 				features;
 
+	/* Zero-copy IO is requested with "zero_copy" attribute and only
+	 * possible for guest RAM already mapped in hypervisor. Guest RAM
+	 * allocated by hypervisor has no such mapping so requests use
+	 * bounce buffers unless guest RAM is backed by mapped host memory.
+	 */
+	bool				zero_copy;
+
 	struct vmm_virtio_blk_config 	config;
 	struct vmm_vdisk		*vdisk;
 };
@@ -82,10 +107,13 @@ static u64 virtio_blk_get_host_features(struct vmm_virtio_device *dev)
 	return	1UL << VMM_VIRTIO_BLK_F_SEG_MAX
 		| 1UL << VMM_VIRTIO_BLK_F_BLK_SIZE
 		| 1UL << VMM_VIRTIO_BLK_F_FLUSH
-		| 1UL << VMM_VIRTIO_RING_F_EVENT_IDX;
-#if 0
-		| 1UL << VMM_VIRTIO_RING_F_INDIRECT_DESC;
-#endif
+		| 1UL << VMM_VIRTIO_BLK_F_MQ
+		| 1UL << VMM_VIRTIO_BLK_F_DISCARD
+		| 1UL << VMM_VIRTIO_BLK_F_WRITE_ZEROES
+		| 1UL << VMM_VIRTIO_RING_F_EVENT_IDX
+		| 1UL << VMM_VIRTIO_RING_F_INDIRECT_DESC
+		| 1ULL << VMM_VIRTIO_F_VERSION_1
+		| 1ULL << VMM_VIRTIO_F_RING_PACKED;
 }
 
 static void virtio_blk_set_guest_features(struct vmm_virtio_device *dev,
@@ -104,53 +132,49 @@ static int virtio_blk_init_vq(struct vmm_virtio_device *dev,
 			      u32 vq, u32 page_size, u32 align,
 			      u32 pfn)
 {
-	int rc;
 	struct virtio_blk_dev *vbdev = dev->emu_data;
 
-	switch (vq) {
-	case VIRTIO_BLK_IO_QUEUE:
-		rc = vmm_virtio_queue_setup(&vbdev->vqs[vq], dev->guest,
+	if (vbdev->num_queues <= vq) {
+		return VMM_EINVALID;
+	}
+
+	return vmm_virtio_queue_setup(&vbdev->queues[vq].vq, dev->guest,
 				pfn, page_size, VIRTIO_BLK_QUEUE_SIZE, align);
-		break;
-	default:
-		rc = VMM_EINVALID;
-		break;
-	};
+}
 
-	return rc;
+static int virtio_blk_init_vq_addr(struct vmm_virtio_device *dev,
+				   u32 vq, u32 size,
+				   physical_addr_t desc_addr,
+				   physical_addr_t driver_addr,
+				   physical_addr_t device_addr, bool packed)
+{
+	struct virtio_blk_dev *vbdev = dev->emu_data;
+
+	if (vbdev->num_queues <= vq) {
+		return VMM_EINVALID;
+	}
+
+	return vmm_virtio_queue_setup_addr(&vbdev->queues[vq].vq, dev->guest,
+				desc_addr, driver_addr, device_addr,
+				size, packed);
 }
 
 static int virtio_blk_get_pfn_vq(struct vmm_virtio_device *dev, u32 vq)
 {
-	int rc;
 	struct virtio_blk_dev *vbdev = dev->emu_data;
 
-	switch (vq) {
-	case VIRTIO_BLK_IO_QUEUE:
-		rc = vmm_virtio_queue_guest_pfn(&vbdev->vqs[vq]);
-		break;
-	default:
-		rc = VMM_EINVALID;
-		break;
-	};
+	if (vbdev->num_queues <= vq) {
+		return VMM_EINVALID;
+	}
 
-	return rc;
+	return vmm_virtio_queue_guest_pfn(&vbdev->queues[vq].vq);
 }
 
 static int virtio_blk_get_size_vq(struct vmm_virtio_device *dev, u32 vq)
 {
-	int rc;
-
-	switch (vq) {
-	case VIRTIO_BLK_IO_QUEUE:
-		rc = VIRTIO_BLK_QUEUE_SIZE;
-		break;
-	default:
-		rc = 0;
-		break;
-	};
+	struct virtio_blk_dev *vbdev = dev->emu_data;
 
-	return rc;
+	return (vq < vbdev->num_queues) ? VIRTIO_BLK_QUEUE_SIZE : 0;
 }
 
 static int virtio_blk_set_size_vq(struct vmm_virtio_device *dev,
@@ -160,11 +184,58 @@ static int virtio_blk_set_size_vq(struct vmm_virtio_device *dev,
 	return size;
 }
 
+/* Map guest data segments of request for zero-copy IO */
+static int virtio_blk_req_map(struct virtio_blk_dev *vbdev,
+			      struct virtio_blk_dev_req *req,
+			      struct vmm_virtio_iovec *iov, u32 iov_cnt)
+{
+	int rc;
+	u32 i;
+	struct vmm_virtio_device *dev = vbdev->vdev;
+
+	if (!vbdev->zero_copy) {
+		return VMM_ENOTSUPP;
+	}
+
+	if (!iov_cnt || (req->len < vmm_vdisk_block_size(vbdev->vdisk))) {
+		return VMM_EINVALID;
+	}
+
+	rc = vmm_virtio_iovec_to_sg(dev, iov, iov_cnt, req->vsg,
+				    VIRTIO_BLK_SG_MAX, &req->sg_cnt);
+	if (rc) {
+		return rc;
+	}
+
+	/* Segment without hypervisor mapping falls back to bounce buffer */
+	for (i = 0; i < req->sg_cnt; i++) {
+		if (!req->vsg[i].hva) {
+			vmm_virtio_sg_release(dev, req->vsg, req->sg_cnt);
+			req->sg_cnt = 0;
+			return VMM_ENOTSUPP;
+		}
+		req->bsg[i].data = (void *)req->vsg[i].hva;
+		req->bsg[i].len = req->vsg[i].len;
+	}
+
+	return VMM_OK;
+}
+
+static void virtio_blk_req_unmap(struct virtio_blk_dev *vbdev,
+				 struct virtio_blk_dev_req *req)
+{
+	if (req->sg_cnt) {
+		vmm_virtio_sg_release(vbdev->vdev, req->vsg, req->sg_cnt);
+		req->sg_cnt = 0;
+	}
+}
+
 static void virtio_blk_req_done(struct virtio_blk_dev *vbdev,
 				struct virtio_blk_dev_req *req, u8 status)
 {
+	irq_flags_t flags;
+	struct virtio_blk_queue *q = req->q;
 	struct vmm_virtio_device *dev = vbdev->vdev;
-	int queueid = req->vq - vbdev->vqs;
 
 	if (req->read_iov && req->len && req->data &&
 	    (status == VMM_VIRTIO_BLK_S_OK) &&
@@ -176,6 +247,8 @@ static void virtio_blk_req_done(struct virtio_blk_dev *vbdev,
 					  req->len);
 	}
 
+	virtio_blk_req_unmap(vbdev, req);
+
 	if (req->read_iov) {
 		vmm_free(req->read_iov);
 		req->read_iov = NULL;
@@ -190,11 +263,13 @@ static void virtio_blk_req_done(struct virtio_blk_dev *vbdev,
 
 	vmm_virtio_buf_to_iovec_write(dev, &req->status_iov, 1, &status, 1);
 
-	vmm_virtio_queue_set_used_elem(req->vq, req->head, req->len);
-
-	if (vmm_virtio_queue_should_signal(req->vq)) {
-		dev->tra->notify(dev, queueid);
+	/* Completions for a queue can race with its submission path */
+	vmm_spin_lock_irqsave_lite(&q->used_lock, flags);
+	vmm_virtio_queue_set_used_elem(&q->vq, req->head, req->len);
+	if (vmm_virtio_queue_should_signal(&q->vq)) {
+		dev->tra->notify(dev, q->num);
 	}
+	vmm_spin_unlock_irqrestore_lite(&q->used_lock, flags);
 }
 
 static void virtio_blk_attached(struct vmm_vdisk *vdisk)
@@ -244,42 +319,48 @@ static void virtio_blk_req_failed(struct vmm_vdisk *vdisk,
 }
 
 static void virtio_blk_do_io(struct vmm_virtio_device *dev,
-			     struct virtio_blk_dev *vbdev)
+			     struct virtio_blk_dev *vbdev,
+			     struct virtio_blk_queue *q)
 {
 	int rc;
-	u16 head, thead;
+	u16 head;
 	u32 i, iov_cnt, len;
+	irq_flags_t flags;
+	enum vmm_vdisk_request_type type;
 	struct virtio_blk_dev_req *req;
-	struct vmm_virtio_queue *vq = &vbdev->vqs[VIRTIO_BLK_IO_QUEUE];
+	struct vmm_virtio_queue *vq = &q->vq;
+	struct vmm_virtio_iovec *iov = q->iov;
 	struct vmm_virtio_blk_outhdr hdr;
+	struct virtio_blk_discard_write_zeroes range;
 
 	while (vmm_virtio_queue_available(vq)) {
-		thead = vmm_virtio_queue_pop(vq);
-		req = &vbdev->reqs[thead];
-		rc = vmm_virtio_queue_get_head_iovec(vq, thead, vbdev->iov,
-						     &iov_cnt, &len, &head);
+		rc = vmm_virtio_queue_get_iovec(vq, iov,
+						&iov_cnt, &len, &head);
 		if (rc) {
 			vmm_printf("%s: failed to get iovec (error %d)\n",
 				   __func__, rc);
 			continue;
 		}
+		req = &q->reqs[head];
 
-		req->vq = vq;
+		req->q = q;
 		req->head = head;
 		req->read_iov = NULL;
 		req->read_iov_cnt = 0;
 		req->len = 0;
 		for (i = 1; i < (iov_cnt - 1); i++) {
-			req->len += vbdev->iov[i].len;
+			req->len += iov[i].len;
 		}
-		req->status_iov.addr = vbdev->iov[iov_cnt - 1].addr;
-		req->status_iov.len = vbdev->iov[iov_cnt - 1].len;
+		req->status_iov.addr = iov[iov_cnt - 1].addr;
+		req->status_iov.len = iov[iov_cnt - 1].len;
 		vmm_vdisk_set_request_type(&req->r, VMM_VDISK_REQUEST_UNKNOWN);
 
-		len = vmm_virtio_iovec_to_buf_read(dev, &vbdev->iov[0], 1,
+		len = vmm_virtio_iovec_to_buf_read(dev, &iov[0], 1,
 						   &hdr, sizeof(hdr));
 		if (len < sizeof(hdr)) {
-			vmm_virtio_queue_set_used_elem(req->vq, req->head, 0);
+			vmm_spin_lock_irqsave_lite(&q->used_lock, flags);
+			vmm_virtio_queue_set_used_elem(vq, req->head, 0);
+			vmm_spin_unlock_irqrestore_lite(&q->used_lock, flags);
 			continue;
 		}
 
@@ -287,6 +368,18 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 		case VMM_VIRTIO_BLK_T_IN:
 			vmm_vdisk_set_request_type(&req->r,
 						   VMM_VDISK_REQUEST_READ);
+			if (!virtio_blk_req_map(vbdev, req, &iov[1],
+						iov_cnt - 2)) {
+				DPRINTF("%s: VIRTIO_BLK_T_IN dev=%s "
+					"hdr.sector=%"PRIu64" req->len=%d "
+					"sg_cnt=%d\n", __func__, dev->name,
+					(u64)hdr.sector, req->len, req->sg_cnt);
+				vmm_vdisk_submit_request_sg(vbdev->vdisk,
+					&req->r, VMM_VDISK_REQUEST_READ,
+					hdr.sector, req->bsg,
+					req->sg_cnt, req->len);
+				break;
+			}
 			req->data = vmm_malloc(req->len);
 			if (!req->data) {
 				virtio_blk_req_done(vbdev, req,
@@ -302,8 +395,8 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 			}
 			req->read_iov_cnt = iov_cnt - 2;
 			for (i = 0; i < req->read_iov_cnt; i++) {
-				req->read_iov[i].addr = vbdev->iov[i + 1].addr;
-				req->read_iov[i].len = vbdev->iov[i + 1].len;
+				req->read_iov[i].addr = iov[i + 1].addr;
+				req->read_iov[i].len = iov[i + 1].len;
 			}
 			DPRINTF("%s: VIRTIO_BLK_T_IN dev=%s "
 				"hdr.sector=%"PRIu64" req->len=%d\n",
@@ -319,6 +412,18 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 		case VMM_VIRTIO_BLK_T_OUT:
 			vmm_vdisk_set_request_type(&req->r,
 						   VMM_VDISK_REQUEST_WRITE);
+			if (!virtio_blk_req_map(vbdev, req, &iov[1],
+						iov_cnt - 2)) {
+				DPRINTF("%s: VIRTIO_BLK_T_OUT dev=%s "
+					"hdr.sector=%"PRIu64" req->len=%d "
+					"sg_cnt=%d\n", __func__, dev->name,
+					(u64)hdr.sector, req->len, req->sg_cnt);
+				vmm_vdisk_submit_request_sg(vbdev->vdisk,
+					&req->r, VMM_VDISK_REQUEST_WRITE,
+					hdr.sector, req->bsg,
+					req->sg_cnt, req->len);
+				break;
+			}
 			req->data = vmm_malloc(req->len);
 			if (!req->data) {
 				virtio_blk_req_done(vbdev, req,
@@ -326,7 +431,7 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 				continue;
 			} else {
 				vmm_virtio_iovec_to_buf_read(dev,
-							 &vbdev->iov[1],
+							 &iov[1],
 							 iov_cnt - 2,
 							 req->data,
 							 req->len);
@@ -355,6 +460,35 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 						    VMM_VIRTIO_BLK_S_OK);
 			}
 			break;
+		case VMM_VIRTIO_BLK_T_DISCARD:
+		case VMM_VIRTIO_BLK_T_WRITE_ZEROES:
+			type = (hdr.type == VMM_VIRTIO_BLK_T_DISCARD) ?
+				VMM_VDISK_REQUEST_DISCARD :
+				VMM_VDISK_REQUEST_WRITE_ZEROES;
+			vmm_vdisk_set_request_type(&req->r, type);
+			/* Only one range per request is advertised */
+			len = vmm_virtio_iovec_to_buf_read(dev, &iov[1],
+							   iov_cnt - 2, &range,
+							   sizeof(range));
+			if ((len != sizeof(range)) ||
+			    (req->len != sizeof(range)) ||
+			    !range.num_sectors ||
+			    (VIRTIO_BLK_RANGE_SECTORS_MAX <
+							range.num_sectors)) {
+				req->len = 0;
+				virtio_blk_req_done(vbdev, req,
+						    VMM_VIRTIO_BLK_S_UNSUPP);
+				continue;
+			}
+			req->len = 0;
+			DPRINTF("%s: type=%d dev=%s sector=%"PRIu64" "
+				"num_sectors=%d\n", __func__, hdr.type,
+				dev->name, (u64)range.sector,
+				range.num_sectors);
+			len = range.num_sectors * VIRTIO_BLK_SECTOR_SIZE;
+			vmm_vdisk_submit_request_range(vbdev->vdisk, &req->r,
+						       type, range.sector, len);
+			break;
 		case VMM_VIRTIO_BLK_T_GET_ID:
 			vmm_vdisk_set_request_type(&req->r,
 						   VMM_VDISK_REQUEST_READ);
@@ -373,8 +507,8 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 				continue;
 			}
 			req->read_iov_cnt = 1;
-			req->read_iov[0].addr = vbdev->iov[1].addr;
-			req->read_iov[0].len = vbdev->iov[1].len;
+			req->read_iov[0].addr = iov[1].addr;
+			req->read_iov[0].len = iov[1].len;
 			DPRINTF("%s: VIRTIO_BLK_T_GET_ID dev=%s req->len=%d\n",
 				__func__, dev->name, req->len);
 			if (vmm_vdisk_current_block_device(vbdev->vdisk,
@@ -396,21 +530,25 @@ static void virtio_blk_do_io(struct vmm_virtio_device *dev,
 
 static int virtio_blk_notify_vq(struct vmm_virtio_device *dev, u32 vq)
 {
-	int rc = VMM_OK;
 	struct virtio_blk_dev *vbdev = dev->emu_data;
 
 	DPRINTF("%s: dev=%s vq=%d\n", __func__, dev->name, vq);
 
-	switch (vq) {
-	case VIRTIO_BLK_IO_QUEUE:
-		virtio_blk_do_io(dev, vbdev);
-		break;
-	default:
-		rc = VMM_EINVALID;
-		break;
-	};
+	if (vbdev->num_queues <= vq) {
+		return VMM_EINVALID;
+	}
+
+	virtio_blk_do_io(dev, vbdev, &vbdev->queues[vq]);
+
+	return VMM_OK;
+}
+
+static struct vmm_virtio_queue *virtio_blk_get_vq(
+					struct vmm_virtio_device *dev, u32 vq)
+{
+	struct virtio_blk_dev *vbdev = dev->emu_data;
 
-	return rc;
+	return (vq < vbdev->num_queues) ? &vbdev->queues[vq].vq : NULL;
 }
 
 static void virtio_blk_status_changed(struct vmm_virtio_device *dev,
@@ -456,25 +594,81 @@ static int virtio_blk_write_config(struct vmm_virtio_device *dev,
 static int virtio_blk_reset(struct vmm_virtio_device *dev)
 {
 	int i, rc;
+	u32 qn;
+	struct vmm_virtio_sg *vsg;
+	struct vmm_request_sg *bsg;
+	struct virtio_blk_queue *q;
 	struct virtio_blk_dev_req *req;
 	struct virtio_blk_dev *vbdev = dev->emu_data;
 
 	DPRINTF("%s: dev=%s\n", __func__, dev->name);
 
-	for (i = 0; i < VIRTIO_BLK_QUEUE_SIZE; i++) {
-		req = &vbdev->reqs[i];
-		if (vmm_vdisk_get_request_type(&req->r) !=
-					VMM_VDISK_REQUEST_UNKNOWN) {
-			vmm_vdisk_abort_request(vbdev->vdisk, &req->r);
+	for (qn = 0; qn < vbdev->num_queues; qn++) {
+		q = &vbdev->queues[qn];
+		for (i = 0; i < VIRTIO_BLK_QUEUE_SIZE; i++) {
+			req = &q->reqs[i];
+			if (vmm_vdisk_get_request_type(&req->r) !=
+						VMM_VDISK_REQUEST_UNKNOWN) {
+				vmm_vdisk_abort_request(vbdev->vdisk, &req->r);
+			}
+			virtio_blk_req_unmap(vbdev, req);
+			vsg = req->vsg;
+			bsg = req->bsg;
+			memset(req, 0, sizeof(*req));
+			req->vsg = vsg;
+			req->bsg = bsg;
+			vmm_vdisk_set_request_type(&req->r,
+						   VMM_VDISK_REQUEST_UNKNOWN);
+		}
+
+		rc = vmm_virtio_queue_cleanup(&q->vq);
+		if (rc) {
+			return rc;
 		}
-		memset(req, 0, sizeof(*req));
-		vmm_vdisk_set_request_type(&req->r,
-					   VMM_VDISK_REQUEST_UNKNOWN);
 	}
 
-	rc = vmm_virtio_queue_cleanup(&vbdev->vqs[VIRTIO_BLK_IO_QUEUE]);
-	if (rc) {
-		return rc;
+	return VMM_OK;
+}
+
+static void virtio_blk_free_sg(struct virtio_blk_dev *vbdev)
+{
+	u32 qn, i;
+	struct virtio_blk_queue *q;
+
+	for (qn = 0; qn < vbdev->num_queues; qn++) {
+		q = &vbdev->queues[qn];
+		for (i = 0; i < VIRTIO_BLK_QUEUE_SIZE; i++) {
+			q->reqs[i].vsg = NULL;
+			q->reqs[i].bsg = NULL;
+		}
+		if (q->vsgs) {
+			vmm_free(q->vsgs);
+			q->vsgs = NULL;
+		}
+		if (q->bsgs) {
+			vmm_free(q->bsgs);
+			q->bsgs = NULL;
+		}
+	}
+}
+
+/* Preallocate segment arrays of all request slots for zero-copy IO */
+static int virtio_blk_alloc_sg(struct virtio_blk_dev *vbdev)
+{
+	u32 qn, i, cnt = VIRTIO_BLK_QUEUE_SIZE * VIRTIO_BLK_SG_MAX;
+	struct virtio_blk_queue *q;
+
+	for (qn = 0; qn < vbdev->num_queues; qn++) {
+		q = &vbdev->queues[qn];
+		q->vsgs = vmm_malloc(cnt * sizeof(*q->vsgs));
+		q->bsgs = vmm_malloc(cnt * sizeof(*q->bsgs));
+		if (!q->vsgs || !q->bsgs) {
+			return VMM_ENOMEM;
+		}
+		for (i = 0; i < VIRTIO_BLK_QUEUE_SIZE; i++) {
+			q->reqs[i].vsg = &q->vsgs[i * VIRTIO_BLK_SG_MAX];
+			q->reqs[i].bsg = &q->bsgs[i * VIRTIO_BLK_SG_MAX];
+		}
 	}
 
 	return VMM_OK;
@@ -483,6 +677,7 @@ static int virtio_blk_reset(struct vmm_virtio_device *dev)
 static int virtio_blk_connect(struct vmm_virtio_device *dev,
 			      struct vmm_virtio_emulator *emu)
 {
+	u32 i;
 	const char *attr;
 	struct virtio_blk_dev *vbdev;
 
@@ -495,9 +690,45 @@ static int virtio_blk_connect(struct vmm_virtio_device *dev,
 	}
 	vbdev->vdev = dev;
 
+	/* One request queue per guest VCPU so that guest blk-mq
+	 * contexts do not contend on a single ring
+	 */
+	vbdev->num_queues = vmm_manager_guest_vcpu_count(dev->guest);
+	if (VIRTIO_BLK_MAX_QUEUES < vbdev->num_queues) {
+		vbdev->num_queues = VIRTIO_BLK_MAX_QUEUES;
+	}
+	if (!vbdev->num_queues) {
+		vbdev->num_queues = 1;
+	}
+	vbdev->queues = vmm_zalloc(vbdev->num_queues *
+				   sizeof(struct virtio_blk_queue));
+	if (!vbdev->queues) {
+		vmm_free(vbdev);
+		return VMM_ENOMEM;
+	}
+	for (i = 0; i < vbdev->num_queues; i++) {
+		vbdev->queues[i].num = i;
+		INIT_SPIN_LOCK(&vbdev->queues[i].used_lock);
+	}
+
+	vbdev->zero_copy = (vmm_devtree_getattr(dev->edev->node,
+				"zero_copy")) ? TRUE : FALSE;
+	if (vbdev->zero_copy && virtio_blk_alloc_sg(vbdev)) {
+		virtio_blk_free_sg(vbdev);
+		vmm_free(vbdev->queues);
+		vmm_free(vbdev);
+		return VMM_ENOMEM;
+	}
+
 	vbdev->config.capacity = 0;
 	vbdev->config.seg_max = VIRTIO_BLK_DISK_SEG_MAX,
 	vbdev->config.blk_size = VIRTIO_BLK_SECTOR_SIZE;
+	vbdev->config.num_queues = vbdev->num_queues;
+	vbdev->config.max_discard_sectors = VIRTIO_BLK_RANGE_SECTORS_MAX;
+	vbdev->config.max_discard_seg = 1;
+	vbdev->config.discard_sector_alignment = 1;
+	vbdev->config.max_write_zeroes_sectors = VIRTIO_BLK_RANGE_SECTORS_MAX;
+	vbdev->config.max_write_zeroes_seg = 1;
 
 	vbdev->vdisk = vmm_vdisk_create(dev->name, VIRTIO_BLK_SECTOR_SIZE,
 					virtio_blk_attached,
@@ -506,6 +737,8 @@ static int virtio_blk_connect(struct vmm_virtio_device *dev,
 					virtio_blk_req_failed,
 					vbdev);
 	if (!vbdev->vdisk) {
+		virtio_blk_free_sg(vbdev);
+		vmm_free(vbdev->queues);
 		vmm_free(vbdev);
 		return VMM_EFAIL;
 	}
@@ -523,11 +756,21 @@ static int virtio_blk_connect(struct vmm_virtio_device *dev,
 
 static void virtio_blk_disconnect(struct vmm_virtio_device *dev)
 {
+	u32 i, qn;
+	struct virtio_blk_dev_req *req;
 	struct virtio_blk_dev *vbdev = dev->emu_data;
 
 	DPRINTF("%s: dev=%s\n", __func__, dev->name);
 
 	vmm_vdisk_destroy(vbdev->vdisk);
+	for (qn = 0; qn < vbdev->num_queues; qn++) {
+		for (i = 0; i < VIRTIO_BLK_QUEUE_SIZE; i++) {
+			req = &vbdev->queues[qn].reqs[i];
+			virtio_blk_req_unmap(vbdev, req);
+		}
+	}
+	virtio_blk_free_sg(vbdev);
+	vmm_free(vbdev->queues);
 	vmm_free(vbdev);
 }
 
@@ -544,10 +787,12 @@ struct vmm_virtio_emulator virtio_blk = {
 	.get_host_features      = virtio_blk_get_host_features,
 	.set_guest_features     = virtio_blk_set_guest_features,
 	.init_vq                = virtio_blk_init_vq,
+	.init_vq_addr           = virtio_blk_init_vq_addr,
 	.get_pfn_vq             = virtio_blk_get_pfn_vq,
 	.get_size_vq            = virtio_blk_get_size_vq,
 	.set_size_vq            = virtio_blk_set_size_vq,
 	.notify_vq              = virtio_blk_notify_vq,
+	.get_vq                 = virtio_blk_get_vq,
 	.status_changed         = virtio_blk_status_changed,
 
 	/* Emulator operations */
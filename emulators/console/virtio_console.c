@@ -65,7 +65,9 @@ static u64 virtio_console_get_host_features(struct vmm_virtio_device *dev)
 {
 	/* We support emergency write. */
 	return 1UL << VMM_VIRTIO_RING_F_EVENT_IDX
-		| 1UL << VMM_VIRTIO_CONSOLE_F_EMERG_WRITE;
+		| 1UL << VMM_VIRTIO_CONSOLE_F_EMERG_WRITE
+		| 1ULL << VMM_VIRTIO_F_VERSION_1
+		| 1ULL << VMM_VIRTIO_F_RING_PACKED;
 }
 
 static void virtio_console_set_guest_features(struct vmm_virtio_device *dev,
@@ -94,6 +96,30 @@ static int virtio_console_init_vq(struct vmm_virtio_device *dev,
 	return rc;
 }
 
+static int virtio_console_init_vq_addr(struct vmm_virtio_device *dev,
+				       u32 vq, u32 size,
+				       physical_addr_t desc_addr,
+				       physical_addr_t driver_addr,
+				       physical_addr_t device_addr, bool packed)
+{
+	int rc;
+	struct virtio_console_dev *cdev = dev->emu_data;
+
+	switch (vq) {
+	case VIRTIO_CONSOLE_RX_QUEUE:
+	case VIRTIO_CONSOLE_TX_QUEUE:
+		rc = vmm_virtio_queue_setup_addr(&cdev->vqs[vq], dev->guest,
+				desc_addr, driver_addr, device_addr,
+				size, packed);
+		break;
+	default:
+		rc = VMM_EINVALID;
+		break;
+	};
+
+	return rc;
+}
+
 static int virtio_console_get_pfn_vq(struct vmm_virtio_device *dev, u32 vq)
 {
 	int rc;
@@ -394,6 +420,7 @@ struct vmm_virtio_emulator virtio_console = {
 	.get_host_features      = virtio_console_get_host_features,
 	.set_guest_features     = virtio_console_set_guest_features,
 	.init_vq                = virtio_console_init_vq,
+	.init_vq_addr           = virtio_console_init_vq_addr,
 	.get_pfn_vq             = virtio_console_get_pfn_vq,
 	.get_size_vq            = virtio_console_get_size_vq,
 	.set_size_vq            = virtio_console_set_size_vq,
@@ -676,6 +676,20 @@ static int pl110_emulator_probe(struct vmm_guest *guest,
 	}
 	INIT_SPIN_LOCK(&s->lock);
 
+	/* Batch writes to LCDTiming2, LCDTiming3, LCDUPBASE, LCDLPBASE
+	 * and palette because these only update emulator state.
+	 */
+	rc = vmm_devemu_register_coalesced(edev, 0x008, 0x010,
+					   VMM_DEVEMU_COALESCED_WRITE);
+	if (rc) {
+		goto pl110_emulator_probe_freestate_fail;
+	}
+	rc = vmm_devemu_register_coalesced(edev, 0x200, 0x200,
+					   VMM_DEVEMU_COALESCED_WRITE);
+	if (rc) {
+		goto pl110_emulator_probe_freestate_fail;
+	}
+
 	strlcpy(name, guest->name, sizeof(name));
 	strlcat(name, "/", sizeof(name));
 	if (strlcat(name, edev->node->name, sizeof(name)) >= sizeof(name)) {
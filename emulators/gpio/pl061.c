@@ -543,6 +543,13 @@ static int pl061_emulator_probe(struct vmm_guest *guest,
 		goto pl061_emulator_probe_freestate_failed;
 	}
 
+	/* Batch writes to GPIODATA (e.g. LED blinking) */
+	rc = vmm_devemu_register_coalesced(edev, 0x000, 0x400,
+					   VMM_DEVEMU_COALESCED_WRITE);
+	if (rc) {
+		goto pl061_emulator_probe_freestate_failed;
+	}
+
 	s->edev = edev;
 	s->guest = guest;
 	INIT_SPIN_LOCK(&s->lock);
@@ -70,6 +70,35 @@
 #define PCI_CONFIG_MIN_GNT_OFFS		62
 #define PCI_CONFIG_MAX_LAT_OFFS		63
 
+/* PCI STATUS */
+#define PCI_STATUS_CAP_LIST		0x10
+
+/* PCI capability IDs */
+#define PCI_CAP_ID_MSIX			0x11
+
+/* MSI-X capability registers (offsets from capability start) */
+#define PCI_MSIX_CAP_FLAGS		2
+#define PCI_MSIX_CAP_TABLE		4
+#define PCI_MSIX_CAP_PBA		8
+#define PCI_MSIX_CAP_SIZE		12
+#define PCI_MSIX_FLAGS_QSIZE		0x07FF
+#define PCI_MSIX_FLAGS_MASKALL		0x4000
+#define PCI_MSIX_FLAGS_ENABLE		0x8000
+#define PCI_MSIX_BIR_MASK		0x7
+
+/* MSI-X table entry layout */
+#define PCI_MSIX_ENTRY_SIZE		16
+#define PCI_MSIX_ENTRY_LOWER_ADDR	0
+#define PCI_MSIX_ENTRY_UPPER_ADDR	4
+#define PCI_MSIX_ENTRY_DATA		8
+#define PCI_MSIX_ENTRY_VECTOR_CTRL	12
+#define PCI_MSIX_ENTRY_CTRL_MASKBIT	0x1
+
+/* Maximum MSI-X vectors supported by emulated devices */
+#define PCI_MSIX_MAX_VECTORS		64
+/* Vector number meaning no MSI-X vector is assigned */
+#define PCI_MSIX_NO_VECTOR		0xFFFF
+
 #define PCI_CONTROLLER_TO_CLASS(controller)	(&(controller)->class)
 
 #define PCI_DEVICE_TO_CLASS(pdev)			(&(pdev)->class)
@@ -141,13 +170,39 @@ struct pci_device {
 	struct pci_class class;
 	u32 device_id; /* ID for responding to BDF */
 	struct dlist head;
+	struct dlist dev_head;
 	struct pci_bus *pci_bus;
 	struct vmm_guest *guest;
 	struct vmm_devtree_node *node;
+	struct pci_dev_emulator *emu;
 	struct vmm_spinlock lock;
 	void *priv;
 };
 
+struct pci_msix_entry {
+	u32 addr_lo;
+	u32 addr_hi;
+	u32 data;
+	u32 ctrl;
+} __packed;
+
+/* MSI-X state of an emulated PCI device. The capability lives in
+ * PCI config space at cap_offset whereas the vector table and the
+ * pending bit array live in BAR number bir of the device.
+ */
+struct pci_msix {
+	vmm_spinlock_t lock;
+	struct vmm_guest *guest;
+	u8 cap_offset;
+	u8 bir;
+	u16 flags;
+	u32 nr_vectors;
+	u32 table_offset;
+	u32 pba_offset;
+	struct pci_msix_entry table[PCI_MSIX_MAX_VECTORS];
+	u32 pba[PCI_MSIX_MAX_VECTORS / 32];
+};
+
 struct pci_dev_emulator {
 	struct dlist head;
 	char name[VMM_FIELD_NAME_SIZE];
@@ -167,6 +222,7 @@ struct pci_dev_emulator *pci_emu_find_device(const char *name);
 int pci_emu_find_pci_device(struct pci_host_controller *controller,
 			    int bus_id, int dev_id,
 			    struct pci_device **pdev);
+struct pci_device *pci_emu_find_device_by_node(struct vmm_devtree_node *node);
 struct pci_device *pci_emu_pci_dev_find_by_addr(struct pci_host_controller
 						*controller, u32 addr);
 int pci_emu_probe_devices(struct vmm_guest *guest,
@@ -174,10 +230,26 @@ int pci_emu_probe_devices(struct vmm_guest *guest,
 			  struct vmm_devtree_node *node);
 int pci_emu_register_controller(struct vmm_devtree_node *node, struct vmm_guest *guest,
 				struct pci_host_controller *controller);
+int pci_emu_unregister_controller(struct pci_host_controller *controller);
 int pci_emu_attach_new_pci_bus(struct pci_host_controller *controller, u32 bus_id);
 int pci_emu_detach_pci_bus(struct pci_host_controller *controller, u32 bus_id);
 int pci_emu_config_space_write(struct pci_class *class, u32 reg_offs, u32 val);
 u32 pci_emu_config_space_read(struct pci_class *class, u32 reg_offs, u32 size);
+int pci_emu_msix_init(struct pci_device *pdev, struct pci_msix *msix,
+		      u8 cap_offset, u32 nr_vectors, u8 bir,
+		      u32 table_offset, u32 pba_offset);
+void pci_emu_msix_reset(struct pci_msix *msix);
+bool pci_emu_msix_enabled(struct pci_msix *msix);
+bool pci_emu_msix_config_read(struct pci_msix *msix,
+			      u16 reg_offs, u32 *val);
+bool pci_emu_msix_config_write(struct pci_msix *msix,
+			       u16 reg_offs, u32 val);
+bool pci_emu_msix_bar_access(struct pci_msix *msix, u32 offset);
+int pci_emu_msix_bar_read(struct pci_msix *msix,
+			  u32 offset, u32 *dst, u32 size);
+int pci_emu_msix_bar_write(struct pci_msix *msix,
+			   u32 offset, u32 src, u32 size);
+int pci_emu_msix_notify(struct pci_msix *msix, u32 vector);
 int __init pci_devemu_init(void);
 
 #endif /* __PCI_EMU_CORE_H */
@@ -80,7 +80,8 @@ struct virtio_input_dev {
 static u64 virtio_input_get_host_features(struct vmm_virtio_device *dev)
 {
 	return	1ULL << VMM_VIRTIO_F_VERSION_1
-		| 1UL << VMM_VIRTIO_RING_F_EVENT_IDX;
+		| 1UL << VMM_VIRTIO_RING_F_EVENT_IDX
+		| 1ULL << VMM_VIRTIO_F_RING_PACKED;
 #if 0
 		| 1UL << VMM_VIRTIO_RING_F_INDIRECT_DESC;
 #endif
@@ -124,6 +125,30 @@ static int virtio_input_init_vq(struct vmm_virtio_device *dev,
 	return rc;
 }
 
+static int virtio_input_init_vq_addr(struct vmm_virtio_device *dev,
+				     u32 vq, u32 size,
+				     physical_addr_t desc_addr,
+				     physical_addr_t driver_addr,
+				     physical_addr_t device_addr, bool packed)
+{
+	int rc;
+	struct virtio_input_dev *videv = dev->emu_data;
+
+	switch (vq) {
+	case VIRTIO_INPUT_EVENT_QUEUE:
+	case VIRTIO_INPUT_STATUS_QUEUE:
+		rc = vmm_virtio_queue_setup_addr(&videv->vqs[vq], dev->guest,
+				desc_addr, driver_addr, device_addr,
+				size, packed);
+		break;
+	default:
+		rc = VMM_EINVALID;
+		break;
+	};
+
+	return rc;
+}
+
 static int virtio_input_get_pfn_vq(struct vmm_virtio_device *dev, u32 vq)
 {
 	int rc;
@@ -638,6 +663,7 @@ struct vmm_virtio_emulator virtio_input = {
 	.get_host_features      = virtio_input_get_host_features,
 	.set_guest_features     = virtio_input_set_guest_features,
 	.init_vq                = virtio_input_init_vq,
+	.init_vq_addr           = virtio_input_init_vq_addr,
 	.get_pfn_vq             = virtio_input_get_pfn_vq,
 	.get_size_vq            = virtio_input_get_size_vq,
 	.set_size_vq            = virtio_input_set_size_vq,
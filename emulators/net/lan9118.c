@@ -1442,6 +1442,8 @@ static int lan9118_emulator_probe(struct vmm_guest *guest,
 		goto lan9118_emulator_probe_freeport_failed;
 	}
 
+	vmm_netport_rate_parse(s->port, edev->node);
+
 	if (vmm_devtree_read_string(edev->node,
 				    "switch", &attr) == VMM_OK) {
 		nsw = vmm_netswitch_find((char *)attr);
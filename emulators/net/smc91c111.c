@@ -1018,6 +1018,8 @@ static int smc91c111_emulator_probe(struct vmm_guest *guest,
 		goto smc91c111_probe_netport_failed;
 	}
 
+	vmm_netport_rate_parse(s->port, edev->node);
+
 	if (vmm_devtree_read_string(edev->node,
 				    "switch", &attr) == VMM_OK) {
 		nsw = vmm_netswitch_find(attr);
@@ -23,8 +23,11 @@
 
 #include <vmm_error.h>
 #include <vmm_heap.h>
+#include <vmm_smp.h>
 #include <vmm_modules.h>
 #include <vmm_devemu.h>
+#include <vmm_host_aspace.h>
+#include <vmm_guest_aspace.h>
 #include <vio/vmm_virtio.h>
 #include <vio/vmm_virtio_net.h>
 
@@ -34,6 +37,7 @@
 #include <net/vmm_netswitch.h>
 #include <net/vmm_netport.h>
 #include <net/vmm_mbuf.h>
+#include <libs/mathlib.h>
 
 #define MODULE_DESC			"VirtIO Net Emulator"
 #define MODULE_AUTHOR			"Pranav Sawargaonkar"
@@ -51,24 +55,41 @@
 
 #define VIRTIO_NET_MTU			1514
 
+/* Largest TSO packet accepted from guest (64KB IP packet + Ethernet) */
+#define VIRTIO_NET_MAX_GSO_LEN		(65535 + ETHER_HLEN + 4)
+
 #define VIRTIO_NET_TX_LAZY_BUDGET	(VIRTIO_NET_QUEUE_SIZE / 4)
 
+/* TX packets of at least this size are not copied out of guest */
+#define VIRTIO_NET_ZCOPY_MIN_LEN	1024
+
+/* Spare segments for guest buffers split across host regions */
+#define VIRTIO_NET_ZCOPY_EXTRA_SG	4
+
 struct virtio_net_queue {
 	int num;
 	int valid;
 	int type;
+	/* Protects used ring of TX queue and epoch */
+	vmm_spinlock_t used_lock;
+	/* Incremented on queue reset to orphan in-flight TX buffers */
+	u32 epoch;
 	struct vmm_netport_lazy lazy;
 	struct vmm_virtio_queue vq;
 	struct vmm_virtio_iovec iov[VIRTIO_NET_QUEUE_SIZE];
+	struct vmm_vring_used_elem used[VIRTIO_NET_QUEUE_SIZE];
 	struct virtio_net_dev *ndev;
 };
 
 struct virtio_net_dev {
 	struct vmm_virtio_device *vdev;
+	/* Held by device and by each in-flight zero-copy TX packet */
+	atomic_t ref;
 
 	struct virtio_net_queue *vqs;
 	u32 cq;		/* Configuration queue number */
 	u32 max_queues;
+	u32 curr_queue_pairs;
 	u32 can_receive;
 	struct vmm_virtio_net_config config;
 	u64 features;
@@ -78,24 +99,38 @@ struct virtio_net_dev {
 	char name[VMM_VIRTIO_DEVICE_MAX_NAME_LEN];
 };
 
+/*
+ * TX packet forwarded without copying out of guest. The guest
+ * buffers stay pinned and the descriptor chain is returned to
+ * guest only when the last mbuf reference is dropped.
+ */
+struct virtio_net_zcopy {
+	struct vmm_mbuf_guest g;
+	struct vmm_guest *guest;
+	struct virtio_net_queue *q;
+	u32 epoch;
+	u16 head;
+	u32 used_len;
+	u32 sg_cnt;
+	struct vmm_virtio_sg sg[];
+};
+
 static u64 virtio_net_get_host_features(struct vmm_virtio_device *dev)
 {
 	return 1UL << VMM_VIRTIO_NET_F_MAC
-#if 0
 		| 1UL << VMM_VIRTIO_NET_F_CSUM
-		| 1UL << VMM_VIRTIO_NET_F_HOST_UFO
+		| 1UL << VMM_VIRTIO_NET_F_GUEST_CSUM
 		| 1UL << VMM_VIRTIO_NET_F_HOST_TSO4
 		| 1UL << VMM_VIRTIO_NET_F_HOST_TSO6
-		| 1UL << VMM_VIRTIO_NET_F_GUEST_UFO
 		| 1UL << VMM_VIRTIO_NET_F_GUEST_TSO4
 		| 1UL << VMM_VIRTIO_NET_F_GUEST_TSO6
-#endif
+		| 1UL << VMM_VIRTIO_NET_F_MRG_RXBUF
 		| 1UL << VMM_VIRTIO_RING_F_EVENT_IDX
-#if 0
 		| 1UL << VMM_VIRTIO_RING_F_INDIRECT_DESC
-#endif
 		| 1UL << VMM_VIRTIO_NET_F_MQ
 		| 1UL << VMM_VIRTIO_NET_F_CTRL_VQ
+		| 1ULL << VMM_VIRTIO_F_VERSION_1
+		| 1ULL << VMM_VIRTIO_F_RING_PACKED
 		;
 }
 
@@ -109,6 +144,90 @@ static void virtio_net_set_guest_features(struct vmm_virtio_device *dev,
 
 	ndev->features &= ~((u64)UINT_MAX << (select * 32));
 	ndev->features |= ((u64)features << (select * 32));
+
+	/* Tell netswitch which offloads guest can receive */
+	if (ndev->port) {
+		ndev->port->features = VMM_NETPORT_F_GUEST_MBUF;
+		if (ndev->features & (1ULL << VMM_VIRTIO_NET_F_GUEST_CSUM)) {
+			ndev->port->features |= VMM_NETPORT_F_CSUM;
+		}
+		if (ndev->features & (1ULL << VMM_VIRTIO_NET_F_GUEST_TSO4)) {
+			ndev->port->features |= VMM_NETPORT_F_TSO4;
+		}
+		if (ndev->features & (1ULL << VMM_VIRTIO_NET_F_GUEST_TSO6)) {
+			ndev->port->features |= VMM_NETPORT_F_TSO6;
+		}
+	}
+}
+
+/* VirtIO 1.0 and MRG_RXBUF have num_buffers field in packet header */
+static u32 virtio_net_hdr_len(struct virtio_net_dev *ndev)
+{
+	if (ndev->features & ((1ULL << VMM_VIRTIO_F_VERSION_1) |
+			      (1ULL << VMM_VIRTIO_NET_F_MRG_RXBUF))) {
+		return sizeof(struct vmm_virtio_net_hdr_mrg_rxbuf);
+	}
+
+	return sizeof(struct vmm_virtio_net_hdr);
+}
+
+/* Convert guest TX header into mbuf offload metadata */
+static int virtio_net_hdr_to_mbuf(struct vmm_virtio_net_hdr *hdr,
+				  struct vmm_mbuf *mb)
+{
+	if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+		mb->m_csum_flags = M_CSUM_PARTIAL;
+		mb->m_csum_start = hdr->csum_start;
+		mb->m_csum_offset = hdr->csum_offset;
+	} else if (hdr->flags & VIRTIO_NET_HDR_F_DATA_VALID) {
+		mb->m_csum_flags = M_CSUM_VALID;
+	}
+
+	switch (hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) {
+	case VIRTIO_NET_HDR_GSO_NONE:
+		return VMM_OK;
+	case VIRTIO_NET_HDR_GSO_TCPV4:
+		mb->m_gso_type = M_GSO_TCPV4;
+		break;
+	case VIRTIO_NET_HDR_GSO_TCPV6:
+		mb->m_gso_type = M_GSO_TCPV6;
+		break;
+	default:
+		return VMM_ENOTSUPP;
+	};
+	mb->m_gso_size = hdr->gso_size;
+	mb->m_hdr_len = hdr->hdr_len;
+
+	return (mb->m_gso_size) ? VMM_OK : VMM_EINVALID;
+}
+
+/* Convert mbuf offload metadata into guest RX header */
+static void virtio_net_mbuf_to_hdr(struct virtio_net_dev *ndev,
+				   struct vmm_mbuf *mb,
+				   struct vmm_virtio_net_hdr *hdr)
+{
+	if (mb->m_csum_flags & M_CSUM_PARTIAL) {
+		hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+		hdr->csum_start = mb->m_csum_start;
+		hdr->csum_offset = mb->m_csum_offset;
+	} else if ((mb->m_csum_flags & M_CSUM_VALID) &&
+		   (ndev->features & (1ULL << VMM_VIRTIO_NET_F_GUEST_CSUM))) {
+		hdr->flags = VIRTIO_NET_HDR_F_DATA_VALID;
+	}
+
+	switch (mb->m_gso_type) {
+	case M_GSO_TCPV4:
+		hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+		break;
+	case M_GSO_TCPV6:
+		hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+		break;
+	default:
+		hdr->gso_type = VIRTIO_NET_HDR_GSO_NONE;
+		return;
+	};
+	hdr->gso_size = mb->m_gso_size;
+	hdr->hdr_len = mb->m_hdr_len;
 }
 
 static int virtio_net_init_vq(struct vmm_virtio_device *dev,
@@ -126,6 +245,29 @@ static int virtio_net_init_vq(struct vmm_virtio_device *dev,
 	return rc;
 }
 
+static int virtio_net_init_vq_addr(struct vmm_virtio_device *dev,
+				   u32 vq, u32 size,
+				   physical_addr_t desc_addr,
+				   physical_addr_t driver_addr,
+				   physical_addr_t device_addr, bool packed)
+{
+	int rc;
+	struct virtio_net_dev *ndev = dev->emu_data;
+
+	if (ndev->max_queues <= vq) {
+		return VMM_EINVALID;
+	}
+
+	rc = vmm_virtio_queue_setup_addr(&ndev->vqs[vq].vq, dev->guest,
+					 desc_addr, driver_addr, device_addr,
+					 size, packed);
+	if (rc == VMM_OK) {
+		ndev->vqs[vq].valid = 1;
+	}
+
+	return rc;
+}
+
 static int virtio_net_get_pfn_vq(struct vmm_virtio_device *dev, u32 vq)
 {
 	int rc;
@@ -152,13 +294,170 @@ static int virtio_net_set_size_vq(struct vmm_virtio_device *dev,
 	return size;
 }
 
+static void virtio_net_put(struct virtio_net_dev *ndev)
+{
+	if (arch_atomic_sub_return(&ndev->ref, 1) > 0) {
+		return;
+	}
+
+	vmm_free(ndev->vqs);
+	vmm_free(ndev);
+}
+
+static u32 virtio_net_zcopy_read(struct vmm_mbuf_guest *g,
+				 u32 off, void *buf, u32 len)
+{
+	u32 i, seg, pos = 0;
+	struct virtio_net_zcopy *zc =
+			container_of(g, struct virtio_net_zcopy, g);
+
+	for (i = 0; (i < zc->sg_cnt) && (pos < len); i++) {
+		if (zc->sg[i].len <= off) {
+			off -= zc->sg[i].len;
+			continue;
+		}
+
+		seg = min((u32)zc->sg[i].len - off, len - pos);
+		if (zc->sg[i].hva) {
+			memcpy(buf + pos, (void *)(zc->sg[i].hva + off), seg);
+		} else {
+			seg = vmm_host_memory_read(zc->sg[i].hpa + off,
+						   buf + pos, seg, TRUE);
+			if (!seg) {
+				break;
+			}
+		}
+		pos += seg;
+		off = 0;
+	}
+
+	return pos;
+}
+
+static u32 virtio_net_zcopy_phys(struct vmm_mbuf_guest *g,
+				 u32 off, physical_addr_t *hpa)
+{
+	u32 i;
+	struct virtio_net_zcopy *zc =
+			container_of(g, struct virtio_net_zcopy, g);
+
+	for (i = 0; i < zc->sg_cnt; i++) {
+		if (zc->sg[i].len <= off) {
+			off -= zc->sg[i].len;
+			continue;
+		}
+
+		*hpa = zc->sg[i].hpa + off;
+		return zc->sg[i].len - off;
+	}
+
+	return 0;
+}
+
+static void virtio_net_zcopy_release(struct vmm_mbuf_guest *g)
+{
+	u32 i;
+	irq_flags_t flags;
+	struct virtio_net_zcopy *zc =
+			container_of(g, struct virtio_net_zcopy, g);
+	struct virtio_net_queue *q = zc->q;
+	struct virtio_net_dev *ndev = q->ndev;
+	struct vmm_virtio_device *dev = ndev->vdev;
+
+	for (i = 0; i < zc->sg_cnt; i++) {
+		vmm_guest_physical_unpin(zc->guest, zc->sg[i].reg);
+	}
+
+	/* Queue might have been reset while packet was in-flight */
+	vmm_spin_lock_irqsave_lite(&q->used_lock, flags);
+	if (q->valid && (q->epoch == zc->epoch)) {
+		vmm_virtio_queue_set_used_elem(&q->vq, zc->head,
+					       zc->used_len);
+		if (vmm_virtio_queue_should_signal(&q->vq)) {
+			dev->tra->notify(dev, q->num);
+		}
+	}
+	vmm_spin_unlock_irqrestore_lite(&q->used_lock, flags);
+
+	vmm_free(zc);
+	virtio_net_put(ndev);
+}
+
+/* Forward TX packet referencing guest buffers instead of copying them */
+static int virtio_net_tx_zcopy(struct virtio_net_queue *q,
+			       struct vmm_virtio_net_hdr *hdr,
+			       struct vmm_virtio_iovec *iov, u32 iov_cnt,
+			       u32 pkt_len, u16 head, u32 used_len)
+{
+	int rc;
+	u32 i, sg_max = iov_cnt + VIRTIO_NET_ZCOPY_EXTRA_SG;
+	struct vmm_mbuf *mb;
+	struct virtio_net_zcopy *zc;
+	struct virtio_net_dev *ndev = q->ndev;
+
+	zc = vmm_malloc(sizeof(*zc) + sg_max * sizeof(struct vmm_virtio_sg));
+	if (!zc) {
+		return VMM_ENOMEM;
+	}
+
+	rc = vmm_virtio_iovec_to_sg(ndev->vdev, iov, iov_cnt,
+				    zc->sg, sg_max, &zc->sg_cnt);
+	if (rc) {
+		vmm_free(zc);
+		return rc;
+	}
+
+	/* Only guest RAM can be read after TX descriptor is consumed */
+	for (i = 0; i < zc->sg_cnt; i++) {
+		if (!(zc->sg[i].flags & VMM_VIRTIO_SG_RAM)) {
+			rc = VMM_ENOTSUPP;
+			goto fail_release;
+		}
+	}
+
+	zc->g.read = virtio_net_zcopy_read;
+	zc->g.phys = virtio_net_zcopy_phys;
+	zc->g.release = virtio_net_zcopy_release;
+	zc->guest = ndev->vdev->guest;
+	zc->q = q;
+	zc->epoch = q->epoch;
+	zc->head = head;
+	zc->used_len = used_len;
+
+	MGETHDR(mb, 0, 0);
+	if (!mb) {
+		rc = VMM_ENOMEM;
+		goto fail_release;
+	}
+	rc = virtio_net_hdr_to_mbuf(hdr, mb);
+	if (!rc) {
+		rc = m_ext_guest_add(mb, pkt_len, &zc->g);
+	}
+	if (rc) {
+		m_freem(mb);
+		goto fail_release;
+	}
+
+	arch_atomic_add(&ndev->ref, 1);
+	vmm_port2switch_xfer_mbuf(ndev->port, mb);
+
+	return VMM_OK;
+
+fail_release:
+	vmm_virtio_sg_release(ndev->vdev, zc->sg, zc->sg_cnt);
+	vmm_free(zc);
+	return rc;
+}
+
 static void virtio_net_tx_poke(struct virtio_net_dev *ndev, u32 vq);
 
 static void virtio_net_tx_lazy(struct vmm_netport *port, void *arg, int budget)
 {
 	int rc;
 	u16 head = 0;
-	u32 iov_cnt = 0, pkt_len = 0, total_len = 0;
+	irq_flags_t flags;
+	u32 i, hdr_len, max_len, iov_cnt = 0, pkt_len = 0, total_len = 0;
+	struct vmm_virtio_net_hdr hdr;
 	struct virtio_net_queue *q = arg;
 	struct virtio_net_dev *ndev = q->ndev;
 	struct vmm_virtio_queue *vq = &q->vq;
@@ -175,27 +474,63 @@ static void virtio_net_tx_lazy(struct vmm_netport *port, void *arg, int budget)
 			continue;
 		}
 
-		/* iov[0] is offload info */
-		pkt_len = total_len - iov[0].len;
+		/* Offload info is either whole iov[0] or start of iov[0] */
+		hdr_len = virtio_net_hdr_len(ndev);
+		memset(&hdr, 0, sizeof(hdr));
+		vmm_virtio_iovec_to_buf_read(dev, &iov[0], 1, &hdr,
+					     min(iov[0].len, (u32)sizeof(hdr)));
+		max_len = (hdr.gso_type == VIRTIO_NET_HDR_GSO_NONE) ?
+			  VIRTIO_NET_MTU : VIRTIO_NET_MAX_GSO_LEN;
+		if (iov[0].len <= hdr_len) {
+			pkt_len = total_len - iov[0].len;
+			i = 1;
+		} else {
+			pkt_len = total_len - hdr_len;
+			iov[0].addr += hdr_len;
+			iov[0].len -= hdr_len;
+			i = 0;
+		}
+
+		/* Zero-copy path returns descriptor to guest by itself */
+		if ((VIRTIO_NET_ZCOPY_MIN_LEN <= pkt_len) &&
+		    (pkt_len <= max_len) &&
+		    !virtio_net_tx_zcopy(q, &hdr, &iov[i], iov_cnt - i,
+					 pkt_len, head, total_len)) {
+			budget--;
+			continue;
+		}
 
-		if (pkt_len <= VIRTIO_NET_MTU) {
+		if (pkt_len && (pkt_len <= max_len)) {
 			MGETHDR(mb, 0, 0);
-			MEXTMALLOC(mb, pkt_len, 0);
+			if (!mb) {
+				goto skip;
+			}
+			if (!MEXTMALLOC(mb, pkt_len, 0) ||
+			    virtio_net_hdr_to_mbuf(&hdr, mb)) {
+				m_freem(mb);
+				goto skip;
+			}
 			vmm_virtio_iovec_to_buf_read(dev,
-						 &iov[1], iov_cnt - 1,
+						 &iov[i], iov_cnt - i,
 						 M_BUFADDR(mb), pkt_len);
 			mb->m_len = mb->m_pktlen = pkt_len;
 			vmm_port2switch_xfer_mbuf(ndev->port, mb);
 		}
 
+skip:
+
+		vmm_spin_lock_irqsave_lite(&q->used_lock, flags);
 		vmm_virtio_queue_set_used_elem(vq, head, total_len);
+		vmm_spin_unlock_irqrestore_lite(&q->used_lock, flags);
 
 		budget--;
 	}
 
+	vmm_spin_lock_irqsave_lite(&q->used_lock, flags);
 	if (vmm_virtio_queue_should_signal(vq)) {
 		dev->tra->notify(dev, q->num);
 	}
+	vmm_spin_unlock_irqrestore_lite(&q->used_lock, flags);
 
 	virtio_net_tx_poke(ndev, q->num);
 }
@@ -254,7 +589,14 @@ static void virtio_net_handle_ctrl(struct virtio_net_dev *ndev, u32 qnum)
 			vmm_virtio_iovec_to_buf_read(dev, &iov[1], 1,
 						     &ctrl_mq, sizeof(ctrl_mq));
 
-			if (ctrl_mq.virtqueue_pairs < ndev->max_queues) {
+			if ((ctrl_hdr.cmd ==
+				VMM_VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) &&
+			    (VMM_VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN <=
+				ctrl_mq.virtqueue_pairs) &&
+			    (ctrl_mq.virtqueue_pairs <=
+				ndev->config.max_virtqueue_pairs)) {
+				ndev->curr_queue_pairs =
+						ctrl_mq.virtqueue_pairs;
 				status = VMM_VIRTIO_NET_OK;
 			}
 			break;
@@ -331,65 +673,413 @@ static int virtio_net_can_receive(struct vmm_netport *p)
 	return ndev->can_receive;
 }
 
-static int virtio_net_switch2port_xfer(struct vmm_netport *p,
-				       struct vmm_mbuf *mb)
+/* Simple hash of IPv4 5-tuple (zero for other packets) */
+static u32 virtio_net_flow_hash(struct vmm_mbuf *mb)
+{
+	u8 *ip, *ptr;
+	u32 i, ihl, hash;
+	u8 *frame = mtod(mb, u8 *);
+
+	if ((mb->m_len < (ETHER_HLEN + IP4_HLEN)) ||
+	    (ether_type(frame) != 0x0800)) {
+		return 0;
+	}
+
+	ip = ether_payload(frame);
+	ihl = (ip[0] & 0xf) * 4;
+	hash = ip_protocol(ip);
+
+	/* Source and destination address are contiguous and so are
+	 * source and destination port of both TCP and UDP.
+	 */
+	ptr = ip_srcaddr(ip);
+	for (i = 0; i < 8; i++) {
+		hash = (hash << 5) - hash + ptr[i];
+	}
+	if (((ip_protocol(ip) == 0x06) || (ip_protocol(ip) == 0x11)) &&
+	    (IP4_HLEN <= ihl) &&
+	    ((ETHER_HLEN + ihl + 4) <= mb->m_len)) {
+		ptr = ip + ihl;
+		for (i = 0; i < 4; i++) {
+			hash = (hash << 5) - hash + ptr[i];
+		}
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x45d9f3b;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+static struct virtio_net_queue *virtio_net_rx_queue(
+					struct virtio_net_dev *ndev,
+					struct vmm_mbuf *mb)
+{
+	u32 pair = 0;
+	struct virtio_net_queue *q;
+
+	if (1 < ndev->curr_queue_pairs) {
+		pair = umod32(virtio_net_flow_hash(mb),
+			      ndev->curr_queue_pairs);
+	}
+
+	/* RX queue of pair N is queue 2N */
+	q = &ndev->vqs[pair * 2];
+	if (!q->valid) {
+		q = &ndev->vqs[0];
+	}
+
+	return q;
+}
+
+struct virtio_net_copy {
+	struct vmm_guest *guest;
+	physical_addr_t gpa;
+};
+
+static u32 virtio_net_copy_page(void *src, u32 len, void *priv)
+{
+	u32 wr;
+	struct virtio_net_copy *c = priv;
+
+	wr = vmm_guest_memory_write(c->guest, c->gpa, src, len, TRUE);
+	c->gpa += wr;
+
+	return wr;
+}
+
+/*
+ * Write packet bytes to guest RX buffers. Packets backed by memory of
+ * another guest are written straight from a temporary mapping of the
+ * source guest pages so that each byte is copied only once on its way
+ * between guests.
+ */
+static u32 virtio_net_mbuf_to_iovec(struct virtio_net_dev *ndev,
+				    struct vmm_virtio_iovec *iov, u32 iov_cnt,
+				    struct vmm_mbuf *mb, u32 off, u32 len)
+{
+	u32 i, ioff, chunk, wr, pos = 0;
+	physical_addr_t hpa;
+	struct virtio_net_copy c;
+	struct vmm_virtio_device *dev = ndev->vdev;
+	struct vmm_mbuf_guest *g = mb->m_extarg;
+
+	if (!(mb->m_flags & M_EXT_GUEST)) {
+		return vmm_virtio_buf_to_iovec_write(dev, iov, iov_cnt,
+						M_BUFADDR(mb) + off, len);
+	}
+	if (!g->phys) {
+		return 0;
+	}
+
+	c.guest = dev->guest;
+	for (i = 0; (i < iov_cnt) && (pos < len); i++) {
+		ioff = 0;
+		while ((ioff < iov[i].len) && (pos < len)) {
+			chunk = min(iov[i].len - ioff, len - pos);
+			if ((off + pos) < mb->m_len) {
+				/* Headers are local to hypervisor */
+				chunk = min(chunk, mb->m_len - (off + pos));
+				wr = vmm_guest_memory_write(dev->guest,
+						iov[i].addr + ioff,
+						mtod(mb, u8 *) + off + pos,
+						chunk, TRUE);
+			} else {
+				chunk = min(chunk, g->phys(g, off + pos, &hpa));
+				if (!chunk) {
+					return pos;
+				}
+				c.gpa = iov[i].addr + ioff;
+				wr = vmm_host_memory_map_read(hpa, chunk, TRUE,
+							virtio_net_copy_page,
+							&c);
+			}
+			ioff += wr;
+			pos += wr;
+			if (wr < chunk) {
+				return pos;
+			}
+		}
+	}
+
+	return pos;
+}
+
+/*
+ * Spread one packet over as many RX chains as needed (MRG_RXBUF).
+ * Buffers needed for whole packet are looked up first so that packet
+ * is dropped, leaving guest buffers untouched, instead of delivering
+ * a truncated frame when there are not enough buffers.
+ */
+static void virtio_net_rx_mergeable(struct virtio_net_dev *ndev,
+				    struct virtio_net_queue *q,
+				    struct vmm_mbuf *mb)
 {
 	int rc;
 	u16 head = 0;
-	u64 iov0_addr;
-	u32 iov_cnt = 0, iov0_len, total_len = 0, pkt_len = 0;
-	struct virtio_net_dev *ndev = p->priv;
-	/* FIXME: Select correct RX queue here  */
-	struct virtio_net_queue *q = &ndev->vqs[0];
+	u32 i, n, pos, len, off, pkt_len, avail;
+	u32 iov_cnt = 0, total_len = 0;
 	struct vmm_virtio_queue *vq = &q->vq;
 	struct vmm_virtio_iovec *iov = q->iov;
+	struct vmm_virtio_iovec hdr_iov = { 0 };
 	struct vmm_virtio_device *dev = ndev->vdev;
-	struct vmm_virtio_net_hdr hdr;
+	struct vmm_virtio_net_hdr_mrg_rxbuf hdr;
 
-	pkt_len = min(VIRTIO_NET_MTU, mb->m_pktlen);
+	pkt_len = (mb->m_gso_type == M_GSO_NONE) ?
+		  min(VIRTIO_NET_MTU, mb->m_pktlen) : mb->m_pktlen;
 
-	if (vmm_virtio_queue_available(vq)) {
+	pos = vmm_virtio_queue_avail_pos(vq);
+	n = avail = 0;
+	while (avail < (sizeof(hdr) + pkt_len)) {
+		if ((n == VIRTIO_NET_QUEUE_SIZE) ||
+		    !vmm_virtio_queue_available(vq)) {
+			goto drop;
+		}
 		rc = vmm_virtio_queue_get_iovec(vq, iov,
 						&iov_cnt, &total_len, &head);
 		if (rc) {
 			vmm_printf("%s: failed to get iovec (error %d)\n",
 				   __func__, rc);
-			return rc;
+			goto drop;
+		}
+		/* Header goes at start of first buffer */
+		if (!n && (!iov_cnt || (iov[0].len < sizeof(hdr)))) {
+			goto drop;
 		}
+		avail += total_len;
+		n++;
+	}
+
+	/* Get buffers again unless packet fits in the first one */
+	if (1 < n) {
+		vmm_virtio_queue_rewind(vq, pos);
+	}
+
+	off = 0;
+	for (i = 0; i < n; i++) {
+		if (1 < n) {
+			rc = vmm_virtio_queue_get_iovec(vq, iov, &iov_cnt,
+							&total_len, &head);
+			if (rc) {
+				/* Guest changed buffers meanwhile */
+				break;
+			}
+		}
+
+		q->used[i].id = head;
+		q->used[i].len = 0;
+
+		if (!i) {
+			hdr_iov.addr = iov[0].addr;
+			hdr_iov.len = sizeof(hdr);
+			iov[0].addr += sizeof(hdr);
+			iov[0].len -= sizeof(hdr);
+			q->used[0].len = sizeof(hdr);
+		}
+
+		len = virtio_net_mbuf_to_iovec(ndev, iov, iov_cnt,
+					       mb, off, pkt_len - off);
+		q->used[i].len += len;
+		off += len;
+	}
+
+	/* Never deliver a truncated frame */
+	if (off < pkt_len) {
+		goto drop;
+	}
+
+	if (hdr_iov.len) {
+		memset(&hdr, 0, sizeof(hdr));
+		virtio_net_mbuf_to_hdr(ndev, mb, &hdr.hdr);
+		hdr.num_buffers = i;
+		vmm_virtio_buf_to_iovec_write(dev, &hdr_iov, 1,
+					      &hdr, sizeof(hdr));
+	}
+
+	/* Publish all buffers of the packet together */
+	vmm_virtio_queue_set_used_elems(vq, q->used, i);
+	return;
+
+drop:
+	vmm_virtio_queue_rewind(vq, pos);
+}
+
+/* Write one packet to a RX buffer if whole packet fits in it */
+static int virtio_net_rx_fill(struct virtio_net_dev *ndev,
+			      struct virtio_net_queue *q,
+			      struct vmm_virtio_iovec *iov, u32 iov_cnt,
+			      u32 total_len, u16 head,
+			      struct vmm_mbuf *mb)
+{
+	u64 iov0_addr;
+	u32 iov0_len, cap, len, used, pkt_len;
+	struct vmm_virtio_queue *vq = &q->vq;
+	struct vmm_virtio_device *dev = ndev->vdev;
+	struct vmm_virtio_net_hdr_mrg_rxbuf hdr;
+	u32 hdr_len = virtio_net_hdr_len(ndev);
+
+	if (!iov_cnt || (iov[0].len < hdr_len)) {
+		return VMM_ENOSPC;
+	}
+
+	/* Header either shares first buffer or has it to itself */
+	cap = (iov_cnt == 1) ? iov[0].len - hdr_len : total_len - iov[0].len;
+	pkt_len = (mb->m_gso_type == M_GSO_NONE) ?
+		  min(VIRTIO_NET_MTU, mb->m_pktlen) : mb->m_pktlen;
+	if (cap < pkt_len) {
+		return VMM_ENOSPC;
 	}
 
 	memset(&hdr, 0, sizeof(hdr));
+	virtio_net_mbuf_to_hdr(ndev, mb, &hdr.hdr);
+	hdr.num_buffers = 1;
+	vmm_virtio_buf_to_iovec_write(dev, &iov[0], 1, &hdr, hdr_len);
 	if (iov_cnt == 1) {
-		vmm_virtio_buf_to_iovec_write(dev, &iov[0], 1,
-					      &hdr, sizeof(hdr));
 		iov0_addr = iov[0].addr;
 		iov0_len = iov[0].len;
-		iov[0].addr += sizeof(hdr);
-		iov[0].len -= sizeof(hdr);
-		vmm_virtio_buf_to_iovec_write(dev, &iov[0], 1,
-					      M_BUFADDR(mb), pkt_len);
-		vmm_virtio_queue_set_used_elem(vq, head,
-					       sizeof(hdr) + pkt_len);
+		iov[0].addr += hdr_len;
+		iov[0].len -= hdr_len;
+		len = virtio_net_mbuf_to_iovec(ndev, &iov[0], 1,
+					       mb, 0, pkt_len);
+		used = hdr_len + pkt_len;
 		iov[0].addr = iov0_addr;
 		iov[0].len = iov0_len;
-	} else if (iov_cnt > 1) {
-		vmm_virtio_buf_to_iovec_write(dev, &iov[0], 1,
-					      &hdr, sizeof(hdr));
-		vmm_virtio_buf_to_iovec_write(dev, &iov[1], iov_cnt - 1,
-					      M_BUFADDR(mb), pkt_len);
-		vmm_virtio_queue_set_used_elem(vq, head, iov[0].len + pkt_len);
+	} else {
+		len = virtio_net_mbuf_to_iovec(ndev, &iov[1], iov_cnt - 1,
+					       mb, 0, pkt_len);
+		used = iov[0].len + pkt_len;
 	}
 
-	if (vmm_virtio_queue_should_signal(vq)) {
-		/* FIXME: Select correct RX queue here  */
-		dev->tra->notify(dev, 0);
+	/* Short copy (e.g. source guest memory gone) drops the packet */
+	vmm_virtio_queue_set_used_elem(vq, head, (len < pkt_len) ? 0 : used);
+
+	return VMM_OK;
+}
+
+/* Fill one RX buffer of the queue without notifying guest */
+static int virtio_net_rx_one(struct virtio_net_dev *ndev,
+			     struct virtio_net_queue *q,
+			     struct vmm_mbuf *mb)
+{
+	int rc;
+	u16 head = 0;
+	struct dlist segs;
+	struct vmm_mbuf *m;
+	u32 iov_cnt = 0, total_len = 0;
+	struct vmm_virtio_queue *vq = &q->vq;
+	struct vmm_virtio_iovec *iov = q->iov;
+
+	if (ndev->features & (1ULL << VMM_VIRTIO_NET_F_MRG_RXBUF)) {
+		virtio_net_rx_mergeable(ndev, q, mb);
+		return VMM_OK;
 	}
 
-	m_freem(mb);
+	if (!vmm_virtio_queue_available(vq)) {
+		return VMM_OK;
+	}
+
+	rc = vmm_virtio_queue_get_iovec(vq, iov, &iov_cnt, &total_len, &head);
+	if (rc) {
+		vmm_printf("%s: failed to get iovec (error %d)\n",
+			   __func__, rc);
+		return rc;
+	}
+
+	rc = virtio_net_rx_fill(ndev, q, iov, iov_cnt, total_len, head, mb);
+	if (rc != VMM_ENOSPC) {
+		return rc;
+	}
+
+	/*
+	 * Packet does not fit in guest buffer. GSO packets are segmented
+	 * and other packets are dropped but never truncated. Buffer which
+	 * can't be used is returned empty which guest counts as a runt.
+	 */
+	INIT_LIST_HEAD(&segs);
+	if ((mb->m_gso_type == M_GSO_NONE) || m_gso_segment(mb, &segs)) {
+		vmm_virtio_queue_set_used_elem(vq, head, 0);
+		return VMM_OK;
+	}
+
+	m = m_list_entry(list_pop(&segs));
+	INIT_LIST_HEAD(&m->m_list);
+	rc = virtio_net_rx_fill(ndev, q, iov, iov_cnt, total_len, head, m);
+	if (rc) {
+		vmm_virtio_queue_set_used_elem(vq, head, 0);
+	}
+	m_freem(m);
+
+	while (!list_empty(&segs)) {
+		m = m_list_entry(list_pop(&segs));
+		INIT_LIST_HEAD(&m->m_list);
+		virtio_net_rx_one(ndev, q, m);
+		m_freem(m);
+	}
 
 	return VMM_OK;
 }
 
+static void virtio_net_rx_signal(struct virtio_net_dev *ndev,
+				 struct virtio_net_queue *q)
+{
+	struct vmm_virtio_device *dev = ndev->vdev;
+
+	if (vmm_virtio_queue_should_signal(&q->vq)) {
+		dev->tra->notify(dev, q->num);
+	}
+}
+
+static int virtio_net_switch2port_xfer(struct vmm_netport *p,
+				       struct vmm_mbuf *mb)
+{
+	int rc;
+	struct virtio_net_dev *ndev = p->priv;
+	struct virtio_net_queue *q = virtio_net_rx_queue(ndev, mb);
+
+	rc = virtio_net_rx_one(ndev, q, mb);
+	if (!rc) {
+		virtio_net_rx_signal(ndev, q);
+	}
+
+	m_freem(mb);
+
+	return rc;
+}
+
+/* Fill RX buffers for a burst of packets and notify guest once
+ * per RX queue instead of once per packet.
+ */
+static int virtio_net_switch2port_xfer_bulk(struct vmm_netport *p,
+					    struct vmm_mbuf **mbs, u32 count)
+{
+	u32 i;
+	int rc, ret = VMM_OK;
+	struct virtio_net_dev *ndev = p->priv;
+	struct virtio_net_queue *q, *last_q = NULL;
+
+	for (i = 0; i < count; i++) {
+		q = virtio_net_rx_queue(ndev, mbs[i]);
+		if (last_q && (q != last_q)) {
+			virtio_net_rx_signal(ndev, last_q);
+		}
+		last_q = q;
+
+		rc = virtio_net_rx_one(ndev, q, mbs[i]);
+		if (rc) {
+			ret = rc;
+		}
+
+		m_freem(mbs[i]);
+	}
+
+	if (last_q) {
+		virtio_net_rx_signal(ndev, last_q);
+	}
+
+	return ret;
+}
+
 static int virtio_net_read_config(struct vmm_virtio_device *dev,
 				  u32 offset, void *dst, u32 dst_len)
 {
@@ -418,12 +1108,23 @@ static int virtio_net_write_config(struct vmm_virtio_device *dev,
 	return VMM_OK;
 }
 
+/* In-flight zero-copy TX buffers must not touch queue after this */
+static void virtio_net_queue_orphan(struct virtio_net_queue *q)
+{
+	irq_flags_t flags;
+
+	vmm_spin_lock_irqsave_lite(&q->used_lock, flags);
+	q->epoch++;
+	vmm_spin_unlock_irqrestore_lite(&q->used_lock, flags);
+}
+
 static int virtio_net_reset(struct vmm_virtio_device *dev)
 {
 	int rc, i;
 	struct virtio_net_dev *ndev = dev->emu_data;
 
 	for (i = 0; i < ndev->max_queues; i++) {
+		virtio_net_queue_orphan(&ndev->vqs[i]);
 		if (ndev->vqs[i].valid) {
 			rc = vmm_virtio_queue_cleanup(&ndev->vqs[i].vq);
 			if (rc) {
@@ -432,11 +1133,29 @@ static int virtio_net_reset(struct vmm_virtio_device *dev)
 		}
 		ndev->vqs[i].valid = 0;
 	}
+	ndev->curr_queue_pairs = 1;
 	ndev->can_receive = 0;
+	if (ndev->port) {
+		ndev->port->features = VMM_NETPORT_F_GUEST_MBUF;
+	}
 
 	return VMM_OK;
 }
 
+/* Spread queue pairs over online host CPUs */
+static int virtio_net_queue_cpu(u32 pair)
+{
+	u32 c, n = umod32(pair, vmm_num_online_cpus());
+
+	for_each_online_cpu(c) {
+		if (!n--) {
+			return c;
+		}
+	}
+
+	return -1;
+}
+
 static int virtio_net_connect(struct vmm_virtio_device *dev,
 			      struct vmm_virtio_emulator *emu)
 {
@@ -452,6 +1171,7 @@ static int virtio_net_connect(struct vmm_virtio_device *dev,
 	}
 
 	ndev->vdev = dev;
+	ARCH_ATOMIC_INIT(&ndev->ref, 1);
 	vmm_snprintf(ndev->name, VMM_VIRTIO_DEVICE_MAX_NAME_LEN,
 		     "%s", dev->name);
 	ndev->port = vmm_netport_alloc(ndev->name, VIRTIO_NET_QUEUE_SIZE);
@@ -460,9 +1180,11 @@ static int virtio_net_connect(struct vmm_virtio_device *dev,
 		return VMM_ENOMEM;
 	}
 	ndev->port->mtu = VIRTIO_NET_MTU;
+	ndev->port->features = VMM_NETPORT_F_GUEST_MBUF;
 	ndev->port->link_changed = virtio_net_link_changed;
 	ndev->port->can_receive = virtio_net_can_receive;
 	ndev->port->switch2port_xfer = virtio_net_switch2port_xfer;
+	ndev->port->switch2port_xfer_bulk = virtio_net_switch2port_xfer_bulk;
 	ndev->port->priv = ndev;
 
 	ndev->config.max_virtqueue_pairs = dev->guest->vcpu_count;
@@ -479,11 +1201,13 @@ static int virtio_net_connect(struct vmm_virtio_device *dev,
 	ndev->config.status = VMM_VIRTIO_NET_S_LINK_UP;
 	ndev->cq = ndev->config.max_virtqueue_pairs * 2;
 	ndev->max_queues = ndev->config.max_virtqueue_pairs * 2 + 1;
+	ndev->curr_queue_pairs = 1;
 	dev->emu_data = ndev;
 
 	for (i = 0; i < ndev->max_queues; i++) {
 		ndev->vqs[i].num = i;
 		ndev->vqs[i].valid = 0;
+		INIT_SPIN_LOCK(&ndev->vqs[i].used_lock);
 		ndev->vqs[i].ndev = ndev;
 		if (i == ndev->cq) {
 			ndev->vqs[i].type = VIRTIO_NET_CTRL_QUEUE;
@@ -494,6 +1218,8 @@ static int virtio_net_connect(struct vmm_virtio_device *dev,
 						  VIRTIO_NET_TX_LAZY_BUDGET,
 						  &ndev->vqs[i],
 						  virtio_net_tx_lazy);
+				ndev->vqs[i].lazy.cpu =
+						virtio_net_queue_cpu(i / 2);
 				ndev->vqs[i].type = VIRTIO_NET_TX_QUEUE;
 			} else {
 				ndev->vqs[i].type = VIRTIO_NET_RX_QUEUE;
@@ -513,6 +1239,8 @@ static int virtio_net_connect(struct vmm_virtio_device *dev,
 		ndev->config.mac[i] = vmm_netport_mac(ndev->port)[i];
 	}
 
+	vmm_netport_rate_parse(ndev->port, dev->edev->node);
+
 	if (vmm_devtree_read_string(dev->edev->node,
 				    "switch", &attr) == VMM_OK) {
 		nsw = vmm_netswitch_find(attr);
@@ -529,12 +1257,23 @@ static int virtio_net_connect(struct vmm_virtio_device *dev,
 
 static void virtio_net_disconnect(struct vmm_virtio_device *dev)
 {
+	u32 i;
 	struct virtio_net_dev *ndev = dev->emu_data;
 
 	vmm_netport_unregister(ndev->port);
-	vmm_free(ndev->vqs);
 	vmm_netport_free(ndev->port);
-	vmm_free(ndev);
+	ndev->port = NULL;
+
+	/*
+	 * Zero-copy TX packets still in-flight hold a reference on ndev
+	 * and pins on guest regions. Pinned regions are freed only on
+	 * last unpin, so their memory outlives guest teardown. Orphaned
+	 * queues are never touched again by such packets.
+	 */
+	for (i = 0; i < ndev->max_queues; i++) {
+		virtio_net_queue_orphan(&ndev->vqs[i]);
+	}
+	virtio_net_put(ndev);
 }
 
 struct vmm_virtio_device_id virtio_net_emu_id[] = {
@@ -550,6 +1289,7 @@ struct vmm_virtio_emulator virtio_net = {
 	.get_host_features      = virtio_net_get_host_features,
 	.set_guest_features     = virtio_net_set_guest_features,
 	.init_vq                = virtio_net_init_vq,
+	.init_vq_addr           = virtio_net_init_vq_addr,
 	.get_pfn_vq             = virtio_net_get_pfn_vq,
 	.get_size_vq            = virtio_net_get_size_vq,
 	.set_size_vq            = virtio_net_set_size_vq,
@@ -284,6 +284,15 @@ _done:
 
 static int gpex_emulator_remove(struct vmm_emudev *edev)
 {
+	struct gpex_state *s = edev->priv;
+
+	if (s) {
+		pci_emu_unregister_controller(s->controller);
+		vmm_free(s->controller);
+		vmm_free(s);
+		edev->priv = NULL;
+	}
+
 	return VMM_OK;
 }
 
@@ -383,7 +383,15 @@ static int i440fx_emulator_probe(struct vmm_guest *guest,
 
 static int i440fx_emulator_remove(struct vmm_emudev *edev)
 {
-	//struct i440fx_state *s = edev->priv;
+	struct i440fx_state *s = edev->priv;
+
+	if (s) {
+		vmm_guest_aspace_unregister_client(&s->guest_aspace_client);
+		pci_emu_unregister_controller(s->controller);
+		vmm_free(s->controller);
+		vmm_free(s);
+		edev->priv = NULL;
+	}
 
 	return VMM_OK;
 }
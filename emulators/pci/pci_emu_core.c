@@ -49,6 +49,8 @@
 struct pci_devemu_ctrl {
 	struct vmm_mutex emu_lock;
 	struct dlist emu_list;
+	vmm_spinlock_t dev_lock;
+	struct dlist dev_list;
 };
 
 static struct pci_devemu_ctrl pci_emu_dectrl;
@@ -125,6 +127,28 @@ struct pci_device *pci_emu_pci_dev_find_by_addr(struct pci_host_controller
 	return pdev;
 }
 
+struct pci_device *pci_emu_find_device_by_node(struct vmm_devtree_node *node)
+{
+	irq_flags_t flags;
+	struct pci_device *pdev, *found = NULL;
+
+	if (!node)
+		return NULL;
+
+	vmm_spin_lock_irqsave(&pci_emu_dectrl.dev_lock, flags);
+
+	list_for_each_entry(pdev, &pci_emu_dectrl.dev_list, dev_head) {
+		if (pdev->node == node) {
+			found = pdev;
+			break;
+		}
+	}
+
+	vmm_spin_unlock_irqrestore(&pci_emu_dectrl.dev_lock, flags);
+
+	return found;
+}
+
 struct pci_dev_emulator *pci_emu_find_device(const char *name)
 {
 	struct pci_dev_emulator *emu;
@@ -166,6 +190,24 @@ static int pci_emu_attach_pci_device(struct pci_host_controller *controller,
 	return VMM_OK;
 }
 
+static void pci_emu_add_device(struct pci_device *pdev)
+{
+	irq_flags_t flags;
+
+	vmm_spin_lock_irqsave(&pci_emu_dectrl.dev_lock, flags);
+	list_add_tail(&pdev->dev_head, &pci_emu_dectrl.dev_list);
+	vmm_spin_unlock_irqrestore(&pci_emu_dectrl.dev_lock, flags);
+}
+
+static void pci_emu_del_device(struct pci_device *pdev)
+{
+	irq_flags_t flags;
+
+	vmm_spin_lock_irqsave(&pci_emu_dectrl.dev_lock, flags);
+	list_del(&pdev->dev_head);
+	vmm_spin_unlock_irqrestore(&pci_emu_dectrl.dev_lock, flags);
+}
+
 #if 0
 static int pci_emu_detach_pci_device(struct pci_host_controller *controller,
 					 struct pci_device *dev, u32 bus_id)
@@ -349,7 +391,11 @@ int pci_emu_probe_devices(struct vmm_guest *guest,
 					return VMM_EFAIL;
 				}
 				INIT_SPIN_LOCK(&pdev->lock);
+				INIT_SPIN_LOCK(&pdev->class.lock);
+				INIT_LIST_HEAD(&pdev->dev_head);
 				pdev->node = dev_node;
+				pdev->guest = guest;
+				pdev->emu = emu;
 				pdev->priv = NULL;
 				rc = vmm_devtree_read_u32(dev_node,
 							  "device_id", &pdev->device_id);
@@ -400,10 +446,14 @@ int pci_emu_probe_devices(struct vmm_guest *guest,
 					return rc;
 				}
 
+				/* Make device visible to its BAR emulators */
+				pci_emu_add_device(pdev);
+
 				/* FIXME: Unregister the complete device */
 				rc = pci_emu_enumerate_bars(guest, pdev, dev_node);
 				vmm_devtree_dref_node(dev_node);
 				if (rc != VMM_OK) {
+					pci_emu_del_device(pdev);
 					vmm_free(pdev);
 					vmm_devtree_dref_node(tnode);
 					vmm_devtree_dref_node(devs_node);
@@ -427,6 +477,46 @@ int pci_emu_register_controller(struct vmm_devtree_node *node, struct vmm_guest
 	return pci_emu_probe_devices(guest, controller, node);
 }
 
+int pci_emu_unregister_controller(struct pci_host_controller *controller)
+{
+	irq_flags_t flags;
+	struct pci_bus *bus, *nbus;
+	struct pci_device *pdev, *npdev;
+
+	if (!controller) {
+		return VMM_EFAIL;
+	}
+
+	vmm_mutex_lock(&pci_emu_dectrl.emu_lock);
+
+	list_for_each_entry_safe(bus, nbus,
+				 &controller->attached_buses, head) {
+		list_for_each_entry_safe(pdev, npdev,
+					 &bus->attached_devices, head) {
+			vmm_spin_lock_irqsave(&bus->lock, flags);
+			list_del(&pdev->head);
+			vmm_spin_unlock_irqrestore(&bus->lock, flags);
+
+			/* Hide device from its BAR emulators */
+			pci_emu_del_device(pdev);
+
+			if (pdev->emu && pdev->emu->remove) {
+				pdev->emu->remove(pdev);
+			}
+			vmm_free(pdev);
+		}
+
+		vmm_spin_lock_irqsave(&controller->lock, flags);
+		list_del(&bus->head);
+		vmm_spin_unlock_irqrestore(&controller->lock, flags);
+		vmm_free(bus);
+	}
+
+	vmm_mutex_unlock(&pci_emu_dectrl.emu_lock);
+
+	return VMM_OK;
+}
+
 int pci_emu_attach_new_pci_bus(struct pci_host_controller *controller, u32 bus_id)
 {
 	struct pci_bus *nbus = vmm_zalloc(sizeof(struct pci_bus));
@@ -633,12 +723,329 @@ u32 pci_emu_config_space_read(struct pci_class *class, u32 reg_offs, u32 size)
 	return ret;
 }
 
+int pci_emu_msix_init(struct pci_device *pdev, struct pci_msix *msix,
+		      u8 cap_offset, u32 nr_vectors, u8 bir,
+		      u32 table_offset, u32 pba_offset)
+{
+	struct pci_class *class;
+
+	if (!pdev || !msix || !nr_vectors ||
+	    (PCI_MSIX_MAX_VECTORS < nr_vectors) ||
+	    (cap_offset <= PCI_CONFIG_HEADER_END) ||
+	    ((PCI_CONFIG_SPACE_SIZE - PCI_MSIX_CAP_SIZE) < cap_offset) ||
+	    (PCI_MSIX_BIR_MASK < bir) ||
+	    (table_offset & PCI_MSIX_BIR_MASK) ||
+	    (pba_offset & PCI_MSIX_BIR_MASK)) {
+		return VMM_EINVALID;
+	}
+
+	memset(msix, 0, sizeof(*msix));
+	INIT_SPIN_LOCK(&msix->lock);
+	msix->guest = pdev->guest;
+	msix->cap_offset = cap_offset;
+	msix->bir = bir;
+	msix->nr_vectors = nr_vectors;
+	msix->table_offset = table_offset;
+	msix->pba_offset = pba_offset;
+	pci_emu_msix_reset(msix);
+
+	class = PCI_DEVICE_TO_CLASS(pdev);
+	class->conf_header.cap_pointer = cap_offset;
+	class->conf_header.status |= PCI_STATUS_CAP_LIST;
+
+	return VMM_OK;
+}
+
+void pci_emu_msix_reset(struct pci_msix *msix)
+{
+	u32 i;
+	irq_flags_t flags;
+
+	vmm_spin_lock_irqsave(&msix->lock, flags);
+
+	msix->flags = 0;
+	for (i = 0; i < msix->nr_vectors; i++) {
+		msix->table[i].addr_lo = 0;
+		msix->table[i].addr_hi = 0;
+		msix->table[i].data = 0;
+		msix->table[i].ctrl = PCI_MSIX_ENTRY_CTRL_MASKBIT;
+	}
+	memset(msix->pba, 0, sizeof(msix->pba));
+
+	vmm_spin_unlock_irqrestore(&msix->lock, flags);
+}
+
+bool pci_emu_msix_enabled(struct pci_msix *msix)
+{
+	return (msix->flags & PCI_MSIX_FLAGS_ENABLE) ? TRUE : FALSE;
+}
+
+/* Note: Must be called with msix lock held */
+static bool __msix_vector_masked(struct pci_msix *msix, u32 vector)
+{
+	if (!(msix->flags & PCI_MSIX_FLAGS_ENABLE) ||
+	    (msix->flags & PCI_MSIX_FLAGS_MASKALL)) {
+		return TRUE;
+	}
+
+	return (msix->table[vector].ctrl & PCI_MSIX_ENTRY_CTRL_MASKBIT) ?
+								TRUE : FALSE;
+}
+
+/* Note: Must be called with msix lock held */
+static void __msix_message(struct pci_msix *msix, u32 vector,
+			   physical_addr_t *addr, u32 *data)
+{
+	struct pci_msix_entry *e = &msix->table[vector];
+
+	*addr = ((physical_addr_t)e->addr_hi << 16) << 16;
+	*addr |= e->addr_lo;
+	*data = e->data;
+}
+
+/* Note: Must be called with msix lock held */
+static bool __msix_take_pending(struct pci_msix *msix, u32 vector,
+				physical_addr_t *addr, u32 *data)
+{
+	if (!(msix->pba[vector / 32] & (1U << (vector % 32))) ||
+	    __msix_vector_masked(msix, vector)) {
+		return FALSE;
+	}
+
+	msix->pba[vector / 32] &= ~(1U << (vector % 32));
+	__msix_message(msix, vector, addr, data);
+
+	return TRUE;
+}
+
+/* Note: Must be called without msix lock held because MSI write
+ * is handled by the irqchip msi() callback which may call back into us.
+ */
+static int msix_deliver(struct pci_msix *msix, u32 vector,
+			physical_addr_t addr, u32 data)
+{
+	int rc;
+	irq_flags_t f;
+
+	rc = vmm_devemu_emulate_msi(msix->guest, addr, data);
+	if (rc == VMM_ENOTAVAIL) {
+		/* No irqchip receives this address so keep vector pending */
+		vmm_spin_lock_irqsave(&msix->lock, f);
+		msix->pba[vector / 32] |= (1U << (vector % 32));
+		vmm_spin_unlock_irqrestore(&msix->lock, f);
+	}
+
+	return rc;
+}
+
+bool pci_emu_msix_config_read(struct pci_msix *msix,
+			      u16 reg_offs, u32 *val)
+{
+	u8 cap[PCI_MSIX_CAP_SIZE + sizeof(u32)];
+	u16 flags;
+	u32 off;
+
+	if ((reg_offs < msix->cap_offset) ||
+	    ((msix->cap_offset + PCI_MSIX_CAP_SIZE) <= reg_offs)) {
+		return FALSE;
+	}
+
+	memset(cap, 0, sizeof(cap));
+	cap[0] = PCI_CAP_ID_MSIX;
+	cap[1] = 0; /* No next capability */
+	flags = msix->flags | ((msix->nr_vectors - 1) & PCI_MSIX_FLAGS_QSIZE);
+	cap[PCI_MSIX_CAP_FLAGS] = flags & 0xFF;
+	cap[PCI_MSIX_CAP_FLAGS + 1] = flags >> 8;
+	off = msix->table_offset | msix->bir;
+	memcpy(&cap[PCI_MSIX_CAP_TABLE], &off, sizeof(off));
+	off = msix->pba_offset | msix->bir;
+	memcpy(&cap[PCI_MSIX_CAP_PBA], &off, sizeof(off));
+
+	memcpy(val, &cap[reg_offs - msix->cap_offset], sizeof(*val));
+
+	return TRUE;
+}
+
+bool pci_emu_msix_config_write(struct pci_msix *msix,
+			       u16 reg_offs, u32 val)
+{
+	u32 i;
+	u16 flags;
+	irq_flags_t f;
+	u32 data;
+	physical_addr_t addr;
+	u32 pending[PCI_MSIX_MAX_VECTORS / 32];
+
+	if ((reg_offs < msix->cap_offset) ||
+	    ((msix->cap_offset + PCI_MSIX_CAP_SIZE) <= reg_offs)) {
+		return FALSE;
+	}
+
+	/* Only the upper byte of message control is writeable */
+	switch (reg_offs - msix->cap_offset) {
+	case 0:
+		flags = val >> 16;
+		break;
+	case PCI_MSIX_CAP_FLAGS:
+		flags = val;
+		break;
+	case PCI_MSIX_CAP_FLAGS + 1:
+		flags = val << 8;
+		break;
+	default:
+		return TRUE;
+	}
+
+	vmm_spin_lock_irqsave(&msix->lock, f);
+
+	msix->flags = flags & (PCI_MSIX_FLAGS_ENABLE | PCI_MSIX_FLAGS_MASKALL);
+	memset(pending, 0, sizeof(pending));
+	for (i = 0; i < msix->nr_vectors; i++) {
+		if (__msix_take_pending(msix, i, &addr, &data)) {
+			pending[i / 32] |= (1U << (i % 32));
+		}
+	}
+
+	vmm_spin_unlock_irqrestore(&msix->lock, f);
+
+	for (i = 0; i < msix->nr_vectors; i++) {
+		if (!(pending[i / 32] & (1U << (i % 32)))) {
+			continue;
+		}
+		vmm_spin_lock_irqsave(&msix->lock, f);
+		__msix_message(msix, i, &addr, &data);
+		vmm_spin_unlock_irqrestore(&msix->lock, f);
+		msix_deliver(msix, i, addr, data);
+	}
+
+	return TRUE;
+}
+
+bool pci_emu_msix_bar_access(struct pci_msix *msix, u32 offset)
+{
+	if ((msix->table_offset <= offset) &&
+	    (offset < (msix->table_offset +
+		       msix->nr_vectors * PCI_MSIX_ENTRY_SIZE))) {
+		return TRUE;
+	}
+
+	if ((msix->pba_offset <= offset) &&
+	    (offset < (msix->pba_offset + sizeof(msix->pba)))) {
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+int pci_emu_msix_bar_read(struct pci_msix *msix,
+			  u32 offset, u32 *dst, u32 size)
+{
+	u32 val, shift;
+	irq_flags_t f;
+
+	if (!pci_emu_msix_bar_access(msix, offset) ||
+	    ((offset & 0x3) + size > sizeof(u32))) {
+		return VMM_EINVALID;
+	}
+
+	shift = (offset & 0x3) * 8;
+
+	vmm_spin_lock_irqsave(&msix->lock, f);
+
+	if (msix->pba_offset <= offset &&
+	    offset < (msix->pba_offset + sizeof(msix->pba))) {
+		val = msix->pba[(offset - msix->pba_offset) / sizeof(u32)];
+	} else {
+		offset -= msix->table_offset;
+		memcpy(&val, (u8 *)&msix->table[offset / PCI_MSIX_ENTRY_SIZE] +
+			     (offset & (PCI_MSIX_ENTRY_SIZE - 4)), sizeof(val));
+	}
+
+	vmm_spin_unlock_irqrestore(&msix->lock, f);
+
+	val >>= shift;
+	*dst = (size < sizeof(u32)) ? val & ((1U << (size * 8)) - 1) : val;
+
+	return VMM_OK;
+}
+
+int pci_emu_msix_bar_write(struct pci_msix *msix,
+			   u32 offset, u32 src, u32 size)
+{
+	u32 *reg, mask, shift, vector, data = 0;
+	bool pending = FALSE;
+	physical_addr_t addr = 0;
+	irq_flags_t f;
+
+	if (!pci_emu_msix_bar_access(msix, offset) ||
+	    ((offset & 0x3) + size > sizeof(u32))) {
+		return VMM_EINVALID;
+	}
+
+	/* Pending bit array is read-only */
+	if (msix->pba_offset <= offset &&
+	    offset < (msix->pba_offset + sizeof(msix->pba))) {
+		return VMM_OK;
+	}
+
+	shift = (offset & 0x3) * 8;
+	mask = (size < sizeof(u32)) ? ((1U << (size * 8)) - 1) : ~0U;
+	offset -= msix->table_offset;
+	vector = offset / PCI_MSIX_ENTRY_SIZE;
+
+	vmm_spin_lock_irqsave(&msix->lock, f);
+
+	reg = (u32 *)((u8 *)&msix->table[vector] +
+		      (offset & (PCI_MSIX_ENTRY_SIZE - 4)));
+	*reg = (*reg & ~(mask << shift)) | ((src & mask) << shift);
+	if ((offset & (PCI_MSIX_ENTRY_SIZE - 4)) ==
+					PCI_MSIX_ENTRY_VECTOR_CTRL) {
+		*reg &= PCI_MSIX_ENTRY_CTRL_MASKBIT;
+		pending = __msix_take_pending(msix, vector, &addr, &data);
+	}
+
+	vmm_spin_unlock_irqrestore(&msix->lock, f);
+
+	if (pending) {
+		msix_deliver(msix, vector, addr, data);
+	}
+
+	return VMM_OK;
+}
+
+int pci_emu_msix_notify(struct pci_msix *msix, u32 vector)
+{
+	u32 data = 0;
+	bool masked;
+	irq_flags_t f;
+	physical_addr_t addr = 0;
+
+	if (msix->nr_vectors <= vector) {
+		return VMM_EINVALID;
+	}
+
+	vmm_spin_lock_irqsave(&msix->lock, f);
+
+	masked = __msix_vector_masked(msix, vector);
+	if (masked) {
+		msix->pba[vector / 32] |= (1U << (vector % 32));
+	} else {
+		__msix_message(msix, vector, &addr, &data);
+	}
+
+	vmm_spin_unlock_irqrestore(&msix->lock, f);
+
+	return (masked) ? VMM_OK : msix_deliver(msix, vector, addr, data);
+}
+
 static int __init pci_emulator_core_init(void)
 {
 	memset(&pci_emu_dectrl, 0, sizeof(pci_emu_dectrl));
 
 	INIT_MUTEX(&pci_emu_dectrl.emu_lock);
 	INIT_LIST_HEAD(&pci_emu_dectrl.emu_list);
+	INIT_SPIN_LOCK(&pci_emu_dectrl.dev_lock);
+	INIT_LIST_HEAD(&pci_emu_dectrl.dev_list);
 
 	return VMM_OK;
 }
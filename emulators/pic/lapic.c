@@ -843,6 +843,27 @@ static int apic_emulator_write32(struct vmm_emudev *edev,
 	return ret_val;
 }
 
+/* Deliver MSI written to 0xFEExxxxx, decoded as per Intel SDM 10.11 */
+static int apic_emulator_msi(struct vmm_emudev *edev,
+			     physical_addr_t offset, u32 data)
+{
+	irq_flags_t flags;
+	apic_state_t *s = edev->priv;
+	u8 dest, dest_mode, del_mode, tmode, vnum;
+
+	dest = (offset >> 12) & 0xff;
+	dest_mode = (offset >> 2) & 0x1;
+	vnum = data & 0xff;
+	del_mode = (data >> 8) & 0x7;
+	tmode = (data >> 15) & 0x1;
+
+	vmm_spin_lock_irqsave(&s->state_lock, flags);
+	apic_deliver_irq(s, dest, dest_mode, del_mode, vnum, tmode);
+	vmm_spin_unlock_irqrestore(&s->state_lock, flags);
+
+	return VMM_OK;
+}
+
 void cpu_set_apic_base(apic_state_t *s, u64 val)
 {
 	/* FIXME: Change the APIC base and move the region. */
@@ -1063,6 +1084,7 @@ static struct vmm_emulator apic_emulator = {
 	.write16 =     apic_emulator_write16,
 	.read32 =      apic_emulator_read32,
 	.write32 =     apic_emulator_write32,
+	.msi =         apic_emulator_msi,
 	.reset =       apic_emulator_reset,
 	.remove =      apic_emulator_remove,
 };
@@ -89,7 +89,9 @@ struct virtio_rpmsg_dev {
 
 static u64 virtio_rpmsg_get_host_features(struct vmm_virtio_device *dev)
 {
-	return 1UL << VMM_VIRTIO_RPMSG_F_NS;
+	return 1UL << VMM_VIRTIO_RPMSG_F_NS
+		| 1ULL << VMM_VIRTIO_F_VERSION_1
+		| 1ULL << VMM_VIRTIO_F_RING_PACKED;
 }
 
 static void virtio_rpmsg_set_guest_features(struct vmm_virtio_device *dev,
@@ -124,6 +126,30 @@ static int virtio_rpmsg_init_vq(struct vmm_virtio_device *dev,
 	return rc;
 }
 
+static int virtio_rpmsg_init_vq_addr(struct vmm_virtio_device *dev,
+				     u32 vq, u32 size,
+				     physical_addr_t desc_addr,
+				     physical_addr_t driver_addr,
+				     physical_addr_t device_addr, bool packed)
+{
+	int rc;
+	struct virtio_rpmsg_dev *rdev = dev->emu_data;
+
+	switch (vq) {
+	case VIRTIO_RPMSG_RX_QUEUE:
+	case VIRTIO_RPMSG_TX_QUEUE:
+		rc = vmm_virtio_queue_setup_addr(&rdev->vqs[vq], dev->guest,
+				desc_addr, driver_addr, device_addr,
+				size, packed);
+		break;
+	default:
+		rc = VMM_EINVALID;
+		break;
+	};
+
+	return rc;
+}
+
 static int virtio_rpmsg_get_pfn_vq(struct vmm_virtio_device *dev, u32 vq)
 {
 	int rc;
@@ -602,6 +628,7 @@ struct vmm_virtio_emulator virtio_rpmsg = {
 	.get_host_features      = virtio_rpmsg_get_host_features,
 	.set_guest_features     = virtio_rpmsg_set_guest_features,
 	.init_vq                = virtio_rpmsg_init_vq,
+	.init_vq_addr           = virtio_rpmsg_init_vq_addr,
 	.get_pfn_vq             = virtio_rpmsg_get_pfn_vq,
 	.get_size_vq            = virtio_rpmsg_get_size_vq,
 	.set_size_vq            = virtio_rpmsg_set_size_vq,
@@ -441,10 +441,26 @@ static int pl011_emulator_probe(struct vmm_guest *guest,
 		goto pl011_emulator_probe_freerbuf_fail;
 	}
 
+	/* Batch TX writes to UARTDR. Reading UARTFR does not depend
+	 * on transmitted characters so it need not apply them first.
+	 */
+	rc = vmm_devemu_register_coalesced(edev, 0x00, 0x4,
+					   VMM_DEVEMU_COALESCED_WRITE);
+	if (rc) {
+		goto pl011_emulator_probe_freevser_fail;
+	}
+	rc = vmm_devemu_register_coalesced(edev, 0x18, 0x4,
+					   VMM_DEVEMU_COALESCED_READ_NOFLUSH);
+	if (rc) {
+		goto pl011_emulator_probe_freevser_fail;
+	}
+
 	edev->priv = s;
 
 	goto pl011_emulator_probe_done;
 
+pl011_emulator_probe_freevser_fail:
+	vmm_vserial_destroy(s->vser);
 pl011_emulator_probe_freerbuf_fail:
 	fifo_free(s->rd_fifo);
 pl011_emulator_probe_freestate_fail:
@@ -41,8 +41,24 @@ struct virtio_mmio_dev {
 	struct vmm_virtio_device dev;
 	struct vmm_virtio_mmio_config config;
 	u32 irq;
+	u64 guest_features;
+	/* Queue layout of selected queue (only for version 2) */
+	u64 queue_desc;
+	u64 queue_avail;
+	u64 queue_used;
+	u64 queue_ready;
+	struct vmm_devemu_doorbell notify_db;
 };
 
+static void virtio_mmio_notify_ring(struct vmm_devemu_doorbell *db, u64 val)
+{
+	struct virtio_mmio_dev *m = db->priv;
+
+	if (val < VMM_VIRTIO_MMIO_QUEUE_MAX) {
+		vmm_virtio_notify_vq(&m->dev, (u32)val);
+	}
+}
+
 static int virtio_mmio_notify(struct vmm_virtio_device *dev, u32 vq)
 {
 	struct virtio_mmio_dev *m = dev->tra_data;
@@ -58,6 +74,8 @@ int virtio_mmio_config_read(struct virtio_mmio_dev *m,
 			    u32 offset, void *dst, u32 dst_len)
 {
 	int rc = VMM_OK;
+	u32 sel;
+	u64 features;
 
 	if (dst_len != 4) {
 		vmm_printf("%s: guest=%s invalid length=%d\n",
@@ -82,12 +100,15 @@ int virtio_mmio_config_read(struct virtio_mmio_dev *m,
 		*(u32 *)dst = *((u32 *)((void *)&m->config.interrupt_state));
 		break;
 	case VMM_VIRTIO_MMIO_HOST_FEATURES:
+		features = m->dev.emu->get_host_features(&m->dev);
+		if (m->config.version < 2) {
+			/* Packed virtqueue needs separate queue areas */
+			features &= ~(1ULL << VMM_VIRTIO_F_RING_PACKED);
+		}
 		if (m->config.host_features_sel == 0)
-			*(u32 *)dst =
-			(u32)m->dev.emu->get_host_features(&m->dev);
+			*(u32 *)dst = (u32)features;
 		else
-			*(u32 *)dst =
-			(u32)(m->dev.emu->get_host_features(&m->dev) >> 32);
+			*(u32 *)dst = (u32)(features >> 32);
 		break;
 	case VMM_VIRTIO_MMIO_QUEUE_PFN:
 		*(u32 *)dst = m->dev.emu->get_pfn_vq(&m->dev,
@@ -97,9 +118,16 @@ int virtio_mmio_config_read(struct virtio_mmio_dev *m,
 		*(u32 *)dst = m->dev.emu->get_size_vq(&m->dev,
 					      m->config.queue_sel);
 		break;
+	case VMM_VIRTIO_MMIO_QUEUE_READY:
+		sel = m->config.queue_sel;
+		*(u32 *)dst = (sel < 64) ? ((m->queue_ready >> sel) & 0x1) : 0;
+		break;
 	case VMM_VIRTIO_MMIO_STATUS:
 		*(u32 *)dst = *((u32 *)((void *)&m->config.status));
 		break;
+	case VMM_VIRTIO_MMIO_CONFIG_GENERATION:
+		*(u32 *)dst = 0;
+		break;
 	default:
 		vmm_printf("%s: guest=%s invalid offset=0x%x\n",
 			   __func__, m->guest->name, offset);
@@ -122,11 +150,56 @@ static int virtio_mmio_read(struct virtio_mmio_dev *m,
 	return virtio_mmio_config_read(m, offset, dst, dst_len);
 }
 
+static int virtio_mmio_queue_ready(struct virtio_mmio_dev *m, u32 val)
+{
+	int rc;
+	bool packed;
+	u32 sel = m->config.queue_sel;
+
+	if ((m->config.version < 2) || (64 <= sel)) {
+		return VMM_EINVALID;
+	}
+
+	if (!val) {
+		/* Release the queue like a legacy QUEUE_PFN write of zero */
+		m->queue_ready &= ~(1ULL << sel);
+		vmm_virtio_dataplane_pause(&m->dev);
+		m->dev.emu->init_vq(&m->dev, sel, 0, 0, 0);
+		vmm_virtio_dataplane_resume(&m->dev);
+		return VMM_OK;
+	}
+
+	if (!m->dev.emu->init_vq_addr ||
+	    !m->config.queue_num ||
+	    (m->dev.emu->get_size_vq(&m->dev, sel) < m->config.queue_num)) {
+		vmm_printf("%s: guest=%s cannot setup queue=%d\n",
+			   __func__, m->guest->name, sel);
+		return VMM_EINVALID;
+	}
+
+	packed = (m->guest_features & (1ULL << VMM_VIRTIO_F_RING_PACKED)) ?
+		 TRUE : FALSE;
+	vmm_virtio_dataplane_pause(&m->dev);
+	rc = m->dev.emu->init_vq_addr(&m->dev, sel, m->config.queue_num,
+				      m->queue_desc, m->queue_avail,
+				      m->queue_used, packed);
+	vmm_virtio_dataplane_resume(&m->dev);
+	if (rc) {
+		vmm_printf("%s: guest=%s queue=%d setup failed (error %d)\n",
+			   __func__, m->guest->name, sel, rc);
+		return rc;
+	}
+
+	m->queue_ready |= (1ULL << sel);
+
+	return VMM_OK;
+}
+
 static int virtio_mmio_config_write(struct virtio_mmio_dev *m,
 				    u32 offset, void *src, u32 src_len)
 {
 	int rc = VMM_OK;
-	u32 val = *(u32 *)(src);
+	u32 sel, val = *(u32 *)(src);
 
 	if (src_len != 4) {
 		vmm_printf("%s: guest=%s invalid length=%d\n",
@@ -142,6 +215,11 @@ static int virtio_mmio_config_write(struct virtio_mmio_dev *m,
 		m->config.guest_features_sel = val;
 		break;
 	case VMM_VIRTIO_MMIO_GUEST_FEATURES:
+		if (m->config.guest_features_sel < 2) {
+			sel = m->config.guest_features_sel * 32;
+			m->guest_features &= ~((u64)UINT_MAX << sel);
+			m->guest_features |= ((u64)val << sel);
+		}
 		m->dev.emu->set_guest_features(&m->dev,
 					m->config.guest_features_sel, val);
 		break;
@@ -153,28 +231,59 @@ static int virtio_mmio_config_write(struct virtio_mmio_dev *m,
 		break;
 	case VMM_VIRTIO_MMIO_QUEUE_NUM:
 		m->config.queue_num = val;
+		vmm_virtio_dataplane_pause(&m->dev);
 		m->dev.emu->set_size_vq(&m->dev,
 					m->config.queue_sel,
 					m->config.queue_num);
+		vmm_virtio_dataplane_resume(&m->dev);
 		break;
 	case VMM_VIRTIO_MMIO_QUEUE_ALIGN:
 		m->config.queue_align = val;
 		break;
 	case VMM_VIRTIO_MMIO_QUEUE_PFN:
+		vmm_virtio_dataplane_pause(&m->dev);
 		m->dev.emu->init_vq(&m->dev,
 				    m->config.queue_sel,
 				    m->config.guest_page_size,
 				    m->config.queue_align,
 				    val);
+		vmm_virtio_dataplane_resume(&m->dev);
+		break;
+	case VMM_VIRTIO_MMIO_QUEUE_READY:
+		rc = virtio_mmio_queue_ready(m, val);
+		break;
+	case VMM_VIRTIO_MMIO_QUEUE_DESC_LOW:
+		m->queue_desc = (m->queue_desc & ~(u64)UINT_MAX) | val;
+		break;
+	case VMM_VIRTIO_MMIO_QUEUE_DESC_HIGH:
+		m->queue_desc = (m->queue_desc & UINT_MAX) | ((u64)val << 32);
+		break;
+	case VMM_VIRTIO_MMIO_QUEUE_AVAIL_LOW:
+		m->queue_avail = (m->queue_avail & ~(u64)UINT_MAX) | val;
+		break;
+	case VMM_VIRTIO_MMIO_QUEUE_AVAIL_HIGH:
+		m->queue_avail = (m->queue_avail & UINT_MAX) | ((u64)val << 32);
+		break;
+	case VMM_VIRTIO_MMIO_QUEUE_USED_LOW:
+		m->queue_used = (m->queue_used & ~(u64)UINT_MAX) | val;
+		break;
+	case VMM_VIRTIO_MMIO_QUEUE_USED_HIGH:
+		m->queue_used = (m->queue_used & UINT_MAX) | ((u64)val << 32);
 		break;
 	case VMM_VIRTIO_MMIO_QUEUE_NOTIFY:
-		m->dev.emu->notify_vq(&m->dev, val);
+		if (val < VMM_VIRTIO_MMIO_QUEUE_MAX) {
+			vmm_virtio_notify_vq(&m->dev, val);
+		}
 		break;
 	case VMM_VIRTIO_MMIO_INTERRUPT_ACK:
 		m->config.interrupt_state &= ~val;
 		vmm_devemu_emulate_irq(m->guest, m->irq, 0);
 		break;
 	case VMM_VIRTIO_MMIO_STATUS:
+		if (!val) {
+			vmm_devemu_flush_doorbell(&m->notify_db);
+			m->queue_ready = 0;
+		}
 		if (val != m->config.status) {
 			m->dev.emu->status_changed(&m->dev, val);
 		}
@@ -271,6 +380,12 @@ static int virtio_mmio_reset(struct vmm_emudev *edev)
 	m->config.queue_sel = 0x0;
 	m->config.interrupt_state = 0x0;
 	m->config.status = 0x0;
+	m->guest_features = 0x0;
+	m->queue_desc = 0x0;
+	m->queue_avail = 0x0;
+	m->queue_used = 0x0;
+	m->queue_ready = 0x0;
+	vmm_devemu_flush_doorbell(&m->notify_db);
 	vmm_devemu_emulate_irq(m->guest, m->irq, 0);
 
 	return vmm_virtio_reset(&m->dev);
@@ -319,6 +434,17 @@ static int virtio_mmio_probe(struct vmm_guest *guest,
 	m->config.device_id = val;
 	m->dev.id.type = m->config.device_id;
 
+	/* Optionally expose VirtIO 1.0 (modern) register layout which
+	 * is required for packed virtqueues.
+	 */
+	if (!vmm_devtree_read_u32(edev->node, "virtio_version", &val)) {
+		if ((val < 1) || (2 < val)) {
+			rc = VMM_EINVALID;
+			goto virtio_mmio_probe_freestate_fail;
+		}
+		m->config.version = val;
+	}
+
 	rc = vmm_devtree_read_u32_atindex(edev->node,
 					  VMM_DEVTREE_INTERRUPTS_ATTR_NAME,
 					  &m->irq, 0);
@@ -326,14 +452,27 @@ static int virtio_mmio_probe(struct vmm_guest *guest,
 		goto virtio_mmio_probe_freestate_fail;
 	}
 
-	if ((rc = vmm_virtio_register_device(&m->dev))) {
+	/* Queue notifications are processed by doorbell work queue
+	 * so that VCPU writing QueueNotify register does not wait for
+	 * emulator to process the virtqueue.
+	 */
+	rc = vmm_devemu_register_doorbell(edev, &m->notify_db,
+					  VMM_VIRTIO_MMIO_QUEUE_NOTIFY, 4,
+					  0, 0, virtio_mmio_notify_ring, m);
+	if (rc) {
 		goto virtio_mmio_probe_freestate_fail;
 	}
 
+	if ((rc = vmm_virtio_register_device(&m->dev))) {
+		goto virtio_mmio_probe_unregdb_fail;
+	}
+
 	edev->priv = m;
 
 	goto virtio_mmio_probe_done;
 
+virtio_mmio_probe_unregdb_fail:
+	vmm_devemu_unregister_doorbell(edev, &m->notify_db);
 virtio_mmio_probe_freestate_fail:
 	vmm_free(m);
 virtio_mmio_probe_done:
@@ -345,6 +484,7 @@ static int virtio_mmio_remove(struct vmm_emudev *edev)
 	struct virtio_mmio_dev *m = edev->priv;
 
 	if (m) {
+		vmm_devemu_unregister_doorbell(edev, &m->notify_db);
 		vmm_virtio_unregister_device(&m->dev);
 		vmm_free(m);
 		edev->priv = NULL;
@@ -53,12 +53,50 @@ struct virtio_pci_dev {
 	struct vmm_virtio_device dev;
 	struct vmm_virtio_pci_config config;
 	u32 irq;
+	struct vmm_devemu_doorbell notify_db;
+	struct pci_device *pdev;
+	bool msix_avail;
+	struct pci_msix msix;
+	u16 config_vector;
+	u16 queue_vector[VMM_VIRTIO_PCI_QUEUE_MAX];
 };
 
+static inline bool virtio_pci_msix_enabled(struct virtio_pci_dev *m)
+{
+	return (m->msix_avail && pci_emu_msix_enabled(&m->msix)) ?
+								TRUE : FALSE;
+}
+
+static void virtio_pci_notify_ring(struct vmm_devemu_doorbell *db, u64 val)
+{
+	struct virtio_pci_dev *m = db->priv;
+
+	if (val < VMM_VIRTIO_PCI_QUEUE_MAX) {
+		vmm_virtio_notify_vq(&m->dev, (u32)val);
+	}
+}
+
 static int virtio_pci_notify(struct vmm_virtio_device *dev, u32 vq)
 {
+	int rc;
+	u16 vector;
 	struct virtio_pci_dev *m = dev->tra_data;
 
+	if (virtio_pci_msix_enabled(m)) {
+		vector = (vq < VMM_VIRTIO_PCI_QUEUE_MAX) ?
+			 m->queue_vector[vq] : VMM_VIRTIO_MSI_NO_VECTOR;
+		if (vector == VMM_VIRTIO_MSI_NO_VECTOR) {
+			return VMM_OK;
+		}
+
+		/* INTx is disabled while MSI-X is enabled so a vector
+		 * without MSI doorbell stays pending instead.
+		 */
+		rc = pci_emu_msix_notify(&m->msix, vector);
+
+		return (rc == VMM_ENOTAVAIL) ? VMM_OK : rc;
+	}
+
 	m->config.interrupt_state |= VMM_VIRTIO_PCI_INT_VRING;
 
 	vmm_devemu_emulate_irq(m->guest, m->irq, 1);
@@ -92,6 +130,12 @@ int virtio_pci_config_read(struct virtio_pci_dev *m,
 		m->config.interrupt_state = 0;
 		vmm_devemu_emulate_irq(m->guest, m->irq, 0);
 		break;
+	case VMM_VIRTIO_MSI_CONFIG_VECTOR:
+		*(u32 *)dst = m->config_vector;
+		break;
+	case VMM_VIRTIO_MSI_QUEUE_VECTOR:
+		*(u32 *)dst = m->queue_vector[m->config.queue_sel];
+		break;
 	default:
 		vmm_printf("%s: guest=%s invalid offset=0x%x\n",
 			   __func__, m->guest->name, offset);
@@ -105,9 +149,17 @@ int virtio_pci_config_read(struct virtio_pci_dev *m,
 static int virtio_pci_read(struct virtio_pci_dev *m,
 			   u32 offset, u32 *dst, u32 dst_len)
 {
+	u32 config_off;
+
+	/* MSI-X table and pending bit array */
+	if (m->msix_avail && pci_emu_msix_bar_access(&m->msix, offset)) {
+		return pci_emu_msix_bar_read(&m->msix, offset, dst, dst_len);
+	}
+
 	/* Device specific config write */
-	if (offset >= VMM_VIRTIO_PCI_CONFIG) {
-		offset -= VMM_VIRTIO_PCI_CONFIG;
+	config_off = VMM_VIRTIO_PCI_CONFIG_OFF(virtio_pci_msix_enabled(m));
+	if (offset >= config_off) {
+		offset -= config_off;
 		return vmm_virtio_config_read(&m->dev, offset, dst, dst_len);
 	}
 
@@ -125,11 +177,13 @@ static int virtio_pci_config_write(struct virtio_pci_dev *m,
 		m->dev.emu->set_guest_features(&m->dev, 0, val);
 		break;
 	case VMM_VIRTIO_PCI_QUEUE_PFN:
+		vmm_virtio_dataplane_pause(&m->dev);
 		m->dev.emu->init_vq(&m->dev,
 				    m->config.queue_sel,
 				    VMM_VIRTIO_PCI_PAGE_SIZE,
 				    VMM_VIRTIO_PCI_PAGE_SIZE,
 				    val);
+		vmm_virtio_dataplane_resume(&m->dev);
 		break;
 	case VMM_VIRTIO_PCI_QUEUE_SEL:
 		if (val < VMM_VIRTIO_PCI_QUEUE_MAX) {
@@ -138,15 +192,27 @@ static int virtio_pci_config_write(struct virtio_pci_dev *m,
 		break;
 	case VMM_VIRTIO_PCI_QUEUE_NOTIFY:
 		if (val < VMM_VIRTIO_PCI_QUEUE_MAX) {
-			m->dev.emu->notify_vq(&m->dev, val);
+			vmm_virtio_notify_vq(&m->dev, val);
 		}
 		break;
 	case VMM_VIRTIO_PCI_STATUS:
+		if (!(u8)val) {
+			vmm_devemu_flush_doorbell(&m->notify_db);
+		}
 		if ((u8)val != m->config.status) {
 			m->dev.emu->status_changed(&m->dev, val);
 		}
 		m->config.status = (u8)val;
 		break;
+	case VMM_VIRTIO_MSI_CONFIG_VECTOR:
+		m->config_vector = ((u16)val < m->msix.nr_vectors) ?
+				   (u16)val : VMM_VIRTIO_MSI_NO_VECTOR;
+		break;
+	case VMM_VIRTIO_MSI_QUEUE_VECTOR:
+		m->queue_vector[m->config.queue_sel] =
+			((u16)val < m->msix.nr_vectors) ?
+			(u16)val : VMM_VIRTIO_MSI_NO_VECTOR;
+		break;
 
 	default:
 		vmm_printf("%s: guest=%s invalid offset=0x%x\n",
@@ -161,11 +227,19 @@ static int virtio_pci_config_write(struct virtio_pci_dev *m,
 static int virtio_pci_write(struct virtio_pci_dev *m,
 			    u32 offset, u32 src_mask, u32 src, u32 src_len)
 {
+	u32 config_off;
+
 	src = src & ~src_mask;
 
+	/* MSI-X table and pending bit array */
+	if (m->msix_avail && pci_emu_msix_bar_access(&m->msix, offset)) {
+		return pci_emu_msix_bar_write(&m->msix, offset, src, src_len);
+	}
+
 	/* Device specific config write */
-	if (offset >= VMM_VIRTIO_PCI_CONFIG) {
-		offset -= VMM_VIRTIO_PCI_CONFIG;
+	config_off = VMM_VIRTIO_PCI_CONFIG_OFF(virtio_pci_msix_enabled(m));
+	if (offset >= config_off) {
+		offset -= config_off;
 		return vmm_virtio_config_write(&m->dev, offset, &src, src_len);
 	}
 
@@ -177,6 +251,43 @@ static struct vmm_virtio_transport pci_tra = {
 	.notify = virtio_pci_notify,
 };
 
+static void virtio_pci_reset_vectors(struct virtio_pci_dev *m)
+{
+	u32 i;
+
+	m->config_vector = VMM_VIRTIO_MSI_NO_VECTOR;
+	for (i = 0; i < VMM_VIRTIO_PCI_QUEUE_MAX; i++) {
+		m->queue_vector[i] = VMM_VIRTIO_MSI_NO_VECTOR;
+	}
+}
+
+static u32 virtio_pci_class_config_read(struct pci_class *class,
+					u16 reg_offset)
+{
+	u32 val = 0;
+	struct pci_device *pdev = container_of(class, struct pci_device, class);
+	struct virtio_pci_dev *m = pdev->priv;
+
+	if (m && m->msix_avail) {
+		pci_emu_msix_config_read(&m->msix, reg_offset, &val);
+	}
+
+	return val;
+}
+
+static int virtio_pci_class_config_write(struct pci_class *class,
+					 u16 reg_offset, u32 data)
+{
+	struct pci_device *pdev = container_of(class, struct pci_device, class);
+	struct virtio_pci_dev *m = pdev->priv;
+
+	if (m && m->msix_avail) {
+		pci_emu_msix_config_write(&m->msix, reg_offset, data);
+	}
+
+	return VMM_OK;
+}
+
 static int virtio_pci_emulator_reset(struct pci_device *pdev)
 {
 	return VMM_OK;
@@ -199,6 +310,10 @@ static int virtio_pci_emulator_probe(struct pci_device *pdev,
 	/* Block Device */
 	class->conf_header.device_id = GET_VIRTIO_PCI_DEVICE_ID(pdev->device_id);
 
+	/* Capabilities (MSI-X) are provided by BAR emulator */
+	class->config_read = virtio_pci_class_config_read;
+	class->config_write = virtio_pci_class_config_write;
+
 	pdev->priv = NULL;
 
 	return VMM_OK;
@@ -274,16 +389,34 @@ static int virtio_pci_bar_reset(struct vmm_emudev *edev)
 	m->config.queue_sel = 0x0;
 	m->config.interrupt_state = 0x0;
 	m->config.status = 0x0;
+	vmm_devemu_flush_doorbell(&m->notify_db);
 	vmm_devemu_emulate_irq(m->guest, m->irq, 0);
+	virtio_pci_reset_vectors(m);
+	if (m->msix_avail) {
+		pci_emu_msix_reset(&m->msix);
+	}
 
 	return vmm_virtio_reset(&m->dev);
 }
 
 static int virtio_pci_bar_remove(struct vmm_emudev *edev)
 {
+	irq_flags_t flags;
+	struct pci_device *pdev = NULL;
+	struct vmm_devtree_node *bars = edev->node->parent;
 	struct virtio_pci_dev *vdev = edev->priv;
 
 	if (vdev) {
+		/* PCI device is gone if host controller was removed first */
+		if (vdev->pdev && bars) {
+			pdev = pci_emu_find_device_by_node(bars->parent);
+		}
+		if (pdev) {
+			vmm_spin_lock_irqsave(&pdev->class.lock, flags);
+			pdev->priv = NULL;
+			vmm_spin_unlock_irqrestore(&pdev->class.lock, flags);
+		}
+		vmm_devemu_unregister_doorbell(edev, &vdev->notify_db);
 		vmm_virtio_unregister_device(&vdev->dev);
 		vmm_free(vdev);
 		edev->priv = NULL;
@@ -292,11 +425,71 @@ static int virtio_pci_bar_remove(struct vmm_emudev *edev)
 	return VMM_OK;
 }
 
+static int virtio_pci_msix_probe(struct virtio_pci_dev *vdev,
+				 struct vmm_emudev *edev)
+{
+	int rc;
+	u32 barnum, nr_vectors = 0;
+	struct vmm_devtree_node *bars;
+
+	/* MSI-X is optional and only possible for memory BAR */
+	vmm_devtree_read_u32(edev->node, "msix_vectors", &nr_vectors);
+	if (!nr_vectors) {
+		return VMM_OK;
+	}
+
+	/* Don't advertise MSI-X when no emulated irqchip of guest can
+	 * receive MSIs because guest would never get any interrupt.
+	 */
+	if (!vmm_devemu_msi_capable(vdev->guest)) {
+		vmm_printf("%s: %s MSI-X disabled as guest has no MSI capable "
+			   "irqchip probed before it\n",
+			   __func__, vdev->dev.name);
+		return VMM_OK;
+	}
+
+	if (!(edev->reg->flags & VMM_REGION_MEMORY) ||
+	    (VMM_REGION_PHYS_SIZE(edev->reg) < VMM_VIRTIO_PCI_MSIX_BAR_SIZE)) {
+		vmm_printf("%s: %s MSI-X needs memory BAR of at least 0x%x\n",
+			   __func__, vdev->dev.name,
+			   VMM_VIRTIO_PCI_MSIX_BAR_SIZE);
+		return VMM_EINVALID;
+	}
+
+	rc = vmm_devtree_read_u32(edev->node, "barnum", &barnum);
+	if (rc) {
+		return rc;
+	}
+
+	/* BAR node is placed under "bars" node of PCI device node */
+	bars = edev->node->parent;
+	vdev->pdev = pci_emu_find_device_by_node((bars) ? bars->parent : NULL);
+	if (!vdev->pdev) {
+		vmm_printf("%s: %s PCI device not found\n",
+			   __func__, vdev->dev.name);
+		return VMM_ENODEV;
+	}
+
+	rc = pci_emu_msix_init(vdev->pdev, &vdev->msix,
+			       VMM_VIRTIO_PCI_MSIX_CAP, nr_vectors, barnum,
+			       VMM_VIRTIO_PCI_MSIX_TABLE,
+			       VMM_VIRTIO_PCI_MSIX_PBA);
+	if (rc) {
+		vdev->pdev = NULL;
+		return rc;
+	}
+
+	vdev->msix_avail = TRUE;
+
+	return VMM_OK;
+}
+
 static int virtio_pci_bar_probe(struct vmm_guest *guest,
 				struct vmm_emudev *edev,
 				const struct vmm_devtree_nodeid *eid)
 {
 	int rc = VMM_OK;
+	irq_flags_t flags;
 	struct virtio_pci_dev *vdev;
 
 	vdev = vmm_zalloc(sizeof(struct virtio_pci_dev));
@@ -317,6 +510,7 @@ static int virtio_pci_bar_probe(struct vmm_guest *guest,
 	vdev->config = (struct vmm_virtio_pci_config) {
 		.queue_num  = 256,
 	};
+	virtio_pci_reset_vectors(vdev);
 
 	rc = vmm_devtree_read_u32(edev->node, "virtio_type",
 				  &vdev->dev.id.type);
@@ -331,14 +525,36 @@ static int virtio_pci_bar_probe(struct vmm_guest *guest,
 		goto virtio_pci_probe_freestate_fail;
 	}
 
-	if ((rc = vmm_virtio_register_device(&vdev->dev))) {
+	/* Queue notifications are processed by doorbell work queue
+	 * so that VCPU writing QueueNotify register does not wait for
+	 * emulator to process the virtqueue.
+	 */
+	rc = vmm_devemu_register_doorbell(edev, &vdev->notify_db,
+					  VMM_VIRTIO_PCI_QUEUE_NOTIFY, 2,
+					  0, 0, virtio_pci_notify_ring, vdev);
+	if (rc) {
 		goto virtio_pci_probe_freestate_fail;
 	}
 
+	if ((rc = virtio_pci_msix_probe(vdev, edev))) {
+		goto virtio_pci_probe_unregdb_fail;
+	}
+
+	if ((rc = vmm_virtio_register_device(&vdev->dev))) {
+		goto virtio_pci_probe_unregdb_fail;
+	}
+
 	edev->priv = vdev;
+	if (vdev->pdev) {
+		vmm_spin_lock_irqsave(&vdev->pdev->class.lock, flags);
+		vdev->pdev->priv = vdev;
+		vmm_spin_unlock_irqrestore(&vdev->pdev->class.lock, flags);
+	}
 
 	goto virtio_pci_probe_done;
 
+virtio_pci_probe_unregdb_fail:
+	vmm_devemu_unregister_doorbell(edev, &vdev->notify_db);
 virtio_pci_probe_freestate_fail:
 	vmm_free(vdev);
 virtio_pci_probe_done:
@@ -0,0 +1,125 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file checksum.c
+ * @author agent (agent@local)
+ * @brief Internet checksum (RFC 1071) implementation
+ */
+
+#include <vmm_types.h>
+#include <vmm_host_io.h>
+#include <vmm_modules.h>
+#include <libs/checksum.h>
+
+#if !defined(ARCH_HAS_CSUM_PARTIAL)
+
+/*
+ * Sum native-endian words at naturally aligned addresses into a 64-bit
+ * accumulator. Each 64-bit word is added as two 32-bit halves so that
+ * no carry is lost and no carry propagation is needed in the loop.
+ * As ones' complement sum is byte order independent, the folded result
+ * is converted to big-endian word sum only once at the end.
+ */
+u32 csum_partial(const void *buf, u32 len, u32 sum)
+{
+	u64 w, acc = 0;
+	u32 res;
+	const u8 *p = buf;
+	bool odd = ((virtual_addr_t)p & 1) ? TRUE : FALSE;
+
+	if (!len) {
+		return sum;
+	}
+
+	/* Align to 2, 4 and 8 bytes */
+	if (odd) {
+#ifdef CONFIG_CPU_BE
+		acc += *p;
+#else
+		acc += (u32)*p << 8;
+#endif
+		p++;
+		len--;
+	}
+	if (((virtual_addr_t)p & 2) && (len >= 2)) {
+		acc += *(const u16 *)p;
+		p += 2;
+		len -= 2;
+	}
+	if (((virtual_addr_t)p & 4) && (len >= 4)) {
+		acc += *(const u32 *)p;
+		p += 4;
+		len -= 4;
+	}
+
+	/* Main loop unrolled over 32 bytes */
+	while (len >= 32) {
+		w = ((const u64 *)p)[0];
+		acc += (w & 0xffffffff) + (w >> 32);
+		w = ((const u64 *)p)[1];
+		acc += (w & 0xffffffff) + (w >> 32);
+		w = ((const u64 *)p)[2];
+		acc += (w & 0xffffffff) + (w >> 32);
+		w = ((const u64 *)p)[3];
+		acc += (w & 0xffffffff) + (w >> 32);
+		p += 32;
+		len -= 32;
+	}
+	while (len >= 8) {
+		w = *(const u64 *)p;
+		acc += (w & 0xffffffff) + (w >> 32);
+		p += 8;
+		len -= 8;
+	}
+
+	/* Remaining tail */
+	if (len >= 4) {
+		acc += *(const u32 *)p;
+		p += 4;
+		len -= 4;
+	}
+	if (len >= 2) {
+		acc += *(const u16 *)p;
+		p += 2;
+		len -= 2;
+	}
+	if (len) {
+#ifdef CONFIG_CPU_BE
+		acc += (u32)*p << 8;
+#else
+		acc += *p;
+#endif
+	}
+
+	/* Fold to 16 bits */
+	acc = (acc & 0xffffffff) + (acc >> 32);
+	acc = (acc & 0xffffffff) + (acc >> 32);
+	res = (u32)acc;
+	res = (res & 0xffff) + (res >> 16);
+	res = (res & 0xffff) + (res >> 16);
+
+	/* Words were summed one byte off when buffer started at odd address */
+	if (odd) {
+		res = ((res & 0xff) << 8) | (res >> 8);
+	}
+
+	return csum_add(sum, vmm_be16_to_cpu((u16)res));
+}
+VMM_EXPORT_SYMBOL(csum_partial);
+
+#endif
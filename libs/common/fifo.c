@@ -203,6 +203,59 @@ bool fifo_dequeue(struct fifo *f, void *dst)
 	return ret;
 }
 
+u32 fifo_enqueue_bulk(struct fifo *f, const void *src, u32 count)
+{
+	u32 i;
+	irq_flags_t flags;
+
+	if (!f || !src) {
+		return 0;
+	}
+
+	vmm_spin_lock_irqsave_lite(&f->lock, flags);
+
+	for (i = 0; (i < count) && !__fifo_isfull(f); i++) {
+		memcpy(f->elements + (f->write_pos * f->element_size),
+			src + (i * f->element_size), f->element_size);
+		f->write_pos++;
+		if (f->element_count <= f->write_pos) {
+			f->write_pos = 0;
+		}
+		f->avail_count++;
+	}
+
+	vmm_spin_unlock_irqrestore_lite(&f->lock, flags);
+
+	return i;
+}
+
+u32 fifo_dequeue_bulk(struct fifo *f, void *dst, u32 count)
+{
+	u32 i;
+	irq_flags_t flags;
+
+	if (!f || !dst) {
+		return 0;
+	}
+
+	vmm_spin_lock_irqsave_lite(&f->lock, flags);
+
+	for (i = 0; (i < count) && !__fifo_isempty(f); i++) {
+		memcpy(dst + (i * f->element_size),
+			f->elements + (f->read_pos * f->element_size),
+			f->element_size);
+		f->read_pos++;
+		if (f->element_count <= f->read_pos) {
+			f->read_pos = 0;
+		}
+		f->avail_count--;
+	}
+
+	vmm_spin_unlock_irqrestore_lite(&f->lock, flags);
+
+	return i;
+}
+
 bool fifo_clear(struct fifo *f)
 {
 	irq_flags_t flags;
@@ -271,3 +271,29 @@ int mempool_free(struct mempool *mp, void *entity)
 	return VMM_OK;
 }
 
+u32 mempool_malloc_bulk(struct mempool *mp, void **entities, u32 count)
+{
+	if (!mp || !entities) {
+		return 0;
+	}
+
+	/* FIFO elements are virtual addresses of pointer size */
+	return fifo_dequeue_bulk(mp->f, entities, count);
+}
+
+u32 mempool_free_bulk(struct mempool *mp, void **entities, u32 count)
+{
+	u32 i;
+
+	if (!mp || !entities) {
+		return 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!mempool_check_ptr(mp, entities[i])) {
+			return 0;
+		}
+	}
+
+	return fifo_enqueue_bulk(mp->f, entities, count);
+}
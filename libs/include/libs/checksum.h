@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file checksum.h
+ * @author agent (agent@local)
+ * @brief Internet checksum (RFC 1071) helpers
+ *
+ * Partial sums are 32-bit ones' complement sums of big-endian 16-bit
+ * words (i.e. in host order as a value) which can be combined using
+ * csum_add() and turned into checksum field value using csum_fold().
+ * Partial sum of a buffer chained after a buffer of odd length must
+ * be byte swapped using csum_shift() before combining.
+ *
+ * Architectures can provide optimized csum_partial() by defining
+ * ARCH_HAS_CSUM_PARTIAL in arch_config.h.
+ */
+
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#include <vmm_types.h>
+#include <arch_config.h>
+
+/** Ones' complement addition of two partial sums */
+static inline u32 csum_add(u32 sum, u32 addend)
+{
+	sum += addend;
+	return sum + (sum < addend);
+}
+
+/** Byte swap a partial sum of buffer starting at odd offset */
+static inline u32 csum_shift(u32 sum)
+{
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return ((sum & 0xff) << 8) | (sum >> 8);
+}
+
+/** Fold a partial sum into 16-bit checksum field value */
+static inline u16 csum_fold(u32 sum)
+{
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (u16)~sum;
+}
+
+/**
+ * Incrementally update a checksum field value when a 16-bit word
+ * covered by it changes from old to new (RFC 1624, eqn. 3)
+ */
+static inline u16 csum_replace16(u16 check, u16 old, u16 new)
+{
+	return csum_fold((u32)(u16)~check + (u16)~old + new);
+}
+
+/** Incrementally update a checksum field value for a 32-bit change */
+static inline u16 csum_replace32(u16 check, u32 old, u32 new)
+{
+	u32 sum = (u16)~check;
+
+	sum += (u16)~(old >> 16) + (u16)~(old & 0xffff);
+	sum += (new >> 16) + (new & 0xffff);
+
+	return csum_fold(sum);
+}
+
+/** Add ones' complement sum of a buffer to partial sum */
+u32 csum_partial(const void *buf, u32 len, u32 sum);
+
+#endif /* __CHECKSUM_H__ */
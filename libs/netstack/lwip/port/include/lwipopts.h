@@ -24,6 +24,8 @@
 #ifndef __LWIPOPTS_H_
 #define __LWIPOPTS_H_
 
+#include <libs/checksum.h>
+
 /*
    -----------------------------------------------
    ---------- Platform specific locking ----------
@@ -113,7 +115,7 @@
  * MEMP_NUM_TCP_SEG: the number of simultaneously queued TCP segments.
  * (requires the LWIP_TCP option)
  */
-#define MEMP_NUM_TCP_SEG                16
+#define MEMP_NUM_TCP_SEG                128
 
 /**
  * MEMP_NUM_REASSDATA: the number of simultaneously IP packets queued for
@@ -164,7 +166,7 @@
 /**
  * PBUF_POOL_SIZE: the number of buffers in the pbuf pool. 
  */
-#define PBUF_POOL_SIZE                  8
+#define PBUF_POOL_SIZE                  48
 
 /*
    ---------------------------------
@@ -332,6 +334,29 @@
 
 #define LWIP_LISTEN_BACKLOG             0
 
+/**
+ * TCP_MSS: TCP Maximum segment size. Full sized Ethernet frames.
+ */
+#define TCP_MSS                         1460
+
+/**
+ * TCP_WND: The size of a TCP window. lwIP v1.4.1 does not support
+ * window scaling (RFC 1323) so use largest unscaled window which is
+ * a multiple of TCP_MSS.
+ */
+#define TCP_WND                         (44 * TCP_MSS)
+
+/**
+ * TCP_SND_BUF: TCP sender buffer space (bytes).
+ */
+#define TCP_SND_BUF                     (44 * TCP_MSS)
+
+/**
+ * TCP_SND_QUEUELEN: TCP sender buffer space (pbufs). This must be less
+ * than or equal to MEMP_NUM_TCP_SEG.
+ */
+#define TCP_SND_QUEUELEN                (2 * (TCP_SND_BUF / TCP_MSS))
+
 /*
    ----------------------------------
    ---------- Pbuf options ----------
@@ -414,6 +439,19 @@
  * LWIP_STATS==1: Enable statistics collection in lwip_stats.
  */
 #define LWIP_STATS                      0
+
+/*
+   --------------------------------------
+   ---------- Checksum options ----------
+   --------------------------------------
+*/
+/**
+ * LWIP_CHKSUM: Checksum routine returning folded (but not complemented)
+ * sum in network byte order. Use the optimized one from common libs.
+ */
+#define LWIP_CHKSUM(dataptr, len)	\
+	vmm_cpu_to_be16((u16)~csum_fold(csum_partial((dataptr), (len), 0)))
+
 /*
    ---------------------------------
    ---------- PPP options ----------
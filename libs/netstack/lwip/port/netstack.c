@@ -29,6 +29,7 @@
 #include <vmm_mutex.h>
 #include <vmm_completion.h>
 #include <vmm_modules.h>
+#include <libs/mempool.h>
 #include <libs/netstack.h>
 
 #include "lwip/opt.h"
@@ -61,6 +62,9 @@
 
 #define MAX_FRAME_LEN			1518
 
+/** number of received frames which can be held by lwIP without copy */
+#define RX_PBUF_COUNT			256
+
 #undef PING_USE_SOCKETS
 
 /** ping receive timeout - in milliseconds */
@@ -72,9 +76,16 @@
 /** ping identifier - must fit on a u16_t */
 #define PING_ID				0xAFAF
 
+/** custom pbuf wrapping data of received mbuf */
+struct lwip_rx_pbuf {
+	struct pbuf_custom pc;
+	struct vmm_mbuf *mbuf;
+};
+
 struct lwip_netstack {
 	struct netif nif;
 	struct vmm_netport *port;
+	struct mempool *rx_pool;
 #if !defined(PING_USE_SOCKETS)
 	struct vmm_mutex ping_lock;
 	ip_addr_t ping_addr;
@@ -705,6 +716,42 @@ static int lwip_can_receive(struct vmm_netport *port)
 	return FALSE;
 }
 
+static void lwip_rx_pbuf_free(struct pbuf *p)
+{
+	struct lwip_rx_pbuf *rp = (struct lwip_rx_pbuf *)p;
+
+	m_freem(rp->mbuf);
+	mempool_free(lns.rx_pool, rp);
+}
+
+/*
+ * Wrap data of received mbuf into a custom pbuf without copying.
+ * lwIP updates headers of received frames in-place (e.g. TCP header
+ * byte order and ARP replies) so this is only possible when we are
+ * the only user of a contiguous and writable mbuf.
+ */
+static struct pbuf *lwip_rx_pbuf_wrap(struct lwip_netstack *lns,
+				      struct vmm_mbuf *mbuf)
+{
+	struct lwip_rx_pbuf *rp;
+
+	if (mbuf->m_next || (mbuf->m_len != mbuf->m_pktlen) ||
+	    (mbuf->m_len > MAX_FRAME_LEN) || M_READONLY(mbuf)) {
+		return NULL;
+	}
+
+	rp = mempool_malloc(lns->rx_pool);
+	if (!rp) {
+		return NULL;
+	}
+
+	rp->mbuf = mbuf;
+	rp->pc.custom_free_function = lwip_rx_pbuf_free;
+
+	return pbuf_alloced_custom(PBUF_RAW, mbuf->m_len, PBUF_REF, &rp->pc,
+				   mtod(mbuf, void *), mbuf->m_len);
+}
+
 static int lwip_switch2port_xfer(struct vmm_netport *port,
 			 	 struct vmm_mbuf *mbuf)
 {
@@ -714,16 +761,25 @@ static int lwip_switch2port_xfer(struct vmm_netport *port,
 	struct lwip_netstack *lns = port->priv;
 	u32 lcopied = 0;
 
-	/* Move received packet into a new pbuf */
-	pbuf_len = min(MAX_FRAME_LEN, mbuf->m_pktlen);
-	p = pbuf_alloc(PBUF_LINK, pbuf_len, PBUF_POOL);
+	/* Hand over received packet to lwIP if possible */
+	p = lwip_rx_pbuf_wrap(lns, mbuf);
 	if (!p) {
-		return VMM_ENOMEM;
-	}
+		/* Move received packet into a new pbuf */
+		pbuf_len = min(MAX_FRAME_LEN, mbuf->m_pktlen);
+		p = pbuf_alloc(PBUF_LINK, pbuf_len, PBUF_POOL);
+		if (p) {
+			for (q = p; q != NULL; q = q->next) {
+				m_copydata(mbuf, lcopied, q->len, q->payload);
+				lcopied += q->len;
+			}
+		}
 
-	for (q = p; q != NULL; q = q->next) {
-		m_copydata(mbuf, lcopied, q->len, q->payload);
-		lcopied += q->len;
+		/* Free the mbuf */
+		m_freem(mbuf);
+
+		if (!p) {
+			return VMM_ENOMEM;
+		}
 	}
 
 	/* Points to packet ethernet header */
@@ -744,9 +800,6 @@ static int lwip_switch2port_xfer(struct vmm_netport *port,
 		break;
 	}
 
-	/* Free the mbuf */
-	m_freem(mbuf);
-
 	/* Return success */
 	return VMM_OK;
 }
@@ -772,26 +825,38 @@ static err_t lwip_netstack_output(struct netif *netif, struct pbuf *p)
 		return ERR_MEM;
 	}
 
-	/* Increase reference to the pbuf as we reuse the same buffers */
-	pbuf_ref(p);
-
 	/* Create the first mbuf in the chain */
 	MGETHDR(mbuf_head, 0, 0);
+	if (!mbuf_head) {
+		return ERR_MEM;
+	}
+
+	/* Increase reference to the pbuf as we reuse the same buffers */
+	pbuf_ref(p);
 	MEXTADD(mbuf_head, p->payload, p->len, lwip_netstack_mbuf_free, p);
+	mbuf_head->m_len = p->len;
 	mbuf_cur = mbuf_head;
 
 	/* Create next mbufs in chain from the pbuf chain */
 	q = p->next;
 	while (q != NULL) {
 		MGET(mbuf, 0, M_EXT_DONTFREE);
+		if (!mbuf) {
+			m_freem(mbuf_head);
+			return ERR_MEM;
+		}
 		MEXTADD(mbuf, q->payload, q->len, NULL, NULL);
+		mbuf->m_len = q->len;
 		mbuf_cur->m_next = mbuf;
 		mbuf_cur = mbuf;
 		q = q->next;
 	}
 
-	/* Setup mbuf len */
-	mbuf_head->m_len = mbuf_head->m_pktlen = p->tot_len;
+	/* Setup packet len */
+	mbuf_head->m_pktlen = p->tot_len;
+
+	/* lwIP generates complete checksums for all packets */
+	mbuf_head->m_csum_flags = M_CSUM_VALID;
 
 	/* Send mbuf to the netswitch */
 	vmm_port2switch_xfer_mbuf(lns->port, mbuf_head);
@@ -834,6 +899,13 @@ static int __init lwip_netstack_init(void)
 	/* Clear lwIP state */
 	memset(&lns, 0, sizeof(lns));
 
+	/* Create pool of custom pbufs for received frames */
+	lns.rx_pool = mempool_heap_create(sizeof(struct lwip_rx_pbuf),
+					  RX_PBUF_COUNT);
+	if (!lns.rx_pool) {
+		return VMM_ENOMEM;
+	}
+
 	/* Get netstack device tree node if available */
 	node = vmm_devtree_getnode(VMM_DEVTREE_PATH_SEPARATOR_STRING
 				   VMM_DEVTREE_VMMINFO_NODE_NAME
@@ -923,6 +995,7 @@ fail2:
 fail1:
 	vmm_netport_free(lns.port);
 fail:
+	mempool_destroy(lns.rx_pool);
 	return rc;
 }
 
@@ -930,6 +1003,7 @@ static void __exit lwip_netstack_exit(void)
 {
 	vmm_netport_unregister(lns.port);
 	vmm_netport_free(lns.port);
+	mempool_destroy(lns.rx_pool);
 }
 
 VMM_DECLARE_MODULE(MODULE_DESC, 
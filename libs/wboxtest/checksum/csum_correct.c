@@ -0,0 +1,183 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file csum_correct.c
+ * @author agent (agent@local)
+ * @brief csum_correct test implementation
+ *
+ * This tests csum_partial() against byte-at-a-time reference for all
+ * buffer alignments and lengths upto a jumbo frame, chaining of
+ * partial sums split at odd and even lengths, and incremental
+ * checksum update helpers.
+ */
+
+#include <vmm_error.h>
+#include <vmm_stdio.h>
+#include <vmm_heap.h>
+#include <vmm_modules.h>
+#include <libs/stringlib.h>
+#include <libs/wboxtest.h>
+
+#include "csum_test.h"
+
+#define MODULE_DESC			"csum_correct test"
+#define MODULE_AUTHOR			"agent"
+#define MODULE_LICENSE			"GPL"
+#define MODULE_IPRIORITY		(WBOXTEST_IPRIORITY+1)
+#define	MODULE_INIT			csum_correct_init
+#define	MODULE_EXIT			csum_correct_exit
+
+/* Every length upto full sized frame and then sparsely upto jumbo */
+#define CSUM_CORRECT_DENSE_LEN		1600
+#define CSUM_CORRECT_SPARSE_STEP	61
+#define CSUM_CORRECT_MAX_LEN		9018
+#define CSUM_CORRECT_UPDATES		1024
+
+static int csum_correct_partial(struct vmm_chardev *cdev, const u8 *buf)
+{
+	u32 off, len, split, s1, s2;
+	u16 csum, ref;
+
+	for (off = 0; off < CSUM_TEST_MAX_OFFSET; off++) {
+		for (len = 0; len <= CSUM_CORRECT_MAX_LEN;
+		     len += (len < CSUM_CORRECT_DENSE_LEN) ?
+			    1 : CSUM_CORRECT_SPARSE_STEP) {
+			ref = csum_fold(csum_test_ref(buf + off, len, 0));
+			csum = csum_fold(csum_partial(buf + off, len, 0));
+			if (!csum_test_equal(csum, ref)) {
+				vmm_cprintf(cdev, "csum_partial() offset=%d "
+					    "len=%d got 0x%04x expected "
+					    "0x%04x\n", off, len, csum, ref);
+				return VMM_EFAIL;
+			}
+
+			/* Chain partial sums of two halves */
+			split = (len * 7) / 16;
+			s1 = csum_partial(buf + off, split, 0);
+			s2 = csum_partial(buf + off + split, len - split, 0);
+			if (split & 1) {
+				s2 = csum_shift(s2);
+			}
+			csum = csum_fold(csum_add(s1, s2));
+			if (!csum_test_equal(csum, ref)) {
+				vmm_cprintf(cdev, "chained csum_partial() "
+					    "offset=%d len=%d split=%d\n",
+					    off, len, split);
+				return VMM_EFAIL;
+			}
+		}
+	}
+
+	return VMM_OK;
+}
+
+static int csum_correct_replace(struct vmm_chardev *cdev, u8 *buf)
+{
+	u32 i, old32, new32;
+	u16 csum, ref, old16, new16;
+
+	for (i = 0; i < CSUM_CORRECT_UPDATES; i++) {
+		/* IPv4 header sized block with valid checksum */
+		csum_test_fill(buf, 20, i);
+		buf[10] = buf[11] = 0;
+		csum = csum_fold(csum_test_ref(buf, 20, 0));
+
+		/* Update a 16-bit word (e.g. total length) */
+		old16 = ((u16)buf[2] << 8) | buf[3];
+		new16 = old16 + i;
+		buf[2] = new16 >> 8;
+		buf[3] = new16 & 0xff;
+		ref = csum_fold(csum_test_ref(buf, 20, 0));
+		csum = csum_replace16(csum, old16, new16);
+		if (!csum_test_equal(csum, ref)) {
+			vmm_cprintf(cdev, "csum_replace16() 0x%04x->0x%04x "
+				    "got 0x%04x expected 0x%04x\n",
+				    old16, new16, csum, ref);
+			return VMM_EFAIL;
+		}
+
+		/* Update a 32-bit word (e.g. source address) */
+		old32 = ((u32)buf[12] << 24) | ((u32)buf[13] << 16) |
+			((u32)buf[14] << 8) | buf[15];
+		new32 = old32 ^ (i * 0x9e3779b9);
+		buf[12] = new32 >> 24;
+		buf[13] = (new32 >> 16) & 0xff;
+		buf[14] = (new32 >> 8) & 0xff;
+		buf[15] = new32 & 0xff;
+		ref = csum_fold(csum_test_ref(buf, 20, 0));
+		csum = csum_replace32(csum, old32, new32);
+		if (!csum_test_equal(csum, ref)) {
+			vmm_cprintf(cdev, "csum_replace32() 0x%08x->0x%08x "
+				    "got 0x%04x expected 0x%04x\n",
+				    old32, new32, csum, ref);
+			return VMM_EFAIL;
+		}
+	}
+
+	return VMM_OK;
+}
+
+static int csum_correct_run(struct wboxtest *test, struct vmm_chardev *cdev,
+			    u32 test_hcpu)
+{
+	int rc;
+	u8 *buf;
+
+	buf = vmm_malloc(CSUM_TEST_BUF_SIZE);
+	if (!buf) {
+		return VMM_ENOMEM;
+	}
+	csum_test_fill(buf, CSUM_TEST_BUF_SIZE, 1);
+
+	/* All ones data is the corner case of ones' complement sum */
+	memset(buf + CSUM_TEST_BUF_SIZE / 2, 0xff, 4096);
+
+	rc = csum_correct_partial(cdev, buf);
+	if (!rc) {
+		rc = csum_correct_partial(cdev, buf + CSUM_TEST_BUF_SIZE / 2);
+	}
+	if (!rc) {
+		rc = csum_correct_replace(cdev, buf);
+	}
+
+	vmm_free(buf);
+
+	return rc;
+}
+
+static struct wboxtest csum_correct = {
+	.name = "csum_correct",
+	.run = csum_correct_run,
+};
+
+static int __init csum_correct_init(void)
+{
+	return wboxtest_register("checksum", &csum_correct);
+}
+
+static void __exit csum_correct_exit(void)
+{
+	wboxtest_unregister(&csum_correct);
+}
+
+VMM_DECLARE_MODULE(MODULE_DESC,
+		   MODULE_AUTHOR,
+		   MODULE_LICENSE,
+		   MODULE_IPRIORITY,
+		   MODULE_INIT,
+		   MODULE_EXIT);
@@ -0,0 +1,141 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file csum_perf.c
+ * @author agent (agent@local)
+ * @brief csum_perf test implementation
+ *
+ * This measures csum_partial() throughput for typical packet sizes at
+ * aligned and unaligned buffer offsets along with byte-at-a-time
+ * reference implementation as baseline.
+ */
+
+#include <vmm_error.h>
+#include <vmm_stdio.h>
+#include <vmm_heap.h>
+#include <vmm_timer.h>
+#include <vmm_modules.h>
+#include <libs/mathlib.h>
+#include <libs/wboxtest.h>
+
+#include "csum_test.h"
+
+#define MODULE_DESC			"csum_perf test"
+#define MODULE_AUTHOR			"agent"
+#define MODULE_LICENSE			"GPL"
+#define MODULE_IPRIORITY		(WBOXTEST_IPRIORITY+1)
+#define	MODULE_INIT			csum_perf_init
+#define	MODULE_EXIT			csum_perf_exit
+
+/* Bytes checksummed for each measurement */
+#define CSUM_PERF_BYTES			(16 * 1024 * 1024)
+
+static const u32 csum_perf_lens[] = { 64, 576, 1500, 1501, 9000, 65536 };
+static const u32 csum_perf_offs[] = { 0, 1, 2, 3, 6 };
+
+/* Measure throughput in MB/s and check that each result was right */
+static int csum_perf_measure(const u8 *buf, u32 len, bool ref, u64 *mbps)
+{
+	u32 i, sum, expected, iters = CSUM_PERF_BYTES / len;
+	u64 tstamp;
+	bool ok = TRUE;
+
+	expected = (ref) ? csum_test_ref(buf, len, 0) :
+			   csum_partial(buf, len, 0);
+	if (!csum_test_equal(csum_fold(expected),
+			     csum_fold(csum_test_ref(buf, len, 0)))) {
+		return VMM_EFAIL;
+	}
+
+	tstamp = vmm_timer_timestamp();
+	for (i = 0; i < iters; i++) {
+		sum = (ref) ? csum_test_ref(buf, len, 0) :
+			      csum_partial(buf, len, 0);
+		if (sum != expected) {
+			ok = FALSE;
+		}
+	}
+	tstamp = vmm_timer_timestamp() - tstamp;
+
+	*mbps = (tstamp) ? udiv64((u64)iters * len * 1000, tstamp) : 0;
+
+	return (ok) ? VMM_OK : VMM_EFAIL;
+}
+
+static int csum_perf_run(struct wboxtest *test, struct vmm_chardev *cdev,
+			 u32 test_hcpu)
+{
+	u32 i, j, len, off;
+	u64 mbps;
+	u8 *buf;
+	int rc = VMM_OK;
+
+	buf = vmm_malloc(CSUM_TEST_BUF_SIZE);
+	if (!buf) {
+		return VMM_ENOMEM;
+	}
+	csum_test_fill(buf, CSUM_TEST_BUF_SIZE, 1);
+
+	vmm_cprintf(cdev, "%-8s %-8s %-14s %-14s\n",
+		    "Length", "Offset", "Fast-MB/s", "Bytewise-MB/s");
+	for (i = 0; i < array_size(csum_perf_lens); i++) {
+		len = csum_perf_lens[i];
+		for (j = 0; j < array_size(csum_perf_offs); j++) {
+			off = csum_perf_offs[j];
+			vmm_cprintf(cdev, "%-8d %-8d ", len, off);
+			if (csum_perf_measure(buf + off, len, FALSE, &mbps)) {
+				vmm_cprintf(cdev, "FAIL\n");
+				rc = VMM_EFAIL;
+				continue;
+			}
+			vmm_cprintf(cdev, "%-14"PRIu64" ", mbps);
+			if (csum_perf_measure(buf + off, len, TRUE, &mbps)) {
+				vmm_cprintf(cdev, "FAIL\n");
+				rc = VMM_EFAIL;
+				continue;
+			}
+			vmm_cprintf(cdev, "%-14"PRIu64"\n", mbps);
+		}
+	}
+
+	vmm_free(buf);
+
+	return rc;
+}
+
+static struct wboxtest csum_perf = {
+	.name = "csum_perf",
+	.run = csum_perf_run,
+};
+
+static int __init csum_perf_init(void)
+{
+	return wboxtest_register("checksum", &csum_perf);
+}
+
+static void __exit csum_perf_exit(void)
+{
+	wboxtest_unregister(&csum_perf);
+}
+
+VMM_DECLARE_MODULE(MODULE_DESC,
+		   MODULE_AUTHOR,
+		   MODULE_LICENSE,
+		   MODULE_IPRIORITY,
+		   MODULE_INIT,
+		   MODULE_EXIT);
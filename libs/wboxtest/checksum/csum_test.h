@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2026 agent.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file csum_test.h
+ * @author agent (agent@local)
+ * @brief Checksum test helper routines
+ */
+
+#ifndef __CSUM_TEST_H__
+#define __CSUM_TEST_H__
+
+#include <vmm_types.h>
+#include <libs/checksum.h>
+
+/* Test buffer has room for largest length at largest offset */
+#define CSUM_TEST_MAX_OFFSET		8
+#define CSUM_TEST_BUF_SIZE		(65536 + CSUM_TEST_MAX_OFFSET)
+
+/* Byte-at-a-time reference implementation of csum_partial() */
+static inline u32 csum_test_ref(const u8 *buf, u32 len, u32 sum)
+{
+	while (len > 1) {
+		sum = csum_add(sum, ((u32)buf[0] << 8) | buf[1]);
+		buf += 2;
+		len -= 2;
+	}
+	if (len) {
+		sum = csum_add(sum, (u32)buf[0] << 8);
+	}
+
+	return sum;
+}
+
+/* Fill buffer with pseudo-random bytes */
+static inline void csum_test_fill(u8 *buf, u32 len, u32 seed)
+{
+	u32 i;
+
+	for (i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+/* Checksums equal as ones' complement numbers (0x0000 is 0xffff) */
+static inline bool csum_test_equal(u16 a, u16 b)
+{
+	return (a == b) || ((a == 0x0000) && (b == 0xffff)) ||
+	       ((a == 0xffff) && (b == 0x0000));
+}
+
+#endif /* __CSUM_TEST_H__ */